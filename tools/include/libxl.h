@@ -1498,6 +1498,21 @@ void libxl_mac_copy(libxl_ctx *ctx, libxl_mac *dst, const libxl_mac *src);
  */
 #define LIBXL_HAVE_CREATEINFO_XEND_SUSPEND_EVTCHN_COMPAT
 
+/*
+ * LIBXL_HAVE_DOMAIN_CREATE_PROFILE
+ *
+ * If this is defined, libxl_domain_create_profile() and
+ * libxl_domain_create_profile_written() are available.
+ */
+#define LIBXL_HAVE_DOMAIN_CREATE_PROFILE 1
+
+/*
+ * LIBXL_HAVE_DOMAIN_CREATE_TEMPLATE
+ *
+ * If this is defined, libxl_domain_create_template() is available.
+ */
+#define LIBXL_HAVE_DOMAIN_CREATE_TEMPLATE 1
+
 typedef char **libxl_string_list;
 void libxl_string_list_dispose(libxl_string_list *sl);
 int libxl_string_list_length(const libxl_string_list *sl);
@@ -1773,6 +1788,33 @@ int libxl_domain_create_restore(libxl_ctx *ctx, libxl_domain_config *d_config,
                                 const libxl_asyncprogress_how *aop_console_how)
                                 LIBXL_EXTERNAL_CALLERS_ONLY;
 
+/*
+ * Profiling of domain creation.
+ *
+ * While a file is set with libxl_domain_create_profile(), the domains
+ * created with @ctx record how long each phase of their creation takes,
+ * and write it to @path as JSON before the creation completes.  A NULL
+ * @path stops profiling.  This takes precedence over the
+ * LIBXL_CREATE_PROFILE environment variable.
+ *
+ * libxl_domain_create_profile_written() returns whether the last
+ * creation to complete wrote its profile.
+ */
+int libxl_domain_create_profile(libxl_ctx *ctx, const char *path);
+bool libxl_domain_create_profile_written(libxl_ctx *ctx);
+
+/*
+ * Recording of domain templates.
+ *
+ * While a file is set with libxl_domain_create_template(), the kernel of
+ * each PV or PVH domain built with @ctx is recorded into a domain template
+ * at @path.  The template can then be given as the kernel of identical
+ * domains, which are built without parsing the kernel again.  A NULL @path
+ * stops recording.  This takes precedence over the
+ * LIBXL_DOMAIN_TEMPLATE_RECORD environment variable.
+ */
+int libxl_domain_create_template(libxl_ctx *ctx, const char *path);
+
 #if defined(LIBXL_API_VERSION) && LIBXL_API_VERSION < 0x040400
 
 static inline int libxl_domain_create_restore_0x040200(
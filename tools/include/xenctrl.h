@@ -882,6 +882,20 @@ long long xc_logdirty_control(xc_interface *xch,
 int xc_get_paging_mempool_size(xc_interface *xch, uint32_t domid, uint64_t *size);
 int xc_set_paging_mempool_size(xc_interface *xch, uint32_t domid, uint64_t size);
 
+/**
+ * Query how far the destruction of a domain has got.
+ *
+ * @parm xch a handle to an open hypervisor interface
+ * @parm domid the domain being destroyed
+ * @parm state XEN_DOMCTL_TEARDOWN_alive, _dying or _dead
+ * @parm pages pages the domain still owns
+ * @parm initial_pages pages the domain owned when its destruction started
+ * return 0 on success, -1 on failure
+ */
+int xc_domain_get_teardown_progress(xc_interface *xch, uint32_t domid,
+                                    uint32_t *state, uint64_t *pages,
+                                    uint64_t *initial_pages);
+
 int xc_sched_credit_domain_set(xc_interface *xch,
                                uint32_t domid,
                                struct xen_domctl_sched_credit *sdom);
@@ -1160,6 +1174,7 @@ typedef struct xen_sysctl_cputopo xc_cputopo_t;
 typedef struct xen_sysctl_numainfo xc_numainfo_t;
 typedef struct xen_sysctl_meminfo xc_meminfo_t;
 typedef struct xen_sysctl_pcitopoinfo xc_pcitopoinfo_t;
+typedef struct xen_sysctl_scrubnode xc_scrubnode_t;
 
 typedef uint32_t xc_cpu_to_node_t;
 typedef uint32_t xc_cpu_to_socket_t;
@@ -1180,6 +1195,8 @@ int xc_numainfo(xc_interface *xch, unsigned *max_nodes,
                 xc_meminfo_t *meminfo, uint32_t *distance);
 int xc_pcitopoinfo(xc_interface *xch, unsigned num_devs,
                    physdev_pci_device_t *devs, uint32_t *nodes);
+int xc_scrubinfo(xc_interface *xch, unsigned *max_nodes,
+                 xc_scrubnode_t *scrubinfo);
 
 int xc_sched_id(xc_interface *xch,
                 int *sched_id);
@@ -192,6 +192,9 @@ struct xc_dom_image {
     struct xc_dom_loader *kernel_loader;
     void *private_loader;
 
+    /* template being recorded, see xc_dom_template_record() */
+    struct xc_dom_template *tmpl;
+
     /* vNUMA information */
     xen_vmemrange_t *vmemranges;
     unsigned int nr_vmemranges;
@@ -324,6 +327,15 @@ int xc_dom_devicetree_file(struct xc_dom_image *dom, const char *filename);
 int xc_dom_devicetree_mem(struct xc_dom_image *dom, const void *mem,
                           size_t memsize);
 
+/*
+ * Record the kernel of the domain, as laid out in guest memory, into a
+ * template file while the domain is built.  The template can be passed to
+ * the builder instead of the kernel of identical domains, sparing the
+ * parsing and decompression of the kernel.  Call before
+ * xc_dom_parse_image(); the file is written by xc_dom_build_image().
+ */
+int xc_dom_template_record(struct xc_dom_image *dom, const char *filename);
+
 int xc_dom_parse_image(struct xc_dom_image *dom);
 int xc_dom_set_arch_hooks(struct xc_dom_image *dom);
 int xc_dom_build_image(struct xc_dom_image *dom);
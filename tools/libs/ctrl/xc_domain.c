@@ -686,6 +686,26 @@ int xc_set_paging_mempool_size(xc_interface *xch, uint32_t domid, uint64_t size)
     return do_domctl(xch, &domctl);
 }
 
+int xc_domain_get_teardown_progress(xc_interface *xch, uint32_t domid,
+                                    uint32_t *state, uint64_t *pages,
+                                    uint64_t *initial_pages)
+{
+    int rc;
+    struct xen_domctl domctl = {
+        .cmd         = XEN_DOMCTL_get_teardown_progress,
+        .domain      = domid,
+    };
+
+    rc = do_domctl(xch, &domctl);
+    if ( rc )
+        return rc;
+
+    *state = domctl.u.teardown_progress.state;
+    *pages = domctl.u.teardown_progress.pages;
+    *initial_pages = domctl.u.teardown_progress.initial_pages;
+    return 0;
+}
+
 int xc_domain_setmaxmem(xc_interface *xch,
                         uint32_t domid,
                         uint64_t max_memkb)
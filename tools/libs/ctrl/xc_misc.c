@@ -324,6 +324,33 @@ out:
     return ret;
 }
 
+int xc_scrubinfo(xc_interface *xch, unsigned *max_nodes,
+                 xc_scrubnode_t *scrubinfo)
+{
+    int ret;
+    struct xen_sysctl sysctl = {};
+    DECLARE_HYPERCALL_BOUNCE(scrubinfo, *max_nodes * sizeof(*scrubinfo),
+                             XC_HYPERCALL_BUFFER_BOUNCE_OUT);
+
+    if ( (ret = xc_hypercall_bounce_pre(xch, scrubinfo)) )
+        goto out;
+
+    sysctl.u.scrubinfo.num_nodes = *max_nodes;
+    set_xen_guest_handle(sysctl.u.scrubinfo.scrubinfo, scrubinfo);
+
+    sysctl.cmd = XEN_SYSCTL_scrubinfo;
+
+    if ( (ret = do_sysctl(xch, &sysctl)) != 0 )
+        goto out;
+
+    *max_nodes = sysctl.u.scrubinfo.num_nodes;
+
+out:
+    xc_hypercall_bounce_post(xch, scrubinfo);
+
+    return ret;
+}
+
 int xc_pcitopoinfo(xc_interface *xch, unsigned num_devs,
                    physdev_pci_device_t *devs,
                    uint32_t *nodes)
@@ -123,6 +123,9 @@ static struct xen_bin_image_table *find_table(struct xc_dom_image *dom)
 
     if ( dom->kernel_size < sizeof(*table) )
         return NULL;
+    /* A template holds a kernel image within the range searched below. */
+    if ( xc_dom_is_template(dom->kernel_blob, dom->kernel_size) )
+        return NULL;
     probe_ptr = dom->kernel_blob;
     if ( dom->kernel_size > (8192 + sizeof(*table)) )
         probe_end = dom->kernel_blob + 8192;
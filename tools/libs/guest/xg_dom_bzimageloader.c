@@ -547,13 +547,159 @@ static int xc_try_lzo1x_decode(
 
 #if defined(HAVE_ZSTD)
 
+#include <pthread.h>
 #include <zstd.h>
 
+/*
+ * Kernels compressed as several independent zstd frames (e.g. with
+ * "zstd -T0 --block-size") can have their frames decompressed
+ * concurrently, each straight into its slot of the output buffer.
+ */
+#define ZSTD_MAX_THREADS 8
+
+struct zstd_frame {
+    const void *src;
+    size_t srclen;
+    void *dst;
+    size_t dstlen;
+};
+
+struct zstd_worker {
+    struct zstd_frame *frames;
+    unsigned int first, nr;
+    const char *error; /* NULL on success. */
+};
+
+static void *zstd_decode_worker(void *arg)
+{
+    struct zstd_worker *w = arg;
+    ZSTD_DCtx *dctx = ZSTD_createDCtx();
+    unsigned int i;
+
+    if ( !dctx )
+    {
+        w->error = "failed to alloc memory";
+        return NULL;
+    }
+
+    for ( i = w->first; i < w->first + w->nr; i++ )
+    {
+        struct zstd_frame *f = &w->frames[i];
+        size_t actual = ZSTD_decompressDCtx(dctx, f->dst, f->dstlen,
+                                            f->src, f->srclen);
+
+        if ( ZSTD_isError(actual) )
+        {
+            w->error = ZSTD_getErrorName(actual);
+            break;
+        }
+        if ( actual != f->dstlen )
+        {
+            w->error = "short frame";
+            break;
+        }
+    }
+
+    ZSTD_freeDCtx(dctx);
+    return NULL;
+}
+
+/*
+ * Returns 0 on success, -1 on failure and 1 if the input is not suitable
+ * for parallel decompression, in which case the caller falls back to
+ * decompressing it in one go.
+ */
+static int xc_zstd_decode_frames(struct xc_dom_image *dom,
+                                 const void *in, size_t insize,
+                                 void *out, size_t outsize)
+{
+    struct zstd_frame *frames = NULL;
+    struct zstd_worker workers[ZSTD_MAX_THREADS] = {};
+    pthread_t threads[ZSTD_MAX_THREADS];
+    unsigned int nr_frames = 0, nr_threads, started = 0, i;
+    size_t inoff = 0, outoff = 0;
+    long cpus;
+    int rc = 1;
+
+    while ( inoff < insize )
+    {
+        size_t clen = ZSTD_findFrameCompressedSize(in + inoff, insize - inoff);
+        unsigned long long dlen = ZSTD_getFrameContentSize(in + inoff,
+                                                           insize - inoff);
+        struct zstd_frame *tmp;
+
+        if ( ZSTD_isError(clen) || dlen == ZSTD_CONTENTSIZE_UNKNOWN ||
+             dlen == ZSTD_CONTENTSIZE_ERROR || dlen > outsize - outoff )
+            goto out;
+
+        tmp = realloc(frames, (nr_frames + 1) * sizeof(*frames));
+        if ( !tmp )
+            goto out;
+        frames = tmp;
+
+        frames[nr_frames].src = in + inoff;
+        frames[nr_frames].srclen = clen;
+        frames[nr_frames].dst = out + outoff;
+        frames[nr_frames].dstlen = dlen;
+        nr_frames++;
+
+        inoff += clen;
+        outoff += dlen;
+    }
+
+    cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    if ( nr_frames < 2 || outoff != outsize || cpus < 2 )
+        goto out;
+
+    nr_threads = min_t(unsigned int, nr_frames,
+                       min_t(long, cpus, ZSTD_MAX_THREADS));
+
+    for ( i = 0; i < nr_threads; i++ )
+    {
+        workers[i].frames = frames;
+        workers[i].first = i * nr_frames / nr_threads;
+        workers[i].nr = (i + 1) * nr_frames / nr_threads - workers[i].first;
+    }
+
+    /* The calling thread handles the first share itself. */
+    for ( i = 1; i < nr_threads; i++, started++ )
+        if ( pthread_create(&threads[i], NULL, zstd_decode_worker,
+                            &workers[i]) )
+            break;
+
+    zstd_decode_worker(&workers[0]);
+
+    /* Frames of workers which failed to start are done here. */
+    for ( i = started + 1; i < nr_threads; i++ )
+        zstd_decode_worker(&workers[i]);
+
+    for ( i = 1; i <= started; i++ )
+        pthread_join(threads[i], NULL);
+
+    rc = 0;
+    for ( i = 0; i < nr_threads; i++ )
+    {
+        if ( !workers[i].error )
+            continue;
+        DOMPRINTF("ZSTD: error: %s", workers[i].error);
+        rc = -1;
+    }
+
+    if ( !rc )
+        DOMPRINTF("%s: %u frames on %u threads", __FUNCTION__,
+                  nr_frames, nr_threads);
+
+ out:
+    free(frames);
+    return rc;
+}
+
 static int xc_try_zstd_decode(
     struct xc_dom_image *dom, void **blob, size_t *size)
 {
     size_t outsize, insize, actual;
     unsigned char *outbuf;
+    int rc;
 
     /* Magic, descriptor byte, and trailing size field. */
     if ( *size <= 9 )
@@ -578,7 +724,14 @@ static int xc_try_zstd_decode(
         return -1;
     }
 
-    actual = ZSTD_decompress(outbuf, outsize, *blob, insize);
+    rc = xc_zstd_decode_frames(dom, *blob, insize, outbuf, outsize);
+    if ( rc < 0 )
+    {
+        free(outbuf);
+        return -1;
+    }
+
+    actual = rc ? ZSTD_decompress(outbuf, outsize, *blob, insize) : outsize;
 
     if ( ZSTD_isError(actual) )
     {
@@ -678,7 +831,7 @@ static int check_magic(struct xc_dom_image *dom, const void *magic, size_t len)
 static int xc_dom_probe_bzimage_kernel(struct xc_dom_image *dom)
 {
     struct setup_header *hdr;
-    uint64_t payload_offset, payload_length;
+    uint64_t payload_offset, payload_length, start;
     int ret;
 
     if ( dom->kernel_blob == NULL )
@@ -732,6 +885,8 @@ static int xc_dom_probe_bzimage_kernel(struct xc_dom_image *dom)
     dom->kernel_blob = dom->kernel_blob + payload_offset;
     dom->kernel_size = payload_length;
 
+    start = xg_time_us();
+
     if ( check_magic(dom, "\037\213", 2) )
     {
         ret = xc_dom_try_gunzip(dom, &dom->kernel_blob, &dom->kernel_size);
@@ -815,6 +970,9 @@ static int xc_dom_probe_bzimage_kernel(struct xc_dom_image *dom)
         return -EINVAL;
     }
 
+    DOMPRINTF("%s: payload decompressed to 0x%zx bytes in %"PRIu64" us",
+              __FUNCTION__, dom->kernel_size, xg_time_us() - start);
+
     return elf_loader.probe(dom);
 }
 
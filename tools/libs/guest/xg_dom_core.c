@@ -574,13 +574,13 @@ static int xc_dom_alloc_pad(struct xc_dom_image *dom, xen_vaddr_t boundary)
     return xc_dom_chk_alloc_pages(dom, "padding", pages);
 }
 
-int xc_dom_alloc_segment(struct xc_dom_image *dom,
-                         struct xc_dom_seg *seg, const char *name,
-                         xen_vaddr_t start, xen_vaddr_t size)
+/* Reserve pages for a segment, without mapping them. */
+static int xc_dom_reserve_segment(struct xc_dom_image *dom,
+                                  struct xc_dom_seg *seg, const char *name,
+                                  xen_vaddr_t start, xen_vaddr_t size)
 {
     unsigned int page_size = XC_DOM_PAGE_SIZE(dom);
     xen_pfn_t pages;
-    void *ptr;
 
     if ( start && xc_dom_alloc_pad(dom, start) )
         return -1;
@@ -594,12 +594,6 @@ int xc_dom_alloc_segment(struct xc_dom_image *dom,
     if ( xc_dom_chk_alloc_pages(dom, name, pages) )
         return -1;
 
-    /* map and clear pages */
-    ptr = xc_dom_seg_to_ptr(dom, seg);
-    if ( ptr == NULL )
-        return -1;
-    memset(ptr, 0, pages * page_size);
-
     seg->vstart = start;
     seg->vend = start + size;
 
@@ -610,6 +604,24 @@ int xc_dom_alloc_segment(struct xc_dom_image *dom,
     return 0;
 }
 
+int xc_dom_alloc_segment(struct xc_dom_image *dom,
+                         struct xc_dom_seg *seg, const char *name,
+                         xen_vaddr_t start, xen_vaddr_t size)
+{
+    void *ptr;
+
+    if ( xc_dom_reserve_segment(dom, seg, name, start, size) )
+        return -1;
+
+    /* map and clear pages */
+    ptr = xc_dom_seg_to_ptr(dom, seg);
+    if ( ptr == NULL )
+        return -1;
+    memset(ptr, 0, seg->pages * XC_DOM_PAGE_SIZE(dom));
+
+    return 0;
+}
+
 xen_pfn_t xc_dom_alloc_page(struct xc_dom_image *dom, const char *name)
 {
     xen_vaddr_t start;
@@ -938,6 +950,10 @@ int xc_dom_parse_image(struct xc_dom_image *dom)
             goto err;
         }
     }
+
+    if ( dom->tmpl && xc_dom_template_parsed(dom) )
+        goto err;
+
     return 0;
 
  err:
@@ -978,11 +994,105 @@ int xc_dom_mem_init(struct xc_dom_image *dom, unsigned int mem_mb)
     return 0;
 }
 
+/*
+ * Modules (typically the ramdisk) can be hundreds of megabytes.  Fill the
+ * segment a window of pages at a time, inflating straight into guest
+ * memory if gunzip is set, so that only one window is mapped at once and
+ * every page is written exactly once.  Whatever the data doesn't cover is
+ * zeroed.
+ */
+#define XC_DOM_MODULE_WINDOW_PAGES 1024
+
+static int xc_dom_stream_module(struct xc_dom_image *dom,
+                                struct xc_dom_seg *seg,
+                                const void *blob, size_t size, bool gunzip)
+{
+    unsigned int page_shift = XC_DOM_PAGE_SHIFT(dom);
+    xen_pfn_t pfn, count, window;
+    z_stream zStream;
+    size_t len, done;
+    void *ptr;
+    int rc = Z_OK;
+
+    if ( gunzip )
+    {
+        memset(&zStream, 0, sizeof(zStream));
+        zStream.next_in = (void *)blob;
+        zStream.avail_in = size;
+        rc = inflateInit2(&zStream, (MAX_WBITS + 32)); /* +32 means "handle gzip" */
+        if ( rc != Z_OK )
+        {
+            xc_dom_panic(dom->xch, XC_INTERNAL_ERROR,
+                         "%s: inflateInit2 failed (rc=%d)", __FUNCTION__, rc);
+            return -1;
+        }
+    }
+
+    /* Anonymous memory is only reachable through its mapping: keep it. */
+    window = dom->guest_domid ? XC_DOM_MODULE_WINDOW_PAGES : seg->pages;
+
+    for ( pfn = seg->pfn; pfn < seg->pfn + seg->pages; pfn += count )
+    {
+        count = min(window, seg->pfn + seg->pages - pfn);
+        ptr = xc_dom_pfn_to_ptr(dom, pfn, count);
+        if ( ptr == NULL )
+            goto err;
+        len = count << page_shift;
+
+        if ( gunzip )
+        {
+            zStream.next_out = ptr;
+            zStream.avail_out = len;
+            if ( rc != Z_STREAM_END )
+                rc = inflate(&zStream, Z_NO_FLUSH);
+            if ( rc != Z_OK && rc != Z_STREAM_END )
+            {
+                xc_dom_panic(dom->xch, XC_INTERNAL_ERROR,
+                             "%s: inflate failed (rc=%d)", __FUNCTION__, rc);
+                if ( dom->guest_domid )
+                    xc_dom_unmap_one(dom, pfn);
+                goto err;
+            }
+            done = len - zStream.avail_out;
+        }
+        else
+        {
+            done = min(len, size);
+            memcpy(ptr, blob, done);
+            blob += done;
+            size -= done;
+        }
+        memset(ptr + done, 0, len - done);
+
+        if ( dom->guest_domid )
+            xc_dom_unmap_one(dom, pfn);
+    }
+
+    if ( gunzip )
+    {
+        inflateEnd(&zStream);
+        if ( rc != Z_STREAM_END )
+        {
+            xc_dom_panic(dom->xch, XC_INTERNAL_ERROR,
+                         "%s: inflated data doesn't fit 0x%" PRIpfn " pages",
+                         __FUNCTION__, seg->pages);
+            return -1;
+        }
+    }
+
+    return 0;
+
+ err:
+    if ( gunzip )
+        inflateEnd(&zStream);
+    return -1;
+}
+
 static int xc_dom_build_module(struct xc_dom_image *dom, unsigned int mod)
 {
     size_t unziplen, modulelen;
-    void *modulemap;
     char name[10];
+    uint64_t start;
 
     if ( !dom->modules[mod].seg.vstart )
         unziplen = xc_dom_check_gzip(dom->xch,
@@ -1008,31 +1118,29 @@ static int xc_dom_build_module(struct xc_dom_image *dom, unsigned int mod)
     }
 
     snprintf(name, sizeof(name), "module%u", mod);
-    if ( xc_dom_alloc_segment(dom, &dom->modules[mod].seg, name,
-                              dom->modules[mod].seg.vstart, modulelen) != 0 )
+    if ( xc_dom_reserve_segment(dom, &dom->modules[mod].seg, name,
+                                dom->modules[mod].seg.vstart, modulelen) != 0 )
         goto err;
-    modulemap = xc_dom_seg_to_ptr(dom, &dom->modules[mod].seg);
-    if ( modulemap == NULL )
-    {
-        DOMPRINTF("%s: xc_dom_seg_to_ptr(dom, &dom->modules[%u].seg) => NULL",
-                  __FUNCTION__, mod);
-        goto err;
-    }
     if ( unziplen )
     {
-        if ( xc_dom_do_gunzip(dom->xch, dom->modules[mod].blob, dom->modules[mod].size,
-                              modulemap, unziplen) != -1 )
+        start = xg_time_us();
+        if ( xc_dom_stream_module(dom, &dom->modules[mod].seg,
+                                  dom->modules[mod].blob,
+                                  dom->modules[mod].size, true) == 0 )
+        {
+            DOMPRINTF("%s: module%u inflated in %"PRIu64" us", __FUNCTION__,
+                      mod, xg_time_us() - start);
             return 0;
+        }
         if ( dom->modules[mod].size > modulelen )
             goto err;
     }
 
     /* Fall back to handing over the raw blob. */
-    memcpy(modulemap, dom->modules[mod].blob, dom->modules[mod].size);
-    /* If an unzip attempt was made, the buffer may no longer be all zero. */
-    if ( unziplen > dom->modules[mod].size )
-        memset(modulemap + dom->modules[mod].size, 0,
-               unziplen - dom->modules[mod].size);
+    if ( xc_dom_stream_module(dom, &dom->modules[mod].seg,
+                              dom->modules[mod].blob,
+                              dom->modules[mod].size, false) != 0 )
+        goto err;
 
     return 0;
 
@@ -1162,6 +1270,8 @@ int xc_dom_build_image(struct xc_dom_image *dom)
         goto err;
     if ( dom->kernel_loader->loader(dom) != 0 )
         goto err;
+    if ( dom->tmpl && xc_dom_template_write(dom) != 0 )
+        goto err;
 
     /* Don't load ramdisk / other modules now if no initial mapping required. */
     for ( mod = 0; mod < dom->num_modules; mod++ )
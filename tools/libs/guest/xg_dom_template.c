@@ -0,0 +1,425 @@
+/*
+ * Xen domain builder -- domain templates.
+ *
+ * A template is the kernel of a domain as it was laid out in guest memory,
+ * together with the results of parsing it.  It is recorded while building
+ * one domain and can then be handed to the domain builder in place of the
+ * kernel: identical domains are built from it without parsing the kernel
+ * image again, without decompressing it and without walking its ELF program
+ * headers, by a single copy into the kernel segment.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation;
+ * version 2.1 of the License.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <inttypes.h>
+
+#include "xg_private.h"
+
+#include <xen-tools/common-macros.h>
+
+/*
+ * On disk layout: a header of XC_DOM_TEMPLATE_HDR_SIZE bytes, then the
+ * kernel image.  The header starts with the magic and the version, followed
+ * by the fields listed in xc_dom_template_hdr_fields(), each stored little
+ * endian, so that the file doesn't depend on the layout of any structure of
+ * the toolstack which wrote it.
+ */
+#define XC_DOM_TEMPLATE_MAGIC    "XenDomT"
+#define XC_DOM_TEMPLATE_VERSION  1
+#define XC_DOM_TEMPLATE_HDR_SIZE XC_PAGE_SIZE
+
+struct xc_dom_template {
+    char *filename;
+    uint32_t container_type;
+    char guest_type[32];
+    uint64_t rambase_pfn;
+    uint64_t kernel_vstart;
+    uint64_t kernel_vend;
+    uint64_t image_size;
+    struct elf_dom_parms parms;
+};
+
+/* Cursor over a header being written (put) or read. */
+struct tmpl_hdr {
+    unsigned char *buf;
+    size_t pos;
+    bool put;
+    bool overflow;
+};
+
+static void hdr_bytes(struct tmpl_hdr *h, void *data, size_t len)
+{
+    if ( h->overflow || len > XC_DOM_TEMPLATE_HDR_SIZE - h->pos )
+    {
+        h->overflow = true;
+        return;
+    }
+
+    if ( h->put )
+        memcpy(h->buf + h->pos, data, len);
+    else
+        memcpy(data, h->buf + h->pos, len);
+    h->pos += len;
+}
+
+/* Integers are stored little endian, in bytes bytes. */
+static void hdr_int(struct tmpl_hdr *h, uint64_t *val, unsigned int bytes)
+{
+    unsigned char le[8];
+    unsigned int i;
+
+    if ( h->put )
+        for ( i = 0; i < bytes; i++ )
+            le[i] = *val >> (i * 8);
+
+    hdr_bytes(h, le, bytes);
+
+    if ( !h->put && !h->overflow )
+        for ( *val = 0, i = 0; i < bytes; i++ )
+            *val |= (uint64_t)le[i] << (i * 8);
+}
+
+static void hdr_u64(struct tmpl_hdr *h, uint64_t *val)
+{
+    hdr_int(h, val, sizeof(*val));
+}
+
+static void hdr_u32(struct tmpl_hdr *h, uint32_t *val)
+{
+    uint64_t v = *val;
+
+    hdr_int(h, &v, sizeof(*val));
+    *val = v;
+}
+
+static void hdr_bool(struct tmpl_hdr *h, bool *val)
+{
+    uint64_t v = *val;
+
+    hdr_int(h, &v, 1);
+    if ( v > 1 )
+        h->overflow = true;
+    *val = v;
+}
+
+/* Strings are stored with their terminating NUL, in a field of len bytes. */
+static void hdr_str(struct tmpl_hdr *h, char *str, size_t len)
+{
+    hdr_bytes(h, str, len);
+    if ( !h->put && !h->overflow && !memchr(str, 0, len) )
+        h->overflow = true;
+}
+
+/*
+ * Write or read all fields of the header after the magic and the version.
+ * Changing this list requires bumping XC_DOM_TEMPLATE_VERSION.  The raw
+ * fields of the parms point into the kernel image and aren't stored.
+ */
+static void xc_dom_template_hdr_fields(struct tmpl_hdr *h,
+                                       struct xc_dom_template *tmpl)
+{
+    struct elf_dom_parms *parms = &tmpl->parms;
+    uint32_t pae = parms->pae;
+    unsigned int i;
+
+    hdr_u32(h, &tmpl->container_type);
+    hdr_str(h, tmpl->guest_type, sizeof(tmpl->guest_type));
+    hdr_u64(h, &tmpl->rambase_pfn);
+    hdr_u64(h, &tmpl->kernel_vstart);
+    hdr_u64(h, &tmpl->kernel_vend);
+    hdr_u64(h, &tmpl->image_size);
+
+    hdr_str(h, parms->guest_os, sizeof(parms->guest_os));
+    hdr_str(h, parms->guest_ver, sizeof(parms->guest_ver));
+    hdr_str(h, parms->xen_ver, sizeof(parms->xen_ver));
+    hdr_str(h, parms->loader, sizeof(parms->loader));
+    hdr_u32(h, &pae);
+    parms->pae = pae;
+    hdr_bool(h, &parms->bsd_symtab);
+    hdr_bool(h, &parms->unmapped_initrd);
+    hdr_bool(h, &parms->phys_reloc);
+    hdr_u64(h, &parms->virt_base);
+    hdr_u64(h, &parms->virt_entry);
+    hdr_u64(h, &parms->virt_hypercall);
+    hdr_u64(h, &parms->virt_hv_start_low);
+    hdr_u64(h, &parms->p2m_base);
+    hdr_u64(h, &parms->elf_paddr_offset);
+    for ( i = 0; i < XENFEAT_NR_SUBMAPS; i++ )
+    {
+        hdr_u32(h, &parms->f_supported[i]);
+        hdr_u32(h, &parms->f_required[i]);
+    }
+    hdr_u32(h, &parms->phys_entry);
+    hdr_u32(h, &parms->phys_align);
+    hdr_u32(h, &parms->phys_min);
+    hdr_u32(h, &parms->phys_max);
+    hdr_u64(h, &parms->virt_kstart);
+    hdr_u64(h, &parms->virt_kend);
+}
+
+bool xc_dom_is_template(const void *blob, size_t size)
+{
+    return blob && size >= XC_DOM_TEMPLATE_HDR_SIZE &&
+           !memcmp(blob, XC_DOM_TEMPLATE_MAGIC, sizeof(XC_DOM_TEMPLATE_MAGIC));
+}
+
+int xc_dom_template_record(struct xc_dom_image *dom, const char *filename)
+{
+    struct xc_dom_template *tmpl;
+
+    DOMPRINTF("%s: filename=\"%s\"", __FUNCTION__, filename);
+
+    tmpl = xc_dom_malloc(dom, sizeof(*tmpl));
+    if ( tmpl == NULL )
+        return -1;
+    memset(tmpl, 0, sizeof(*tmpl));
+
+    tmpl->filename = xc_dom_strdup(dom, filename);
+    if ( tmpl->filename == NULL )
+        return -1;
+
+    dom->tmpl = tmpl;
+    return 0;
+}
+
+int xc_dom_template_parsed(struct xc_dom_image *dom)
+{
+    struct xc_dom_template *tmpl = dom->tmpl;
+
+    /* The HVM firmware loader places its modules outside the kernel. */
+    if ( !strcmp(dom->kernel_loader->name, "HVM-generic") )
+    {
+        xc_dom_panic(dom->xch, XC_INVALID_PARAM,
+                     "%s: can't record a template of HVM firmware",
+                     __FUNCTION__);
+        return -1;
+    }
+
+    if ( strlen(dom->guest_type) >= sizeof(tmpl->guest_type) )
+    {
+        xc_dom_panic(dom->xch, XC_INTERNAL_ERROR,
+                     "%s: guest type %s too long", __FUNCTION__,
+                     dom->guest_type);
+        return -1;
+    }
+
+    tmpl->container_type = dom->container_type;
+    strncpy(tmpl->guest_type, dom->guest_type, sizeof(tmpl->guest_type));
+    tmpl->rambase_pfn = dom->rambase_pfn;
+    tmpl->kernel_vstart = dom->kernel_seg.vstart;
+    tmpl->kernel_vend = dom->kernel_seg.vend;
+
+    /* Take the parms as parsed, before building the domain adjusts them. */
+    tmpl->parms = *dom->parms;
+
+    return 0;
+}
+
+int xc_dom_template_write(struct xc_dom_image *dom)
+{
+    struct xc_dom_template *tmpl = dom->tmpl;
+    struct tmpl_hdr h = { .put = true };
+    char magic[] = XC_DOM_TEMPLATE_MAGIC;
+    uint32_t version = XC_DOM_TEMPLATE_VERSION;
+    const unsigned char *image;
+    size_t size = dom->kernel_seg.vend - dom->kernel_seg.vstart;
+    char *tmpname;
+    int fd, rc = -1;
+
+    image = xc_dom_seg_to_ptr(dom, &dom->kernel_seg);
+    if ( image == NULL )
+    {
+        DOMPRINTF("%s: xc_dom_seg_to_ptr(dom, &dom->kernel_seg) => NULL",
+                  __FUNCTION__);
+        return -1;
+    }
+
+    /* The bss needn't be stored: segments start out cleared. */
+    while ( size && !image[size - 1] )
+        size--;
+    tmpl->image_size = size;
+
+    h.buf = xc_dom_malloc(dom, XC_DOM_TEMPLATE_HDR_SIZE);
+    if ( h.buf == NULL )
+        return -1;
+    memset(h.buf, 0, XC_DOM_TEMPLATE_HDR_SIZE);
+
+    hdr_bytes(&h, magic, sizeof(magic));
+    hdr_u32(&h, &version);
+    xc_dom_template_hdr_fields(&h, tmpl);
+    if ( h.overflow )
+    {
+        xc_dom_panic(dom->xch, XC_INTERNAL_ERROR,
+                     "%s: header too large", __FUNCTION__);
+        return -1;
+    }
+
+    /* Write a temporary file, so that no one builds from a partial one. */
+    tmpname = xc_dom_malloc(dom, strlen(tmpl->filename) + 5);
+    if ( tmpname == NULL )
+        return -1;
+    sprintf(tmpname, "%s.tmp", tmpl->filename);
+
+    fd = open(tmpname, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if ( fd < 0 )
+    {
+        xc_dom_panic(dom->xch, XC_INTERNAL_ERROR,
+                     "%s: failed to open %s: %s", __FUNCTION__, tmpname,
+                     strerror(errno));
+        return -1;
+    }
+
+    if ( write_exact(fd, h.buf, XC_DOM_TEMPLATE_HDR_SIZE) ||
+         write_exact(fd, image, size) )
+    {
+        xc_dom_panic(dom->xch, XC_INTERNAL_ERROR,
+                     "%s: failed to write %s: %s", __FUNCTION__, tmpname,
+                     strerror(errno));
+        goto out;
+    }
+
+    if ( rename(tmpname, tmpl->filename) )
+    {
+        xc_dom_panic(dom->xch, XC_INTERNAL_ERROR,
+                     "%s: failed to rename %s: %s", __FUNCTION__, tmpname,
+                     strerror(errno));
+        goto out;
+    }
+
+    DOMPRINTF("%s: %s: 0x%" PRIx64 " -> 0x%" PRIx64 ", 0x%zx bytes",
+              __FUNCTION__, tmpl->filename, tmpl->kernel_vstart,
+              tmpl->kernel_vend, size);
+    rc = 0;
+
+ out:
+    close(fd);
+    if ( rc )
+        unlink(tmpname);
+    return rc;
+}
+
+/* ------------------------------------------------------------------------ */
+
+static int xc_dom_probe_template(struct xc_dom_image *dom)
+{
+    struct xc_dom_template *tmpl;
+    struct tmpl_hdr h = { .buf = dom->kernel_blob };
+    char magic[sizeof(XC_DOM_TEMPLATE_MAGIC)];
+    uint32_t version;
+
+    if ( !xc_dom_is_template(dom->kernel_blob, dom->kernel_size) )
+        return -EINVAL;
+
+    hdr_bytes(&h, magic, sizeof(magic));
+    hdr_u32(&h, &version);
+    if ( version != XC_DOM_TEMPLATE_VERSION )
+    {
+        xc_dom_panic(dom->xch, XC_INVALID_KERNEL,
+                     "%s: template version %" PRIu32 " not supported",
+                     __FUNCTION__, version);
+        return -EINVAL;
+    }
+
+    tmpl = xc_dom_malloc(dom, sizeof(*tmpl));
+    if ( tmpl == NULL )
+        return -ENOMEM;
+    memset(tmpl, 0, sizeof(*tmpl));
+
+    xc_dom_template_hdr_fields(&h, tmpl);
+
+    if ( h.overflow ||
+         tmpl->image_size > dom->kernel_size - XC_DOM_TEMPLATE_HDR_SIZE ||
+         tmpl->kernel_vend < tmpl->kernel_vstart ||
+         tmpl->image_size > tmpl->kernel_vend - tmpl->kernel_vstart )
+    {
+        xc_dom_panic(dom->xch, XC_INVALID_KERNEL,
+                     "%s: corrupted template", __FUNCTION__);
+        return -EINVAL;
+    }
+
+    dom->private_loader = tmpl;
+    return 0;
+}
+
+static int xc_dom_parse_template(struct xc_dom_image *dom)
+{
+    const struct xc_dom_template *tmpl = dom->private_loader;
+
+    if ( tmpl->container_type != dom->container_type ||
+         tmpl->rambase_pfn != dom->rambase_pfn )
+    {
+        xc_dom_panic(dom->xch, XC_INVALID_KERNEL,
+                     "%s: template recorded for a different kind of domain",
+                     __FUNCTION__);
+        return -EINVAL;
+    }
+
+    *dom->parms = tmpl->parms;
+    dom->guest_type = xc_dom_strdup(dom, tmpl->guest_type);
+    if ( dom->guest_type == NULL )
+        return -ENOMEM;
+
+    dom->kernel_seg.vstart = tmpl->kernel_vstart;
+    dom->kernel_seg.vend = tmpl->kernel_vend;
+
+    DOMPRINTF("%s: %s: 0x%" PRIx64 " -> 0x%" PRIx64 "",
+              __FUNCTION__, dom->guest_type,
+              dom->kernel_seg.vstart, dom->kernel_seg.vend);
+
+    return 0;
+}
+
+static int xc_dom_load_template(struct xc_dom_image *dom)
+{
+    const struct xc_dom_template *tmpl = dom->private_loader;
+    void *dest;
+
+    dest = xc_dom_seg_to_ptr(dom, &dom->kernel_seg);
+    if ( dest == NULL )
+    {
+        DOMPRINTF("%s: xc_dom_seg_to_ptr(dom, &dom->kernel_seg) => NULL",
+                  __FUNCTION__);
+        return -1;
+    }
+
+    memcpy(dest, dom->kernel_blob + XC_DOM_TEMPLATE_HDR_SIZE,
+           tmpl->image_size);
+
+    return 0;
+}
+
+/* ------------------------------------------------------------------------ */
+static struct xc_dom_loader template_loader = {
+    .name = "domain template",
+    .probe = xc_dom_probe_template,
+    .parser = xc_dom_parse_template,
+    .loader = xc_dom_load_template,
+};
+
+static void __init register_loader(void)
+{
+    xc_dom_register_loader(&template_loader);
+}
+
+/*
+ * Local variables:
+ * mode: C
+ * c-file-style: "BSD"
+ * c-basic-offset: 4
+ * tab-width: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
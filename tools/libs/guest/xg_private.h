@@ -26,6 +26,7 @@
 #include <sys/mman.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <time.h>
 
 #include "xc_private.h"
 #include "xc_bitops.h"
@@ -88,8 +89,25 @@ static inline unsigned int get_unaligned_le32(const uint8_t *buf)
 
 #endif /* !__MINIOS__ || XG_NEED_UNALIGNED */
 
+/* Monotonic clock in microseconds, for timing the phases of a domain build. */
+static inline uint64_t xg_time_us(void)
+{
+    struct timespec ts;
+
+    if ( clock_gettime(CLOCK_MONOTONIC, &ts) )
+        return 0;
+
+    return ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
 unsigned long csum_page (void * page);
 
+/* Hooks of the domain builder for recording a template. */
+int xc_dom_template_parsed(struct xc_dom_image *dom);
+int xc_dom_template_write(struct xc_dom_image *dom);
+/* Whether a kernel blob is a template, for loaders searching inside blobs. */
+bool xc_dom_is_template(const void *blob, size_t size);
+
 #define _PAGE_PRESENT   0x001
 #define _PAGE_RW        0x002
 #define _PAGE_USER      0x004
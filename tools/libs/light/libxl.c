@@ -183,6 +183,8 @@ int libxl_ctx_free(libxl_ctx *ctx)
     }
 
     free(ctx->watch_slots);
+    free(ctx->create_profile);
+    free(ctx->create_template);
 
     discard_events(&ctx->occurred);
 
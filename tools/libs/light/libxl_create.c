@@ -1015,8 +1015,10 @@ static void domcreate_devmodel_started(libxl__egc *egc,
                                        libxl__dm_spawn_state *dmss,
                                        int rc);
 static void domcreate_attach_devices(libxl__egc *egc,
-                                     libxl__multidev *multidev,
-                                     int ret);
+                                     libxl__domain_create_state *dcs);
+static void domcreate_devclass_attached(libxl__egc *egc,
+                                        libxl__multidev *multidev,
+                                        int ret);
 static void console_xswait_callback(libxl__egc *egc, libxl__xswait_state *xswa,
                                     int rc, const char *p);
 
@@ -1032,6 +1034,18 @@ static void domcreate_destruction_cb(libxl__egc *egc,
                                      libxl__domain_destroy_state *dds,
                                      int rc);
 
+/* Records the phase of the creation which just ended and starts @next */
+static void domcreate_phase(libxl__domain_create_state *dcs,
+                            const char *next)
+{
+    uint64_t now = libxl__timestamp_us();
+
+    if (dcs->phase)
+        libxl__profile_span(dcs->ao, dcs->phase_start, now, "%s", dcs->phase);
+    dcs->phase = next;
+    dcs->phase_start = now;
+}
+
 static bool ok_to_default_memkb_in_create(libxl__gc *gc)
 {
     /*
@@ -1323,6 +1337,9 @@ static void initiate_domain_create(libxl__egc *egc,
     libxl__domain_build_state_init(dbs);
     dbs->restore = dcs->restore_fd >= 0;
 
+    dcs->phase = NULL;
+    domcreate_phase(dcs, "domain make");
+
     ret = libxl__domain_config_setdefault(gc,d_config,domid);
     if (ret) goto error_out;
 
@@ -1370,6 +1387,7 @@ static void initiate_domain_create(libxl__egc *egc,
     if (ret)
         goto error_out;
 
+    domcreate_phase(dcs, "bootloader");
     if (dbs->restore || dcs->soft_reset) {
         LOGD(DEBUG, domid, "restoring, not running bootloader");
         domcreate_bootloader_done(egc, &dcs->bl, 0);
@@ -1447,6 +1465,7 @@ static void domcreate_bootloader_done(libxl__egc *egc,
     dcs->sdss.callback = domcreate_devmodel_started;
 
     if (restore_fd < 0 && !dcs->soft_reset) {
+        domcreate_phase(dcs, "domain build");
         rc = libxl__domain_build(gc, d_config, domid, state);
         domcreate_rebuild_done(egc, dcs, rc);
         return;
@@ -1454,6 +1473,7 @@ static void domcreate_bootloader_done(libxl__egc *egc,
 
     /* Prepare environment for domcreate_stream_done */
     dcs->srs.dcs = dcs;
+    domcreate_phase(dcs, "restore stream");
 
     /* Restore */
     callbacks->static_data_done = libxl__srm_callout_callback_static_data_done;
@@ -1587,6 +1607,7 @@ static void domcreate_stream_done(libxl__egc *egc,
     if (ret)
         goto out;
 
+    domcreate_phase(dcs, "domain build");
     gettimeofday(&start_time, NULL);
 
     switch (info->type) {
@@ -1679,6 +1700,7 @@ static void domcreate_rebuild_done(libxl__egc *egc,
 
     store_libxl_entry(gc, domid, &d_config->b_info);
 
+    domcreate_phase(dcs, "disks");
     libxl__multidev_begin(ao, &dcs->multidev);
     dcs->multidev.callback = domcreate_launch_dm;
     libxl__add_disks(egc, ao, domid, d_config, &dcs->multidev);
@@ -1708,6 +1730,8 @@ static void domcreate_launch_dm(libxl__egc *egc, libxl__multidev *multidev,
         goto error_out;
     }
 
+    domcreate_phase(dcs, "device model");
+
     for (i = 0; i < d_config->b_info.num_ioports; i++) {
         libxl_ioport_range *io = &d_config->b_info.ioports[i];
 
@@ -1925,6 +1949,32 @@ const libxl__device_type *device_type_tbl[] = {
     NULL
 };
 
+/* Maximum number of devices attached at once, from the environment */
+static int domcreate_attach_parallel(libxl__gc *gc, uint32_t domid,
+                                     int *parallel_r)
+{
+    const char *env_parallel = getenv("LIBXL_DEVICE_ATTACH_PARALLEL");
+    char *end;
+    long parallel;
+
+    if (!env_parallel) {
+        *parallel_r = LIBXL_DEVICE_ATTACH_PARALLEL;
+        return 0;
+    }
+
+    errno = 0;
+    parallel = strtol(env_parallel, &end, 0);
+    if (errno || end == env_parallel || *end || parallel < 1 ||
+        parallel > INT_MAX) {
+        LOGD(ERROR, domid, "LIBXL_DEVICE_ATTACH_PARALLEL=%s: "
+             "expected an integer between 1 and %d", env_parallel, INT_MAX);
+        return ERROR_INVAL;
+    }
+
+    *parallel_r = parallel;
+    return 0;
+}
+
 static void domcreate_devmodel_started(libxl__egc *egc,
                                        libxl__dm_spawn_state *dmss,
                                        int ret)
@@ -1932,14 +1982,39 @@ static void domcreate_devmodel_started(libxl__egc *egc,
     libxl__domain_create_state *dcs = CONTAINER_OF(dmss, *dcs, sdss.dm);
     STATE_AO_GC(dmss->spawn.ao);
     int domid = dcs->guest_domid;
+    libxl_domain_config *const d_config = dcs->guest_config;
+    int i;
 
     if (ret) {
         LOGD(ERROR, domid, "device model did not start: %d", ret);
         goto error_out;
     }
 
-    dcs->device_type_idx = -1;
-    domcreate_attach_devices(egc, &dcs->multidev, 0);
+    domcreate_phase(dcs, "devices");
+
+    ret = domcreate_attach_parallel(gc, domid, &dcs->devices_parallel);
+    if (ret)
+        goto error_out;
+
+    for (i = 0; device_type_tbl[i]; i++)
+        ;
+    GCNEW_ARRAY(dcs->devclasses, i);
+
+    for (i = 0; device_type_tbl[i]; i++) {
+        libxl__domcreate_devclass *dc = &dcs->devclasses[i];
+
+        dc->dcs = dcs;
+        dc->dt = device_type_tbl[i];
+        dc->num = *libxl__device_type_get_num(dc->dt, d_config);
+        dc->state = dc->num > 0 && !dc->dt->skip_attach
+                    ? LIBXL__DEVCLASS_PENDING : LIBXL__DEVCLASS_DONE;
+    }
+
+    dcs->devclasses_running = 0;
+    dcs->devices_running = 0;
+    dcs->devclasses_rc = 0;
+    dcs->devclasses_attaching = false;
+    domcreate_attach_devices(egc, dcs);
     return;
 
 error_out:
@@ -1947,39 +2022,92 @@ error_out:
     domcreate_complete(egc, dcs, ret);
 }
 
+static bool domcreate_devclass_ready(libxl__domain_create_state *dcs,
+                                     const libxl__domcreate_devclass *dc)
+{
+    int i;
+
+    if (!dc->dt->attach_after)
+        return true;
+
+    for (i = 0; device_type_tbl[i]; i++)
+        if (device_type_tbl[i] == dc->dt->attach_after)
+            return dcs->devclasses[i].state == LIBXL__DEVCLASS_DONE;
+
+    return true;
+}
+
+/*
+ * Attaches the devices of all the types in device_type_tbl.  Each type is
+ * attached through its own multidev, so the devices of a type are set up in
+ * parallel, and types are started concurrently as long as their attach_after
+ * dependency is satisfied and the number of devices being attached stays
+ * within LIBXL_DEVICE_ATTACH_PARALLEL.  A type is always started when
+ * nothing else is in progress, so a limit of 1 attaches one type at a time.
+ *
+ * Called again every time a type completes; the attachments may complete
+ * reentrantly, in which case the outermost invocation rescans the table.
+ */
 static void domcreate_attach_devices(libxl__egc *egc,
-                                     libxl__multidev *multidev,
-                                     int ret)
+                                     libxl__domain_create_state *dcs)
 {
-    libxl__domain_create_state *dcs = CONTAINER_OF(multidev, *dcs, multidev);
     STATE_AO_GC(dcs->ao);
     int domid = dcs->guest_domid;
     libxl_domain_config *const d_config = dcs->guest_config;
-    const libxl__device_type *dt;
+    bool pending;
     char *tty_path;
+    int i, ret;
 
-    if (ret) {
-        LOGD(ERROR, domid, "unable to add %s devices",
-             libxl__device_kind_to_string(device_type_tbl[dcs->device_type_idx]->type));
-        goto error_out;
+    if (dcs->devclasses_attaching) {
+        dcs->devclasses_rescan = true;
+        return;
     }
 
-    dcs->device_type_idx++;
-    dt = device_type_tbl[dcs->device_type_idx];
-    if (dt) {
-        if (*libxl__device_type_get_num(dt, d_config) > 0 && !dt->skip_attach) {
-            /* Attach devices */
-            libxl__multidev_begin(ao, &dcs->multidev);
-            dcs->multidev.callback = domcreate_attach_devices;
-            dt->add(egc, ao, domid, d_config, &dcs->multidev);
-            libxl__multidev_prepared(egc, &dcs->multidev, 0);
-            return;
+    dcs->devclasses_attaching = true;
+    do {
+        dcs->devclasses_rescan = false;
+        pending = false;
+
+        for (i = 0; device_type_tbl[i]; i++) {
+            libxl__domcreate_devclass *dc = &dcs->devclasses[i];
+
+            if (dc->state != LIBXL__DEVCLASS_PENDING)
+                continue;
+            pending = true;
+
+            if (dcs->devclasses_rc || !domcreate_devclass_ready(dcs, dc))
+                continue;
+            if (dcs->devclasses_running &&
+                dcs->devices_running + dc->num > dcs->devices_parallel)
+                continue;
+
+            LOGD(DEBUG, domid, "attaching %d %s device(s)", dc->num,
+                 libxl__device_kind_to_string(dc->dt->type));
+
+            dc->state = LIBXL__DEVCLASS_RUNNING;
+            dcs->devclasses_running++;
+            dcs->devices_running += dc->num;
+            dc->start = libxl__timestamp_us();
+
+            libxl__multidev_begin(ao, &dc->multidev);
+            dc->multidev.callback = domcreate_devclass_attached;
+            dc->dt->add(egc, ao, domid, d_config, &dc->multidev);
+            libxl__multidev_prepared(egc, &dc->multidev, 0);
         }
+    } while (dcs->devclasses_rescan);
+    dcs->devclasses_attaching = false;
 
-        domcreate_attach_devices(egc, &dcs->multidev, 0);
+    if (dcs->devclasses_running)
         return;
+
+    if (dcs->devclasses_rc) {
+        ret = dcs->devclasses_rc;
+        goto error_out;
     }
 
+    assert(!pending);
+
+    domcreate_phase(dcs, "console");
     ret = libxl__console_tty_path(gc, domid, 0, LIBXL_CONSOLE_TYPE_PV, &tty_path);
     if (ret) {
         LOG(ERROR, "failed to get domain %d console tty path",
@@ -2006,6 +2134,33 @@ error_out:
     domcreate_complete(egc, dcs, ret);
 }
 
+static void domcreate_devclass_attached(libxl__egc *egc,
+                                        libxl__multidev *multidev,
+                                        int ret)
+{
+    libxl__domcreate_devclass *dc = CONTAINER_OF(multidev, *dc, multidev);
+    libxl__domain_create_state *dcs = dc->dcs;
+    STATE_AO_GC(dcs->ao);
+    int domid = dcs->guest_domid;
+
+    dc->state = LIBXL__DEVCLASS_DONE;
+    dcs->devclasses_running--;
+    dcs->devices_running -= dc->num;
+
+    if (ret) {
+        LOGD(ERROR, domid, "unable to add %s devices",
+             libxl__device_kind_to_string(dc->dt->type));
+        if (!dcs->devclasses_rc)
+            dcs->devclasses_rc = ret;
+    } else {
+        libxl__profile_span(ao, dc->start, libxl__timestamp_us(),
+                            "%s devices",
+                            libxl__device_kind_to_string(dc->dt->type));
+    }
+
+    domcreate_attach_devices(egc, dcs);
+}
+
 static void console_xswait_callback(libxl__egc *egc, libxl__xswait_state *xswa,
                                     int rc, const char *p)
 {
@@ -2038,6 +2193,7 @@ static void domcreate_complete(libxl__egc *egc,
     libxl_domain_config *const d_config = dcs->guest_config;
     libxl_domain_config *d_config_saved = &dcs->guest_config_saved;
 
+    domcreate_phase(dcs, NULL);
     libxl__xswait_stop(gc, &dcs->console_xswait);
 
     libxl__domain_build_state_dispose(&dcs->build_state);
@@ -2123,6 +2279,10 @@ static int do_domain_create(libxl_ctx *ctx, libxl_domain_config *d_config,
     libxl__app_domain_create_state *cdcs;
     int rc;
 
+    CTX->create_profile_written = false;
+    libxl__profile_init(ao, CTX->create_profile ?:
+                            getenv("LIBXL_CREATE_PROFILE"));
+
     GCNEW(cdcs);
     cdcs->dcs.ao = ao;
     cdcs->dcs.guest_config = d_config;
@@ -2353,6 +2513,8 @@ static void domain_create_cb(libxl__egc *egc,
         if (flrc && !rc) rc = flrc;
     }
 
+    if (libxl__profile_write(gc, ao, domid, rc))
+        CTX->create_profile_written = true;
     libxl__ao_complete(egc, ao, rc);
 }
 
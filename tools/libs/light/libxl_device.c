@@ -731,6 +731,9 @@ void libxl__prepare_ao_device(libxl__ao *ao, libxl__ao_device *aodev)
     libxl__ev_child_init(&aodev->child);
 
     libxl__ev_qmp_init(&aodev->qmp);
+
+    aodev->start = libxl__timestamp_us();
+    aodev->backend_ready = 0;
 }
 
 /* multidev */
@@ -1223,6 +1226,9 @@ static void device_hotplug(libxl__egc *egc, libxl__ao_device *aodev)
     int hotplug, nullfd = -1;
     uint32_t domid;
 
+    if (!aodev->backend_ready)
+        aodev->backend_ready = libxl__timestamp_us();
+
     /*
      * If device is attached from a driver domain don't try to execute
      * hotplug scripts
@@ -1418,6 +1424,17 @@ static void device_hotplug_done(libxl__egc *egc, libxl__ao_device *aodev)
             aodev->rc = rc;
     }
 
+    if (aodev->action == LIBXL__DEVICE_ACTION_ADD &&
+        aodev->start && aodev->backend_ready) {
+        const char *be_path = libxl__device_backend_path(gc, aodev->dev);
+        uint64_t now = libxl__timestamp_us();
+
+        libxl__profile_span(ao, aodev->start, aodev->backend_ready,
+                            "backend %s", be_path);
+        libxl__profile_span(ao, aodev->backend_ready, now,
+                            "hotplug %s", be_path);
+    }
+
     aodev->callback(egc, aodev);
     return;
 }
@@ -2252,6 +2252,27 @@ static void dmss_init(libxl__dm_spawn_state *dmss)
 {
     libxl__ev_qmp_init(&dmss->qmp);
     libxl__ev_time_init(&dmss->timeout);
+    dmss->phase_start = libxl__timestamp_us();
+}
+
+/* Records the phase of the spawn which just ended and starts the next one */
+static void dmss_phase_done(libxl__dm_spawn_state *dmss, const char *phase)
+{
+    uint64_t now = libxl__timestamp_us();
+
+    libxl__profile_span(dmss->spawn.ao, dmss->phase_start, now, "%s: %s",
+                        dmss->spawn.what ?: "device model", phase);
+    dmss->phase_start = now;
+}
+
+static void stubdom_phase_done(libxl__stub_dm_spawn_state *sdss,
+                               const char *phase)
+{
+    uint64_t now = libxl__timestamp_us();
+
+    libxl__profile_span(sdss->dm.spawn.ao, sdss->dm.phase_start, now,
+                        "stubdomain %u: %s", sdss->pvqemu.guest_domid, phase);
+    sdss->dm.phase_start = now;
 }
 
 static void dmss_dispose(libxl__gc *gc, libxl__dm_spawn_state *dmss)
@@ -2515,6 +2536,8 @@ static void spawn_stub_launch_dm(libxl__egc *egc,
         goto out;
      }
 
+    stubdom_phase_done(sdss, "build");
+
     for (i = 0; i < dm_config->num_nics; i++) {
          /* We have to init the nic here, because we still haven't
          * called libxl_device_nic_add at this point, but qemu needs
@@ -2817,6 +2840,8 @@ static void stubdom_pvqemu_unpaused(libxl__egc *egc,
 
     if (rc) goto out;
 
+    stubdom_phase_done(sdss, "device model");
+
     sdss->xswait.ao = ao;
     sdss->xswait.what = GCSPRINTF("Stubdom %u for %u startup",
                                   dm_domid, sdss->dm.guest_domid);
@@ -2850,6 +2875,8 @@ static void stubdom_xswait_cb(libxl__egc *egc, libxl__xswait_state *xswait,
 
     if (strcmp(p, "running"))
         return;
+
+    stubdom_phase_done(sdss, "startup");
  out:
     libxl__domain_build_state_dispose(&sdss->dm_state);
     libxl__xswait_stop(gc, xswait);
@@ -3125,6 +3152,8 @@ static void device_model_probe_spawn_outcome(libxl__egc *egc,
              dmss->spawn.pidpath);
     }
 
+    dmss_phase_done(dmss, "complete");
+
     /*
      * Ignore all failure from the QEMU command line probe, start the
      * device model in any case.
@@ -3401,6 +3430,8 @@ static void device_model_spawn_outcome(libxl__egc *egc,
     if (rc)
         LOGD(ERROR, dmss->guest_domid,
              "%s: spawn failed (rc=%d)", dmss->spawn.what, rc);
+    else
+        dmss_phase_done(dmss, "startup");
 
     libxl__domain_build_state *state = dmss->build_state;
 
@@ -3621,6 +3652,8 @@ static void device_model_postconfig_done(libxl__egc *egc,
     if (rc)
         LOGD(ERROR, dmss->guest_domid,
              "Post DM startup configs failed, rc=%d", rc);
+    else
+        dmss_phase_done(dmss, "post startup configuration");
     dmss_dispose(gc, dmss);
     dmss->callback(egc, dmss, rc);
 }
@@ -549,6 +549,7 @@ static int libxl__build_dom(libxl__gc *gc, uint32_t domid,
              struct xc_dom_image *dom)
 {
     libxl_domain_build_info *const info = &d_config->b_info;
+    const char *template;
     uint64_t mem_kb;
     int ret;
 
@@ -562,6 +563,13 @@ static int libxl__build_dom(libxl__gc *gc, uint32_t domid,
         goto out;
     }
 #endif
+    template = CTX->create_template ?:
+               getenv("LIBXL_DOMAIN_TEMPLATE_RECORD");
+    if ( template && info->type != LIBXL_DOMAIN_TYPE_HVM &&
+         (ret = xc_dom_template_record(dom, template)) != 0 ) {
+        LOGE(ERROR, "xc_dom_template_record failed");
+        goto out;
+    }
     if ( (ret = xc_dom_parse_image(dom)) != 0 ) {
         LOG(ERROR, "xc_dom_parse_image failed");
         goto out;
@@ -606,6 +614,24 @@ out:
     return ret != 0 ? ERROR_FAIL : 0;
 }
 
+int libxl_domain_create_template(libxl_ctx *ctx, const char *path)
+{
+    char *copy = NULL;
+
+    if (path) {
+        copy = strdup(path);
+        if (!copy)
+            return ERROR_NOMEM;
+    }
+
+    libxl__ctx_lock(ctx);
+    free(ctx->create_template);
+    ctx->create_template = copy;
+    libxl__ctx_unlock(ctx);
+
+    return 0;
+}
+
 int libxl__build_pv(libxl__gc *gc, uint32_t domid,
              libxl_domain_config *d_config, libxl__domain_build_state *state)
 {
@@ -103,6 +103,11 @@
 #define LIBXL_STUBDOM_START_TIMEOUT 30
 #define LIBXL_QEMU_BODGE_TIMEOUT 2
 #define LIBXL_BOOTLOADER_TIMEOUT 120
+/*
+ * Maximum number of devices being attached at once by domain creation,
+ * overridable with the environment variable of the same name.
+ */
+#define LIBXL_DEVICE_ATTACH_PARALLEL 32
 #define LIBXL_XENCONSOLE_LIMIT 1048576
 #define LIBXL_XENCONSOLE_PROTOCOL "vt100"
 #define LIBXL_MAXMEM_CONSTANT 1024
@@ -195,6 +200,7 @@ typedef struct libxl__dm_resume_state libxl__dm_resume_state;
 typedef struct libxl__ao_device libxl__ao_device;
 typedef struct libxl__multidev libxl__multidev;
 typedef struct libxl__ev_immediate libxl__ev_immediate;
+typedef struct libxl__profile libxl__profile;
 
 typedef struct libxl__domain_create_state libxl__domain_create_state;
 typedef void libxl__domain_create_cb(struct libxl__egc *egc,
@@ -733,6 +739,13 @@ struct libxl__ctx {
 
     bool libxl_domain_need_memory_0x041200_called,
          libxl_domain_need_memory_called;
+
+    /* libxl_domain_create_profile() */
+    char *create_profile;
+    bool create_profile_written;
+
+    /* libxl_domain_create_template() */
+    char *create_template;
 };
 
 /*
@@ -825,6 +838,7 @@ struct libxl__ao {
     uint32_t domid;
     XEN_TAILQ_ENTRY(libxl__ao) entry_for_callback;
     int outstanding_killed_child;
+    libxl__profile *profile;
 };
 
 #define LIBXL_INIT_GC(gc,ctx) do{               \
@@ -2602,6 +2616,27 @@ _hidden libxl__ao *libxl__nested_ao_create(libxl__ao *parent); /* cannot fail */
 _hidden void libxl__nested_ao_free(libxl__ao *child);
 
 
+/*
+ * Profiling of an ao.
+ *
+ * libxl__profile_init attaches a profile to a (root) ao, to be written
+ * as JSON to the file @path (nothing is done if @path is NULL).  Any code
+ * running on behalf of the ao, or of one of its sub-aos, may then record
+ * with libxl__profile_span how long some phase of the operation took;
+ * this does nothing when the ao is not being profiled.
+ *
+ * Times are libxl__timestamp_us() values, monotonic and in microseconds;
+ * 0 means that the time is not known and the span is then not recorded.
+ */
+_hidden uint64_t libxl__timestamp_us(void);
+_hidden void libxl__profile_init(libxl__ao *ao, const char *path);
+_hidden void libxl__profile_span(libxl__ao *ao, uint64_t start, uint64_t end,
+                                 const char *fmt, ...) PRINTF_ATTRIBUTE(4, 5);
+/* Returns whether the profile was written */
+_hidden bool libxl__profile_write(libxl__gc *gc, libxl__ao *ao,
+                                  uint32_t domid, int rc);
+
+
 /*
  * File descriptors and CLOEXEC
  */
@@ -2779,6 +2814,9 @@ struct libxl__ao_device {
      * 'libxl__$type_devtype'. */
     void *device_config;
     const libxl__device_type *device_type;
+    /* private for add/remove implementation, libxl__timestamp_us() of
+     * the start of the operation and of the backend being ready */
+    uint64_t start, backend_ready;
 };
 
 /*
@@ -3940,6 +3978,8 @@ typedef int (*device_set_xenstore_config_fn_t)(libxl__gc *, uint32_t, void *,
 struct libxl__device_type {
     libxl__device_kind type;
     int skip_attach;   /* Skip entry in domcreate_attach_devices() if 1 */
+    /* domcreate_attach_devices() attaches this type after attach_after */
+    const libxl__device_type *attach_after;
     int ptr_offset;    /* Offset of device array ptr in libxl_domain_config */
     int num_offset;    /* Offset of # of devices in libxl_domain_config */
     int dev_elem_size; /* Size of one device element in array */
@@ -4160,6 +4200,7 @@ struct libxl__dm_spawn_state {
     libxl__dm_resume_state dmrs;
     libxl__qemu_available_opts qemu_opts;
     const char *dm;
+    uint64_t phase_start; /* for libxl__profile_span() */
     /* filled in by user, must remain valid: */
     uint32_t guest_domid; /* domain being served */
     libxl_domain_config *guest_config;
@@ -4204,6 +4245,20 @@ _hidden int libxl__destroy_qemu_xenpv_backend(libxl__gc *gc, uint32_t domid);
 
 /*----- Domain creation -----*/
 
+typedef struct libxl__domcreate_devclass libxl__domcreate_devclass;
+struct libxl__domcreate_devclass {
+    /* private to domcreate_attach_devices() */
+    libxl__domain_create_state *dcs;
+    const libxl__device_type *dt;
+    enum {
+        LIBXL__DEVCLASS_PENDING,
+        LIBXL__DEVCLASS_RUNNING,
+        LIBXL__DEVCLASS_DONE,
+    } state;
+    int num;
+    uint64_t start;
+    libxl__multidev multidev;
+};
 
 struct libxl__domain_create_state {
     /* filled in by user */
@@ -4220,7 +4275,12 @@ struct libxl__domain_create_state {
     libxl_asyncprogress_how aop_console_how;
     /* private to domain_create */
     int guest_domid;
-    int device_type_idx;
+    libxl__domcreate_devclass *devclasses; /* one per device_type_tbl entry */
+    int devclasses_running, devices_running, devices_parallel;
+    int devclasses_rc;
+    bool devclasses_attaching, devclasses_rescan;
+    const char *phase; /* for libxl__profile_span() */
+    uint64_t phase_start;
     const char *colo_proxy_script;
     libxl__domain_build_state build_state;
     libxl__colo_restore_state crs;
@@ -0,0 +1,238 @@
+/*
+ * Profiling of asynchronous operations: records how long each phase of
+ * an ao takes and dumps the result as JSON.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation; version 2.1 only. with the special
+ * exception on linking described in file LICENSE.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ */
+
+#include "libxl_osdeps.h" /* must come before any other headers */
+
+#include "libxl_internal.h"
+
+typedef struct {
+    const char *name;
+    uint64_t start, end;
+} libxl__profile_span_entry;
+
+struct libxl__profile {
+    const char *path;
+    uint64_t origin;
+    libxl__profile_span_entry *spans;
+    int nr_spans, allocd;
+    /* only valid while writing */
+    uint32_t domid;
+    int rc;
+};
+
+uint64_t libxl__timestamp_us(void)
+{
+    struct timespec ts;
+
+    if (clock_gettime(CLOCK_MONOTONIC, &ts))
+        return 0;
+
+    return ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+/* Spans live in the gc of the root ao, which outlives any nested ao. */
+static libxl__ao *profile_ao(libxl__ao *ao)
+{
+    return ao->nested_root ?: ao;
+}
+
+void libxl__profile_init(libxl__ao *ao, const char *path)
+{
+    AO_GC;
+    libxl__profile *prof;
+
+    if (!path || !*path)
+        return;
+
+    GCNEW(prof);
+    prof->path = libxl__strdup(gc, path);
+    prof->origin = libxl__timestamp_us();
+    ao->profile = prof;
+}
+
+void libxl__profile_span(libxl__ao *ao, uint64_t start, uint64_t end,
+                         const char *fmt, ...)
+{
+    libxl__ao *root = profile_ao(ao);
+    libxl__gc *gc = &root->gc;
+    libxl__profile *prof = root->profile;
+    libxl__profile_span_entry *span;
+    va_list ap;
+
+    if (!prof || !start || !end)
+        return;
+
+    if (prof->nr_spans >= prof->allocd) {
+        prof->allocd = prof->allocd * 2 + 16;
+        GCREALLOC_ARRAY(prof->spans, prof->allocd);
+    }
+    span = &prof->spans[prof->nr_spans++];
+
+    va_start(ap, fmt);
+    span->name = libxl__vsprintf(gc, fmt, ap);
+    va_end(ap);
+    span->start = start;
+    span->end = end;
+
+    LOG(DEBUG, "profile: %s: %"PRIu64" us", span->name, end - start);
+}
+
+static uint64_t profile_rel(const libxl__profile *prof, uint64_t t)
+{
+    return t > prof->origin ? t - prof->origin : 0;
+}
+
+static yajl_gen_status profile_gen_json(yajl_gen hand, void *p)
+{
+    libxl__profile *prof = p;
+    uint64_t end = libxl__timestamp_us();
+    yajl_gen_status s;
+    int i;
+
+    s = yajl_gen_map_open(hand);
+    if (s != yajl_gen_status_ok) goto out;
+
+    s = libxl__yajl_gen_asciiz(hand, "domid");
+    if (s != yajl_gen_status_ok) goto out;
+    s = yajl_gen_integer(hand, prof->domid);
+    if (s != yajl_gen_status_ok) goto out;
+
+    s = libxl__yajl_gen_asciiz(hand, "rc");
+    if (s != yajl_gen_status_ok) goto out;
+    s = yajl_gen_integer(hand, prof->rc);
+    if (s != yajl_gen_status_ok) goto out;
+
+    s = libxl__yajl_gen_asciiz(hand, "total_us");
+    if (s != yajl_gen_status_ok) goto out;
+    s = libxl__uint64_gen_json(hand, profile_rel(prof, end));
+    if (s != yajl_gen_status_ok) goto out;
+
+    s = libxl__yajl_gen_asciiz(hand, "spans");
+    if (s != yajl_gen_status_ok) goto out;
+    s = yajl_gen_array_open(hand);
+    if (s != yajl_gen_status_ok) goto out;
+
+    for (i = 0; i < prof->nr_spans; i++) {
+        const libxl__profile_span_entry *span = &prof->spans[i];
+
+        s = yajl_gen_map_open(hand);
+        if (s != yajl_gen_status_ok) goto out;
+
+        s = libxl__yajl_gen_asciiz(hand, "name");
+        if (s != yajl_gen_status_ok) goto out;
+        s = libxl__yajl_gen_asciiz(hand, span->name);
+        if (s != yajl_gen_status_ok) goto out;
+
+        s = libxl__yajl_gen_asciiz(hand, "start_us");
+        if (s != yajl_gen_status_ok) goto out;
+        s = libxl__uint64_gen_json(hand, profile_rel(prof, span->start));
+        if (s != yajl_gen_status_ok) goto out;
+
+        s = libxl__yajl_gen_asciiz(hand, "duration_us");
+        if (s != yajl_gen_status_ok) goto out;
+        s = libxl__uint64_gen_json(hand, span->end > span->start ?
+                                         span->end - span->start : 0);
+        if (s != yajl_gen_status_ok) goto out;
+
+        s = yajl_gen_map_close(hand);
+        if (s != yajl_gen_status_ok) goto out;
+    }
+
+    s = yajl_gen_array_close(hand);
+    if (s != yajl_gen_status_ok) goto out;
+
+    s = yajl_gen_map_close(hand);
+
+out:
+    return s;
+}
+
+bool libxl__profile_write(libxl__gc *gc, libxl__ao *ao, uint32_t domid,
+                          int rc)
+{
+    libxl__profile *prof = profile_ao(ao)->profile;
+    char *json = NULL;
+    int fd = -1;
+    bool written = false;
+
+    if (!prof)
+        return false;
+
+    prof->domid = domid;
+    prof->rc = rc;
+    json = libxl__object_to_json(CTX, "profile", profile_gen_json, prof);
+    if (!json)
+        goto out;
+
+    fd = open(prof->path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        LOGE(ERROR, "failed to open profile file %s", prof->path);
+        goto out;
+    }
+
+    if (libxl_write_exactly(CTX, fd, json, strlen(json), prof->path,
+                            "profile") ||
+        libxl_write_exactly(CTX, fd, "\n", 1, prof->path, "profile"))
+        goto out;
+
+    LOG(DEBUG, "profile of %d spans written to %s", prof->nr_spans,
+        prof->path);
+    written = true;
+
+out:
+    if (fd >= 0 && close(fd)) {
+        LOGE(ERROR, "failed to close profile file %s", prof->path);
+        written = false;
+    }
+    free(json);
+    return written;
+}
+
+int libxl_domain_create_profile(libxl_ctx *ctx, const char *path)
+{
+    char *copy = NULL;
+
+    if (path) {
+        copy = strdup(path);
+        if (!copy)
+            return ERROR_NOMEM;
+    }
+
+    libxl__ctx_lock(ctx);
+    free(ctx->create_profile);
+    ctx->create_profile = copy;
+    libxl__ctx_unlock(ctx);
+
+    return 0;
+}
+
+bool libxl_domain_create_profile_written(libxl_ctx *ctx)
+{
+    bool written;
+
+    libxl__ctx_lock(ctx);
+    written = ctx->create_profile_written;
+    libxl__ctx_unlock(ctx);
+
+    return written;
+}
+
+/*
+ * Local variables:
+ * mode: C
+ * c-basic-offset: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -0,0 +1,576 @@
+/* SPDX-License-Identifier: GPL-2.0-only */
+/*
+ * xen-memshared: background deduplication of guest memory.
+ *
+ * Samples the pages of HVM guests, a window of each domain per interval,
+ * and hashes them with xxHash.  A page hashing the same as one seen before
+ * is nominated for sharing along with it, compared once both are nominated
+ * (a write to either afterwards invalidates its handle), and shared if the
+ * contents match.  The number of pages shared per second is limited, and
+ * the memory saved and the rate at which guests break the sharing by
+ * writing to shared pages are reported every interval.
+ *
+ * Sharing must be possible for the domains: they have to use HAP, and have
+ * no device assigned.  Guests writing to a shared page need memory to be
+ * available for their own copy of it.
+ */
+
+#include <err.h>
+#include <errno.h>
+#include <endian.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <xenctrl.h>
+#include <xenforeignmemory.h>
+#include <xen-tools/common-macros.h>
+
+/*
+ * The hypervisor's xxHash, built without the hypervisor headers: provide
+ * what xen/include/xen/xxhash.h and xen/unaligned.h would.
+ */
+struct xxh64_state {
+    uint64_t total_len;
+    uint64_t v1;
+    uint64_t v2;
+    uint64_t v3;
+    uint64_t v4;
+    uint64_t mem64[4];
+    uint32_t memsize;
+};
+
+static inline uint32_t get_unaligned_le32(const void *p)
+{
+    uint32_t v;
+
+    memcpy(&v, p, sizeof(v));
+
+    return le32toh(v);
+}
+
+static inline uint64_t get_unaligned_le64(const void *p)
+{
+    uint64_t v;
+
+    memcpy(&v, p, sizeof(v));
+
+    return le64toh(v);
+}
+
+#include "../../xen/lib/xxhash64.c"
+
+#define PAGE_SHIFT  XC_PAGE_SHIFT
+#define PAGE_SIZE   XC_PAGE_SIZE
+
+/* Pages mapped at once to be hashed. */
+#define MAP_BATCH   256
+
+#define DEFAULT_INTERVAL    10
+#define DEFAULT_SAMPLE      16384
+#define DEFAULT_RATE        2048
+#define DEFAULT_TABLE_ORDER 20
+
+/* Last page seen with each hash, indexed by its low bits. */
+struct page_ref {
+    uint64_t hash;
+    uint64_t gfn;
+    domid_t domid;          /* 0 for an empty entry: dom0 isn't scanned. */
+};
+
+static struct page_ref *table;
+static unsigned long table_mask;
+
+/* Scan state of each domain, reset when another domain gets the ID. */
+struct dom_state {
+    xen_domain_handle_t handle;
+    bool known;
+    bool enabled;
+    bool skip;
+    uint64_t next_gfn;
+};
+
+static struct dom_state doms[DOMID_FIRST_RESERVED];
+
+static bool selected[DOMID_FIRST_RESERVED];
+static bool select_all = true;
+
+static struct {
+    unsigned long scanned;
+    unsigned long candidates;
+    unsigned long changed;
+    unsigned long busy;
+    unsigned long already;
+    unsigned long shared;
+} stats, total;
+
+static xc_interface *xch;
+static xenforeignmemory_handle *fmem;
+static volatile bool done;
+static bool daemonized;
+static bool verbose;
+
+static void __attribute__((format(printf, 2, 3)))
+report(int prio, const char *fmt, ...)
+{
+    va_list ap;
+
+    if ( prio == LOG_DEBUG && !verbose )
+        return;
+
+    va_start(ap, fmt);
+    if ( daemonized )
+        vsyslog(prio, fmt, ap);
+    else
+    {
+        vprintf(fmt, ap);
+        putchar('\n');
+        fflush(stdout);
+    }
+    va_end(ap);
+}
+
+static void daemonize(void)
+{
+    switch ( fork() )
+    {
+    case -1:
+        err(EXIT_FAILURE, "fork");
+    case 0:
+        break;
+    default:
+        exit(EXIT_SUCCESS);
+    }
+
+    umask(0);
+    if ( setsid() < 0 )
+        err(EXIT_FAILURE, "setsid");
+    if ( chdir("/") < 0 )
+        err(EXIT_FAILURE, "chdir /");
+    if ( !freopen("/dev/null", "r", stdin) ||
+         !freopen("/dev/null", "w", stdout) ||
+         !freopen("/dev/null", "w", stderr) )
+        err(EXIT_FAILURE, "reopen standard streams");
+
+    openlog("xen-memshared", LOG_PID, LOG_DAEMON);
+    daemonized = true;
+}
+
+static void catch_exit(int sig)
+{
+    done = true;
+}
+
+static void *map_page(domid_t domid, uint64_t gfn)
+{
+    xen_pfn_t pfn = gfn;
+    int rc;
+    void *p = xenforeignmemory_map(fmem, domid, PROT_READ, 1, &pfn, &rc);
+
+    if ( p && rc )
+    {
+        xenforeignmemory_unmap(fmem, p, 1);
+        p = NULL;
+    }
+
+    return p;
+}
+
+/*
+ * Nominate both pages, check they still match, and share the client's into
+ * the source's.  Returns true if the pages are now shared.  Pages already
+ * shared together don't count as candidates, nor against the budget.
+ */
+static bool share_pages(struct page_ref *src, domid_t domid, uint64_t gfn,
+                        unsigned long *budget)
+{
+    uint64_t src_handle, handle;
+    void *p, *q;
+    bool same = false;
+
+    if ( xc_memshr_nominate_gfn(xch, src->domid, src->gfn, &src_handle) )
+    {
+        /* Gone, or busy: remember the new page instead. */
+        report(LOG_DEBUG, "d%u gfn %#"PRIx64": nominate failed: %s",
+               src->domid, src->gfn, strerror(errno));
+        src->domid = domid;
+        src->gfn = gfn;
+        stats.candidates++;
+        stats.busy++;
+        (*budget)--;
+        return false;
+    }
+
+    if ( xc_memshr_nominate_gfn(xch, domid, gfn, &handle) )
+    {
+        report(LOG_DEBUG, "d%u gfn %#"PRIx64": nominate failed: %s",
+               domid, gfn, strerror(errno));
+        stats.candidates++;
+        stats.busy++;
+        (*budget)--;
+        return false;
+    }
+
+    if ( handle == src_handle )
+    {
+        stats.already++;
+        return false;
+    }
+
+    stats.candidates++;
+    (*budget)--;
+
+    p = map_page(src->domid, src->gfn);
+    q = map_page(domid, gfn);
+    if ( p && q )
+        same = !memcmp(p, q, PAGE_SIZE);
+    if ( p )
+        xenforeignmemory_unmap(fmem, p, 1);
+    if ( q )
+        xenforeignmemory_unmap(fmem, q, 1);
+
+    if ( !same )
+    {
+        stats.changed++;
+        return false;
+    }
+
+    if ( xc_memshr_share_gfns(xch, src->domid, src->gfn, src_handle,
+                              domid, gfn, handle) )
+    {
+        /* Written to since nominated. */
+        stats.changed++;
+        return false;
+    }
+
+    stats.shared++;
+
+    return true;
+}
+
+/*
+ * Hash @nr pages of @domid from its last position, sharing duplicates as
+ * long as @budget allows.
+ */
+static void scan_domain(domid_t domid, struct dom_state *ds, unsigned long nr,
+                        unsigned long *budget)
+{
+    xen_pfn_t max_gpfn, pfns[MAP_BATCH];
+    int errs[MAP_BATCH];
+    struct {
+        struct page_ref *ref;
+        uint64_t gfn;
+    } cand[MAP_BATCH];
+
+    if ( xc_domain_maximum_gpfn(xch, domid, &max_gpfn) < 0 )
+        return;
+
+    nr = nr < max_gpfn + 1 ? nr : max_gpfn + 1;
+
+    while ( nr && !done )
+    {
+        unsigned int i, batch = nr < MAP_BATCH ? nr : MAP_BATCH, nr_cand = 0;
+        uint8_t *pages;
+
+        for ( i = 0; i < batch; i++ )
+        {
+            if ( ds->next_gfn > max_gpfn )
+                ds->next_gfn = 0;
+            pfns[i] = ds->next_gfn++;
+        }
+        nr -= batch;
+
+        pages = xenforeignmemory_map(fmem, domid, PROT_READ, batch, pfns, errs);
+        if ( !pages )
+        {
+            report(LOG_DEBUG, "d%u: mapping %u pages from %#"PRIx64": %s",
+                   domid, batch, (uint64_t)pfns[0], strerror(errno));
+            continue;
+        }
+
+        for ( i = 0; i < batch; i++ )
+        {
+            struct page_ref *ref;
+            uint64_t hash;
+
+            /* Holes, MMIO, and pages paged out. */
+            if ( errs[i] )
+                continue;
+
+            hash = xxh64(pages + ((size_t)i << PAGE_SHIFT), PAGE_SIZE, 0);
+            ref = &table[hash & table_mask];
+            stats.scanned++;
+
+            if ( ref->domid && ref->hash == hash )
+            {
+                if ( ref->domid != domid || ref->gfn != pfns[i] )
+                {
+                    cand[nr_cand].ref = ref;
+                    cand[nr_cand++].gfn = pfns[i];
+                }
+                continue;
+            }
+
+            ref->hash = hash;
+            ref->gfn = pfns[i];
+            ref->domid = domid;
+        }
+
+        /* Nominating fails for pages with references, as our mappings. */
+        xenforeignmemory_unmap(fmem, pages, batch);
+
+        for ( i = 0; i < nr_cand && *budget; i++ )
+            share_pages(cand[i].ref, domid, cand[i].gfn, budget);
+    }
+}
+
+static void scan(unsigned long sample, unsigned long budget)
+{
+    xc_domaininfo_t info[64];
+    domid_t first = 1;
+    int nr, i;
+
+    while ( !done &&
+            (nr = xc_domain_getinfolist(xch, first, ARRAY_SIZE(info),
+                                        info)) > 0 )
+    {
+        for ( i = 0; i < nr && !done; i++ )
+        {
+            domid_t domid = info[i].domain;
+            struct dom_state *ds = &doms[domid];
+
+            if ( !ds->known ||
+                 memcmp(ds->handle, info[i].handle, sizeof(ds->handle)) )
+            {
+                memset(ds, 0, sizeof(*ds));
+                memcpy(ds->handle, info[i].handle, sizeof(ds->handle));
+                ds->known = true;
+            }
+
+            if ( ds->skip || (!select_all && !selected[domid]) ||
+                 !(info[i].flags & XEN_DOMINF_hvm_guest) ||
+                 (info[i].flags & (XEN_DOMINF_dying | XEN_DOMINF_shutdown)) )
+                continue;
+
+            if ( !ds->enabled )
+            {
+                if ( xc_memshr_control(xch, domid, 1) )
+                {
+                    report(LOG_WARNING, "d%u: can't enable sharing: %s",
+                           domid, strerror(errno));
+                    ds->skip = true;
+                    continue;
+                }
+                ds->enabled = true;
+            }
+
+            scan_domain(domid, ds, sample, &budget);
+
+            report(LOG_DEBUG, "d%u: %"PRIu64" pages, %"PRIu64" shared",
+                   domid, (uint64_t)info[i].tot_pages,
+                   (uint64_t)info[i].shr_pages);
+        }
+
+        first = info[nr - 1].domain + 1;
+    }
+}
+
+static void __attribute__((noreturn)) usage(int exit_code)
+{
+    FILE *out = exit_code ? stderr : stdout;
+
+    fprintf(out,
+            "Usage: xen-memshared [OPTION]...\n"
+            "Share identical pages of HVM guests in the background.\n\n"
+            "  -h, --help            Display this help text and exit.\n"
+            "  -F, --foreground      Run in foreground.\n"
+            "  -v, --verbose         Report on each domain.\n"
+            "  -d, --domain=DOMID    Scan DOMID only (may be repeated).\n"
+            "                        Default: all HVM guests.\n"
+            "  -i, --interval=SECS   Seconds between scans (default %u).\n"
+            "  -s, --sample=PAGES    Pages hashed per domain and scan\n"
+            "                        (default %u).\n"
+            "  -r, --rate=PAGES      Pages shared per second at most\n"
+            "                        (default %u).\n"
+            "  -t, --table=ORDER     Remember 2^ORDER hashes (default %u).\n",
+            DEFAULT_INTERVAL, DEFAULT_SAMPLE, DEFAULT_RATE,
+            DEFAULT_TABLE_ORDER);
+    exit(exit_code);
+}
+
+static unsigned long parse_num(const char *arg, const char *what,
+                               unsigned long min, unsigned long max)
+{
+    char *endptr;
+    unsigned long val;
+
+    errno = 0;
+    val = strtoul(arg, &endptr, 0);
+    if ( errno || *endptr || val < min || val > max )
+        errx(EXIT_FAILURE, "invalid %s: '%s'", what, arg);
+
+    return val;
+}
+
+int main(int argc, char **argv)
+{
+    static const struct option long_options[] = {
+        { "help",       no_argument,       NULL, 'h' },
+        { "foreground", no_argument,       NULL, 'F' },
+        { "verbose",    no_argument,       NULL, 'v' },
+        { "domain",     required_argument, NULL, 'd' },
+        { "interval",   required_argument, NULL, 'i' },
+        { "sample",     required_argument, NULL, 's' },
+        { "rate",       required_argument, NULL, 'r' },
+        { "table",      required_argument, NULL, 't' },
+        { NULL, 0, NULL, 0 },
+    };
+    unsigned long interval = DEFAULT_INTERVAL, sample = DEFAULT_SAMPLE;
+    unsigned long rate = DEFAULT_RATE, order = DEFAULT_TABLE_ORDER;
+    bool daemon = true;
+    long freed, last_freed;
+    int c;
+
+    while ( (c = getopt_long(argc, argv, "hFvd:i:s:r:t:",
+                             long_options, NULL)) != -1 )
+    {
+        switch ( c )
+        {
+        case 'h':
+            usage(EXIT_SUCCESS);
+
+        case 'F':
+            daemon = false;
+            break;
+
+        case 'v':
+            verbose = true;
+            break;
+
+        case 'd':
+            selected[parse_num(optarg, "domain", 1,
+                               DOMID_FIRST_RESERVED - 1)] = true;
+            select_all = false;
+            break;
+
+        case 'i':
+            interval = parse_num(optarg, "interval", 1, 3600);
+            break;
+
+        case 's':
+            sample = parse_num(optarg, "sample", 1, ULONG_MAX);
+            break;
+
+        case 'r':
+            rate = parse_num(optarg, "rate", 1, ULONG_MAX / 3600);
+            break;
+
+        case 't':
+            order = parse_num(optarg, "table order", 10, 30);
+            break;
+
+        default:
+            usage(EXIT_FAILURE);
+        }
+    }
+
+    if ( optind != argc )
+        usage(EXIT_FAILURE);
+
+    table = calloc(1UL << order, sizeof(*table));
+    if ( !table )
+        err(EXIT_FAILURE, "allocating the hash table");
+    table_mask = (1UL << order) - 1;
+
+    xch = xc_interface_open(NULL, NULL, 0);
+    if ( !xch )
+        err(EXIT_FAILURE, "xc_interface_open");
+
+    fmem = xenforeignmemory_open(NULL, 0);
+    if ( !fmem )
+        err(EXIT_FAILURE, "xenforeignmemory_open");
+
+    if ( daemon )
+        daemonize();
+
+    if ( signal(SIGHUP, catch_exit) == SIG_ERR ||
+         signal(SIGINT, catch_exit) == SIG_ERR ||
+         signal(SIGTERM, catch_exit) == SIG_ERR )
+        err(EXIT_FAILURE, "signal");
+
+    last_freed = xc_sharing_freed_pages(xch);
+
+    while ( !done )
+    {
+        struct timespec start, now, left;
+        long breaks;
+
+        clock_gettime(CLOCK_MONOTONIC, &start);
+
+        memset(&stats, 0, sizeof(stats));
+        scan(sample, rate * interval);
+
+        /*
+         * Freed pages go up with each page shared, and down as guests write
+         * to shared pages and get a copy of their own.
+         */
+        freed = xc_sharing_freed_pages(xch);
+        breaks = last_freed + (long)stats.shared - freed;
+        last_freed = freed;
+
+        total.scanned += stats.scanned;
+        total.candidates += stats.candidates;
+        total.changed += stats.changed;
+        total.busy += stats.busy;
+        total.already += stats.already;
+        total.shared += stats.shared;
+
+        report(LOG_INFO,
+               "hashed %lu pages, shared %lu of %lu candidates (%lu changed, "
+               "%lu busy, %lu already shared); %ld MiB saved, "
+               "%.1f CoW breaks/s",
+               stats.scanned, stats.shared, stats.candidates, stats.changed,
+               stats.busy, stats.already, freed >> (20 - PAGE_SHIFT),
+               breaks > 0 ? (double)breaks / interval : 0.0);
+
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        left.tv_sec = start.tv_sec + interval - now.tv_sec;
+        left.tv_nsec = start.tv_nsec - now.tv_nsec;
+        if ( left.tv_nsec < 0 )
+        {
+            left.tv_nsec += 1000000000L;
+            left.tv_sec--;
+        }
+        if ( left.tv_sec >= 0 && !done )
+            nanosleep(&left, NULL);
+    }
+
+    report(LOG_INFO, "exiting: hashed %lu pages, shared %lu of %lu "
+           "candidates", total.scanned, total.shared, total.candidates);
+
+    xenforeignmemory_close(fmem);
+    xc_interface_close(xch);
+    free(table);
+
+    return 0;
+}
+
+/*
+ * Local variables:
+ * mode: C
+ * c-file-style: "BSD"
+ * c-basic-offset: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -0,0 +1,190 @@
+/*
+ * Userspace emulation of the hypervisor environment xen/common/event_fifo.c
+ * is built against.
+ *
+ * Unlike the hypervisor, several threads may run the code at once: queue
+ * locks are real spinlocks and guest bit operations are atomic, so that
+ * concurrent senders race as they would on different pCPUs.  Guest frames
+ * are plain page aligned allocations, their gfn being their address shifted.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms and conditions of the GNU General Public
+ * License, version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program; If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _TEST_EVTCHN_FIFO_EMUL_
+#define _TEST_EVTCHN_FIFO_EMUL_
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <xen-tools/common-macros.h>
+
+#include <xen/xen.h>
+#include <xen/event_channel.h>
+
+/* Compiler annotations. */
+#define __init
+#define cf_check
+#define unlikely(x) __builtin_expect(!!(x), 0)
+#define likely(x) __builtin_expect(!!(x), 1)
+
+/* Barriers and atomics, all sequentially consistent. */
+#define smp_mb()  __atomic_thread_fence(__ATOMIC_SEQ_CST)
+#define smp_rmb() smp_mb()
+#define smp_wmb() smp_mb()
+#define read_atomic(p) __atomic_load_n(p, __ATOMIC_SEQ_CST)
+#define write_atomic(p, v) __atomic_store_n(p, v, __ATOMIC_SEQ_CST)
+#define cmpxchg(p, o, n) __sync_val_compare_and_swap(p, o, n)
+
+#define array_index_nospec(idx, size) (idx)
+
+/* Bit operations on guest memory, as arrays of 32-bit words. */
+#define guest_word_(p, nr) ((uint32_t *)(p) + (nr) / 32)
+#define guest_mask_(nr) (1U << ((nr) % 32))
+#define guest_test_bit(d, nr, p) \
+    (!!(read_atomic(guest_word_(p, nr)) & guest_mask_(nr)))
+#define guest_set_bit(d, nr, p) \
+    ((void)__atomic_fetch_or(guest_word_(p, nr), guest_mask_(nr), \
+                             __ATOMIC_SEQ_CST))
+#define guest_clear_bit(d, nr, p) \
+    ((void)__atomic_fetch_and(guest_word_(p, nr), ~guest_mask_(nr), \
+                              __ATOMIC_SEQ_CST))
+#define guest_test_and_set_bit(d, nr, p) \
+    (!!(__atomic_fetch_or(guest_word_(p, nr), guest_mask_(nr), \
+                          __ATOMIC_SEQ_CST) & guest_mask_(nr)))
+
+/* Messages, with %pd and %pv understood as in the hypervisor. */
+void sim_printk(const char *fmt, ...);
+#define printk(fmt, args...) sim_printk(fmt, ## args)
+#define gprintk(lvl, fmt, args...) sim_printk(fmt, ## args)
+#define gdprintk(lvl, fmt, args...) sim_printk(fmt, ## args)
+#define XENLOG_WARNING ""
+#define XENLOG_G_WARNING ""
+
+/* Locks. */
+typedef pthread_spinlock_t spinlock_t;
+#define spin_lock_init(l) pthread_spin_init(l, PTHREAD_PROCESS_PRIVATE)
+#define spin_lock(l) pthread_spin_lock(l)
+#define spin_unlock(l) pthread_spin_unlock(l)
+#define spin_lock_irqsave(l, f) ((void)(f), pthread_spin_lock(l))
+#define spin_unlock_irqrestore(l, f) ((void)(f), pthread_spin_unlock(l))
+
+/* The event lock is only taken while setting up, by a single thread. */
+typedef struct { int held; } rwlock_t;
+#define write_lock(l) ((void)(l))
+#define write_unlock(l) ((void)(l))
+
+/* Memory. */
+#define PAGE_SHIFT 12
+#define PAGE_SIZE (1UL << PAGE_SHIFT)
+#define PAGE_MASK (~(PAGE_SIZE - 1))
+
+struct page_info;
+typedef unsigned long mfn_t;
+
+#define xzalloc(type) ((type *)calloc(1, sizeof(type)))
+#define xfree(p) free(p)
+
+#define P2M_ALLOC 0
+#define get_page_from_gfn(d, gfn, t, q) \
+    ((struct page_info *)(uintptr_t)((gfn) << PAGE_SHIFT))
+#define get_page_type(p, t) true
+#define put_page(p) ((void)(p))
+#define put_page_and_type(p) ((void)(p))
+#define __map_domain_page_global(p) ((void *)(p))
+#define unmap_domain_page_global(v) ((void)(v))
+#define domain_page_map_to_mfn(v) ((mfn_t)(uintptr_t)(v))
+#define mfn_to_page(m) ((struct page_info *)(m))
+
+/* Domains, vCPUs and event channels. */
+struct evtchn {
+    evtchn_port_t port;
+    bool pending;
+    unsigned char priority;
+    unsigned short notify_vcpu_id;
+    uint32_t fifo_lastq;
+
+    /* Taken for reading around sends, for writing around rebinds. */
+    pthread_rwlock_t lock;
+};
+
+struct vcpu {
+    unsigned int vcpu_id;
+    struct domain *domain;
+    struct vcpu *next_in_list;
+    struct evtchn_fifo_vcpu *evtchn_fifo;
+
+    bool upcall_pending;
+    unsigned long kicks;
+};
+
+struct evtchn_port_ops {
+    void (*init)(struct domain *d, struct evtchn *evtchn);
+    void (*set_pending)(struct vcpu *v, struct evtchn *evtchn);
+    void (*clear_pending)(struct domain *d, struct evtchn *evtchn);
+    void (*unmask)(struct domain *d, struct evtchn *evtchn);
+    bool (*is_pending)(const struct domain *d, const struct evtchn *evtchn);
+    bool (*is_masked)(const struct domain *d, const struct evtchn *evtchn);
+    bool (*is_busy)(const struct domain *d, const struct evtchn *evtchn);
+    int (*set_priority)(struct domain *d, struct evtchn *evtchn,
+                        unsigned int priority);
+    void (*print_state)(struct domain *d, const struct evtchn *evtchn);
+};
+
+struct domain {
+    domid_t domain_id;
+    unsigned int max_vcpus;
+    struct vcpu **vcpu;
+    rwlock_t event_lock;
+    const struct evtchn_port_ops *evtchn_port_ops;
+    struct evtchn_fifo_domain *evtchn_fifo;
+
+    struct evtchn *evtchn;
+    unsigned int nr_evtchns;
+    uint32_t evtchn_pending[EVTCHN_2L_NR_CHANNELS / 32];
+};
+
+#define for_each_vcpu(d, v) \
+    for ( (v) = (d)->vcpu[0]; (v); (v) = (v)->next_in_list )
+
+static inline struct vcpu *domain_vcpu(const struct domain *d,
+                                       unsigned int vcpu_id)
+{
+    return vcpu_id < d->max_vcpus ? d->vcpu[vcpu_id] : NULL;
+}
+
+extern struct vcpu *sim_current;
+#define current sim_current
+
+#define shared_info(d, field) ((d)->field)
+
+#define max_evtchns(d) \
+    ((d)->evtchn_fifo ? EVTCHN_FIFO_NR_CHANNELS : EVTCHN_2L_NR_CHANNELS)
+#define port_is_valid(d, p) ((p) < (d)->nr_evtchns)
+#define evtchn_from_port(d, p) (&(d)->evtchn[p])
+
+void evtchn_check_pollers(struct domain *d, unsigned int port);
+void vcpu_mark_events_pending(struct vcpu *v);
+
+/* Exported by event_fifo.c. */
+int evtchn_fifo_init_control(struct evtchn_init_control *init_control);
+int evtchn_fifo_expand_array(const struct evtchn_expand_array *expand_array);
+void evtchn_fifo_dump(const struct domain *d);
+void evtchn_fifo_destroy(struct domain *d);
+
+#endif
+
@@ -0,0 +1,407 @@
+/*
+ * Model test of FIFO event channels: runs xen/common/event_fifo.c in
+ * userspace, with sender threads raising events on a set of ports as
+ * concurrently as pCPUs would, a thread moving ports between vCPUs and
+ * priorities, and for each vCPU a thread consuming its queues as Linux
+ * does.  Each send bumps a sequence number of the port before raising it,
+ * and each handled event records the number it sees: once everything has
+ * settled, every port must have been handled with its last number, or an
+ * event got lost.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms and conditions of the GNU General Public
+ * License, version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program; If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "emul.h"
+
+#include <sched.h>
+#include <stdarg.h>
+#include <string.h>
+#include <unistd.h>
+
+struct vcpu *sim_current;
+
+static struct domain dom;
+
+static unsigned int nr_vcpus = 2, nr_ports = 64, nr_senders = 4;
+static unsigned long nr_sends = 1000000;
+static bool stop_senders, stop_consumers;
+
+/* Per port: last sequence number sent, and last one handled. */
+static unsigned long *sent, *handled;
+static unsigned long nr_handled, nr_lost_warnings;
+
+/* Guest view of a vCPU: its control block, and its queue heads. */
+struct guest_vcpu {
+    struct vcpu *v;
+    evtchn_fifo_control_block_t *control_block;
+    uint32_t head[EVTCHN_FIFO_MAX_QUEUES];
+};
+
+static struct guest_vcpu *guest_vcpus;
+static event_word_t *event_array;
+
+void sim_printk(const char *fmt, ...)
+{
+    const char *p;
+    va_list args;
+
+    va_start(args, fmt);
+
+    for ( p = fmt; *p; p++ )
+    {
+        char spec[16];
+        size_t len;
+
+        if ( *p != '%' )
+        {
+            putchar(*p);
+            continue;
+        }
+
+        len = strspn(p + 1, "-+ #0123456789.lz") + 2;
+        if ( len >= sizeof(spec) )
+            break;
+        memcpy(spec, p, len);
+        spec[len] = '\0';
+
+        if ( p[len - 1] == 'p' && (p[len] == 'v' || p[len] == 'd') )
+        {
+            if ( p[len] == 'v' )
+            {
+                const struct vcpu *v = va_arg(args, const struct vcpu *);
+
+                printf("d%uv%u", v->domain->domain_id, v->vcpu_id);
+            }
+            else
+                printf("d%u", va_arg(args, const struct domain *)->domain_id);
+            p += len;
+            continue;
+        }
+
+        switch ( p[len - 1] )
+        {
+        case 's':
+            printf(spec, va_arg(args, const char *));
+            break;
+        case 'p':
+            printf(spec, va_arg(args, void *));
+            break;
+        case '%':
+            putchar('%');
+            break;
+        default:
+            if ( strchr(spec, 'l') )
+                printf(spec, va_arg(args, unsigned long));
+            else
+                printf(spec, va_arg(args, unsigned int));
+            break;
+        }
+        p += len - 1;
+    }
+
+    va_end(args);
+
+    if ( strstr(fmt, "lost") || strstr(fmt, "not linked") )
+        __atomic_fetch_add(&nr_lost_warnings, 1, __ATOMIC_RELAXED);
+}
+
+void evtchn_check_pollers(struct domain *d, unsigned int port)
+{
+}
+
+void vcpu_mark_events_pending(struct vcpu *v)
+{
+    if ( !__atomic_exchange_n(&v->upcall_pending, true, __ATOMIC_SEQ_CST) )
+        __atomic_fetch_add(&v->kicks, 1, __ATOMIC_RELAXED);
+}
+
+static uint32_t clear_linked(event_word_t *word)
+{
+    event_word_t new, old, w = read_atomic(word);
+
+    do {
+        old = w;
+        new = w & ~((1U << EVTCHN_FIFO_LINKED) | EVTCHN_FIFO_LINK_MASK);
+    } while ( (w = cmpxchg(word, old, new)) != old );
+
+    return w & EVTCHN_FIFO_LINK_MASK;
+}
+
+/* Handle the event at the head of a queue, as Linux' consume_one_event(). */
+static void consume_one(struct guest_vcpu *gv, unsigned int q,
+                        uint32_t *ready)
+{
+    uint32_t port = gv->head[q];
+    event_word_t *word;
+
+    if ( !port )
+        port = read_atomic(&gv->control_block->head[q]);
+
+    word = &event_array[port];
+    gv->head[q] = clear_linked(word);
+    if ( !gv->head[q] )
+        *ready &= ~(1U << q);
+
+    if ( guest_test_bit(&dom, EVTCHN_FIFO_PENDING, word) &&
+         !guest_test_bit(&dom, EVTCHN_FIFO_MASKED, word) )
+    {
+        /* Acknowledge, then look at what was sent. */
+        guest_clear_bit(&dom, EVTCHN_FIFO_PENDING, word);
+        handled[port] = read_atomic(&sent[port]);
+        __atomic_fetch_add(&nr_handled, 1, __ATOMIC_RELAXED);
+    }
+}
+
+static void *consumer(void *arg)
+{
+    struct guest_vcpu *gv = arg;
+
+    for ( ; ; )
+    {
+        uint32_t ready;
+
+        if ( !__atomic_exchange_n(&gv->v->upcall_pending, false,
+                                  __ATOMIC_SEQ_CST) )
+        {
+            if ( read_atomic(&stop_consumers) &&
+                 !read_atomic(&gv->v->upcall_pending) )
+                break;
+            sched_yield();
+            continue;
+        }
+
+        ready = __atomic_exchange_n(&gv->control_block->ready, 0,
+                                    __ATOMIC_SEQ_CST);
+        while ( ready )
+        {
+            consume_one(gv, __builtin_ctz(ready), &ready);
+            ready |= __atomic_exchange_n(&gv->control_block->ready, 0,
+                                         __ATOMIC_SEQ_CST);
+        }
+    }
+
+    return NULL;
+}
+
+static void *sender(void *arg)
+{
+    unsigned int seed = (uintptr_t)arg;
+    unsigned long i;
+
+    for ( i = 0; i < nr_sends; i++ )
+    {
+        evtchn_port_t port = 1 + rand_r(&seed) % nr_ports;
+        struct evtchn *chn = evtchn_from_port(&dom, port);
+
+        __atomic_fetch_add(&sent[port], 1, __ATOMIC_SEQ_CST);
+
+        pthread_rwlock_rdlock(&chn->lock);
+        dom.evtchn_port_ops->set_pending(dom.vcpu[chn->notify_vcpu_id], chn);
+        pthread_rwlock_unlock(&chn->lock);
+    }
+
+    return NULL;
+}
+
+/* Move ports between vCPUs and priorities, as guests may at any time. */
+static void *rebinder(void *arg)
+{
+    unsigned int seed = (uintptr_t)arg;
+
+    while ( !read_atomic(&stop_senders) )
+    {
+        struct evtchn *chn = evtchn_from_port(&dom,
+                                              1 + rand_r(&seed) % nr_ports);
+
+        pthread_rwlock_wrlock(&chn->lock);
+        if ( rand_r(&seed) & 1 )
+            chn->notify_vcpu_id = rand_r(&seed) % nr_vcpus;
+        else
+            dom.evtchn_port_ops->set_priority(&dom, chn, rand_r(&seed) %
+                                              (EVTCHN_FIFO_PRIORITY_MIN + 1));
+        pthread_rwlock_unlock(&chn->lock);
+
+        usleep(10);
+    }
+
+    return NULL;
+}
+
+static void *alloc_page(void)
+{
+    void *p = aligned_alloc(PAGE_SIZE, PAGE_SIZE);
+
+    if ( !p )
+    {
+        perror("aligned_alloc");
+        exit(1);
+    }
+    memset(p, 0, PAGE_SIZE);
+
+    return p;
+}
+
+static void setup(void)
+{
+    struct evtchn_expand_array expand = {};
+    unsigned int i;
+
+    dom.max_vcpus = nr_vcpus;
+    dom.vcpu = calloc(nr_vcpus, sizeof(*dom.vcpu));
+    guest_vcpus = calloc(nr_vcpus, sizeof(*guest_vcpus));
+    dom.nr_evtchns = nr_ports + 1;
+    dom.evtchn = calloc(dom.nr_evtchns, sizeof(*dom.evtchn));
+    sent = calloc(dom.nr_evtchns, sizeof(*sent));
+    handled = calloc(dom.nr_evtchns, sizeof(*handled));
+    if ( !dom.vcpu || !guest_vcpus || !dom.evtchn || !sent || !handled )
+    {
+        perror("calloc");
+        exit(1);
+    }
+
+    for ( i = 0; i < nr_vcpus; i++ )
+    {
+        struct vcpu *v = calloc(1, sizeof(*v));
+
+        if ( !v )
+        {
+            perror("calloc");
+            exit(1);
+        }
+        v->vcpu_id = i;
+        v->domain = &dom;
+        dom.vcpu[i] = v;
+        if ( i )
+            dom.vcpu[i - 1]->next_in_list = v;
+        guest_vcpus[i].v = v;
+    }
+
+    for ( i = 0; i < dom.nr_evtchns; i++ )
+    {
+        dom.evtchn[i].port = i;
+        dom.evtchn[i].notify_vcpu_id = i % nr_vcpus;
+        pthread_rwlock_init(&dom.evtchn[i].lock, NULL);
+    }
+
+    sim_current = dom.vcpu[0];
+
+    for ( i = 0; i < nr_vcpus; i++ )
+    {
+        struct evtchn_init_control init = { .vcpu = i };
+        int rc;
+
+        guest_vcpus[i].control_block = alloc_page();
+        init.control_gfn = (uintptr_t)guest_vcpus[i].control_block >>
+                           PAGE_SHIFT;
+        rc = evtchn_fifo_init_control(&init);
+        if ( rc )
+        {
+            fprintf(stderr, "init_control(%u): %d\n", i, rc);
+            exit(1);
+        }
+    }
+
+    event_array = alloc_page();
+    expand.array_gfn = (uintptr_t)event_array >> PAGE_SHIFT;
+    if ( evtchn_fifo_expand_array(&expand) )
+    {
+        fprintf(stderr, "expand_array failed\n");
+        exit(1);
+    }
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr,
+            "Usage: %s [options]\n"
+            "  -v N  vCPUs (default: 2)\n"
+            "  -p N  ports (default: 64, at most %lu)\n"
+            "  -s N  sender threads (default: 4)\n"
+            "  -n N  sends per sender (default: 1000000)\n",
+            prog, PAGE_SIZE / sizeof(event_word_t) - 1);
+    exit(1);
+}
+
+int main(int argc, char **argv)
+{
+    pthread_t *senders, *consumers, rebind;
+    unsigned int i, nr_stale = 0;
+    int c;
+
+    while ( (c = getopt(argc, argv, "v:p:s:n:h")) != -1 )
+    {
+        switch ( c )
+        {
+        case 'v': nr_vcpus = strtoul(optarg, NULL, 0); break;
+        case 'p': nr_ports = strtoul(optarg, NULL, 0); break;
+        case 's': nr_senders = strtoul(optarg, NULL, 0); break;
+        case 'n': nr_sends = strtoul(optarg, NULL, 0); break;
+        default: usage(argv[0]);
+        }
+    }
+
+    if ( !nr_vcpus || !nr_ports || !nr_senders ||
+         nr_ports >= PAGE_SIZE / sizeof(event_word_t) )
+        usage(argv[0]);
+
+    setup();
+
+    senders = calloc(nr_senders, sizeof(*senders));
+    consumers = calloc(nr_vcpus, sizeof(*consumers));
+    if ( !senders || !consumers )
+    {
+        perror("calloc");
+        return 1;
+    }
+
+    for ( i = 0; i < nr_vcpus; i++ )
+        pthread_create(&consumers[i], NULL, consumer, &guest_vcpus[i]);
+    pthread_create(&rebind, NULL, rebinder, (void *)(uintptr_t)nr_senders);
+    for ( i = 0; i < nr_senders; i++ )
+        pthread_create(&senders[i], NULL, sender, (void *)(uintptr_t)i);
+
+    for ( i = 0; i < nr_senders; i++ )
+        pthread_join(senders[i], NULL);
+    write_atomic(&stop_senders, true);
+    pthread_join(rebind, NULL);
+
+    write_atomic(&stop_consumers, true);
+    for ( i = 0; i < nr_vcpus; i++ )
+        pthread_join(consumers[i], NULL);
+
+    for ( i = 1; i <= nr_ports; i++ )
+        if ( handled[i] != sent[i] )
+        {
+            printf("port %u: last sent %lu, last handled %lu\n",
+                   i, sent[i], handled[i]);
+            nr_stale++;
+        }
+
+    printf("%lu sends, %lu handled, kicks:", nr_senders * nr_sends,
+           nr_handled);
+    for ( i = 0; i < nr_vcpus; i++ )
+        printf(" %lu", dom.vcpu[i]->kicks);
+    printf("\n");
+    evtchn_fifo_dump(&dom);
+
+    /* Events lost to too many queue changes are reported, and expected. */
+    if ( nr_stale > nr_lost_warnings )
+    {
+        printf("FAIL: %u ports with unhandled events\n", nr_stale);
+        return 1;
+    }
+
+    printf("PASS\n");
+
+    return 0;
+}
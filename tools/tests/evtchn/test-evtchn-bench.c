@@ -0,0 +1,252 @@
+/*
+ * Microbenchmark of event channel notifications: binds pairs of loopback
+ * interdomain channels in this domain, then times raising all of them
+ *  - through the event channel device, one ioctl per port,
+ *  - with one EVTCHNOP_send hypercall per port,
+ *  - with a single EVTCHNOP_send_multi hypercall.
+ * The hypercall modes are issued through the privcmd driver, so they don't
+ * depend on the kernel's event channel driver knowing about them.  Each mode
+ * is checked to have raised every channel.
+ */
+#include <err.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <poll.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <xencall.h>
+#include <xenevtchn.h>
+#include <xen-tools/common-macros.h>
+
+static unsigned int nr_failures;
+#define fail(fmt, ...)                          \
+({                                              \
+    nr_failures++;                              \
+    (void)printf(fmt, ##__VA_ARGS__);           \
+})
+
+enum mode {
+    MODE_NOTIFY,
+    MODE_SEND,
+    MODE_SEND_MULTI,
+};
+
+static const char *const mode_names[] = {
+    [MODE_NOTIFY]     = "notify",
+    [MODE_SEND]       = "send",
+    [MODE_SEND_MULTI] = "send_multi",
+};
+
+static xenevtchn_handle *xce;
+static xencall_handle *xcall;
+
+/* Local ports sent to, and the ports they raise. */
+static evtchn_port_t *lports, *rports;
+static unsigned int nr_ports;
+
+static struct evtchn_send *send_buf;
+static struct evtchn_send_multi *multi_buf;
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int raise_all(enum mode mode, unsigned int nr)
+{
+    unsigned int i;
+    int rc;
+
+    switch ( mode )
+    {
+    case MODE_NOTIFY:
+        for ( i = 0; i < nr; i++ )
+            if ( xenevtchn_notify(xce, lports[i]) )
+                return -1;
+        return 0;
+
+    case MODE_SEND:
+        for ( i = 0; i < nr; i++ )
+        {
+            send_buf->port = lports[i];
+            rc = xencall2(xcall, __HYPERVISOR_event_channel_op, EVTCHNOP_send,
+                          (uintptr_t)send_buf);
+            if ( rc )
+                return rc;
+        }
+        return 0;
+
+    case MODE_SEND_MULTI:
+        multi_buf->nr_ports = nr;
+        multi_buf->done = 0;
+        return xencall2(xcall, __HYPERVISOR_event_channel_op,
+                        EVTCHNOP_send_multi, (uintptr_t)multi_buf);
+    }
+
+    return -1;
+}
+
+/* Collect the pending ports, expecting all of the first nr to be raised. */
+static void drain(enum mode mode, unsigned int nr)
+{
+    bool *seen = calloc(nr_ports, sizeof(*seen));
+    struct pollfd pfd = { .fd = xenevtchn_fd(xce), .events = POLLIN };
+    unsigned int i, nr_seen = 0;
+
+    if ( !seen )
+        err(1, "calloc");
+
+    while ( poll(&pfd, 1, 100) > 0 )
+    {
+        xenevtchn_port_or_error_t port = xenevtchn_pending(xce);
+
+        if ( port < 0 )
+            break;
+
+        for ( i = 0; i < nr; i++ )
+            if ( rports[i] == port && !seen[i] )
+            {
+                seen[i] = true;
+                nr_seen++;
+            }
+
+        xenevtchn_unmask(xce, port);
+    }
+
+    if ( nr_seen != nr )
+        fail("  Fail: %s raised %u of %u ports\n", mode_names[mode],
+             nr_seen, nr);
+
+    free(seen);
+}
+
+static void bench(unsigned int nr, unsigned int iters)
+{
+    uint64_t ns[ARRAY_SIZE(mode_names)];
+    enum mode mode;
+    unsigned int i;
+
+    for ( mode = 0; mode < ARRAY_SIZE(mode_names); mode++ )
+    {
+        uint64_t t = now_ns();
+
+        for ( i = 0; i < iters; i++ )
+            if ( raise_all(mode, nr) )
+            {
+                fail("  Fail: %s of %u ports: %d - %s\n", mode_names[mode],
+                     nr, errno, strerror(errno));
+                return;
+            }
+
+        ns[mode] = now_ns() - t;
+        drain(mode, nr);
+    }
+
+    printf("  %6u", nr);
+    for ( mode = 0; mode < ARRAY_SIZE(mode_names); mode++ )
+        printf(" %14"PRIu64, ns[mode] / ((uint64_t)iters * nr));
+    printf("\n");
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr,
+            "Usage: %s [options]\n"
+            "  -d DOMID  id of this domain (default: 0)\n"
+            "  -n N      largest number of ports (default: 64)\n"
+            "  -i N      iterations per number of ports (default: 10000)\n",
+            prog);
+    exit(1);
+}
+
+int main(int argc, char **argv)
+{
+    uint32_t domid = 0;
+    unsigned int iters = 10000, nr, i;
+    enum mode mode;
+    int c;
+
+    nr_ports = 64;
+
+    while ( (c = getopt(argc, argv, "d:n:i:h")) != -1 )
+    {
+        switch ( c )
+        {
+        case 'd': domid = strtoul(optarg, NULL, 0); break;
+        case 'n': nr_ports = strtoul(optarg, NULL, 0); break;
+        case 'i': iters = strtoul(optarg, NULL, 0); break;
+        default: usage(argv[0]);
+        }
+    }
+
+    if ( !nr_ports || !iters )
+        usage(argv[0]);
+
+    xce = xenevtchn_open(NULL, 0);
+    if ( !xce )
+        err(1, "Failed to open event channel device");
+
+    xcall = xencall_open(NULL, 0);
+    if ( !xcall )
+        err(1, "Failed to open privcmd");
+
+    lports = calloc(nr_ports, sizeof(*lports));
+    rports = calloc(nr_ports, sizeof(*rports));
+    send_buf = xencall_alloc_buffer(xcall, sizeof(*send_buf));
+    multi_buf = xencall_alloc_buffer(xcall, sizeof(*multi_buf) +
+                                     nr_ports * sizeof(evtchn_port_t));
+    if ( !lports || !rports || !send_buf || !multi_buf )
+        err(1, "Failed to allocate buffers");
+
+    for ( i = 0; i < nr_ports; i++ )
+    {
+        xenevtchn_port_or_error_t port = xenevtchn_bind_unbound_port(xce,
+                                                                     domid);
+
+        if ( port < 0 )
+            err(1, "Failed to allocate a port for d%u", domid);
+        rports[i] = port;
+
+        port = xenevtchn_bind_interdomain(xce, domid, rports[i]);
+        if ( port < 0 )
+            err(1, "Failed to bind to d%u port %u", domid, rports[i]);
+        lports[i] = port;
+
+        multi_buf->ports[i] = lports[i];
+    }
+
+    printf("Event channel sends of d%u ports, %u iterations:\n", domid, iters);
+    printf("  %6s", "ports");
+    for ( mode = 0; mode < ARRAY_SIZE(mode_names); mode++ )
+        printf(" %14s", mode_names[mode]);
+    printf("  (ns/port)\n");
+
+    for ( nr = 1; nr <= nr_ports; nr *= 2 )
+        bench(nr, iters);
+    if ( (nr / 2) != nr_ports )
+        bench(nr_ports, iters);
+
+    for ( i = 0; i < nr_ports; i++ )
+    {
+        xenevtchn_unbind(xce, lports[i]);
+        xenevtchn_unbind(xce, rports[i]);
+    }
+
+    xencall_free_buffer(xcall, multi_buf);
+    xencall_free_buffer(xcall, send_buf);
+    xencall_close(xcall);
+    xenevtchn_close(xce);
+    free(rports);
+    free(lports);
+
+    return !!nr_failures;
+}
@@ -0,0 +1,208 @@
+/*
+ * Microbenchmark of grant mapping: shares pages of this domain with itself,
+ * then times mapping and unmapping them through the grant device, in
+ * batches of increasing sizes.  Each mapping of a batch is a single
+ * GNTTABOP_map_grant_ref (and GNTTABOP_unmap_grant_ref) hypercall of as many
+ * operations as the batch has pages.
+ *
+ * Then times GNTTABOP_copy of chunks of increasing sizes out of the shared
+ * pages, each hypercall copying a chunk from every page in turn, as a
+ * backend gathering small packets from a frontend's ring would.
+ */
+#include <err.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include <xengnttab.h>
+#include <xen-tools/common-macros.h>
+
+static unsigned int nr_failures;
+#define fail(fmt, ...)                          \
+({                                              \
+    nr_failures++;                              \
+    (void)printf(fmt, ##__VA_ARGS__);           \
+})
+
+#define XEN_PAGE_SIZE 4096
+
+static xengnttab_handle *gh;
+static xengntshr_handle *sh;
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void bench(uint32_t domid, uint32_t *refs, unsigned int batch,
+                  unsigned int iters)
+{
+    uint64_t map_ns = 0, unmap_ns = 0, t;
+    unsigned int i;
+
+    for ( i = 0; i < iters; i++ )
+    {
+        volatile uint32_t *p;
+
+        t = now_ns();
+        p = xengnttab_map_domain_grant_refs(gh, batch, domid, refs,
+                                            PROT_READ | PROT_WRITE);
+        map_ns += now_ns() - t;
+        if ( !p )
+            return fail("  Fail: map %u grants: %d - %s\n",
+                        batch, errno, strerror(errno));
+
+        if ( p[0] != refs[0] )
+            fail("  Fail: page of ref %u contains %u\n", refs[0], p[0]);
+
+        t = now_ns();
+        if ( xengnttab_unmap(gh, (void *)p, batch) )
+            return fail("  Fail: unmap %u grants: %d - %s\n",
+                        batch, errno, strerror(errno));
+        unmap_ns += now_ns() - t;
+    }
+
+    printf("  %6u %12"PRIu64" %14"PRIu64"\n", batch,
+           map_ns / ((uint64_t)iters * batch),
+           unmap_ns / ((uint64_t)iters * batch));
+}
+
+static void bench_copy(uint32_t domid, uint32_t *refs, unsigned int nr,
+                       uint16_t len, unsigned int iters)
+{
+    xengnttab_grant_copy_segment_t *segs;
+    uint8_t *buf;
+    uint64_t ns = 0, t;
+    unsigned int i, j;
+
+    segs = calloc(nr, sizeof(*segs));
+    buf = malloc((size_t)nr * len);
+    if ( !segs || !buf )
+        err(1, "malloc");
+
+    for ( j = 0; j < nr; j++ )
+    {
+        segs[j].source.foreign.ref = refs[j];
+        segs[j].source.foreign.offset = 0;
+        segs[j].source.foreign.domid = domid;
+        segs[j].dest.virt = buf + (size_t)j * len;
+        segs[j].len = len;
+        segs[j].flags = GNTCOPY_source_gref;
+    }
+
+    for ( i = 0; i < iters; i++ )
+    {
+        t = now_ns();
+        if ( xengnttab_grant_copy(gh, nr, segs) )
+        {
+            fail("  Fail: copy %u segments: %d - %s\n",
+                 nr, errno, strerror(errno));
+            goto out;
+        }
+        ns += now_ns() - t;
+
+        for ( j = 0; j < nr; j++ )
+            if ( segs[j].status != GNTST_okay )
+            {
+                fail("  Fail: copy from ref %u: status %d\n",
+                     refs[j], segs[j].status);
+                goto out;
+            }
+    }
+
+    if ( len >= sizeof(*refs) &&
+         memcmp(buf + (size_t)(nr - 1) * len, &refs[nr - 1], sizeof(*refs)) )
+        fail("  Fail: copy from ref %u got the wrong data\n", refs[nr - 1]);
+
+    printf("  %6u %12"PRIu64" %14"PRIu64"\n", len,
+           ns / ((uint64_t)iters * nr),
+           ns ? (uint64_t)iters * nr * 1000000000 / ns : 0);
+
+ out:
+    free(buf);
+    free(segs);
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr,
+            "Usage: %s [options]\n"
+            "  -d DOMID  id of this domain (default: 0)\n"
+            "  -n N      largest batch, in pages (default: 256)\n"
+            "  -i N      iterations per batch size (default: 1000)\n",
+            prog);
+    exit(1);
+}
+
+int main(int argc, char **argv)
+{
+    uint32_t domid = 0, *refs;
+    unsigned int max_batch = 256, iters = 1000, batch, len, i;
+    uint8_t *pages;
+    int c;
+
+    while ( (c = getopt(argc, argv, "d:n:i:h")) != -1 )
+    {
+        switch ( c )
+        {
+        case 'd': domid = strtoul(optarg, NULL, 0); break;
+        case 'n': max_batch = strtoul(optarg, NULL, 0); break;
+        case 'i': iters = strtoul(optarg, NULL, 0); break;
+        default: usage(argv[0]);
+        }
+    }
+
+    if ( !max_batch || !iters )
+        usage(argv[0]);
+
+    gh = xengnttab_open(NULL, 0);
+    sh = xengntshr_open(NULL, 0);
+    if ( !gh || !sh )
+        err(1, "Failed to open grant device");
+
+    if ( xengnttab_set_max_grants(gh, max_batch) )
+        err(1, "Failed to set the maximum number of grants");
+
+    refs = calloc(max_batch, sizeof(*refs));
+    if ( !refs )
+        err(1, "calloc");
+
+    pages = xengntshr_share_pages(sh, domid, max_batch, refs, 1);
+    if ( !pages )
+        err(1, "Failed to share %u pages with d%u", max_batch, domid);
+
+    /* Tag each page with its ref, to check what gets mapped. */
+    for ( i = 0; i < max_batch; i++ )
+        memcpy(pages + i * XEN_PAGE_SIZE, &refs[i], sizeof(refs[i]));
+
+    printf("Grant map/unmap of d%u pages, %u iterations:\n", domid, iters);
+    printf("  %6s %12s %14s\n", "batch", "map ns/page", "unmap ns/page");
+
+    for ( batch = 1; batch <= max_batch; batch *= 2 )
+        bench(domid, refs, batch, iters);
+    if ( (batch / 2) != max_batch )
+        bench(domid, refs, max_batch, iters);
+
+    printf("Grant copy of %u segments from d%u pages, %u iterations:\n",
+           max_batch, domid, iters);
+    printf("  %6s %12s %14s\n", "bytes", "ns/op", "ops/s");
+
+    for ( len = 64; len <= XEN_PAGE_SIZE; len *= 2 )
+        bench_copy(domid, refs, max_batch, len, iters);
+
+    xengntshr_unshare(sh, pages, max_batch);
+    xengntshr_close(sh);
+    xengnttab_close(gh);
+    free(refs);
+
+    return !!nr_failures;
+}
@@ -0,0 +1,321 @@
+/*
+ * Unit tests and microbenchmark of the rangeset code.
+ *
+ * Random additions and removals are checked against a bitmap of the same
+ * space.  Adding, looking up and removing ranges in sets of 10k to 100k
+ * ranges is then timed, at the scale of the I/O memory and ioreq server
+ * ranges of large passthrough setups, for the rbtree implementation and for
+ * the list one it replaced.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms and conditions of the GNU General Public
+ * License, version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program; If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "emul.h"
+
+#include <time.h>
+
+#define CHECK(cond, fmt, ...) ({                                        \
+    if ( !(cond) )                                                      \
+    {                                                                   \
+        fprintf(stderr, "%s:%d: check failed: " fmt "\n",               \
+                __FILE__, __LINE__, ## __VA_ARGS__);                    \
+        exit(1);                                                        \
+    }                                                                   \
+})
+
+/* Space the random operations work in, and its reference bitmap. */
+#define SPACE 4096
+static bool ref[SPACE];
+
+struct report {
+    unsigned long last_e;
+    bool any;
+};
+
+/* Check reported ranges are ascending, merged, and match the bitmap. */
+static int cf_check check_range(unsigned long s, unsigned long e, void *data)
+{
+    struct report *rep = data;
+    unsigned long i;
+
+    CHECK(s <= e, "range %lu-%lu", s, e);
+    CHECK(!rep->any || rep->last_e + 1 < s,
+          "range %lu-%lu after one ending at %lu", s, e, rep->last_e);
+    for ( i = s; i <= e; i++ )
+        CHECK(ref[i], "%lu in range %lu-%lu but not set", i, s, e);
+
+    rep->last_e = e;
+    rep->any = true;
+
+    return 0;
+}
+
+static void check_set(struct rangeset *r)
+{
+    struct report rep = {};
+    unsigned long i, nr = 0;
+
+    rangeset_report_ranges(r, 0, ~0UL, check_range, &rep);
+
+    for ( i = 0; i < SPACE; i++ )
+    {
+        CHECK(rangeset_contains_singleton(r, i) == ref[i],
+              "contains(%lu) %d", i, !ref[i]);
+        nr += ref[i];
+    }
+
+    CHECK(rangeset_is_empty(r) == !nr, "empty with %lu set", nr);
+}
+
+static void test_random(void)
+{
+    struct rangeset *r = rangeset_new(NULL, "random", 0);
+    unsigned int iter;
+
+    CHECK(r, "rangeset_new");
+
+    srand(1);
+    for ( iter = 0; iter < 20000; iter++ )
+    {
+        unsigned long s = rand() % SPACE;
+        unsigned long e = s + rand() % (iter & 1 ? 16 : 256);
+        bool add = rand() % 3;
+        unsigned long i;
+        bool any = false, all = true;
+
+        if ( e >= SPACE )
+            e = SPACE - 1;
+
+        for ( i = s; i <= e; i++ )
+        {
+            any |= ref[i];
+            all &= ref[i];
+        }
+        CHECK(rangeset_overlaps_range(r, s, e) == any,
+              "overlaps(%lu, %lu)", s, e);
+        CHECK(rangeset_contains_range(r, s, e) == all,
+              "contains(%lu, %lu)", s, e);
+
+        if ( add )
+            CHECK(!rangeset_add_range(r, s, e), "add(%lu, %lu)", s, e);
+        else
+            CHECK(!rangeset_remove_range(r, s, e), "remove(%lu, %lu)", s, e);
+        for ( i = s; i <= e; i++ )
+            ref[i] = add;
+
+        if ( !(iter % 256) )
+            check_set(r);
+    }
+    check_set(r);
+
+    rangeset_purge(r);
+    memset(ref, 0, sizeof(ref));
+    check_set(r);
+
+    rangeset_destroy(r);
+}
+
+static int cf_check consume(unsigned long s, unsigned long e, void *data,
+                            unsigned long *c)
+{
+    unsigned long *total = data;
+
+    *c = 1;
+    *total += 1;
+
+    return 0;
+}
+
+static void test_misc(void)
+{
+    struct rangeset *a = rangeset_new(NULL, "a", 0);
+    struct rangeset *b = rangeset_new(NULL, "b", 0);
+    unsigned long s, total = 0;
+
+    CHECK(a && b, "rangeset_new");
+
+    /* A limit on the number of ranges, which merges don't count against. */
+    rangeset_limit(a, 2);
+    CHECK(!rangeset_add_range(a, 10, 19), "add");
+    CHECK(!rangeset_add_range(a, 30, 39), "add");
+    CHECK(rangeset_add_range(a, 50, 59) == -ENOMEM, "add over the limit");
+    CHECK(!rangeset_add_range(a, 20, 29), "merging add");
+    CHECK(!rangeset_add_range(a, 50, 59), "add");
+    CHECK(rangeset_contains_range(a, 10, 39), "merged range");
+
+    /* Claims go in the lowest hole large enough. */
+    CHECK(!rangeset_add_range(b, 0, 9), "add");
+    CHECK(!rangeset_add_range(b, 15, 99), "add");
+    CHECK(!rangeset_claim_range(b, 5, &s) && s == 10, "claim at %lu", s);
+    CHECK(!rangeset_claim_range(b, 5, &s) && s == 100, "claim at %lu", s);
+    CHECK(rangeset_contains_range(b, 0, 14) &&
+          rangeset_contains_range(b, 15, 104), "claimed ranges");
+
+    rangeset_swap(a, b);
+    CHECK(rangeset_contains_range(a, 15, 104) &&
+          rangeset_contains_range(b, 10, 39) &&
+          !rangeset_overlaps_range(b, 40, 49), "swap");
+
+    CHECK(!rangeset_merge(b, a), "merge");
+    CHECK(rangeset_contains_range(b, 0, 104) &&
+          !rangeset_overlaps_range(b, 105, 109), "merge");
+
+    CHECK(!rangeset_consume_ranges(b, consume, &total) && total == 105 &&
+          rangeset_is_empty(b), "consumed %lu", total);
+
+    rangeset_destroy(a);
+    rangeset_destroy(b);
+}
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/*
+ * The operations timed, for both implementations.  Going through pointers
+ * costs the same to each.
+ */
+struct bench_ops {
+    const char *name;
+    void *(*new)(void);
+    int (*add)(void *r, unsigned long s);
+    bool (*contains)(void *r, unsigned long s);
+    int (*remove)(void *r, unsigned long s);
+    void (*destroy)(void *r);
+};
+
+#define BENCH_OPS(rs)                                                   \
+static void *bench_ ## rs ## _new(void)                                 \
+{                                                                       \
+    return rs ## _new(NULL, "bench", 0);                                \
+}                                                                       \
+static int bench_ ## rs ## _add(void *r, unsigned long s)               \
+{                                                                       \
+    return rs ## _add_singleton(r, s);                                  \
+}                                                                       \
+static bool bench_ ## rs ## _contains(void *r, unsigned long s)         \
+{                                                                       \
+    return rs ## _contains_singleton(r, s);                             \
+}                                                                       \
+static int bench_ ## rs ## _remove(void *r, unsigned long s)            \
+{                                                                       \
+    return rs ## _remove_singleton(r, s);                               \
+}                                                                       \
+static void bench_ ## rs ## _destroy(void *r)                           \
+{                                                                       \
+    rs ## _destroy(r);                                                  \
+}                                                                       \
+static const struct bench_ops bench_ ## rs = {                          \
+    .name = #rs,                                                        \
+    .new = bench_ ## rs ## _new,                                        \
+    .add = bench_ ## rs ## _add,                                        \
+    .contains = bench_ ## rs ## _contains,                              \
+    .remove = bench_ ## rs ## _remove,                                  \
+    .destroy = bench_ ## rs ## _destroy,                                \
+}
+
+BENCH_OPS(rangeset);
+BENCH_OPS(list_rangeset);
+
+/*
+ * Operations timed on a set of nr ranges.  The list takes time linear in
+ * the size of the set per operation, so only a sample is timed.
+ */
+#define BENCH_OPS_NR 1000
+
+struct bench_result {
+    unsigned long add_ns, contains_ns, remove_ns;
+};
+
+/*
+ * Fill a set with nr ranges spaced by 4, then time adding ranges in the
+ * gaps, looking them up and removing them again, in random order.
+ */
+static void bench(const struct bench_ops *ops, unsigned long nr,
+                  struct bench_result *res)
+{
+    void *r = ops->new();
+    unsigned long order[BENCH_OPS_NR], i;
+    uint64_t t;
+
+    CHECK(r, "%s: allocation", ops->name);
+
+    /* Descending, so that the list finds the place of each at its head. */
+    for ( i = nr; i-- > 0; )
+        CHECK(!ops->add(r, i * 4), "%s: fill", ops->name);
+
+    srand(nr);
+    for ( i = 0; i < BENCH_OPS_NR; i++ )
+        order[i] = (rand() % nr) * 4 + 2;
+
+    t = now_ns();
+    for ( i = 0; i < BENCH_OPS_NR; i++ )
+        CHECK(!ops->add(r, order[i]), "%s: add", ops->name);
+    res->add_ns = (now_ns() - t) / BENCH_OPS_NR;
+
+    t = now_ns();
+    for ( i = 0; i < BENCH_OPS_NR; i++ )
+        CHECK(ops->contains(r, order[BENCH_OPS_NR - 1 - i]),
+              "%s: contains", ops->name);
+    res->contains_ns = (now_ns() - t) / BENCH_OPS_NR;
+
+    t = now_ns();
+    for ( i = 0; i < BENCH_OPS_NR; i++ )
+        CHECK(!ops->remove(r, order[i]), "%s: remove", ops->name);
+    res->remove_ns = (now_ns() - t) / BENCH_OPS_NR;
+
+    for ( i = 0; i < BENCH_OPS_NR; i++ )
+        CHECK(ops->contains(r, order[i] - 2) && !ops->contains(r, order[i]),
+              "%s: contents after removal", ops->name);
+
+    ops->destroy(r);
+}
+
+int main(int argc, char **argv)
+{
+    static const unsigned long sizes[] = { 10000, 20000, 50000, 100000 };
+    unsigned int i;
+
+    test_random();
+    test_misc();
+
+    printf("Rangeset operations, ns/op, list / rbtree:\n");
+    printf("  %7s %17s %17s %17s\n", "ranges", "add", "contains", "remove");
+    for ( i = 0; i < ARRAY_SIZE(sizes); i++ )
+    {
+        struct bench_result list, tree;
+
+        bench(&bench_list_rangeset, sizes[i], &list);
+        bench(&bench_rangeset, sizes[i], &tree);
+
+        printf("  %7lu %8lu / %6lu %8lu / %6lu %8lu / %6lu\n", sizes[i],
+               list.add_ns, tree.add_ns, list.contains_ns, tree.contains_ns,
+               list.remove_ns, tree.remove_ns);
+    }
+
+    return 0;
+}
+
+/*
+ * Local variables:
+ * mode: C
+ * c-file-style: "BSD"
+ * c-basic-offset: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -0,0 +1,710 @@
+/*
+ * Userspace emulation of the hypervisor environment the schedulers in
+ * xen/common/sched/ are built against.
+ *
+ * Everything runs in a single thread: locks are no-ops, "now" is the
+ * simulated time and the current pCPU is whichever the simulator is
+ * scheduling on.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms and conditions of the GNU General Public
+ * License, version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program; If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _TEST_SCHED_EMUL_
+#define _TEST_SCHED_EMUL_
+
+#include <assert.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <xen-tools/common-macros.h>
+
+#ifndef __XEN_TOOLS__
+#define __XEN_TOOLS__
+#endif
+#include <xen/xen.h>
+#include <xen/domctl.h>
+#include <xen/sysctl.h>
+#include <xen/trace.h>
+
+/* Compiler and section annotations. */
+#define __init
+#define __initdata
+#define __read_mostly
+#define __ro_after_init
+#define __used_section(s) __attribute__((__used__))
+#define __must_check __attribute__((__warn_unused_result__))
+#define always_inline inline __attribute__((__always_inline__))
+#define noinline __attribute__((__noinline__))
+#define cf_check
+#define fallthrough __attribute__((__fallthrough__))
+#define unlikely(x) __builtin_expect(!!(x), 0)
+#define likely(x) __builtin_expect(!!(x), 1)
+#define prefetch(x) __builtin_prefetch(x)
+#define smp_wmb()
+#define smp_mb()
+#define barrier() asm volatile ( "" ::: "memory" )
+#define block_lock_speculation()
+#define ACCESS_ONCE(x) (*(volatile typeof(x) *)&(x))
+#define read_atomic(p) ACCESS_ONCE(*(p))
+#define write_atomic(p, v) (ACCESS_ONCE(*(p)) = (v))
+
+#define ASSERT(x) assert(x)
+#define ASSERT_UNREACHABLE() assert(0)
+#define BUG() abort()
+#define BUG_ON(x) assert(!(x))
+#define WARN_ON(x) ({ bool w_ = (x); if ( w_ ) \
+    fprintf(stderr, "WARN_ON(%s) at %s:%d\n", #x, __FILE__, __LINE__); w_; })
+#define WARN() WARN_ON(true)
+#undef BUILD_BUG_ON
+#define BUILD_BUG_ON(c) ((void)sizeof(char[1 - 2 * !!(c)]))
+
+#define count_args_(dot, a1, a2, a3, a4, a5, a6, a7, a8, x, ...) x
+#define count_args(args...) \
+    count_args_(., ## args, 8, 7, 6, 5, 4, 3, 2, 1, 0)
+
+/* Divide n in place, returning the remainder. */
+#define do_div(n, base) ({                      \
+    uint32_t b_ = (base), r_ = (n) % b_;        \
+    (n) /= b_;                                  \
+    r_;                                         \
+})
+
+#define BITS_PER_LONG (sizeof(long) * 8)
+#define BITS_TO_LONGS(bits) (((bits) + BITS_PER_LONG - 1) / BITS_PER_LONG)
+
+/* Messages of the schedulers go to stderr, if the simulator is verbose. */
+void sim_printk(const char *fmt, ...)
+    __attribute__((__format__(__printf__, 1, 2)));
+#define printk(fmt, args...) sim_printk(fmt, ## args)
+#define dprintk(lvl, fmt, args...) sim_printk(fmt, ## args)
+#define gdprintk(lvl, fmt, args...) sim_printk(fmt, ## args)
+#define XENLOG_INFO    ""
+#define XENLOG_WARNING ""
+#define XENLOG_ERR     ""
+#define XENLOG_DEBUG   ""
+#define XENLOG_G_INFO  ""
+#define XENLOG_G_WARNING ""
+#define XENLOG_G_ERR   ""
+#define XENLOG_G_DEBUG ""
+
+#define PRI_stime PRId64
+
+/*
+ * Command line parameters: the integer, boolean and custom ones can be set
+ * with the -o option of the simulator, which finds them in a section.
+ */
+struct sim_param {
+    const char *name;
+    int (*parse)(const char *s);
+    void *var;
+    unsigned int size;
+};
+#define SIM_PARAM(sym, _name, _parse, _var, _size)                      \
+    static const struct sim_param sim_param_##sym = {                   \
+        .name = _name, .parse = _parse, .var = _var, .size = _size,     \
+    };                                                                  \
+    static const struct sim_param *const sim_param_ptr_##sym            \
+        __attribute__((__used__, __section__("sim_params"))) =          \
+        &sim_param_##sym
+#define integer_param(name, var) \
+    SIM_PARAM(var, name, NULL, &(var), sizeof(var))
+#define boolean_param(name, var) \
+    SIM_PARAM(var, name, NULL, &(var), sizeof(var))
+#define custom_param(name, fn) SIM_PARAM(fn, name, fn, NULL, 0)
+#define string_param(name, var)
+#define size_param(name, var)
+
+/* Memory allocation. */
+#define xmalloc(type) ((type *)malloc(sizeof(type)))
+#define xzalloc(type) ((type *)calloc(1, sizeof(type)))
+#define xmalloc_array(type, nr) ((type *)malloc(sizeof(type) * (nr)))
+#define xzalloc_array(type, nr) ((type *)calloc(nr, sizeof(type)))
+#define xvzalloc(type) xzalloc(type)
+#define xfree(p) free(p)
+#define XFREE(p) do { free(p); (p) = NULL; } while ( 0 )
+
+#define ERR_PTR(err) ((void *)(long)(err))
+#define PTR_ERR(p) ((long)(p))
+#define IS_ERR(p) ((unsigned long)(p) >= (unsigned long)-4095)
+
+/*
+ * Bit operations, on 32-bit words as on x86: some schedulers keep their
+ * flags in an unsigned int.
+ */
+#define BIT_WORD(nr) ((nr) / 32)
+#define BIT_MASK(nr) (1U << ((nr) % 32))
+
+static inline void set_bit(unsigned int nr, volatile void *addr)
+{
+    ((unsigned int *)addr)[BIT_WORD(nr)] |= BIT_MASK(nr);
+}
+
+static inline void clear_bit(unsigned int nr, volatile void *addr)
+{
+    ((unsigned int *)addr)[BIT_WORD(nr)] &= ~BIT_MASK(nr);
+}
+
+static inline bool test_bit(unsigned int nr, const volatile void *addr)
+{
+    return ((const unsigned int *)addr)[BIT_WORD(nr)] & BIT_MASK(nr);
+}
+
+static inline bool test_and_set_bit(unsigned int nr, volatile void *addr)
+{
+    bool old = test_bit(nr, addr);
+
+    set_bit(nr, addr);
+    return old;
+}
+
+static inline bool test_and_clear_bit(unsigned int nr, volatile void *addr)
+{
+    bool old = test_bit(nr, addr);
+
+    clear_bit(nr, addr);
+    return old;
+}
+
+#define __set_bit set_bit
+#define __clear_bit clear_bit
+#define __test_and_set_bit test_and_set_bit
+#define __test_and_clear_bit test_and_clear_bit
+
+/* CPU masks. */
+#define NR_CPUS 256
+
+typedef struct cpumask {
+    unsigned long bits[BITS_TO_LONGS(NR_CPUS)];
+} cpumask_t;
+typedef cpumask_t cpumask_var_t[1];
+
+extern unsigned int nr_cpu_ids;
+extern cpumask_t cpu_online_map;
+
+#define nr_cpumask_bits nr_cpu_ids
+#define cpumask_bits(m) ((m)->bits)
+
+static inline void cpumask_set_cpu(unsigned int cpu, cpumask_t *m)
+{
+    set_bit(cpu, m->bits);
+}
+
+static inline void cpumask_clear_cpu(unsigned int cpu, cpumask_t *m)
+{
+    clear_bit(cpu, m->bits);
+}
+
+#define __cpumask_set_cpu cpumask_set_cpu
+#define __cpumask_clear_cpu cpumask_clear_cpu
+#define __cpumask_test_and_clear_cpu cpumask_test_and_clear_cpu
+
+static inline bool cpumask_test_cpu(unsigned int cpu, const cpumask_t *m)
+{
+    return test_bit(cpu, m->bits);
+}
+
+static inline bool cpumask_test_and_set_cpu(unsigned int cpu, cpumask_t *m)
+{
+    return test_and_set_bit(cpu, m->bits);
+}
+
+static inline bool cpumask_test_and_clear_cpu(unsigned int cpu, cpumask_t *m)
+{
+    return test_and_clear_bit(cpu, m->bits);
+}
+
+#define CPUMASK_OP(name, expr)                                          \
+static inline void cpumask_##name(cpumask_t *d, const cpumask_t *a,     \
+                                  const cpumask_t *b)                   \
+{                                                                       \
+    unsigned int i;                                                     \
+                                                                        \
+    for ( i = 0; i < ARRAY_SIZE(d->bits); i++ )                         \
+        d->bits[i] = (expr);                                            \
+}
+CPUMASK_OP(and, a->bits[i] & b->bits[i])
+CPUMASK_OP(or, a->bits[i] | b->bits[i])
+CPUMASK_OP(xor, a->bits[i] ^ b->bits[i])
+CPUMASK_OP(andnot, a->bits[i] & ~b->bits[i])
+#undef CPUMASK_OP
+
+static inline void cpumask_clear(cpumask_t *m)
+{
+    memset(m, 0, sizeof(*m));
+}
+
+static inline void cpumask_setall(cpumask_t *m)
+{
+    unsigned int cpu;
+
+    cpumask_clear(m);
+    for ( cpu = 0; cpu < nr_cpu_ids; cpu++ )
+        cpumask_set_cpu(cpu, m);
+}
+
+static inline void cpumask_copy(cpumask_t *d, const cpumask_t *s)
+{
+    *d = *s;
+}
+
+static inline void cpumask_complement(cpumask_t *d, const cpumask_t *s)
+{
+    unsigned int cpu;
+
+    cpumask_clear(d);
+    for ( cpu = 0; cpu < nr_cpu_ids; cpu++ )
+        if ( !cpumask_test_cpu(cpu, s) )
+            cpumask_set_cpu(cpu, d);
+}
+
+static inline unsigned int cpumask_next(int n, const cpumask_t *m)
+{
+    unsigned int cpu;
+
+    for ( cpu = n + 1; cpu < nr_cpu_ids; cpu++ )
+        if ( cpumask_test_cpu(cpu, m) )
+            return cpu;
+
+    return nr_cpu_ids;
+}
+
+static inline unsigned int cpumask_first(const cpumask_t *m)
+{
+    return cpumask_next(-1, m);
+}
+
+static inline unsigned int cpumask_last(const cpumask_t *m)
+{
+    unsigned int cpu, last = nr_cpu_ids;
+
+    for ( cpu = 0; cpu < nr_cpu_ids; cpu++ )
+        if ( cpumask_test_cpu(cpu, m) )
+            last = cpu;
+
+    return last;
+}
+
+static inline unsigned int cpumask_cycle(int n, const cpumask_t *m)
+{
+    unsigned int nxt = cpumask_next(n, m);
+
+    if ( nxt == nr_cpu_ids )
+        nxt = cpumask_first(m);
+
+    return nxt;
+}
+
+static inline unsigned int cpumask_weight(const cpumask_t *m)
+{
+    unsigned int i, w = 0;
+
+    for ( i = 0; i < ARRAY_SIZE(m->bits); i++ )
+        w += __builtin_popcountl(m->bits[i]);
+
+    return w;
+}
+
+static inline bool cpumask_empty(const cpumask_t *m)
+{
+    return !cpumask_weight(m);
+}
+
+static inline bool cpumask_equal(const cpumask_t *a, const cpumask_t *b)
+{
+    return !memcmp(a, b, sizeof(*a));
+}
+
+static inline bool cpumask_intersects(const cpumask_t *a, const cpumask_t *b)
+{
+    unsigned int i;
+
+    for ( i = 0; i < ARRAY_SIZE(a->bits); i++ )
+        if ( a->bits[i] & b->bits[i] )
+            return true;
+
+    return false;
+}
+
+static inline bool cpumask_subset(const cpumask_t *a, const cpumask_t *b)
+{
+    unsigned int i;
+
+    for ( i = 0; i < ARRAY_SIZE(a->bits); i++ )
+        if ( a->bits[i] & ~b->bits[i] )
+            return false;
+
+    return true;
+}
+
+static inline unsigned int cpumask_test_or_cycle(int n, const cpumask_t *m)
+{
+    if ( cpumask_test_cpu(n, m) )
+        return n;
+
+    return cpumask_cycle(n, m);
+}
+
+/* Xen picks a random CPU; the simulator wants to be reproducible. */
+static inline unsigned int cpumask_any(const cpumask_t *m)
+{
+    return cpumask_first(m);
+}
+
+extern cpumask_t sim_cpumask_of[NR_CPUS];
+#define cpumask_of(cpu) (&sim_cpumask_of[cpu])
+
+#define for_each_cpu(cpu, m)                    \
+    for ( (cpu) = cpumask_first(m);             \
+          (cpu) < nr_cpu_ids;                   \
+          (cpu) = cpumask_next(cpu, m) )
+
+#define cpu_online(cpu) cpumask_test_cpu(cpu, &cpu_online_map)
+#define num_online_cpus() cpumask_weight(&cpu_online_map)
+#define for_each_online_cpu(cpu) for_each_cpu(cpu, &cpu_online_map)
+
+static inline bool alloc_cpumask_var(cpumask_var_t *m)
+{
+    return true;
+}
+
+static inline bool zalloc_cpumask_var(cpumask_var_t *m)
+{
+    cpumask_clear(*m);
+    return true;
+}
+
+static inline void free_cpumask_var(cpumask_var_t m)
+{
+}
+
+/* Per-CPU data. */
+extern unsigned int sim_cpu;
+
+#define DECLARE_PER_CPU(type, name) extern __typeof__(type) per_cpu__##name[NR_CPUS]
+#define DEFINE_PER_CPU(type, name) __typeof__(type) per_cpu__##name[NR_CPUS]
+#define per_cpu(name, cpu) (per_cpu__##name[cpu])
+#define this_cpu(name) per_cpu(name, sim_cpu)
+#define smp_processor_id() sim_cpu
+
+/* Topology: sim_cpu_{core,socket,node} are filled in by the simulator. */
+extern unsigned int sim_cpu_core[NR_CPUS], sim_cpu_socket[NR_CPUS];
+extern unsigned int sim_cpu_node[NR_CPUS];
+DECLARE_PER_CPU(cpumask_var_t, cpu_sibling_mask);
+DECLARE_PER_CPU(cpumask_var_t, cpu_core_mask);
+
+#define cpu_to_core(cpu) sim_cpu_core[cpu]
+#define cpu_to_socket(cpu) sim_cpu_socket[cpu]
+#define cpu_to_node(cpu) sim_cpu_node[cpu]
+#define cpu_data_socket(cpu) sim_cpu_socket[cpu]
+
+/* NUMA nodes: sim_node_to_cpumask is filled in by the simulator. */
+#define MAX_NUMNODES 64
+
+typedef struct { unsigned long bits; } nodemask_t;
+
+extern nodemask_t node_online_map;
+extern cpumask_t sim_node_to_cpumask[MAX_NUMNODES];
+
+#define node_to_cpumask(node) (sim_node_to_cpumask[node])
+
+typedef uint8_t nodeid_t;
+#define NUMA_NO_NODE 0xFF
+#define NUMA_NO_DISTANCE 0xFF
+
+static inline bool nodemask_test(unsigned int node, const nodemask_t *m)
+{
+    return m->bits & (1UL << node);
+}
+
+#define for_each_node_mask(node, mask)                                    \
+    for ( (node) = 0; (node) < MAX_NUMNODES; (node)++ )                   \
+        if ( nodemask_test(node, &(mask)) )
+
+/* Two hops between all nodes, as on a machine without a SLIT. */
+#define __node_distance(a, b) ((a) == (b) ? 10 : 20)
+
+static inline unsigned int sim_cycle_node(unsigned int node, nodemask_t m)
+{
+    unsigned int i;
+
+    for ( i = 1; i <= MAX_NUMNODES; i++ )
+        if ( m.bits & (1UL << ((node + i) % MAX_NUMNODES)) )
+            return (node + i) % MAX_NUMNODES;
+
+    return MAX_NUMNODES;
+}
+#define cycle_node(node, m) sim_cycle_node(node, m)
+
+static inline unsigned int cpu_nr_siblings(unsigned int cpu)
+{
+    return cpumask_weight(per_cpu(cpu_sibling_mask, cpu));
+}
+
+/* Locks. */
+typedef struct { int held; } spinlock_t;
+typedef struct { int held; } rwlock_t;
+
+#define DEFINE_SPINLOCK(l) spinlock_t l
+#define spin_lock_init(l) ((l)->held = 0)
+#define spin_lock(l) ((void)(l))
+#define spin_unlock(l) ((void)(l))
+#define spin_trylock(l) ((void)(l), true)
+#define spin_lock_irq(l) ((void)(l))
+#define spin_unlock_irq(l) ((void)(l))
+#define spin_lock_irqsave(l, f) ((void)(l), (f) = 0)
+#define spin_unlock_irqrestore(l, f) ((void)(l), (void)(f))
+#define _spin_lock(l) ((void)(l))
+#define _spin_lock_irq(l) ((void)(l))
+#define _spin_lock_irqsave(l) ((void)(l), 0UL)
+#define spin_is_locked(l) ((void)(l), true)
+#define rwlock_init(l) ((l)->held = 0)
+#define read_lock(l) ((void)(l))
+#define read_trylock(l) ((void)(l), true)
+#define read_unlock(l) ((void)(l))
+#define write_lock(l) ((void)(l))
+#define write_unlock(l) ((void)(l))
+#define read_lock_irqsave(l, f) ((void)(l), (f) = 0)
+#define read_unlock_irqrestore(l, f) ((void)(l), (void)(f))
+#define write_lock_irqsave(l, f) ((void)(l), (f) = 0)
+#define write_unlock_irqrestore(l, f) ((void)(l), (void)(f))
+#define rw_is_locked(l) ((void)(l), true)
+#define rw_is_write_locked(l) ((void)(l), true)
+#define local_irq_is_enabled() false
+
+typedef struct { int counter; } atomic_t;
+#define atomic_read(a) ((a)->counter)
+#define atomic_set(a, v) ((a)->counter = (v))
+#define atomic_inc(a) ((a)->counter++)
+#define atomic_dec(a) ((a)->counter--)
+#define atomic_add(i, a) ((a)->counter += (i))
+#define atomic_sub(i, a) ((a)->counter -= (i))
+
+typedef struct { int dummy; } rcu_read_lock_t;
+#define rcu_dereference(p) (p)
+#define rcu_assign_pointer(p, v) ((p) = (v))
+#define rcu_read_lock(l) ((void)(l))
+#define rcu_read_unlock(l) ((void)(l))
+struct rcu_head { int dummy; };
+
+/* Time. */
+typedef int64_t s_time_t;
+#define STIME_MAX ((s_time_t)((uint64_t)~0ULL >> 1))
+#define SECONDS(s) ((s_time_t)((s) * 1000000000ULL))
+#define MILLISECS(ms) ((s_time_t)((ms) * 1000000ULL))
+#define MICROSECS(us) ((s_time_t)((us) * 1000ULL))
+
+extern s_time_t sim_now;
+#define NOW() sim_now
+
+/* Timers are fired by the simulator's event loop. */
+#define STIME_DELTA_MAX ((s_time_t)((uint64_t)~0ULL >> 2))
+
+struct timer {
+    s_time_t expires;
+    void (*function)(void *data);
+    void *data;
+    unsigned int cpu;
+#define TIMER_STATUS_invalid  0
+#define TIMER_STATUS_inactive 1
+#define TIMER_STATUS_killed   2
+#define TIMER_STATUS_in_heap  3
+    unsigned int status;
+};
+
+void init_timer(struct timer *timer, void (*function)(void *data),
+                void *data, unsigned int cpu);
+void set_timer(struct timer *timer, s_time_t expires);
+void stop_timer(struct timer *timer);
+void migrate_timer(struct timer *timer, unsigned int new_cpu);
+void kill_timer(struct timer *timer);
+
+static inline bool timer_is_active(const struct timer *timer)
+{
+    return timer->status == TIMER_STATUS_in_heap;
+}
+
+/* Softirqs: a SCHEDULE_SOFTIRQ makes the simulator reschedule the pCPU. */
+#define SCHEDULE_SOFTIRQ 0
+void cpu_raise_softirq(unsigned int cpu, unsigned int nr);
+void cpumask_raise_softirq(const cpumask_t *mask, unsigned int nr);
+
+/* Tracing and statistics are off. */
+#define tb_init_done false
+#define trace_time(ev, size, data) ((void)(ev), (void)(size), (void)(data))
+#define TRACE_TIME(ev, args...) ((void)(ev))
+#define SCHED_STAT_CRANK(x) ((void)0)
+#define perfc_incr(x) ((void)0)
+
+/* Keyhandler output helpers. */
+#define CPUMASK_PR(m) nr_cpu_ids, cpumask_bits(m)
+
+/* Runstates, pause flags and the rest of the vCPU state. */
+#define RUNSTATE_running  0
+#define RUNSTATE_runnable 1
+#define RUNSTATE_blocked  2
+#define RUNSTATE_offline  3
+
+#define _VPF_blocked 0
+#define VPF_blocked  (1UL << _VPF_blocked)
+#define _VPF_down    1
+#define VPF_down     (1UL << _VPF_down)
+#define _VPF_parked  2
+#define VPF_parked   (1UL << _VPF_parked)
+
+#define _VPF_migrating 3
+#define VPF_migrating  (1UL << _VPF_migrating)
+
+/* SMT is never turned off to save power here. */
+#define sched_smt_power_savings false
+
+struct sched_unit;
+
+struct vcpu {
+    int vcpu_id;
+    unsigned int processor;
+    unsigned long pause_flags;
+    bool is_running;
+    int new_state;
+    struct {
+        int state;
+        s_time_t state_entry_time;
+    } runstate;
+    struct vcpu *next_in_list;
+    struct sched_unit *sched_unit;
+    struct domain *domain;
+};
+
+struct sched_unit {
+    struct domain *domain;
+    struct vcpu *vcpu_list;
+    void *priv;
+    struct sched_unit *next_in_list;
+    struct sched_resource *res;
+    unsigned int unit_id;
+
+    bool is_running;
+    bool soft_aff_effective;
+    bool migrated;
+
+    uint64_t state_entry_time;
+    unsigned int runstate_cnt[4];
+
+    cpumask_var_t cpu_hard_affinity;
+    cpumask_var_t cpu_hard_affinity_saved;
+    cpumask_var_t cpu_soft_affinity;
+
+    struct sched_unit *next_task;
+    s_time_t next_time;
+};
+
+struct domain {
+    domid_t domain_id;
+    xen_domain_handle_t handle;
+    unsigned int max_vcpus;
+    struct vcpu **vcpu;
+    struct sched_unit *sched_unit_list;
+    void *sched_priv;
+    struct cpupool *cpupool;
+    nodemask_t node_affinity;
+    struct domain *next_in_list;
+};
+
+#define for_each_sched_unit(d, u)                                         \
+    for ( (u) = (d)->sched_unit_list; (u) != NULL; (u) = (u)->next_in_list )
+
+#define for_each_sched_unit_vcpu(u, v)                                    \
+    for ( (v) = (u)->vcpu_list;                                           \
+          (v) != NULL && (!(u)->next_in_list ||                           \
+                          (v)->vcpu_id < (u)->next_in_list->unit_id);     \
+          (v) = (v)->next_in_list )
+
+#define for_each_vcpu(d, v) \
+    for ( (v) = (d)->vcpu[0]; (v) != NULL; (v) = (v)->next_in_list )
+
+static inline bool is_idle_domain(const struct domain *d)
+{
+    return d->domain_id == DOMID_IDLE;
+}
+
+static inline bool is_idle_vcpu(const struct vcpu *v)
+{
+    return is_idle_domain(v->domain);
+}
+
+static inline bool is_vcpu_online(const struct vcpu *v)
+{
+    return !(v->pause_flags & VPF_down);
+}
+
+static inline bool vcpu_runnable(const struct vcpu *v)
+{
+    return !v->pause_flags;
+}
+
+static inline void vcpu_pause_nosync(struct vcpu *v)
+{
+}
+
+static inline void vcpu_unpause(struct vcpu *v)
+{
+}
+
+struct xen_domctl_scheduler_op;
+struct xen_sysctl_scheduler_op;
+
+extern struct domain *domain_list;
+#define for_each_domain(d) \
+    for ( (d) = domain_list; (d) != NULL; (d) = (d)->next_in_list )
+#define for_each_domain_in_cpupool(d, c) \
+    for_each_domain(d) if ( (d)->cpupool == (c) )
+
+#define rcu_read_lock_domain_list()
+#define rcu_read_unlock_domain_list()
+
+static inline struct scheduler *unit_scheduler(const struct sched_unit *unit);
+
+#include "list.h"
+#include "rbtree.h"
+#include "private.h"
+
+/* There is no .data.schedulers section: export each scheduler by name. */
+#undef REGISTER_SCHEDULER
+#define REGISTER_SCHEDULER(x) const struct scheduler *sim_##x = &(x)
+
+/* The vCPU running on the pCPU being scheduled, as seen by the schedulers. */
+#define current (curr_on_cpu(sim_cpu)->vcpu_list)
+
+/* Guest handles of the tools are plain pointers. */
+#define copy_from_guest(dst, hnd, nr) \
+    (memcpy(dst, (hnd).p, sizeof(*(dst)) * (nr)), 0)
+#define copy_to_guest(hnd, src, nr) \
+    (memcpy((hnd).p, src, sizeof(*(src)) * (nr)), 0)
+#define copy_from_guest_offset(dst, hnd, off, nr) \
+    (memcpy(dst, (hnd).p + (off), sizeof(*(dst)) * (nr)), 0)
+#define copy_to_guest_offset(hnd, off, src, nr) \
+    (memcpy((hnd).p + (off), src, sizeof(*(src)) * (nr)), 0)
+#define hypercall_preempt_check() false
+
+static inline struct scheduler *unit_scheduler(const struct sched_unit *unit)
+{
+    return unit->domain->cpupool->sched;
+}
+
+#endif
@@ -0,0 +1,1245 @@
+/*
+ * Scheduler simulator: runs the hypervisor's schedulers in userspace, over
+ * a number of simulated pCPUs, and replays wakeup/sleep patterns of a set
+ * of vCPUs through them.  The patterns are either synthetic or taken from
+ * the runstate changes recorded by xentrace.  The time the scheduler hooks
+ * take is measured with the host clock, everything else happens in
+ * simulated time.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms and conditions of the GNU General Public
+ * License, version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program; If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "emul.h"
+
+#include <getopt.h>
+#include <math.h>
+#include <stdarg.h>
+#include <time.h>
+
+/* State the schedulers expect the rest of the hypervisor to provide. */
+unsigned int nr_cpu_ids;
+cpumask_t cpu_online_map;
+cpumask_t sim_cpumask_of[NR_CPUS];
+unsigned int sim_cpu;
+unsigned int sim_cpu_core[NR_CPUS], sim_cpu_socket[NR_CPUS];
+unsigned int sim_cpu_node[NR_CPUS];
+nodemask_t node_online_map;
+cpumask_t sim_node_to_cpumask[MAX_NUMNODES];
+DEFINE_PER_CPU(cpumask_var_t, cpu_sibling_mask);
+DEFINE_PER_CPU(cpumask_var_t, cpu_core_mask);
+DEFINE_PER_CPU(struct sched_resource *, sched_res);
+DEFINE_PER_CPU(cpumask_t, cpumask_scratch);
+rcu_read_lock_t sched_res_rculock;
+cpumask_t sched_res_mask;
+cpumask_t cpupool_free_cpus;
+int sched_ratelimit_us = SCHED_DEFAULT_RATELIMIT_US;
+s_time_t sim_now;
+struct domain *domain_list;
+
+extern const struct scheduler *sim_sched_credit_def;
+extern const struct scheduler *sim_sched_credit2_def;
+extern const struct scheduler *sim_sched_rtds_def;
+extern const struct scheduler *sim_sched_null_def;
+extern const struct scheduler *sim_sched_arinc653_def;
+
+static const struct scheduler *const *schedulers[] = {
+    &sim_sched_credit_def,
+    &sim_sched_credit2_def,
+    &sim_sched_rtds_def,
+    &sim_sched_null_def,
+    &sim_sched_arinc653_def,
+};
+
+static bool verbose;
+
+void sim_printk(const char *fmt, ...)
+{
+    va_list args;
+
+    if ( !verbose )
+        return;
+
+    va_start(args, fmt);
+    vfprintf(stderr, fmt, args);
+    va_end(args);
+}
+
+unsigned int cpupool_get_granularity(const struct cpupool *c)
+{
+    return 1;
+}
+
+extern const struct sim_param *const __start_sim_params[];
+extern const struct sim_param *const __stop_sim_params[];
+
+/* Set a command line parameter of the schedulers, given as name=value. */
+static void set_param(const char *arg)
+{
+    const struct sim_param *const *p;
+    const char *val = strchr(arg, '=');
+    size_t len = val ? val - arg : strlen(arg);
+    long long n;
+
+    for ( p = __start_sim_params; p < __stop_sim_params; p++ )
+        if ( strlen((*p)->name) == len && !strncmp((*p)->name, arg, len) )
+            break;
+
+    if ( p == __stop_sim_params || !val )
+    {
+        fprintf(stderr, "Unknown parameter %s\n", arg);
+        exit(1);
+    }
+    val++;
+
+    if ( (*p)->parse )
+    {
+        if ( (*p)->parse(val) )
+        {
+            fprintf(stderr, "Invalid value for %s\n", arg);
+            exit(1);
+        }
+        return;
+    }
+
+    n = strtoll(val, NULL, 0);
+    switch ( (*p)->size )
+    {
+    case 1: *(uint8_t *)(*p)->var = n; break;
+    case 2: *(uint16_t *)(*p)->var = n; break;
+    case 4: *(uint32_t *)(*p)->var = n; break;
+    case 8: *(uint64_t *)(*p)->var = n; break;
+    }
+}
+
+/* ------------------------------------------------------------------------ */
+
+/* All timers ever initialised; the soonest active one fires next. */
+static struct timer **timers;
+static unsigned int nr_timers, max_timers;
+
+void init_timer(struct timer *timer, void (*function)(void *data),
+                void *data, unsigned int cpu)
+{
+    unsigned int i;
+
+    memset(timer, 0, sizeof(*timer));
+    timer->function = function;
+    timer->data = data;
+    timer->cpu = cpu;
+    timer->status = TIMER_STATUS_inactive;
+
+    for ( i = 0; i < nr_timers; i++ )
+        if ( timers[i] == timer )
+            return;
+
+    if ( nr_timers == max_timers )
+    {
+        max_timers = max_timers * 2 + 16;
+        timers = realloc(timers, max_timers * sizeof(*timers));
+        assert(timers);
+    }
+    timers[nr_timers++] = timer;
+}
+
+void set_timer(struct timer *timer, s_time_t expires)
+{
+    if ( timer->status == TIMER_STATUS_killed )
+        return;
+    timer->expires = expires;
+    timer->status = TIMER_STATUS_in_heap;
+}
+
+void stop_timer(struct timer *timer)
+{
+    if ( timer->status == TIMER_STATUS_in_heap )
+        timer->status = TIMER_STATUS_inactive;
+}
+
+void migrate_timer(struct timer *timer, unsigned int new_cpu)
+{
+    timer->cpu = new_cpu;
+}
+
+void kill_timer(struct timer *timer)
+{
+    unsigned int i;
+
+    for ( i = 0; i < nr_timers; i++ )
+        if ( timers[i] == timer )
+        {
+            timers[i] = timers[--nr_timers];
+            break;
+        }
+
+    timer->status = TIMER_STATUS_killed;
+}
+
+static struct timer *first_timer(void)
+{
+    struct timer *first = NULL;
+    unsigned int i;
+
+    for ( i = 0; i < nr_timers; i++ )
+        if ( timers[i]->status == TIMER_STATUS_in_heap &&
+             (!first || timers[i]->expires < first->expires) )
+            first = timers[i];
+
+    return first;
+}
+
+static cpumask_t softirq_pending;
+
+void cpu_raise_softirq(unsigned int cpu, unsigned int nr)
+{
+    ASSERT(nr == SCHEDULE_SOFTIRQ);
+    cpumask_set_cpu(cpu, &softirq_pending);
+}
+
+void cpumask_raise_softirq(const cpumask_t *mask, unsigned int nr)
+{
+    ASSERT(nr == SCHEDULE_SOFTIRQ);
+    cpumask_or(&softirq_pending, &softirq_pending, mask);
+}
+
+/* ------------------------------------------------------------------------ */
+
+/*
+ * Log-linear histogram: 8 buckets per power of two, so that percentiles
+ * are off by at most 12.5%.
+ */
+#define HIST_SUB_BITS 3
+#define HIST_BUCKETS  ((64 - HIST_SUB_BITS + 1) << HIST_SUB_BITS)
+
+struct hist {
+    uint64_t nr, sum, max;
+    uint64_t count[HIST_BUCKETS];
+};
+
+static unsigned int hist_bucket(uint64_t val)
+{
+    unsigned int msb;
+
+    if ( val < (1U << HIST_SUB_BITS) )
+        return val;
+
+    msb = 63 - __builtin_clzll(val);
+
+    return ((msb - HIST_SUB_BITS + 1) << HIST_SUB_BITS) +
+           ((val >> (msb - HIST_SUB_BITS)) & ((1U << HIST_SUB_BITS) - 1));
+}
+
+static uint64_t hist_bucket_base(unsigned int b)
+{
+    unsigned int msb = (b >> HIST_SUB_BITS) + HIST_SUB_BITS - 1;
+
+    if ( b < (1U << HIST_SUB_BITS) )
+        return b;
+
+    return (uint64_t)((1U << HIST_SUB_BITS) + (b & ((1U << HIST_SUB_BITS) - 1)))
+           << (msb - HIST_SUB_BITS);
+}
+
+static void hist_add(struct hist *h, uint64_t val)
+{
+    h->nr++;
+    h->sum += val;
+    if ( val > h->max )
+        h->max = val;
+    h->count[hist_bucket(val)]++;
+}
+
+static void hist_merge(struct hist *h, const struct hist *o)
+{
+    unsigned int i;
+
+    h->nr += o->nr;
+    h->sum += o->sum;
+    if ( o->max > h->max )
+        h->max = o->max;
+    for ( i = 0; i < HIST_BUCKETS; i++ )
+        h->count[i] += o->count[i];
+}
+
+static uint64_t hist_mean(const struct hist *h)
+{
+    return h->nr ? h->sum / h->nr : 0;
+}
+
+static uint64_t hist_pct(const struct hist *h, unsigned int pct)
+{
+    uint64_t target = (h->nr * pct + 99) / 100, seen = 0;
+    unsigned int i;
+
+    for ( i = 0; i < HIST_BUCKETS; i++ )
+    {
+        seen += h->count[i];
+        if ( seen && seen >= target )
+            return min(hist_bucket_base(i), h->max);
+    }
+
+    return h->max;
+}
+
+/* ------------------------------------------------------------------------ */
+
+/*
+ * The workload: every vCPU alternates between blocking for a while and
+ * running for a burst of CPU time.  With a trace, the phases are the ones
+ * recorded; otherwise both are exponentially distributed around the
+ * configured means.
+ */
+struct phase {
+    s_time_t sleep, burst;
+};
+
+struct sim_vcpu {
+    struct vcpu vcpu;
+    struct sched_unit unit;
+    domid_t domid;
+
+    struct phase *phases;  /* NULL for a synthetic workload. */
+    unsigned int nr_phases, cur_phase, max_phases;
+
+    s_time_t burst_left;   /* CPU time until the vCPU blocks again. */
+    s_time_t wake_at;      /* When a blocked vCPU wakes up. */
+    s_time_t ran_since;    /* When it last got a pCPU. */
+    s_time_t wait_since;   /* When it last became runnable, not running. */
+    s_time_t ran;          /* Total CPU time. */
+    unsigned int last_cpu; /* Where it last ran. */
+    unsigned long migrations;
+    struct hist wait;
+    s_time_t remote;       /* CPU time away from its domain's NUMA nodes. */
+
+    /* With RTDS reservations: */
+    s_time_t period_ran;   /* CPU time in the current period. */
+    unsigned long missed;  /* Periods it did not get its budget in. */
+};
+
+static struct {
+    unsigned int cpus, cores_per_socket, threads_per_core;
+    unsigned int domains, vcpus_per_domain;
+    s_time_t burst, sleep, duration;
+    unsigned int seed;
+    const char *sched;
+    const char *trace;
+    uint64_t cpu_hz;
+    s_time_t rt_period, rt_budget;
+    bool numa;
+    bool summary;
+} opt = {
+    .cpus = 8,
+    .cores_per_socket = 4,
+    .threads_per_core = 2,
+    .domains = 8,
+    .vcpus_per_domain = 4,
+    .burst = MICROSECS(500),
+    .sleep = MILLISECS(1),
+    .seed = 1,
+    .sched = "credit2",
+    .cpu_hz = 2400000000ULL,
+};
+
+static struct scheduler sched;
+static struct cpupool pool;
+static struct sim_vcpu *vcpus;
+static unsigned int nr_vcpus;
+
+static struct hist stat_schedule, stat_context_saved, stat_wake;
+static s_time_t next_period;
+
+static uint64_t host_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static s_time_t random_exp(s_time_t mean)
+{
+    return 1 - mean * log(1.0 - drand48());
+}
+
+static struct sim_vcpu *sim_vcpu(struct sched_unit *unit)
+{
+    return container_of(unit, struct sim_vcpu, unit);
+}
+
+static void s_timer_fn(void *data)
+{
+    cpu_raise_softirq((unsigned long)data, SCHEDULE_SOFTIRQ);
+}
+
+static void setup_unit(struct domain *d, struct sim_vcpu *sv,
+                       unsigned int id, unsigned int cpu)
+{
+    struct vcpu *v = &sv->vcpu;
+    struct sched_unit *unit = &sv->unit;
+
+    v->vcpu_id = id;
+    v->domain = d;
+    v->sched_unit = unit;
+    unit->domain = d;
+    unit->vcpu_list = v;
+    unit->unit_id = id;
+    cpumask_setall(unit->cpu_hard_affinity);
+    cpumask_setall(unit->cpu_soft_affinity);
+    sched_set_res(unit, get_sched_res(cpu));
+}
+
+static void setup_cpus(void)
+{
+    struct domain *idle = xzalloc(struct domain);
+    unsigned int cpu, sibling;
+
+    assert(idle);
+    idle->domain_id = DOMID_IDLE;
+    idle->max_vcpus = opt.cpus;
+    idle->vcpu = calloc(opt.cpus, sizeof(*idle->vcpu));
+    assert(idle->vcpu);
+
+    nr_cpu_ids = opt.cpus;
+    for ( cpu = 0; cpu < opt.cpus; cpu++ )
+    {
+        sim_cpu_core[cpu] = cpu / opt.threads_per_core;
+        sim_cpu_socket[cpu] = sim_cpu_core[cpu] / opt.cores_per_socket;
+        sim_cpu_node[cpu] = sim_cpu_socket[cpu] % MAX_NUMNODES;
+        node_online_map.bits |= 1UL << sim_cpu_node[cpu];
+        cpumask_set_cpu(cpu, &sim_node_to_cpumask[sim_cpu_node[cpu]]);
+        cpumask_set_cpu(cpu, &sim_cpumask_of[cpu]);
+        cpumask_set_cpu(cpu, &cpu_online_map);
+        cpumask_set_cpu(cpu, &sched_res_mask);
+    }
+
+    for ( cpu = 0; cpu < opt.cpus; cpu++ )
+        for ( sibling = 0; sibling < opt.cpus; sibling++ )
+        {
+            if ( sim_cpu_core[sibling] == sim_cpu_core[cpu] )
+                cpumask_set_cpu(sibling, per_cpu(cpu_sibling_mask, cpu));
+            if ( sim_cpu_socket[sibling] == sim_cpu_socket[cpu] )
+                cpumask_set_cpu(sibling, per_cpu(cpu_core_mask, cpu));
+        }
+
+    pool.sched = &sched;
+    pool.gran = SCHED_GRAN_cpu;
+    pool.sched_gran = 1;
+    cpumask_copy(pool.cpu_valid, &cpu_online_map);
+    cpumask_copy(pool.res_valid, &cpu_online_map);
+
+    /* As schedule_cpu_add() does, for each pCPU and its idle vCPU. */
+    for ( cpu = 0; cpu < opt.cpus; cpu++ )
+    {
+        struct sched_resource *sr = xzalloc(struct sched_resource);
+        struct sim_vcpu *sv = xzalloc(struct sim_vcpu);
+        void *ppriv, *vpriv;
+
+        assert(sr && sv);
+        sim_cpu = cpu;
+        spin_lock_init(&sr->_lock);
+        sr->schedule_lock = &sr->_lock;
+        sr->master_cpu = cpu;
+        sr->granularity = 1;
+        cpumask_copy(sr->cpus, cpumask_of(cpu));
+        init_timer(&sr->s_timer, s_timer_fn, (void *)(unsigned long)cpu, cpu);
+        set_sched_res(cpu, sr);
+
+        idle->vcpu[cpu] = &sv->vcpu;
+        setup_unit(idle, sv, cpu, cpu);
+        sv->unit.is_running = true;
+        sv->unit.runstate_cnt[RUNSTATE_running] = 1;
+        sr->curr = sr->sched_unit_idle = &sv->unit;
+
+        ppriv = sched_alloc_pdata(&sched, cpu);
+        assert(!IS_ERR(ppriv));
+        vpriv = sched_alloc_udata(&sched, &sv->unit, NULL);
+        assert(vpriv);
+        sr->schedule_lock = sched_switch_sched(&sched, cpu, ppriv, vpriv);
+        sr->scheduler = &sched;
+        sr->sched_priv = ppriv;
+        sr->cpupool = &pool;
+    }
+}
+
+/*
+ * Create the domains, as domain_create() and sched_init_vcpu() would.  The
+ * vCPUs of a domain are contiguous in vcpus[], with their domid set and in
+ * the order of their ids.
+ */
+static void setup_domains(void)
+{
+    struct domain *d = NULL;
+    unsigned int i, j, node = MAX_NUMNODES - 1;
+
+    for ( i = 0; i < nr_vcpus; i++ )
+    {
+        struct sim_vcpu *sv = &vcpus[i];
+        unsigned int cpu = i % opt.cpus;
+
+        if ( !d || d->domain_id != sv->domid )
+        {
+            d = xzalloc(struct domain);
+            assert(d);
+            d->domain_id = sv->domid;
+            memcpy(d->handle, &d->domain_id, sizeof(d->domain_id));
+            for ( j = i; j < nr_vcpus && vcpus[j].domid == sv->domid; j++ )
+                d->max_vcpus++;
+            d->vcpu = calloc(d->max_vcpus, sizeof(*d->vcpu));
+            assert(d->vcpu);
+            d->cpupool = &pool;
+            d->node_affinity = node_online_map;
+            if ( opt.numa )
+            {
+                /* Place the memory of each domain on the next node. */
+                node = cycle_node(node, node_online_map);
+                d->node_affinity.bits = 1UL << node;
+            }
+            d->sched_priv = sched_alloc_domdata(&sched, d);
+            assert(!IS_ERR(d->sched_priv));
+            d->next_in_list = domain_list;
+            domain_list = d;
+            d->sched_unit_list = &sv->unit;
+        }
+        else
+        {
+            vcpus[i - 1].vcpu.next_in_list = &sv->vcpu;
+            vcpus[i - 1].unit.next_in_list = &sv->unit;
+        }
+
+        setup_unit(d, sv, sv->vcpu.vcpu_id, cpu);
+        d->vcpu[sv->vcpu.vcpu_id] = &sv->vcpu;
+
+        /* Start out blocked. */
+        sv->vcpu.pause_flags = VPF_blocked;
+        sv->vcpu.runstate.state = RUNSTATE_blocked;
+        sv->last_cpu = cpu;
+        if ( !sv->phases )
+            sv->wake_at = random_exp(opt.sleep);
+        else if ( sv->nr_phases )
+            sv->wake_at = sv->phases[0].sleep;
+        else
+            sv->wake_at = STIME_MAX;
+
+        sim_cpu = cpu;
+        sv->unit.priv = sched_alloc_udata(&sched, &sv->unit, d->sched_priv);
+        assert(sv->unit.priv);
+    }
+}
+
+static void insert_units(void)
+{
+    unsigned int i;
+
+    for ( i = 0; i < nr_vcpus; i++ )
+    {
+        sim_cpu = sched_unit_master(&vcpus[i].unit);
+        sched_insert_unit(&sched, &vcpus[i].unit);
+    }
+}
+
+/* Give each vCPU the same RTDS reservation, without extra time. */
+static void setup_rtds(void)
+{
+    struct xen_domctl_schedparam_vcpu param = {
+        .u.rtds.period = opt.rt_period / MICROSECS(1),
+        .u.rtds.budget = opt.rt_budget / MICROSECS(1),
+    };
+    struct xen_domctl_scheduler_op op = {
+        .sched_id = XEN_SCHEDULER_RTDS,
+        .cmd = XEN_DOMCTL_SCHEDOP_putvcpuinfo,
+    };
+    unsigned int i;
+
+    set_xen_guest_handle(op.u.v.vcpus, &param);
+    for ( i = 0; i < nr_vcpus; i++ )
+    {
+        param.vcpuid = vcpus[i].vcpu.vcpu_id;
+        op.u.v.nr_vcpus = 1;
+        if ( sched.adjust(&sched, vcpus[i].unit.domain, &op) )
+        {
+            fprintf(stderr, "rtds: invalid reservation\n");
+            exit(1);
+        }
+    }
+
+    next_period = opt.rt_period;
+}
+
+/* Give each vCPU the same share of the ARINC 653 major frame. */
+static void setup_arinc653(void)
+{
+    static struct xen_sysctl_arinc653_schedule a653;
+    struct xen_sysctl_scheduler_op op = {
+        .sched_id = XEN_SCHEDULER_ARINC653,
+        .cmd = XEN_SYSCTL_SCHEDOP_putinfo,
+    };
+    unsigned int i;
+
+    if ( nr_vcpus > ARINC653_MAX_DOMAINS_PER_SCHEDULE )
+        printf("arinc653: only the first %u vCPUs get scheduled\n",
+               ARINC653_MAX_DOMAINS_PER_SCHEDULE);
+
+    for ( i = 0; i < nr_vcpus && i < ARINC653_MAX_DOMAINS_PER_SCHEDULE; i++ )
+    {
+        memcpy(a653.sched_entries[i].dom_handle,
+               vcpus[i].unit.domain->handle, sizeof(xen_domain_handle_t));
+        a653.sched_entries[i].vcpu_id = vcpus[i].vcpu.vcpu_id;
+        a653.sched_entries[i].runtime = MILLISECS(1);
+    }
+    a653.num_sched_entries = i;
+    a653.major_frame = MILLISECS(i);
+
+    set_xen_guest_handle(op.u.sched_arinc653.schedule, &a653);
+    if ( sched.adjust_global(&sched, &op) )
+    {
+        fprintf(stderr, "arinc653: failed to set the schedule\n");
+        exit(1);
+    }
+}
+
+/* ------------------------------------------------------------------------ */
+
+/* The workload when there is no trace. */
+static void synthetic_vcpus(void)
+{
+    unsigned int i;
+
+    nr_vcpus = opt.domains * opt.vcpus_per_domain;
+    vcpus = calloc(nr_vcpus, sizeof(*vcpus));
+    assert(vcpus);
+
+    for ( i = 0; i < nr_vcpus; i++ )
+    {
+        vcpus[i].domid = i / opt.vcpus_per_domain + 1;
+        vcpus[i].vcpu.vcpu_id = i % opt.vcpus_per_domain;
+    }
+}
+
+struct trace_rec {
+    uint64_t tsc;
+    unsigned int seq;
+    uint16_t domid, vcpu_id;
+    uint8_t old_state, new_state;
+};
+
+static int trace_rec_cmp(const void *a, const void *b)
+{
+    const struct trace_rec *ra = a, *rb = b;
+
+    if ( ra->domid != rb->domid )
+        return ra->domid < rb->domid ? -1 : 1;
+    if ( ra->vcpu_id != rb->vcpu_id )
+        return ra->vcpu_id < rb->vcpu_id ? -1 : 1;
+    if ( ra->tsc != rb->tsc )
+        return ra->tsc < rb->tsc ? -1 : 1;
+
+    return ra->seq < rb->seq ? -1 : ra->seq > rb->seq;
+}
+
+static void add_phase(struct sim_vcpu *sv, s_time_t sleep, s_time_t burst)
+{
+    if ( sv->nr_phases == sv->max_phases )
+    {
+        sv->max_phases = sv->max_phases * 2 + 16;
+        sv->phases = realloc(sv->phases, sv->max_phases * sizeof(*sv->phases));
+        assert(sv->phases);
+    }
+
+    sv->phases[sv->nr_phases].sleep = sleep;
+    sv->phases[sv->nr_phases].burst = max_t(s_time_t, burst, 1);
+    sv->nr_phases++;
+}
+
+/*
+ * Turn the runstate changes of one vCPU into phases.  Until the vCPU is
+ * first seen waking up, it is not known for how long it has been awake,
+ * so the recording starts then.
+ */
+static void trace_vcpu_phases(struct sim_vcpu *sv, const struct trace_rec *r,
+                              unsigned int nr, uint64_t first_tsc,
+                              uint64_t last_tsc)
+{
+#define TSC_TO_NS(tsc) \
+    ((s_time_t)(((tsc) - first_tsc) * 1000000000.0 / opt.cpu_hz))
+    s_time_t t, sleep_since = 0, run_since = 0, burst = 0, sleep = 0;
+    bool awake = false;
+    unsigned int i;
+
+    for ( i = 0; i < nr; i++ )
+    {
+        bool was_awake = r[i].old_state < RUNSTATE_blocked;
+        bool is_awake = r[i].new_state < RUNSTATE_blocked;
+
+        t = TSC_TO_NS(r[i].tsc);
+
+        if ( !was_awake && is_awake )
+        {
+            sleep = t - sleep_since;
+            burst = 0;
+            awake = true;
+        }
+        else if ( !awake )
+            continue;
+
+        if ( r[i].old_state == RUNSTATE_running )
+            burst += t - run_since;
+        if ( r[i].new_state == RUNSTATE_running )
+            run_since = t;
+
+        if ( was_awake && !is_awake )
+        {
+            add_phase(sv, sleep, burst);
+            sleep_since = t;
+            awake = false;
+        }
+    }
+
+    if ( awake )
+    {
+        t = TSC_TO_NS(last_tsc);
+        if ( r[nr - 1].new_state == RUNSTATE_running )
+            burst += t - run_since;
+        add_phase(sv, sleep, burst);
+    }
+#undef TSC_TO_NS
+}
+
+/* The workload recorded by xentrace, from its TRC_SCHED_RUNSTATE_CHANGEs. */
+static void trace_vcpus(void)
+{
+    FILE *f = fopen(opt.trace, "rb");
+    struct trace_rec *recs = NULL;
+    unsigned int nr = 0, max = 0, i, j, k;
+    uint64_t first_tsc = UINT64_MAX, last_tsc = 0;
+    uint32_t hdr;
+
+    if ( !f )
+    {
+        perror(opt.trace);
+        exit(1);
+    }
+
+    while ( fread(&hdr, sizeof(hdr), 1, f) == 1 )
+    {
+        uint32_t event = TRC_HD_TO_EVENT(hdr), data[TRACE_EXTRA_MAX];
+        unsigned int extra = TRC_HD_EXTRA(hdr);
+        uint32_t cycles[2] = { 0, 0 };
+        uint64_t tsc;
+
+        if ( (TRC_HD_INCLUDES_CYCLE_COUNT(hdr) &&
+              fread(cycles, sizeof(cycles), 1, f) != 1) ||
+             fread(data, sizeof(*data), extra, f) != extra )
+        {
+            fprintf(stderr, "%s: truncated record\n", opt.trace);
+            break;
+        }
+
+        /* The old and new runstates are encoded in the event. */
+        if ( (event & ~0xff0) != TRC_SCHED_RUNSTATE_CHANGE || extra < 1 ||
+             !TRC_HD_INCLUDES_CYCLE_COUNT(hdr) )
+            continue;
+
+        tsc = ((uint64_t)cycles[1] << 32) | cycles[0];
+        first_tsc = min(first_tsc, tsc);
+        last_tsc = max(last_tsc, tsc);
+
+        if ( (data[0] >> 16) == DOMID_IDLE )
+            continue;
+
+        if ( nr == max )
+        {
+            max = max * 2 + 1024;
+            recs = realloc(recs, max * sizeof(*recs));
+            assert(recs);
+        }
+        recs[nr] = (struct trace_rec){
+            .tsc = tsc,
+            .seq = nr,
+            .vcpu_id = data[0] & 0xffff,
+            .domid = data[0] >> 16,
+            .old_state = (event >> 8) & 3,
+            .new_state = (event >> 4) & 3,
+        };
+        nr++;
+    }
+    fclose(f);
+
+    if ( !nr )
+    {
+        fprintf(stderr, "%s: no runstate changes of non-idle vCPUs\n",
+                opt.trace);
+        exit(1);
+    }
+
+    qsort(recs, nr, sizeof(*recs), trace_rec_cmp);
+
+    /* Each domain gets all vCPUs up to the highest id seen. */
+    for ( i = 0; i < nr; i = j )
+    {
+        for ( j = i; j < nr && recs[j].domid == recs[i].domid; j++ )
+            ;
+        nr_vcpus += recs[j - 1].vcpu_id + 1;
+    }
+    vcpus = calloc(nr_vcpus, sizeof(*vcpus));
+    assert(vcpus);
+
+    for ( i = 0, k = 0; i < nr; i = j )
+    {
+        unsigned int base = k;
+
+        for ( j = i; j < nr && recs[j].domid == recs[i].domid; j++ )
+            ;
+        for ( ; k <= base + recs[j - 1].vcpu_id; k++ )
+        {
+            vcpus[k].domid = recs[i].domid;
+            vcpus[k].vcpu.vcpu_id = k - base;
+            vcpus[k].phases = malloc(sizeof(*vcpus[k].phases));
+            assert(vcpus[k].phases);
+        }
+
+        for ( ; i < j; i = k )
+        {
+            for ( k = i; k < j && recs[k].vcpu_id == recs[i].vcpu_id; k++ )
+                ;
+            trace_vcpu_phases(&vcpus[base + recs[i].vcpu_id], &recs[i],
+                              k - i, first_tsc, last_tsc);
+        }
+        k = base + recs[j - 1].vcpu_id + 1;
+    }
+
+    if ( !opt.duration )
+        opt.duration = (last_tsc - first_tsc) * 1000000000.0 / opt.cpu_hz;
+
+    free(recs);
+}
+
+/* ------------------------------------------------------------------------ */
+
+/* As vcpu_wake() does. */
+static void unit_wake(struct sim_vcpu *sv)
+{
+    uint64_t start;
+
+    if ( !vcpu_runnable(&sv->vcpu) )
+        return;
+
+    sv->vcpu.runstate.state = RUNSTATE_runnable;
+    sv->vcpu.runstate.state_entry_time = sim_now;
+
+    sim_cpu = sched_unit_master(&sv->unit);
+    start = host_ns();
+    sched_wake(&sched, &sv->unit);
+    hist_add(&stat_wake, host_ns() - start);
+}
+
+static void vcpu_wake(struct sim_vcpu *sv)
+{
+    sv->vcpu.pause_flags &= ~VPF_blocked;
+    sv->wake_at = STIME_MAX;
+    sv->wait_since = sim_now;
+    if ( sv->phases )
+        sv->burst_left = sv->phases[sv->cur_phase].burst;
+    else
+        sv->burst_left = random_exp(opt.burst);
+
+    unit_wake(sv);
+}
+
+/*
+ * As sched_unit_migrate_finish() does, for the moves the schedulers ask for
+ * by setting _VPF_migrating.
+ */
+static void unit_migrate_finish(struct sim_vcpu *sv)
+{
+    unsigned int new_cpu;
+
+    if ( sv->unit.is_running ||
+         !test_and_clear_bit(_VPF_migrating, &sv->vcpu.pause_flags) )
+        return;
+
+    new_cpu = sched_pick_resource(&sched, &sv->unit)->master_cpu;
+    sched_migrate(&sched, &sv->unit, new_cpu);
+    unit_wake(sv);
+}
+
+static void vcpu_block(struct sim_vcpu *sv)
+{
+    sv->vcpu.pause_flags |= VPF_blocked;
+    if ( !sv->phases )
+        sv->wake_at = sim_now + random_exp(opt.sleep);
+    else if ( ++sv->cur_phase < sv->nr_phases )
+        sv->wake_at = sim_now + sv->phases[sv->cur_phase].sleep;
+    cpu_raise_softirq(sched_unit_master(&sv->unit), SCHEDULE_SOFTIRQ);
+}
+
+/* Charge a running vCPU for the CPU time it had until now. */
+static void account_run(struct sim_vcpu *sv)
+{
+    s_time_t delta = sim_now - sv->ran_since;
+    unsigned int node = cpu_to_node(sched_unit_master(&sv->unit));
+
+    sv->burst_left -= delta;
+    sv->ran += delta;
+    if ( !nodemask_test(node, &sv->unit.domain->node_affinity) )
+        sv->remote += delta;
+    sv->period_ran += delta;
+    sv->ran_since = sim_now;
+}
+
+/*
+ * With RTDS reservations, every vCPU has its deadlines at the multiples of
+ * the period.  One that is still runnable at a deadline but has not had
+ * its budget since the previous one missed it.
+ */
+static void end_period(void)
+{
+    unsigned int i;
+
+    for ( i = 0; i < nr_vcpus; i++ )
+    {
+        struct sim_vcpu *sv = &vcpus[i];
+
+        if ( sv->unit.is_running )
+            account_run(sv);
+        if ( !(sv->vcpu.pause_flags & VPF_blocked) &&
+             sv->period_ran < opt.rt_budget )
+            sv->missed++;
+        sv->period_ran = 0;
+    }
+
+    next_period += opt.rt_period;
+}
+
+/* What schedule() and sched_context_switch() do for a granularity of 1. */
+static void schedule(unsigned int cpu)
+{
+    struct sched_resource *sr = get_sched_res(cpu);
+    struct sched_unit *prev = sr->curr, *next;
+    uint64_t start;
+
+    sim_cpu = cpu;
+    cpumask_clear_cpu(cpu, &softirq_pending);
+    stop_timer(&sr->s_timer);
+
+    if ( !is_idle_unit(prev) )
+        account_run(sim_vcpu(prev));
+
+    start = host_ns();
+    sched.do_schedule(&sched, prev, sim_now, false);
+    hist_add(&stat_schedule, host_ns() - start);
+
+    next = prev->next_task;
+    if ( prev->next_time >= 0 )
+        set_timer(&sr->s_timer, sim_now + prev->next_time);
+
+    if ( prev == next )
+        return;
+
+    sr->curr = next;
+    sr->prev = prev;
+    next->is_running = true;
+    next->state_entry_time = sim_now;
+    next->runstate_cnt[RUNSTATE_running]++;
+    prev->runstate_cnt[RUNSTATE_running]--;
+    sched_set_res(next, sr);
+    next->vcpu_list->runstate.state = RUNSTATE_running;
+    next->vcpu_list->runstate.state_entry_time = sim_now;
+    if ( !is_idle_unit(next) )
+    {
+        struct sim_vcpu *sv = sim_vcpu(next);
+
+        sv->ran_since = sim_now;
+        hist_add(&sv->wait, sim_now - sv->wait_since);
+        if ( sv->last_cpu != cpu )
+            sv->migrations++;
+        sv->last_cpu = cpu;
+    }
+
+    prev->vcpu_list->runstate.state = prev->vcpu_list->new_state;
+    prev->vcpu_list->runstate.state_entry_time = sim_now;
+    prev->is_running = false;
+    prev->state_entry_time = sim_now;
+    if ( !is_idle_unit(prev) && unit_runnable(prev) )
+        sim_vcpu(prev)->wait_since = sim_now;
+
+    start = host_ns();
+    sched_context_saved(&sched, prev);
+    hist_add(&stat_context_saved, host_ns() - start);
+
+    if ( !is_idle_unit(prev) )
+        unit_migrate_finish(sim_vcpu(prev));
+}
+
+static void run(void)
+{
+    while ( sim_now < opt.duration )
+    {
+        struct timer *timer;
+        struct sim_vcpu *sv = NULL;
+        s_time_t next = opt.duration;
+        unsigned int i;
+
+        /* Softirqs are handled before time moves on. */
+        if ( !cpumask_empty(&softirq_pending) )
+        {
+            schedule(cpumask_first(&softirq_pending));
+            continue;
+        }
+
+        timer = first_timer();
+        if ( timer && timer->expires < next )
+            next = timer->expires;
+        else
+            timer = NULL;
+
+        for ( i = 0; i < nr_vcpus; i++ )
+        {
+            struct sim_vcpu *v = &vcpus[i];
+            s_time_t t = v->wake_at;
+
+            if ( v->unit.is_running && !(v->vcpu.pause_flags & VPF_blocked) )
+                t = v->ran_since + v->burst_left;
+            if ( t < next )
+            {
+                next = t;
+                sv = v;
+                timer = NULL;
+            }
+        }
+
+        /* Deadlines come first, for the CPU time until them to count. */
+        if ( next_period && next_period <= next )
+        {
+            sim_now = max(sim_now, next_period);
+            end_period();
+            continue;
+        }
+
+        sim_now = max(sim_now, next);
+
+        if ( timer )
+        {
+            timer->status = TIMER_STATUS_inactive;
+            sim_cpu = timer->cpu;
+            timer->function(timer->data);
+        }
+        else if ( sv && sv->unit.is_running )
+            vcpu_block(sv);
+        else if ( sv )
+            vcpu_wake(sv);
+    }
+}
+
+/* ------------------------------------------------------------------------ */
+
+static void report_hook(const char *name, const struct hist *h)
+{
+    printf("  %-14s %10"PRIu64" %8"PRIu64" %8"PRIu64" %8"PRIu64" %8"PRIu64"\n",
+           name, h->nr, hist_mean(h), hist_pct(h, 50), hist_pct(h, 99),
+           h->max);
+}
+
+static void report_vcpu(const char *name, const struct sim_vcpu *sv)
+{
+    const struct hist *h = &sv->wait;
+
+    printf("  %-10s %6.1f %9"PRIu64" %8"PRIu64" %8"PRIu64" %8"PRIu64
+           " %8"PRIu64" %8"PRIu64" %10lu",
+           name, sv->ran * 100.0 / opt.duration, h->nr,
+           hist_mean(h) / 1000, hist_pct(h, 50) / 1000,
+           hist_pct(h, 90) / 1000, hist_pct(h, 99) / 1000, h->max / 1000,
+           sv->migrations);
+    if ( opt.numa )
+        printf(" %7.1f", sv->ran ? sv->remote * 100.0 / sv->ran : 0);
+    if ( opt.rt_period )
+        printf(" %8lu", sv->missed);
+    printf("\n");
+}
+
+static void report(void)
+{
+    struct sim_vcpu *all = xzalloc(struct sim_vcpu);
+    unsigned int i, cpu;
+
+    assert(all);
+
+    /* Account for the vCPUs still running at the end. */
+    for_each_cpu ( cpu, &cpu_online_map )
+    {
+        struct sched_unit *unit = curr_on_cpu(cpu);
+
+        if ( !is_idle_unit(unit) )
+            account_run(sim_vcpu(unit));
+    }
+
+    printf("%s: %u pCPUs, %u vCPUs, %"PRId64" ms simulated\n",
+           sched.opt_name, opt.cpus, nr_vcpus, opt.duration / MILLISECS(1));
+
+    printf("\n  %-14s %10s %8s %8s %8s %8s\n",
+           "hook (ns)", "calls", "mean", "p50", "p99", "max");
+    report_hook("do_schedule", &stat_schedule);
+    report_hook("context_saved", &stat_context_saved);
+    report_hook("wake", &stat_wake);
+
+    printf("\n  %-10s %6s %9s %8s %8s %8s %8s %8s %10s",
+           "wait (us)", "run%", "waits", "mean", "p50", "p90", "p99", "max",
+           "migrations");
+    if ( opt.numa )
+        printf(" %7s", "remote%");
+    if ( opt.rt_period )
+        printf(" %8s", "missed");
+    printf("\n");
+    for ( i = 0; i < nr_vcpus; i++ )
+    {
+        struct sim_vcpu *sv = &vcpus[i];
+        char name[32];
+
+        hist_merge(&all->wait, &sv->wait);
+        all->ran += sv->ran;
+        all->remote += sv->remote;
+        all->migrations += sv->migrations;
+        all->missed += sv->missed;
+
+        if ( opt.summary )
+            continue;
+
+        snprintf(name, sizeof(name), "d%uv%u", sv->domid, sv->vcpu.vcpu_id);
+        report_vcpu(name, sv);
+    }
+    report_vcpu("all", all);
+
+    free(all);
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr,
+            "Usage: %s [options]\n"
+            "  -S NAME   scheduler: credit, credit2, rtds, null or arinc653"
+            " (default: %s)\n"
+            "  -p N      number of pCPUs (default: %u)\n"
+            "  -c N      cores per socket (default: %u)\n"
+            "  -t N      threads per core (default: %u)\n"
+            "  -r FILE   replay the vCPU runstate changes of a xentrace file\n"
+            "  -H HZ     TSC frequency of the trace (default: %"PRIu64")\n"
+            "  -d N      number of domains, without a trace (default: %u)\n"
+            "  -v N      vCPUs per domain, without a trace (default: %u)\n"
+            "  -b US     mean run burst, in microseconds (default: %"PRId64")\n"
+            "  -w US     mean sleep, in microseconds (default: %"PRId64")\n"
+            "  -T MS     simulated time, in milliseconds (default: 10000, or\n"
+            "            the length of the trace)\n"
+            "  -s SEED   random seed (default: %u)\n"
+            "  -R PERIOD:BUDGET\n"
+            "            give each vCPU an RTDS reservation, in microseconds,\n"
+            "            and count the periods it misses its budget in\n"
+            "  -N        give each domain the memory of one NUMA node (a node\n"
+            "            per socket), and report the time run away from it\n"
+            "  -o NAME=VALUE\n"
+            "            set a command line parameter of the scheduler\n"
+            "  -q        only report the totals over all vCPUs\n"
+            "  -V        print the messages of the scheduler\n",
+            prog, opt.sched, opt.cpus, opt.cores_per_socket,
+            opt.threads_per_core, opt.cpu_hz, opt.domains,
+            opt.vcpus_per_domain, opt.burst / MICROSECS(1),
+            opt.sleep / MICROSECS(1), opt.seed);
+    exit(1);
+}
+
+int main(int argc, char **argv)
+{
+    unsigned int i;
+    char *end;
+    int c;
+
+    while ( (c = getopt(argc, argv, "S:p:c:t:r:H:d:v:b:w:T:s:R:No:qVh")) != -1 )
+    {
+        switch ( c )
+        {
+        case 'S': opt.sched = optarg; break;
+        case 'p': opt.cpus = atoi(optarg); break;
+        case 'c': opt.cores_per_socket = atoi(optarg); break;
+        case 't': opt.threads_per_core = atoi(optarg); break;
+        case 'r': opt.trace = optarg; break;
+        case 'H': opt.cpu_hz = strtoull(optarg, NULL, 0); break;
+        case 'd': opt.domains = atoi(optarg); break;
+        case 'v': opt.vcpus_per_domain = atoi(optarg); break;
+        case 'b': opt.burst = MICROSECS(atoll(optarg)); break;
+        case 'w': opt.sleep = MICROSECS(atoll(optarg)); break;
+        case 'T': opt.duration = MILLISECS(atoll(optarg)); break;
+        case 's': opt.seed = atoi(optarg); break;
+        case 'R':
+            opt.rt_period = MICROSECS(strtoll(optarg, &end, 0));
+            if ( *end != ':' )
+                usage(argv[0]);
+            opt.rt_budget = MICROSECS(strtoll(end + 1, NULL, 0));
+            if ( opt.rt_period <= 0 || opt.rt_budget <= 0 ||
+                 opt.rt_budget > opt.rt_period )
+                usage(argv[0]);
+            break;
+        case 'N': opt.numa = true; break;
+        case 'o': set_param(optarg); break;
+        case 'q': opt.summary = true; break;
+        case 'V': verbose = true; break;
+        default: usage(argv[0]);
+        }
+    }
+
+    if ( !opt.cpus || opt.cpus > NR_CPUS || !opt.cores_per_socket ||
+         !opt.threads_per_core || !opt.domains || !opt.vcpus_per_domain ||
+         opt.burst <= 0 || opt.sleep <= 0 || !opt.cpu_hz )
+        usage(argv[0]);
+
+    for ( i = 0; i < ARRAY_SIZE(schedulers); i++ )
+        if ( !strcmp((*schedulers[i])->opt_name, opt.sched) )
+            break;
+    if ( i == ARRAY_SIZE(schedulers) )
+    {
+        fprintf(stderr, "Unknown scheduler %s\n", opt.sched);
+        return 1;
+    }
+
+    sched = **schedulers[i];
+    if ( opt.rt_period && sched.sched_id != XEN_SCHEDULER_RTDS )
+    {
+        fprintf(stderr, "-R needs the rtds scheduler\n");
+        return 1;
+    }
+
+    sched.cpupool = &pool;
+    srand48(opt.seed);
+
+    if ( opt.trace )
+        trace_vcpus();
+    else
+        synthetic_vcpus();
+    if ( opt.duration <= 0 )
+        opt.duration = SECONDS(10);
+
+    if ( sched.global_init && sched.global_init() )
+        return 1;
+    if ( sched_init(&sched) )
+        return 1;
+
+    setup_cpus();
+    setup_domains();
+    if ( opt.rt_period )
+        setup_rtds();
+    insert_units();
+    if ( sched.sched_id == XEN_SCHEDULER_ARINC653 )
+        setup_arinc653();
+
+    run();
+    report();
+
+    return 0;
+}
@@ -0,0 +1,155 @@
+/*
+ * Userspace emulation of the hypervisor environment xen/common/timer.c is
+ * built against.
+ *
+ * A single thread plays all CPUs: sim_cpu is the one running, and sim_now
+ * the current system time.  Softirqs are only recorded as pending, for the
+ * test to run them.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms and conditions of the GNU General Public
+ * License, version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program; If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _TEST_TIMER_EMUL_
+#define _TEST_TIMER_EMUL_
+
+#include <assert.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <xen-tools/common-macros.h>
+
+/* Compiler annotations. */
+#define __init
+#define __read_mostly
+#define __ro_after_init
+#define __cacheline_aligned
+#define cf_check
+#define unlikely(x) __builtin_expect(!!(x), 0)
+#define likely(x) __builtin_expect(!!(x), 1)
+
+#define ASSERT(x) assert(x)
+#define BUG() assert(0)
+#define BUG_ON(x) assert(!(x))
+#define WARN_ON(x) assert(!(x))
+
+#define smp_wmb()
+#define prefetch(x) __builtin_prefetch(x)
+#define cpu_relax()
+#define read_atomic(p) (*(p))
+#define write_atomic(p, v) (*(p) = (v))
+
+#define ffs64(x) ((unsigned int)__builtin_ffsll(x))
+#define fls(x) ((x) ? 32 - (unsigned int)__builtin_clz(x) : 0)
+
+/* Command line parameters, exposed for the test to set. */
+#define integer_param(name, var) \
+    __typeof__(var) *const sim_param_##var = &(var)
+#define boolean_param(name, var) integer_param(name, var)
+
+extern unsigned int *const sim_param_timer_slop;
+extern bool *const sim_param_opt_timer_wheel;
+
+/* CPUs. */
+#define CONFIG_NR_CPUS 2
+#define NR_CPUS CONFIG_NR_CPUS
+
+extern unsigned int sim_cpu;
+#define smp_processor_id() sim_cpu
+
+#define DEFINE_PER_CPU(type, name) __typeof__(type) per_cpu__##name[NR_CPUS]
+#define DECLARE_PER_CPU(type, name) \
+    extern __typeof__(type) per_cpu__##name[NR_CPUS]
+#define per_cpu(name, cpu) (per_cpu__##name[cpu])
+#define this_cpu(name) per_cpu(name, smp_processor_id())
+
+extern bool sim_cpu_online[NR_CPUS];
+#define cpu_online(cpu) sim_cpu_online[cpu]
+#define cpumask_any(m) (sim_cpu_online[0] ? 0U : 1U)
+#define for_each_online_cpu(cpu)                  \
+    for ( (cpu) = 0; (cpu) < NR_CPUS; (cpu)++ )   \
+        if ( cpu_online(cpu) )
+#define park_offline_cpus false
+#define system_state 0
+#define SYS_STATE_suspend 1
+
+#define CPU_UP_PREPARE    0x0002
+#define CPU_UP_CANCELED   0x0003
+#define CPU_DEAD          0x0008
+#define CPU_REMOVE        0x0009
+#define CPU_RESUME_FAILED 0x000a
+#define NOTIFY_DONE       0x0000
+
+struct notifier_block {
+    int (*notifier_call)(struct notifier_block *nfb, unsigned long action,
+                         void *hcpu);
+    int priority;
+};
+
+void register_cpu_notifier(struct notifier_block *nfb);
+
+/* Locks, interrupts and RCU, all no-ops with a single thread. */
+typedef bool spinlock_t;
+#define spin_lock_init(l) (*(l) = false)
+#define _spin_lock(l) (*(l) = true)
+#define spin_lock(l) _spin_lock(l)
+#define spin_unlock(l) (*(l) = false)
+#define spin_lock_irq(l) spin_lock(l)
+#define spin_unlock_irq(l) spin_unlock(l)
+#define spin_lock_irqsave(l, f) ((void)(f), spin_lock(l))
+#define spin_unlock_irqrestore(l, f) ((void)(f), spin_unlock(l))
+#define local_irq_save(f) ((f) = 0)
+#define local_irq_restore(f) ((void)(f))
+#define block_lock_speculation()
+
+#define DEFINE_RCU_READ_LOCK(x) int x
+#define rcu_read_lock(x) ((void)(x))
+#define rcu_read_unlock(x) ((void)(x))
+
+/* Softirqs. */
+#define TIMER_SOFTIRQ 0
+
+extern void (*sim_timer_softirq)(void);
+extern bool sim_softirq_pending[NR_CPUS];
+
+#define open_softirq(nr, fn) (sim_timer_softirq = (fn))
+#define cpu_raise_softirq(cpu, nr) (sim_softirq_pending[cpu] = true)
+#define raise_softirq(nr) cpu_raise_softirq(smp_processor_id(), nr)
+
+/* Time. */
+typedef int64_t s_time_t;
+#define STIME_MAX ((s_time_t)((uint64_t)~0ULL >> 1))
+
+extern s_time_t sim_now;
+#define NOW() sim_now
+
+/* Memory. */
+#define xmalloc(type) ((type *)malloc(sizeof(type)))
+#define xmalloc_array(type, nr) ((type *)malloc(sizeof(type) * (nr)))
+#define xfree(p) free(p)
+
+/* Messages. */
+#define printk printf
+#define printk_once printf
+#define XENLOG_WARNING ""
+
+#define register_keyhandler(key, fn, desc, diag) ((void)(fn))
+
+#include "list.h"
+#include "timer.h"
+
+#endif
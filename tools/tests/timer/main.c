@@ -0,0 +1,397 @@
+/*
+ * Unit tests and microbenchmark of the timer code.
+ *
+ * CPU 0 keeps its timers on the heap, and CPU 1 on the timer wheel.  Random
+ * sets, stops and migrations of timers between them, with time moving on by
+ * steps from microseconds to minutes, are checked against a model of which
+ * timers are armed: none may expire early, be lost, or be left behind the
+ * deadline programmed in the time hardware.  Setting, stopping and expiring
+ * thousands of timers, as armed by mostly idle vCPUs, is then timed on each.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms and conditions of the GNU General Public
+ * License, version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program; If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "emul.h"
+
+#include <time.h>
+
+#define CHECK(cond, fmt, ...) ({                                        \
+    if ( !(cond) )                                                      \
+    {                                                                   \
+        fprintf(stderr, "%s:%d: check failed: " fmt "\n",               \
+                __FILE__, __LINE__, ## __VA_ARGS__);                    \
+        exit(1);                                                        \
+    }                                                                   \
+})
+
+#define HEAP_CPU  0
+#define WHEEL_CPU 1
+
+#define MS 1000000LL
+#define S  1000000000LL
+
+unsigned int sim_cpu;
+s_time_t sim_now;
+bool sim_cpu_online[NR_CPUS];
+bool sim_softirq_pending[NR_CPUS];
+void (*sim_timer_softirq)(void);
+
+static struct notifier_block *cpu_nfb;
+
+/* Time of the last softirq run on each CPU. */
+static s_time_t last_run[NR_CPUS];
+
+void register_cpu_notifier(struct notifier_block *nfb)
+{
+    cpu_nfb = nfb;
+}
+
+int reprogram_timer(s_time_t timeout)
+{
+    return 1;
+}
+
+static void cpu_notify(unsigned int cpu, unsigned long action)
+{
+    cpu_nfb->notifier_call(cpu_nfb, action, (void *)(unsigned long)cpu);
+}
+
+static void cpu_up(unsigned int cpu, bool wheel)
+{
+    *sim_param_opt_timer_wheel = wheel;
+    cpu_notify(cpu, CPU_UP_PREPARE);
+    sim_cpu_online[cpu] = true;
+}
+
+/* Run the timer softirq of @cpu as long as it is raised or due. */
+static void run_softirqs(unsigned int cpu)
+{
+    s_time_t deadline;
+
+    while ( sim_softirq_pending[cpu] ||
+            ((deadline = per_cpu(timer_deadline, cpu)) &&
+             deadline <= sim_now) )
+    {
+        sim_cpu = cpu;
+        sim_softirq_pending[cpu] = false;
+        last_run[cpu] = sim_now;
+        sim_timer_softirq();
+    }
+}
+
+struct test_timer {
+    struct timer timer;
+    bool armed;
+    bool rearm;
+    s_time_t expires;
+    unsigned int cpu;
+    unsigned long fired;
+};
+
+#define NR_TIMERS 1000
+static struct test_timer timers[NR_TIMERS];
+
+static void arm(struct test_timer *t, s_time_t expires)
+{
+    set_timer(&t->timer, expires);
+    t->armed = true;
+    t->expires = expires;
+}
+
+/* Delays from the past to beyond the horizon of the wheel. */
+static s_time_t random_delay(void)
+{
+    switch ( rand() % 8 )
+    {
+    case 0:
+        return -(rand() % MS);
+    case 1:
+        return rand() % 50000;
+    case 2: case 3:
+        return rand() % (10 * MS);
+    case 4: case 5:
+        return rand() % S;
+    case 6:
+        return (rand() % 100) * S + rand();
+    default:
+        return (rand() % 2000) * S + rand();
+    }
+}
+
+static void cf_check handler(void *data)
+{
+    struct test_timer *t = data;
+    unsigned int i = t - timers;
+
+    CHECK(t->armed, "timer %u fired while stopped", i);
+    CHECK(t->cpu == sim_cpu, "timer %u of CPU%u fired on CPU%u",
+          i, t->cpu, sim_cpu);
+    CHECK(t->expires < sim_now,
+          "timer %u fired at %"PRId64" before %"PRId64,
+          i, sim_now, t->expires);
+
+    t->armed = false;
+    t->fired++;
+
+    /* As periodic timers do. */
+    if ( t->rearm )
+        arm(t, sim_now + rand() % (10 * MS));
+}
+
+/*
+ * Unless a softirq is pending, the programmed deadline must not be past the
+ * earliest armed timer, give or take timer_slop from the last run.
+ */
+static void check_cpu(unsigned int cpu)
+{
+    s_time_t first = STIME_MAX, deadline = per_cpu(timer_deadline, cpu);
+    unsigned int i;
+
+    if ( sim_softirq_pending[cpu] )
+        return;
+
+    for ( i = 0; i < NR_TIMERS; i++ )
+        if ( timers[i].armed && timers[i].cpu == cpu )
+            first = min(first, timers[i].expires);
+
+    if ( first == STIME_MAX )
+        return;
+
+    CHECK(deadline, "CPU%u has no deadline, timer due at %"PRId64,
+          cpu, first);
+    CHECK(deadline <= MAX(first, last_run[cpu] + *sim_param_timer_slop),
+          "CPU%u deadline %"PRId64" after timer due at %"PRId64,
+          cpu, deadline, first);
+}
+
+static void step(void)
+{
+    unsigned int cpu;
+
+    for ( cpu = 0; cpu < NR_CPUS; cpu++ )
+        if ( sim_cpu_online[cpu] )
+        {
+            run_softirqs(cpu);
+            check_cpu(cpu);
+        }
+}
+
+static void test_random(void)
+{
+    unsigned long fired = 0;
+    unsigned int iter, i;
+
+    srand(1);
+
+    for ( i = 0; i < NR_TIMERS; i++ )
+    {
+        timers[i].cpu = i % NR_CPUS;
+        timers[i].rearm = !(i % 4);
+        init_timer(&timers[i].timer, handler, &timers[i], timers[i].cpu);
+    }
+
+    for ( iter = 0; iter < 200000; iter++ )
+    {
+        struct test_timer *t = &timers[rand() % NR_TIMERS];
+        unsigned int op = rand() % 16;
+        s_time_t when;
+
+        switch ( op )
+        {
+        case 0 ... 6:
+            arm(t, sim_now + random_delay());
+            break;
+
+        case 7: case 8:
+            stop_timer(&t->timer);
+            t->armed = false;
+            break;
+
+        case 9:
+            t->cpu = !t->cpu;
+            migrate_timer(&t->timer, t->cpu);
+            break;
+
+        case 10:
+            when = sim_now + random_delay();
+            CHECK(timer_is_active(&t->timer) == t->armed,
+                  "timer %zu active %d", t - timers, t->armed);
+            CHECK(timer_expires_before(&t->timer, when) ==
+                  (t->armed && t->expires <= when),
+                  "timer %zu expiring before %"PRId64, t - timers, when);
+            break;
+
+        default:
+            if ( op == 15 && !(iter % 64) )
+                sim_now += (rand() % 300) * S;
+            else
+                sim_now += rand() % (MS / 5);
+            break;
+        }
+
+        step();
+    }
+
+    /* Taking the wheel CPU down moves its timers to the heap CPU. */
+    sim_cpu_online[WHEEL_CPU] = false;
+    cpu_notify(WHEEL_CPU, CPU_DEAD);
+    for ( i = 0; i < NR_TIMERS; i++ )
+        timers[i].cpu = HEAP_CPU;
+    step();
+    cpu_up(WHEEL_CPU, true);
+
+    /* Let all timers expire. */
+    for ( i = 0; i < NR_TIMERS; i++ )
+        timers[i].rearm = false;
+    for ( iter = 0; iter < 3000; iter++ )
+    {
+        sim_now += S;
+        step();
+    }
+
+    for ( i = 0; i < NR_TIMERS; i++ )
+    {
+        CHECK(!timers[i].armed, "timer %u never fired", i);
+        fired += timers[i].fired;
+        kill_timer(&timers[i].timer);
+    }
+
+    CHECK(!per_cpu(timer_deadline, HEAP_CPU) &&
+          !per_cpu(timer_deadline, WHEEL_CPU), "deadlines left");
+    CHECK(fired, "no timer fired");
+}
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static unsigned long bench_fired;
+
+static s_time_t bench_delay(void)
+{
+    return MS + rand() % S;
+}
+
+static void cf_check bench_handler(void *data)
+{
+    struct timer *t = data;
+
+    bench_fired++;
+    set_timer(t, sim_now + bench_delay());
+}
+
+struct bench_result {
+    uint64_t set_ns, stop_ns, expire_ns;
+};
+
+/*
+ * Re-arm random timers among @nr armed ones, stop them all, and let them
+ * expire and re-arm themselves for a second.
+ */
+static void bench(unsigned int cpu, unsigned int nr, struct bench_result *res)
+{
+    struct timer *t = calloc(nr, sizeof(*t));
+    unsigned int nr_ops = 1000000, i;
+    unsigned int *order = malloc(nr_ops * sizeof(*order));
+    s_time_t *delay = malloc(nr_ops * sizeof(*delay)), end;
+    uint64_t start;
+
+    CHECK(t && order && delay, "allocation");
+
+    srand(nr);
+    for ( i = 0; i < nr_ops; i++ )
+    {
+        order[i] = rand() % nr;
+        delay[i] = bench_delay();
+    }
+
+    for ( i = 0; i < nr; i++ )
+    {
+        init_timer(&t[i], bench_handler, &t[i], cpu);
+        set_timer(&t[i], sim_now + delay[i]);
+        /* Let the heap grow. */
+        if ( !(i % 16) )
+            run_softirqs(cpu);
+    }
+    run_softirqs(cpu);
+
+    start = now_ns();
+    for ( i = 0; i < nr_ops; i++ )
+        set_timer(&t[order[i]], sim_now + delay[i]);
+    res->set_ns = (now_ns() - start) / nr_ops;
+
+    start = now_ns();
+    for ( i = 0; i < nr; i++ )
+        stop_timer(&t[i]);
+    res->stop_ns = (now_ns() - start) / nr;
+
+    for ( i = 0; i < nr; i++ )
+        set_timer(&t[i], sim_now + delay[i]);
+    run_softirqs(cpu);
+
+    bench_fired = 0;
+    start = now_ns();
+    for ( end = sim_now + S; sim_now < end; sim_now += MS / 20 )
+        run_softirqs(cpu);
+    res->expire_ns = (now_ns() - start) / (bench_fired ?: 1);
+
+    for ( i = 0; i < nr; i++ )
+        kill_timer(&t[i]);
+
+    free(t);
+    free(order);
+    free(delay);
+}
+
+int main(int argc, char **argv)
+{
+    static const unsigned int sizes[] = { 1000, 10000, 50000 };
+    struct bench_result heap, wheel;
+    unsigned int i;
+
+    sim_now = 10 * S;
+    sim_cpu = HEAP_CPU;
+    timer_init();
+    sim_cpu_online[HEAP_CPU] = true;
+    cpu_up(WHEEL_CPU, true);
+
+    test_random();
+
+    printf("Timer operations, ns/op (heap / wheel):\n");
+    printf("  %7s %15s %15s %15s\n", "timers", "set", "stop", "expire");
+    for ( i = 0; i < ARRAY_SIZE(sizes); i++ )
+    {
+        bench(HEAP_CPU, sizes[i], &heap);
+        bench(WHEEL_CPU, sizes[i], &wheel);
+        printf("  %7u %7"PRIu64" / %-5"PRIu64" %7"PRIu64" / %-5"PRIu64
+               " %7"PRIu64" / %-5"PRIu64"\n", sizes[i],
+               heap.set_ns, wheel.set_ns, heap.stop_ns, wheel.stop_ns,
+               heap.expire_ns, wheel.expire_ns);
+    }
+
+    return 0;
+}
+
+/*
+ * Local variables:
+ * mode: C
+ * c-file-style: "BSD"
+ * c-basic-offset: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
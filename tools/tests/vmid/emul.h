@@ -0,0 +1,163 @@
+/*
+ * Userspace emulation of the hypervisor environment xen/arch/arm/vmid.c is
+ * built against.
+ *
+ * A single thread plays all CPUs: sim_cpu is the one running.  The TLB
+ * flush is left to the test, to model the TLBs of each CPU.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms and conditions of the GNU General Public
+ * License, version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program; If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _TEST_VMID_EMUL_
+#define _TEST_VMID_EMUL_
+
+#include <assert.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <xen-tools/common-macros.h>
+
+/* Compiler annotations. */
+#define __init
+#define __read_mostly
+#define cf_check
+
+#define ASSERT(x) assert(x)
+#define BUG_ON(x) assert(!(x))
+#define panic(fmt, ...) \
+    (fprintf(stderr, "panic: " fmt, ## __VA_ARGS__), exit(1))
+
+#define smp_mb()
+#define read_atomic(p) (*(p))
+#define write_atomic(p, v) (*(p) = (v))
+#define cmpxchg64(p, o, n) ({                     \
+    uint64_t old_ = *(p);                         \
+    if ( old_ == (o) )                            \
+        *(p) = (n);                               \
+    old_;                                         \
+})
+
+/* VMIDs: the width is a variable, for the test to make it small. */
+#define CONFIG_ARM_64
+#define MAX_VMID_8_BIT  (1UL << 8)
+#define MAX_VMID_16_BIT (1UL << 16)
+#define INVALID_VMID 0
+extern unsigned int max_vmid;
+#define MAX_VMID max_vmid
+
+struct p2m_domain {
+    uint64_t vmid;
+};
+
+void p2m_vmid_allocator_init(void);
+uint16_t p2m_update_vmid(struct p2m_domain *p2m);
+
+/* Flushes the TLB entries of all VMIDs on the local CPU. */
+void flush_all_guests_tlb_local(void);
+
+/* CPUs. */
+#define CONFIG_NR_CPUS 4
+#define NR_CPUS CONFIG_NR_CPUS
+
+extern unsigned int sim_cpu;
+#define smp_processor_id() sim_cpu
+#define num_possible_cpus() NR_CPUS
+
+#define DEFINE_PER_CPU(type, name) __typeof__(type) per_cpu__##name[NR_CPUS]
+#define per_cpu(name, cpu) (per_cpu__##name[cpu])
+
+extern bool sim_cpu_online[NR_CPUS];
+#define for_each_online_cpu(cpu)                  \
+    for ( (cpu) = 0; (cpu) < NR_CPUS; (cpu)++ )   \
+        if ( sim_cpu_online[cpu] )
+
+typedef struct { unsigned long bits; } cpumask_t;
+#define cpumask_setall(m) ((m)->bits = (1UL << NR_CPUS) - 1)
+#define cpumask_set_cpu(cpu, m) ((m)->bits |= 1UL << (cpu))
+#define cpumask_test_and_clear_cpu(cpu, m) ({     \
+    bool set_ = (m)->bits & (1UL << (cpu));       \
+    (m)->bits &= ~(1UL << (cpu));                 \
+    set_;                                         \
+})
+
+#define CPU_UP_PREPARE    0x0002
+#define CPU_UP_CANCELED   0x0003
+#define CPU_DEAD          0x0008
+#define NOTIFY_DONE       0x0000
+
+struct notifier_block {
+    int (*notifier_call)(struct notifier_block *nfb, unsigned long action,
+                         void *hcpu);
+    int priority;
+};
+
+void register_cpu_notifier(struct notifier_block *nfb);
+
+#define presmp_initcall(fn) int (*const sim_presmp_initcall)(void) = (fn)
+extern int (*const sim_presmp_initcall)(void);
+
+/* Locks and interrupts, all no-ops with a single thread. */
+typedef bool spinlock_t;
+#define SPIN_LOCK_UNLOCKED false
+#define spin_lock(l) (*(l) = true)
+#define spin_unlock(l) (*(l) = false)
+#define spin_lock_irq(l) spin_lock(l)
+#define spin_unlock_irq(l) spin_unlock(l)
+#define local_irq_is_enabled() false
+
+/* Bitmaps. */
+#define BITS_PER_LONG (sizeof(unsigned long) * CHAR_BIT)
+#define BITS_TO_LONGS(bits) (((bits) + BITS_PER_LONG - 1) / BITS_PER_LONG)
+
+static inline void __set_bit(unsigned long nr, unsigned long *addr)
+{
+    addr[nr / BITS_PER_LONG] |= 1UL << (nr % BITS_PER_LONG);
+}
+#define set_bit __set_bit
+
+static inline bool __test_and_set_bit(unsigned long nr, unsigned long *addr)
+{
+    bool set = addr[nr / BITS_PER_LONG] & (1UL << (nr % BITS_PER_LONG));
+
+    __set_bit(nr, addr);
+
+    return set;
+}
+
+static inline void bitmap_zero(unsigned long *addr, unsigned long nbits)
+{
+    memset(addr, 0, BITS_TO_LONGS(nbits) * sizeof(*addr));
+}
+
+static inline unsigned long find_next_zero_bit(const unsigned long *addr,
+                                               unsigned long size,
+                                               unsigned long offset)
+{
+    for ( ; offset < size; offset++ )
+        if ( !(addr[offset / BITS_PER_LONG] &
+               (1UL << (offset % BITS_PER_LONG))) )
+            break;
+
+    return min(offset, size);
+}
+
+/* Memory. */
+#define xzalloc_array(type, nr) ((type *)calloc(nr, sizeof(type)))
+
+#endif
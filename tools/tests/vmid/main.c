@@ -0,0 +1,281 @@
+/*
+ * Unit tests of the Arm VMID allocator.
+ *
+ * With 3-bit VMIDs, far fewer than the domains run, vCPUs of random domains
+ * are scheduled in on random CPUs, while domains are destroyed and created
+ * and CPUs go offline and online.  A model of the TLBs of each CPU, filled
+ * as domains run and emptied by flush_all_guests_tlb_local(), checks that no
+ * domain ever runs with a VMID whose TLB entries belong to another, that
+ * domains running at once have distinct VMIDs, and that CPUs only flush
+ * their TLBs after a rollover or when coming up.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms and conditions of the GNU General Public
+ * License, version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program; If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "emul.h"
+
+#define CHECK(cond, fmt, ...) ({                                        \
+    if ( !(cond) )                                                      \
+    {                                                                   \
+        fprintf(stderr, "%s:%d: check failed: " fmt "\n",               \
+                __FILE__, __LINE__, ## __VA_ARGS__);                    \
+        exit(1);                                                        \
+    }                                                                   \
+})
+
+#define VMID_BITS  3
+#define NR_DOMAINS 32
+#define STEPS      1000000
+
+/* TLB entries left from before Xen started, or the CPU came up. */
+#define STALE (-1)
+/* No TLB entries, or no domain running. */
+#define NONE  (-2)
+
+unsigned int sim_cpu;
+bool sim_cpu_online[NR_CPUS];
+
+static struct notifier_block *cpu_nfb;
+
+static struct p2m_domain p2m[NR_DOMAINS];
+/* Unique identity of the domain in each slot, changed when recreated. */
+static int dom_id[NR_DOMAINS];
+static int next_dom_id;
+
+/* Domain whose entries each CPU's TLB holds, for each hardware VMID. */
+static int tlb[NR_CPUS][1U << VMID_BITS];
+/* Slot of the domain running on each CPU, and its hardware VMID. */
+static int running[NR_CPUS];
+static unsigned int running_vmid[NR_CPUS];
+/* Whether each CPU is allowed to flush its TLBs. */
+static bool may_flush[NR_CPUS];
+
+static uint64_t generation;
+static unsigned long schedules, rollovers, flushes, hotplugs;
+
+void register_cpu_notifier(struct notifier_block *nfb)
+{
+    cpu_nfb = nfb;
+}
+
+/* Note a rollover: it lets every CPU flush once. */
+static void check_generation(void)
+{
+    unsigned int d, cpu;
+
+    for ( d = 0; d < NR_DOMAINS; d++ )
+        if ( (p2m[d].vmid >> VMID_BITS) > generation )
+        {
+            CHECK((p2m[d].vmid >> VMID_BITS) == generation + 1,
+                  "generation %" PRIu64 " skipped", generation + 1);
+            generation++;
+            rollovers++;
+            for ( cpu = 0; cpu < NR_CPUS; cpu++ )
+                may_flush[cpu] = true;
+        }
+}
+
+void flush_all_guests_tlb_local(void)
+{
+    unsigned int vmid;
+
+    /* A new VMID is recorded before the CPU flushes for the rollover. */
+    check_generation();
+    CHECK(may_flush[sim_cpu], "CPU%u flushes its TLBs needlessly", sim_cpu);
+    may_flush[sim_cpu] = false;
+
+    for ( vmid = 0; vmid < max_vmid; vmid++ )
+        tlb[sim_cpu][vmid] = NONE;
+    flushes++;
+}
+
+static void cpu_notify(unsigned int cpu, unsigned long action)
+{
+    cpu_nfb->notifier_call(cpu_nfb, action, (void *)(unsigned long)cpu);
+}
+
+static void schedule(unsigned int cpu, unsigned int d)
+{
+    uint64_t gen = p2m[d].vmid >> VMID_BITS;
+    unsigned int vmid, other;
+
+    sim_cpu = cpu;
+    running[cpu] = NONE;
+
+    vmid = p2m_update_vmid(&p2m[d]);
+    schedules++;
+
+    CHECK(vmid != INVALID_VMID && vmid < max_vmid, "VMID %u", vmid);
+    CHECK(vmid == (p2m[d].vmid & (max_vmid - 1)),
+          "VMID %u returned, %#" PRIx64 " recorded", vmid, p2m[d].vmid);
+    CHECK((p2m[d].vmid >> VMID_BITS) >= gen, "d%d went back a generation",
+          dom_id[d]);
+
+    CHECK(tlb[cpu][vmid] == NONE || tlb[cpu][vmid] == dom_id[d],
+          "d%d runs on CPU%u with VMID %u holding entries of d%d",
+          dom_id[d], cpu, vmid, tlb[cpu][vmid]);
+
+    for_each_online_cpu ( other )
+    {
+        if ( running[other] == NONE )
+            continue;
+        if ( running[other] == (int)d )
+            CHECK(running_vmid[other] == vmid,
+                  "d%d runs with VMID %u on CPU%u and %u on CPU%u",
+                  dom_id[d], running_vmid[other], other, vmid, cpu);
+        else
+            CHECK(running_vmid[other] != vmid,
+                  "d%d on CPU%u and d%d on CPU%u share VMID %u",
+                  dom_id[running[other]], other, dom_id[d], cpu, vmid);
+    }
+
+    tlb[cpu][vmid] = dom_id[d];
+    running[cpu] = d;
+    running_vmid[cpu] = vmid;
+}
+
+static void destroy(unsigned int d)
+{
+    unsigned int cpu;
+
+    for ( cpu = 0; cpu < NR_CPUS; cpu++ )
+        if ( running[cpu] == (int)d )
+            running[cpu] = NONE;
+
+    /* As p2m_init() does for the domain created in the slot. */
+    p2m[d].vmid = INVALID_VMID;
+    dom_id[d] = next_dom_id++;
+}
+
+static void cpu_down(unsigned int cpu)
+{
+    sim_cpu_online[cpu] = false;
+    running[cpu] = NONE;
+    cpu_notify(cpu, CPU_DEAD);
+}
+
+static void cpu_up(unsigned int cpu, bool cancel)
+{
+    unsigned int vmid;
+
+    /* A CPU coming up may hold TLB entries of any VMID. */
+    for ( vmid = 0; vmid < max_vmid; vmid++ )
+        tlb[cpu][vmid] = STALE;
+    may_flush[cpu] = true;
+
+    cpu_notify(cpu, CPU_UP_PREPARE);
+    if ( cancel )
+        cpu_notify(cpu, CPU_UP_CANCELED);
+    else
+        sim_cpu_online[cpu] = true;
+}
+
+static void hotplug(unsigned int cpu)
+{
+    hotplugs++;
+
+    if ( sim_cpu_online[cpu] )
+        cpu_down(cpu);
+    else
+        cpu_up(cpu, !(rand() % 4));
+}
+
+int main(int argc, char **argv)
+{
+    unsigned int cpu, d, vmid, i;
+    unsigned long fast;
+
+    max_vmid = 1U << VMID_BITS;
+
+    for ( cpu = 0; cpu < NR_CPUS; cpu++ )
+    {
+        for ( vmid = 0; vmid < max_vmid; vmid++ )
+            tlb[cpu][vmid] = STALE;
+        running[cpu] = NONE;
+        may_flush[cpu] = true;
+    }
+    for ( d = 0; d < NR_DOMAINS; d++ )
+        destroy(d);
+
+    sim_presmp_initcall();
+    p2m_vmid_allocator_init();
+    generation = 1;
+
+    for ( cpu = 0; cpu < NR_CPUS; cpu++ )
+        cpu_up(cpu, false);
+
+    /* Domains keep their VMID while no rollover happens. */
+    for ( d = 0; d < max_vmid - 1; d++ )
+        schedule(d % NR_CPUS, d);
+    check_generation();
+    CHECK(!rollovers, "rollover with %u domains", max_vmid - 1);
+    fast = flushes;
+    for ( i = 0; i < 1000; i++ )
+    {
+        d = rand() % (max_vmid - 1);
+        vmid = p2m[d].vmid;
+        schedule(rand() % NR_CPUS, d);
+        CHECK(p2m[d].vmid == vmid, "d%d changed VMID without rollover",
+              dom_id[d]);
+    }
+    check_generation();
+    CHECK(!rollovers && flushes == fast,
+          "%lu rollovers, %lu flushes", rollovers, flushes - fast);
+
+    /* A CPU coming up flushes before running a domain, rollover or not. */
+    cpu = NR_CPUS - 1;
+    cpu_down(cpu);
+    cpu_up(cpu, false);
+    schedule(cpu, 0);
+    check_generation();
+    CHECK(!rollovers && !may_flush[cpu], "CPU%u didn't flush", cpu);
+
+    /* Then many more domains than VMIDs. */
+    for ( i = 0; i < STEPS; i++ )
+    {
+        unsigned int r = rand() % 1000;
+
+        cpu = rand() % NR_CPUS;
+        d = rand() % NR_DOMAINS;
+
+        if ( r < 5 )
+            destroy(d);
+        else if ( r < 7 && cpu )
+            hotplug(cpu);
+        else if ( r < 100 )
+            running[cpu] = NONE;
+        else if ( sim_cpu_online[cpu] )
+            schedule(cpu, d);
+
+        check_generation();
+    }
+
+    CHECK(rollovers > 1000, "only %lu rollovers", rollovers);
+
+    printf("%lu schedules of %d domains on %u CPUs with %u-bit VMIDs: "
+           "%lu rollovers, %lu TLB flushes, %lu CPU hotplugs\n",
+           schedules, NR_DOMAINS, NR_CPUS, VMID_BITS, rollovers, flushes,
+           hotplugs);
+
+    return 0;
+}
+
+/*
+ * Local variables:
+ * mode: C
+ * c-file-style: "BSD"
+ * c-basic-offset: 4
+ * tab-width: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -0,0 +1,196 @@
+/*
+ * Userspace emulation of the hypervisor environment xen/common/xmalloc_tlsf.c
+ * is built against.
+ *
+ * A single thread plays all CPUs: sim_cpu is the one running.  The xenheap is
+ * an arena of pages handed out one at a time, with a page_info of each.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms and conditions of the GNU General Public
+ * License, version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program; If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _TEST_XMALLOC_EMUL_
+#define _TEST_XMALLOC_EMUL_
+
+#include <assert.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <xen-tools/common-macros.h>
+
+typedef uint8_t u8;
+typedef uint32_t u32;
+
+/* Compiler annotations. */
+#define __init
+#define __read_mostly
+#define __ro_after_init
+#define cf_check
+#define unlikely(x) __builtin_expect(!!(x), 0)
+#define likely(x) __builtin_expect(!!(x), 1)
+#define IS_ENABLED(option) (option)
+
+/* Build with -DCONFIG_XMEM_POOL_POISON=1 to test poisoning. */
+#ifndef CONFIG_XMEM_POOL_POISON
+#define CONFIG_XMEM_POOL_POISON 0
+#endif
+
+#define ASSERT(x) assert(x)
+#define BUG() assert(0)
+#define BUG_ON(x) assert(!(x))
+#define ASSERT_ALLOC_CONTEXT()
+
+#define smp_wmb()
+#define prefetch(x) __builtin_prefetch(x)
+
+#define ffs(x) __builtin_ffs(x)
+#define flsl(x) ((x) ? 64 - (int)__builtin_clzl(x) : 0)
+#define set_bit(nr, addr) (*(addr) |= 1U << (nr))
+#define clear_bit(nr, addr) (*(addr) &= ~(1U << (nr)))
+
+static inline void *memchr_inv(const void *s, int c, size_t n)
+{
+    const unsigned char *p = s;
+
+    for ( ; n; p++, n-- )
+        if ( *p != (unsigned char)c )
+            return (void *)p;
+
+    return NULL;
+}
+
+#define strlcpy(d, s, n) snprintf(d, n, "%s", s)
+
+/* Command line parameters and initcalls, exposed for the test to use. */
+#define boolean_param(name, var) \
+    __typeof__(var) *const sim_param_##var = &(var)
+#define presmp_initcall(fn) int (*const sim_initcall)(void) = (fn)
+
+extern bool *const sim_param_opt_xmalloc_cache;
+extern int (*const sim_initcall)(void);
+
+/* CPUs. */
+#define NR_CPUS 4
+
+extern unsigned int sim_cpu;
+#define smp_processor_id() sim_cpu
+
+#define DEFINE_PER_CPU(type, name) __typeof__(type) per_cpu__##name[NR_CPUS]
+#define per_cpu(name, cpu) (per_cpu__##name[cpu])
+#define this_cpu(name) per_cpu(name, smp_processor_id())
+
+extern bool sim_cpu_online[NR_CPUS];
+#define for_each_online_cpu(cpu)                  \
+    for ( (cpu) = 0; (cpu) < NR_CPUS; (cpu)++ )   \
+        if ( sim_cpu_online[cpu] )
+
+#define CPU_UP_PREPARE    0x0002
+#define CPU_UP_CANCELED   0x0003
+#define CPU_DEAD          0x0008
+#define NOTIFY_DONE       0x0000
+
+struct notifier_block {
+    int (*notifier_call)(struct notifier_block *nfb, unsigned long action,
+                         void *hcpu);
+    int priority;
+};
+
+void register_cpu_notifier(struct notifier_block *nfb);
+
+/*
+ * Locks, never contended with a single thread, but taken with an atomic
+ * operation as in the hypervisor, for the benchmark to account for it.
+ */
+typedef bool spinlock_t;
+#define DEFINE_SPINLOCK(l) spinlock_t l
+#define spin_lock_init(l) (*(l) = false)
+#define spin_lock(l) ((void)__atomic_exchange_n(l, true, __ATOMIC_ACQUIRE))
+#define spin_unlock(l) __atomic_store_n(l, false, __ATOMIC_RELEASE)
+
+/* Pages. */
+#define PAGE_SHIFT 12
+#define PAGE_SIZE (1UL << PAGE_SHIFT)
+#define PAGE_MASK (~(PAGE_SIZE - 1))
+#define PAGE_ALIGN(x) (((x) + PAGE_SIZE - 1) & PAGE_MASK)
+#define PFN_UP(x) (((x) + PAGE_SIZE - 1) >> PAGE_SHIFT)
+
+struct page_info {
+    unsigned long order;
+};
+
+#define SIM_PAGES (1U << 18)
+
+extern char *sim_arena;
+extern struct page_info sim_pages[SIM_PAGES];
+extern unsigned long sim_pages_used;
+
+#define virt_to_page(p) \
+    (&sim_pages[((char *)(p) - sim_arena) >> PAGE_SHIFT])
+#define PFN_ORDER(pg) ((pg)->order)
+
+static inline unsigned int get_order_from_bytes(unsigned long size)
+{
+    unsigned int order = 0;
+
+    while ( (PAGE_SIZE << order) < size )
+        order++;
+
+    return order;
+}
+
+#define get_order_from_pages(nr) get_order_from_bytes((nr) << PAGE_SHIFT)
+
+void *alloc_xenheap_pages(unsigned int order, unsigned int memflags);
+void free_xenheap_pages(void *v, unsigned int order);
+#define alloc_xenheap_page() alloc_xenheap_pages(0, 0)
+#define free_xenheap_page(v) free_xenheap_pages(v, 0)
+
+/* The allocator. */
+#define ZERO_BLOCK_PTR ((void *)-1L)
+
+struct xmem_pool;
+typedef void *(xmem_pool_get_memory)(unsigned long bytes);
+typedef void (xmem_pool_put_memory)(void *ptr);
+
+struct xmem_pool *xmem_pool_create(
+    const char *name, xmem_pool_get_memory get_mem,
+    xmem_pool_put_memory put_mem, unsigned long max_size,
+    unsigned long grow_size);
+void xmem_pool_destroy(struct xmem_pool *pool);
+void *xmem_pool_alloc(unsigned long size, struct xmem_pool *pool);
+void xmem_pool_free(void *ptr, struct xmem_pool *pool);
+unsigned long xmem_pool_get_used_size(struct xmem_pool *pool);
+unsigned long xmem_pool_get_total_size(struct xmem_pool *pool);
+int xmem_pool_maxalloc(struct xmem_pool *pool);
+
+void *_xmalloc(unsigned long size, unsigned long align);
+void *_xzalloc(unsigned long size, unsigned long align);
+void *_xrealloc(void *ptr, unsigned long size, unsigned long align);
+void xfree(void *p);
+
+/* Messages. */
+#define printk printf
+#define XENLOG_ERR ""
+
+#define register_keyhandler(key, fn, desc, diag) \
+    (sim_keyhandler = (fn))
+
+extern void (*sim_keyhandler)(unsigned char key);
+
+#include "list.h"
+
+#endif
@@ -0,0 +1,410 @@
+/*
+ * Unit tests and microbenchmark of xmalloc() and its per-CPU caches.
+ *
+ * Random allocations, reallocations and frees of all sizes and alignments,
+ * made and freed on random CPUs which come and go, are checked not to
+ * overlap or move contents, and every page to be given back in the end.
+ * Allocating and freeing small objects is then timed through the caches and
+ * through a TLSF pool of its own.  With a single thread, this only compares
+ * the length of the paths: contention on the pool lock isn't modelled.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms and conditions of the GNU General Public
+ * License, version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program; If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "emul.h"
+
+#include <sys/mman.h>
+#include <time.h>
+
+#define CHECK(cond, fmt, ...) ({                                        \
+    if ( !(cond) )                                                      \
+    {                                                                   \
+        fprintf(stderr, "%s:%d: check failed: " fmt "\n",               \
+                __FILE__, __LINE__, ## __VA_ARGS__);                    \
+        exit(1);                                                        \
+    }                                                                   \
+})
+
+unsigned int sim_cpu;
+bool sim_cpu_online[NR_CPUS];
+void (*sim_keyhandler)(unsigned char key);
+
+char *sim_arena;
+struct page_info sim_pages[SIM_PAGES];
+unsigned long sim_pages_used;
+
+/* Next never used page, and freed pages chained through their first word. */
+static unsigned long next_page;
+static void *free_pages;
+
+static struct notifier_block *cpu_nfb;
+
+void register_cpu_notifier(struct notifier_block *nfb)
+{
+    cpu_nfb = nfb;
+}
+
+void *alloc_xenheap_pages(unsigned int order, unsigned int memflags)
+{
+    void *p;
+
+    sim_pages_used += 1UL << order;
+
+    if ( !order && free_pages )
+    {
+        p = free_pages;
+        free_pages = *(void **)p;
+        return p;
+    }
+
+    next_page = ROUNDUP(next_page, order);
+    CHECK(next_page + (1UL << order) <= SIM_PAGES, "out of pages");
+    p = sim_arena + (next_page << PAGE_SHIFT);
+    next_page += 1UL << order;
+
+    return p;
+}
+
+void free_xenheap_pages(void *v, unsigned int order)
+{
+    unsigned long i;
+
+    CHECK(sim_pages_used >= (1UL << order), "freeing unallocated pages");
+    sim_pages_used -= 1UL << order;
+
+    for ( i = 0; i < (1UL << order); i++ )
+    {
+        void *p = v + (i << PAGE_SHIFT);
+
+        *(void **)p = free_pages;
+        free_pages = p;
+    }
+}
+
+static void cpu_notify(unsigned int cpu, unsigned long action)
+{
+    if ( cpu_nfb )
+        cpu_nfb->notifier_call(cpu_nfb, action, (void *)(unsigned long)cpu);
+}
+
+static void cpu_up(unsigned int cpu)
+{
+    cpu_notify(cpu, CPU_UP_PREPARE);
+    sim_cpu_online[cpu] = true;
+}
+
+static void cpu_down(unsigned int cpu)
+{
+    sim_cpu_online[cpu] = false;
+    cpu_notify(cpu, CPU_DEAD);
+}
+
+static unsigned int random_cpu(void)
+{
+    unsigned int cpu;
+
+    do {
+        cpu = rand() % NR_CPUS;
+    } while ( !sim_cpu_online[cpu] );
+
+    return cpu;
+}
+
+struct object {
+    unsigned char *p;
+    unsigned long size;
+    unsigned long align;
+    unsigned char fill;
+};
+
+#define NR_OBJECTS 20000
+static struct object objects[NR_OBJECTS];
+
+static unsigned long random_size(void)
+{
+    switch ( rand() % 20 )
+    {
+    case 0:
+        return 1 + rand() % 6000;
+    case 1 ... 5:
+        return 1 + rand() % 2100;
+    default:
+        return 1 + rand() % 256;
+    }
+}
+
+static unsigned long random_align(void)
+{
+    static const unsigned long aligns[] = { 1, 4, 8, 8, 8, 16, 64, 256 };
+
+    return aligns[rand() % ARRAY_SIZE(aligns)];
+}
+
+static void check_object(const struct object *o)
+{
+    unsigned long i;
+
+    for ( i = 0; i < o->size; i++ )
+        CHECK(o->p[i] == o->fill, "object %zu byte %lu overwritten",
+              o - objects, i);
+}
+
+static void fill_object(struct object *o)
+{
+    CHECK(o->p && o->p != ZERO_BLOCK_PTR, "allocation of %lu bytes failed",
+          o->size);
+    CHECK(!((unsigned long)o->p & (o->align - 1)),
+          "%p not aligned to %lu", o->p, o->align);
+
+    o->fill = rand();
+    memset(o->p, o->fill, o->size);
+}
+
+static void test_random(void)
+{
+    unsigned long baseline = sim_pages_used;
+    unsigned int iter, i;
+
+    srand(1);
+
+    for ( iter = 0; iter < 1000000; iter++ )
+    {
+        struct object *o = &objects[rand() % NR_OBJECTS];
+
+        sim_cpu = random_cpu();
+
+        if ( !o->p )
+        {
+            o->size = random_size();
+            o->align = random_align();
+            o->p = _xmalloc(o->size, o->align);
+            fill_object(o);
+        }
+        else if ( !(rand() % 8) )
+        {
+            unsigned long size = random_size();
+
+            /* Reallocations keep the alignment. */
+            check_object(o);
+            o->p = _xrealloc(o->p, size, o->align);
+            o->size = min(o->size, size);
+            check_object(o);
+            o->size = size;
+            fill_object(o);
+        }
+        else
+        {
+            check_object(o);
+            xfree(o->p);
+            o->p = NULL;
+        }
+
+        /* Cycle CPUs other than the boot one, returning their caches. */
+        if ( !(iter % 50000) )
+        {
+            unsigned int cpu = 1 + rand() % (NR_CPUS - 1);
+
+            if ( sim_cpu_online[cpu] )
+                cpu_down(cpu);
+            else
+                cpu_up(cpu);
+        }
+    }
+
+    for ( i = 0; i < NR_OBJECTS; i++ )
+        if ( objects[i].p )
+        {
+            sim_cpu = random_cpu();
+            check_object(&objects[i]);
+            xfree(objects[i].p);
+            objects[i].p = NULL;
+        }
+
+    sim_cpu = 0;
+    sim_keyhandler('X');
+
+    for ( i = 1; i < NR_CPUS; i++ )
+        if ( sim_cpu_online[i] )
+            cpu_down(i);
+    cpu_notify(0, CPU_DEAD);
+
+    CHECK(sim_pages_used == baseline, "%lu pages leaked",
+          sim_pages_used - baseline);
+
+    cpu_notify(0, CPU_UP_PREPARE);
+    for ( i = 1; i < NR_CPUS; i++ )
+        cpu_up(i);
+}
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void *cf_check pool_get(unsigned long size)
+{
+    return alloc_xenheap_page();
+}
+
+static void cf_check pool_put(void *p)
+{
+    free_xenheap_page(p);
+}
+
+static struct xmem_pool *bench_pool;
+
+static void *bench_alloc(unsigned long size)
+{
+    return bench_pool ? xmem_pool_alloc(size, bench_pool)
+                      : _xmalloc(size, sizeof(void *));
+}
+
+static void bench_free(void *p)
+{
+    if ( bench_pool )
+        xmem_pool_free(p, bench_pool);
+    else
+        xfree(p);
+}
+
+#define NR_OPS 10000000
+
+/* Allocate and free an object of one size, over and over. */
+static uint64_t bench_same(void)
+{
+    uint64_t start = now_ns();
+    unsigned int i;
+
+    for ( i = 0; i < NR_OPS; i++ )
+        bench_free(bench_alloc(64));
+
+    return (now_ns() - start) / NR_OPS;
+}
+
+/* Replace random objects of common sizes among a few thousands. */
+static uint64_t bench_mixed(void)
+{
+    static const unsigned long sizes[] = { 24, 40, 64, 100, 200, 320, 1000 };
+    enum { NR_LIVE = 4096 };
+    static void *live[NR_LIVE];
+    static unsigned int slot[NR_OPS / 10], size[NR_OPS / 10];
+    unsigned int i;
+    uint64_t start;
+
+    srand(2);
+    for ( i = 0; i < ARRAY_SIZE(slot); i++ )
+    {
+        slot[i] = rand() % NR_LIVE;
+        size[i] = sizes[rand() % ARRAY_SIZE(sizes)];
+    }
+    for ( i = 0; i < NR_LIVE; i++ )
+        live[i] = bench_alloc(sizes[i % ARRAY_SIZE(sizes)]);
+
+    start = now_ns();
+    for ( i = 0; i < NR_OPS; i++ )
+    {
+        unsigned int j = i % ARRAY_SIZE(slot);
+
+        bench_free(live[slot[j]]);
+        live[slot[j]] = bench_alloc(size[j]);
+    }
+    start = (now_ns() - start) / NR_OPS;
+
+    for ( i = 0; i < NR_LIVE; i++ )
+        bench_free(live[i]);
+
+    return start;
+}
+
+/* Allocate objects on one CPU and free them on another. */
+static uint64_t bench_remote(void)
+{
+    enum { BATCH = 256 };
+    void *batch[BATCH];
+    unsigned int i, j;
+    uint64_t start = now_ns();
+
+    for ( i = 0; i < NR_OPS; i += BATCH )
+    {
+        sim_cpu = 0;
+        for ( j = 0; j < BATCH; j++ )
+            batch[j] = bench_alloc(96);
+        sim_cpu = 1;
+        for ( j = 0; j < BATCH; j++ )
+            bench_free(batch[j]);
+    }
+    sim_cpu = 0;
+
+    return (now_ns() - start) / NR_OPS;
+}
+
+int main(int argc, char **argv)
+{
+    static const struct {
+        const char *name;
+        uint64_t (*fn)(void);
+    } benches[] = {
+        { "same size", bench_same },
+        { "mixed sizes", bench_mixed },
+        { "remote free", bench_remote },
+    };
+    unsigned int i;
+
+    sim_arena = mmap(NULL, (unsigned long)SIM_PAGES << PAGE_SHIFT,
+                     PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    CHECK(sim_arena != MAP_FAILED, "mapping the arena");
+
+    sim_cpu_online[0] = true;
+    CHECK(*sim_param_opt_xmalloc_cache, "caches disabled by default");
+    sim_initcall();
+    for ( i = 1; i < NR_CPUS; i++ )
+        cpu_up(i);
+
+    test_random();
+
+    bench_pool = xmem_pool_create("bench", pool_get, pool_put, 0, PAGE_SIZE);
+    CHECK(bench_pool, "creating the pool");
+
+    printf("Allocation and free, ns/op (pool / cached):\n");
+    for ( i = 0; i < ARRAY_SIZE(benches); i++ )
+    {
+        struct xmem_pool *pool = bench_pool;
+        uint64_t pool_ns, cached_ns;
+
+        pool_ns = benches[i].fn();
+        bench_pool = NULL;
+        cached_ns = benches[i].fn();
+        bench_pool = pool;
+
+        printf("  %-12s %5"PRIu64" / %-5"PRIu64"\n", benches[i].name,
+               pool_ns, cached_ns);
+    }
+
+    xmem_pool_destroy(bench_pool);
+
+    return 0;
+}
+
+/*
+ * Local variables:
+ * mode: C
+ * c-file-style: "BSD"
+ * c-basic-offset: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
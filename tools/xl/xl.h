@@ -41,6 +41,8 @@ struct domain_create {
     int checkpointed_stream;
     int ignore_global_affinity_masks;
     const char *config_file;
+    const char *profile; /* file to write the creation profile to */
+    const char *record_template; /* file to record a domain template to */
     char *extra_config; /* extra config string */
     const char *restore_file;
     char *colo_proxy_script;
@@ -33,7 +33,13 @@ const struct cmd_spec cmd_table[] = {
       "-n, --dryrun            Dry run - prints the resulting configuration\n"
       "                         (deprecated in favour of global -N option).\n"
       "-p                      Leave the domain paused after it is created.\n"
+      "-P FILE, --profile=FILE\n"
+      "                        Write the duration of each phase of the domain\n"
+      "                        creation to FILE, as JSON.\n"
       "-q, --quiet             Quiet.\n"
+      "-T FILE, --record-template=FILE\n"
+      "                        Record the kernel of the domain as a domain\n"
+      "                        template in FILE.\n"
       "-V, --vncviewer         Connect to the VNC display after the domain is created.\n"
       "-A, --vncviewer-autopass\n"
       "                        Pass VNC password to viewer via stdin.\n"
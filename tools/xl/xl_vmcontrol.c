@@ -945,8 +945,36 @@ start:
         domid = domid_soft_reset;
         domid_soft_reset = INVALID_DOMID;
     } else {
+        if (dom_info->profile &&
+            libxl_domain_create_profile(ctx, dom_info->profile)) {
+            fprintf(stderr, "Failed to set up the creation profile\n");
+            ret = ERROR_FAIL;
+            goto error_out;
+        }
+        if (dom_info->record_template &&
+            libxl_domain_create_template(ctx, dom_info->record_template)) {
+            fprintf(stderr, "Failed to set up the domain template\n");
+            ret = ERROR_FAIL;
+            goto error_out;
+        }
         ret = libxl_domain_create_new(ctx, &d_config, &domid,
                                       0, autoconnect_console_how);
+        if (dom_info->record_template) {
+            /* Rebooting must not overwrite the template. */
+            libxl_domain_create_template(ctx, NULL);
+            if (!ret && !dom_info->quiet)
+                fprintf(stderr, "Domain template written to %s\n",
+                        dom_info->record_template);
+            dom_info->record_template = NULL;
+        }
+        if (dom_info->profile) {
+            /* Only profile the initial creation, not reboots. */
+            libxl_domain_create_profile(ctx, NULL);
+            if (libxl_domain_create_profile_written(ctx) && !dom_info->quiet)
+                fprintf(stderr, "Creation profile written to %s\n",
+                        dom_info->profile);
+            dom_info->profile = NULL;
+        }
     }
     if ( ret )
         goto error_out;
@@ -1194,7 +1222,9 @@ int main_create(int argc, char **argv)
         {"defconfig", 1, 0, 'f'},
         {"dryrun", 0, 0, 'n'},
         {"ignore-global-affinity-masks", 0, 0, 'i'},
+        {"profile", 1, 0, 'P'},
         {"quiet", 0, 0, 'q'},
+        {"record-template", 1, 0, 'T'},
         {"vncviewer", 0, 0, 'V'},
         {"vncviewer-autopass", 0, 0, 'A'},
         COMMON_LONG_OPTS
@@ -1205,13 +1235,19 @@ int main_create(int argc, char **argv)
         argc--; argv++;
     }
 
-    SWITCH_FOREACH_OPT(opt, "AFVcdef:inpq", opts, "create", 0) {
+    SWITCH_FOREACH_OPT(opt, "AFP:T:Vcdef:inpq", opts, "create", 0) {
     case 'A':
         dom_info.vnc = dom_info.vncautopass = 1;
         break;
     case 'F':
         dom_info.daemonize = 0;
         break;
+    case 'P':
+        dom_info.profile = optarg;
+        break;
+    case 'T':
+        dom_info.record_template = optarg;
+        break;
     case 'V':
         dom_info.vnc = 1;
         break;
@@ -66,10 +66,18 @@ long arch_do_domctl(struct xen_domctl *domctl, struct domain *d,
         if ( gfn_x(e) < gfn_x(s) )
             return -EINVAL;
 
-        /* XXX: Handle preemption */
-        do
-            rc = p2m_cache_flush_range(d, &s, e);
-        while ( rc == -ERESTART );
+        rc = p2m_cache_flush_range(d, &s, e);
+        if ( rc == -ERESTART )
+        {
+            /* Continue with the part of the range left to flush. */
+            domctl->u.cacheflush.start_pfn = gfn_x(s);
+            domctl->u.cacheflush.nr_pfns = gfn_x(e) - gfn_x(s);
+            if ( __copy_field_to_guest(u_domctl, domctl, u.cacheflush) )
+                rc = -EFAULT;
+            else
+                rc = hypercall_create_continuation(__HYPERVISOR_domctl,
+                                                   "h", u_domctl);
+        }
 
         return rc;
     }
@@ -179,6 +187,55 @@ long arch_do_domctl(struct xen_domctl *domctl, struct domain *d,
     }
     case XEN_DOMCTL_dt_overlay:
         return dt_overlay_domctl(d, &domctl->u.dt_overlay);
+
+    case XEN_DOMCTL_shadow_op:
+    {
+        struct xen_domctl_shadow_op *sc = &domctl->u.shadow_op;
+        int rc;
+
+        if ( unlikely(d == current->domain) )
+        {
+            gdprintk(XENLOG_INFO, "Tried to do a paging op on itself.\n");
+            return -EINVAL;
+        }
+
+        rc = xsm_shadow_control(XSM_HOOK, d, sc->op);
+        if ( rc )
+            return rc;
+
+        /* Only log-dirty is supported, the p2m is always "translated". */
+        switch ( sc->op )
+        {
+        case XEN_DOMCTL_SHADOW_OP_ENABLE:
+            if ( !(sc->mode & XEN_DOMCTL_SHADOW_ENABLE_LOG_DIRTY) )
+                return -EOPNOTSUPP;
+            fallthrough;
+        case XEN_DOMCTL_SHADOW_OP_ENABLE_LOGDIRTY:
+            rc = p2m_log_dirty_enable(d);
+            break;
+
+        case XEN_DOMCTL_SHADOW_OP_OFF:
+            rc = p2m_log_dirty_disable(d);
+            break;
+
+        case XEN_DOMCTL_SHADOW_OP_CLEAN:
+        case XEN_DOMCTL_SHADOW_OP_PEEK:
+            rc = p2m_log_dirty_op(d, sc);
+            if ( !rc )
+                rc = copy_to_guest(u_domctl, domctl, 1) ? -EFAULT : 0;
+            break;
+
+        default:
+            rc = -EOPNOTSUPP;
+            break;
+        }
+
+        if ( rc == -ERESTART )
+            rc = hypercall_create_continuation(__HYPERVISOR_domctl,
+                                               "h", u_domctl);
+
+        return rc;
+    }
     default:
         return subarch_do_domctl(domctl, d, u_domctl);
     }
@@ -50,6 +50,9 @@ static struct page_info *translate_get_page(copy_info_t info, uint64_t addr,
         return NULL;
     }
 
+    if ( write && p2mt == p2m_ram_logdirty )
+        p2m_log_dirty_mark(info.gpa.d, gaddr_to_gfn(addr), 1);
+
     return page;
 }
 
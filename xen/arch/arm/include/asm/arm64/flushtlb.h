@@ -72,6 +72,9 @@ TLB_HELPER(flush_guest_tlb_local, vmalls12e1, nsh)
 /* Flush innershareable TLBs, current VMID only */
 TLB_HELPER(flush_guest_tlb, vmalls12e1is, ish)
 
+/* Flush innershareable stage-1 and combined TLB entries, current VMID only */
+TLB_HELPER(flush_guest_tlb_stage1, vmalle1is, ish)
+
 /* Flush local TLBs, all VMIDs, non-hypervisor mode */
 TLB_HELPER(flush_all_guests_tlb_local, alle1, nsh)
 
@@ -87,6 +90,43 @@ TLB_HELPER_VA(__flush_xen_tlb_one_local, vae2)
 /* Flush TLB of all processors in the inner-shareable domain for address va. */
 TLB_HELPER_VA(__flush_xen_tlb_one, vae2is)
 
+/*
+ * Flush stage-2 TLB entries of the current VMID for the IPA ipa, in the
+ * inner-shareable domain.
+ */
+TLB_HELPER_VA(__flush_guest_tlb_one_ipa, ipas2e1is)
+
+/*
+ * Range invalidation (FEAT_TLBIRANGE): operand of TLBI R*IS covering
+ * (num + 1) << (5 * scale + 1) pages from page number base, with 4K
+ * translation granule (TG = 1) and no level hint.
+ */
+#define TLBI_RANGE_PAGES(num, scale) \
+    ((unsigned long)((num) + 1) << (5 * (scale) + 1))
+#define TLBI_RANGE_MAX_PAGES TLBI_RANGE_PAGES(31, 3)
+#define TLBI_RANGE_OP(base, scale, num)                     \
+    (((uint64_t)(base) & GENMASK_ULL(36, 0)) |              \
+     ((uint64_t)(num) << 39) | ((uint64_t)(scale) << 44) |  \
+     (1ULL << 46))
+
+/*
+ * Flush stage-2 TLB entries of the current VMID for the IPA range encoded
+ * in op, in the inner-shareable domain.  TLBI RIPAS2E1IS is spelled as a
+ * SYS instruction for assemblers without Armv8.4 support.
+ */
+static inline void __flush_guest_tlb_range_ipa(uint64_t op)
+{
+    asm volatile(
+        "sys  #4, c8, c0, #2, %0;"
+        ALTERNATIVE(
+            "nop; nop;",
+            "dsb  ish;"
+            "sys  #4, c8, c0, #2, %0;",
+            ARM64_WORKAROUND_REPEAT_TLBI,
+            CONFIG_ARM64_WORKAROUND_REPEAT_TLBI)
+        : : "r" (op) : "memory");
+}
+
 #undef TLB_HELPER
 #undef TLB_HELPER_VA
 
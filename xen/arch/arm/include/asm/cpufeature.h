@@ -38,6 +38,12 @@
 #define cpu_has_sve       0
 #endif
 
+#ifdef CONFIG_ARM_64
+#define cpu_has_tlb_range (system_cpuinfo.isa64.tlb >= 2)
+#else
+#define cpu_has_tlb_range 0
+#endif
+
 #ifdef CONFIG_ARM_32
 #define cpu_has_gicv3     (boot_cpu_feature32(gic) >= 1)
 #define cpu_has_gentimer  (boot_cpu_feature32(gentimer) == 1)
@@ -19,9 +19,7 @@ static inline void gnttab_clear_flags(struct domain *d,
 
 static inline void gnttab_mark_dirty(struct domain *d, mfn_t mfn)
 {
-#ifndef NDEBUG
-    printk_once(XENLOG_G_WARNING "gnttab_mark_dirty not implemented yet\n");
-#endif
+    p2m_log_dirty_mark_mfn(d, mfn);
 }
 
 static inline bool gnttab_host_mapping_get_page_type(bool ro,
@@ -29,6 +29,7 @@ extern unsigned int max_vmid;
 #endif
 
 struct domain;
+struct xen_domctl_shadow_op;
 
 extern void memory_type_changed(struct domain *d);
 
@@ -45,10 +46,13 @@ struct p2m_domain {
     /* The root of the p2m tree. May be concatenated */
     struct page_info *root;
 
-    /* Current VMID in use */
-    uint16_t vmid;
+    /*
+     * VMID in use in the low bits, and generation it was allocated in above
+     * them.  0 until a vCPU of the domain first runs.
+     */
+    uint64_t vmid;
 
-    /* Current Translation Table Base Register for the p2m */
+    /* Translation Table Base Register the p2m was last loaded with */
     uint64_t vttbr;
 
     /* Highest guest frame that's ever been mapped in the p2m */
@@ -75,6 +79,13 @@ struct p2m_domain {
      */
     bool need_flush;
 
+    /*
+     * Deferred flush of the TLB entries for [flush_gfn, flush_gfn + flush_nr)
+     * only, when need_flush isn't set.
+     */
+    gfn_t flush_gfn;
+    unsigned long flush_nr;
+
     /* Gather some statistics for information purposes only */
     struct {
         /* Number of mappings at each p2m tree level */
@@ -82,8 +93,17 @@ struct p2m_domain {
         /* Number of times we have shattered a mapping
          * at each p2m tree level. */
         unsigned long shattered[4];
+        /* Number of tables merged back into a mapping at each level. */
+        unsigned long coalesced[4];
+        /* Entries written by p2m_set_entry(), and table walks to do so. */
+        unsigned long entries, walks;
+        /* TLB flushes of the whole VMID, and by IPA range. */
+        unsigned long tlb_flushes, tlb_range_flushes, tlb_range_pages;
     } stats;
 
+    /* Where the background scan merging tables back into blocks resumes. */
+    gfn_t coalesce_gfn;
+
     /*
      * If true, and an access fault comes in and there is no vm_event listener,
      * pause domain. Otherwise, remove access restrictions.
@@ -106,6 +126,50 @@ struct p2m_domain {
      */
     struct radix_tree_root mem_access_settings;
 
+    /* Log-dirty tracking, driven by XEN_DOMCTL_shadow_op. */
+    struct {
+        /* Protects the bitmap trees and the counters below. */
+        spinlock_t lock;
+
+        /* Whether dirty pages are currently being logged. */
+        bool enabled;
+
+        /*
+         * Where to resume the (preemptible) retyping of the p2m when
+         * enabling or disabling log-dirty mode. INVALID_GFN when idle.
+         */
+        gfn_t resume_gfn;
+
+        /*
+         * Dirty bitmap, indexed by gfn. Each slot of the radix tree points
+         * to a page worth of bitmap (i.e. covering 128MB of guest memory
+         * with 4KB pages) and is only allocated when a page in that range
+         * gets dirtied.
+         */
+        struct radix_tree_root bitmap;
+
+        /*
+         * MFNs written through grant mappings or grant copies. There is no
+         * M2P on Arm, so they are translated to GFNs when the bitmap is
+         * next read.
+         */
+        struct radix_tree_root dirty_mfns;
+        unsigned long nr_dirty_mfns;
+
+        unsigned long fault_count;
+        unsigned long dirty_count;
+        unsigned int failed_allocs;
+
+        /*
+         * A preempted XEN_DOMCTL_SHADOW_OP_{PEEK,CLEAN}: the domain which
+         * issued it, the operation and the next page of bitmap to copy.
+         * preempt_dom is NULL when none is in progress.
+         */
+        struct domain *preempt_dom;
+        unsigned int preempt_op;
+        unsigned long preempt_next;
+    } log_dirty;
+
     /* back pointer to domain */
     struct domain *domain;
 
@@ -131,6 +195,7 @@ typedef enum {
     p2m_map_foreign_ro, /* Read-only RAM pages from foreign domain */
     p2m_grant_map_rw,   /* Read/write grant mapping */
     p2m_grant_map_ro,   /* Read-only grant mapping */
+    p2m_ram_logdirty,   /* Temporarily read-only RAM, for log-dirty */
     /* The types below are only used to decide the page attribute in the P2M */
     p2m_iommu_map_rw,   /* Read/write iommu mapping */
     p2m_iommu_map_ro,   /* Read-only iommu mapping */
@@ -142,7 +207,12 @@ typedef enum {
 
 /* RAM types, which map to real machine frames */
 #define P2M_RAM_TYPES (p2m_to_mask(p2m_ram_rw) |        \
-                       p2m_to_mask(p2m_ram_ro))
+                       p2m_to_mask(p2m_ram_ro) |        \
+                       p2m_to_mask(p2m_ram_logdirty))
+
+/* RAM types the guest can write to, whether or not its writes are logged */
+#define P2M_RAM_RW_TYPES (p2m_to_mask(p2m_ram_rw) |     \
+                          p2m_to_mask(p2m_ram_logdirty))
 
 /* Grant mapping types, which map to a real frame in another VM */
 #define P2M_GRANT_TYPES (p2m_to_mask(p2m_grant_map_rw) |  \
@@ -154,6 +224,7 @@ typedef enum {
 
 /* Useful predicates */
 #define p2m_is_ram(_t) (p2m_to_mask(_t) & P2M_RAM_TYPES)
+#define p2m_is_ram_rw(_t) (p2m_to_mask(_t) & P2M_RAM_RW_TYPES)
 #define p2m_is_foreign(_t) (p2m_to_mask(_t) & P2M_FOREIGN_TYPES)
 #define p2m_is_any_ram(_t) (p2m_to_mask(_t) &                   \
                             (P2M_RAM_TYPES | P2M_GRANT_TYPES |  \
@@ -196,8 +267,13 @@ void p2m_altp2m_check(struct vcpu *v, uint16_t idx)
 void p2m_restrict_ipa_bits(unsigned int ipa_bits);
 
 void p2m_vmid_allocator_init(void);
-int p2m_alloc_vmid(struct domain *d);
-void p2m_free_vmid(struct domain *d);
+uint16_t p2m_update_vmid(struct p2m_domain *p2m);
+
+/* VMID the p2m was last given, without its generation. */
+static inline uint16_t p2m_vmid(struct p2m_domain *p2m)
+{
+    return read_atomic(&p2m->vmid) & (MAX_VMID - 1);
+}
 
 /* Second stage paging setup, to be called on all CPUs */
 void setup_virt_paging(void);
@@ -288,6 +364,25 @@ int p2m_set_entry(struct p2m_domain *p2m,
 
 bool p2m_resolve_translation_fault(struct domain *d, gfn_t gfn);
 
+/*
+ * Log-dirty support. Guest RAM is write-protected (p2m_ram_logdirty) and
+ * the first write to each page is recorded in a bitmap, before the page is
+ * made writable again.
+ *
+ * p2m_log_dirty_enable(), p2m_log_dirty_disable() and p2m_log_dirty_op()
+ * may return -ERESTART and need to be called again with the same arguments.
+ */
+int p2m_log_dirty_enable(struct domain *d);
+int p2m_log_dirty_disable(struct domain *d);
+int p2m_log_dirty_op(struct domain *d, struct xen_domctl_shadow_op *sc);
+
+/* Handle a stage-2 permission fault. Returns true if it was resolved. */
+bool p2m_log_dirty_fault(struct domain *d, gfn_t gfn);
+
+/* Record writes done by Xen or by another domain on behalf of the guest. */
+void p2m_log_dirty_mark(struct domain *d, gfn_t gfn, unsigned long nr);
+void p2m_log_dirty_mark_mfn(struct domain *d, mfn_t mfn);
+
 void p2m_domain_creation_finished(struct domain *d);
 
 /*
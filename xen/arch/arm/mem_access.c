@@ -199,9 +199,13 @@ p2m_mem_access_check_and_get_page(vaddr_t gva, unsigned long flag,
     /*
      * Base type doesn't allow r/w
      */
-    if ( t != p2m_ram_rw )
+    if ( !p2m_is_ram_rw(t) )
         goto err;
 
+    /* Xen writes through its own mapping, record it. */
+    if ( (flag & GV2M_WRITE) && t == p2m_ram_logdirty )
+        p2m_log_dirty_mark(v->domain, gfn, 1);
+
     page = mfn_to_page(mfn);
 
     if ( unlikely(!get_page(page, v->domain)) )
@@ -203,7 +203,7 @@ int xenmem_add_to_physmap_one(
         }
 
         if ( p2m_is_ram(p2mt) )
-            t = (p2mt == p2m_ram_rw) ? p2m_map_foreign_rw : p2m_map_foreign_ro;
+            t = p2m_is_ram_rw(p2mt) ? p2m_map_foreign_rw : p2m_map_foreign_ro;
         else
         {
             put_page(page);
@@ -1,10 +1,14 @@
 /* SPDX-License-Identifier: GPL-2.0-only */
 #include <xen/cpu.h>
 #include <xen/domain_page.h>
+#include <xen/guest_access.h>
 #include <xen/ioreq.h>
 #include <xen/lib.h>
+#include <xen/param.h>
 #include <xen/sched.h>
 #include <xen/softirq.h>
+#include <xen/tasklet.h>
+#include <xen/timer.h>
 
 #include <asm/alternative.h>
 #include <asm/event.h>
@@ -168,13 +172,20 @@ void p2m_dump_info(struct domain *d)
 
     p2m_read_lock(p2m);
     printk("p2m mappings for domain %d (vmid %d):\n",
-           d->domain_id, p2m->vmid);
+           d->domain_id, p2m_vmid(p2m));
     BUG_ON(p2m->stats.mappings[0] || p2m->stats.shattered[0]);
-    printk("  1G mappings: %ld (shattered %ld)\n",
-           p2m->stats.mappings[1], p2m->stats.shattered[1]);
-    printk("  2M mappings: %ld (shattered %ld)\n",
-           p2m->stats.mappings[2], p2m->stats.shattered[2]);
+    printk("  1G mappings: %ld (shattered %ld, coalesced %ld)\n",
+           p2m->stats.mappings[1], p2m->stats.shattered[1],
+           p2m->stats.coalesced[1]);
+    printk("  2M mappings: %ld (shattered %ld, coalesced %ld)\n",
+           p2m->stats.mappings[2], p2m->stats.shattered[2],
+           p2m->stats.coalesced[2]);
     printk("  4K mappings: %ld\n", p2m->stats.mappings[3]);
+    printk("  updates: %lu entries in %lu walks\n",
+           p2m->stats.entries, p2m->stats.walks);
+    printk("  TLB flushes: %lu of the VMID, %lu by IPA (%lu pages)\n",
+           p2m->stats.tlb_flushes, p2m->stats.tlb_range_flushes,
+           p2m->stats.tlb_range_pages);
     p2m_read_unlock(p2m);
 }
 
@@ -216,10 +227,15 @@ void p2m_restore_state(struct vcpu *n)
 {
     struct p2m_domain *p2m = p2m_get_hostp2m(n->domain);
     uint8_t *last_vcpu_ran;
+    uint64_t vttbr;
 
     if ( is_idle_vcpu(n) )
         return;
 
+    /* This may flush the guest TLBs of the CPU, if the VMIDs rolled over. */
+    vttbr = generate_vttbr(p2m_update_vmid(p2m), page_to_mfn(p2m->root));
+    write_atomic(&p2m->vttbr, vttbr);
+
     WRITE_SYSREG(n->arch.sctlr, SCTLR_EL1);
     WRITE_SYSREG(n->arch.hcr_el2, HCR_EL2);
 
@@ -229,7 +245,7 @@ void p2m_restore_state(struct vcpu *n)
      * synchronized.
      */
     asm volatile(ALTERNATIVE("nop", "isb", ARM64_WORKAROUND_AT_SPECULATE));
-    WRITE_SYSREG64(p2m->vttbr, VTTBR_EL2);
+    WRITE_SYSREG64(vttbr, VTTBR_EL2);
 
     last_vcpu_ran = &p2m->last_vcpu_ran[smp_processor_id()];
 
@@ -253,26 +269,97 @@ void p2m_restore_state(struct vcpu *n)
 }
 
 /*
- * Force a synchronous P2M TLB flush.
- *
- * Must be called with the p2m lock held.
+ * Above this many pages, invalidating the TLBs one IPA at a time costs more
+ * than flushing all the entries of the VMID, and refilling them.
  */
-void p2m_force_tlb_flush_sync(struct p2m_domain *p2m)
+#define P2M_TLBI_IPA_MAX_PAGES 64
+
+/*
+ * Invalidate the TLB entries of the current VMID for [gfn, gfn + nr), with
+ * range instructions if available, else page by page.  Returns false,
+ * without flushing anything, if the range is too large for either.
+ */
+static bool p2m_flush_guest_tlb_range(gfn_t gfn, unsigned long nr)
+{
+#ifdef CONFIG_ARM_64
+    unsigned long base = gfn_x(gfn);
+    unsigned int scale = 0;
+    bool range = cpu_has_tlb_range;
+
+    if ( nr > (range ? TLBI_RANGE_MAX_PAGES - 1 : P2M_TLBI_IPA_MAX_PAGES) )
+        return false;
+
+    dsb(ishst);
+
+    while ( nr )
+    {
+        int num;
+
+        /* Range operations cover an even number of pages. */
+        if ( !range || (nr & 1) )
+        {
+            __flush_guest_tlb_one_ipa(pfn_to_paddr(base));
+            base++;
+            nr--;
+            continue;
+        }
+
+        num = (int)((nr >> (5 * scale + 1)) & 0x1f) - 1;
+        if ( num >= 0 )
+        {
+            __flush_guest_tlb_range_ipa(TLBI_RANGE_OP(base, scale, num));
+            base += TLBI_RANGE_PAGES(num, scale);
+            nr -= TLBI_RANGE_PAGES(num, scale);
+        }
+        scale++;
+    }
+
+    /*
+     * Stage-1 entries are tagged by VA, and may combine both stages of
+     * translation: they can't be invalidated by IPA.
+     */
+    dsb(ish);
+    flush_guest_tlb_stage1();
+
+    return true;
+#else
+    return false;
+#endif
+}
+
+/*
+ * Flush the TLB entries of the P2M for [gfn, gfn + nr), or all of them if nr
+ * is 0.
+ */
+static void p2m_flush_tlb(struct p2m_domain *p2m, gfn_t gfn, unsigned long nr)
 {
     unsigned long flags = 0;
-    uint64_t ovttbr;
+    uint64_t ovttbr, vttbr;
+    uint16_t vmid;
 
     ASSERT(p2m_is_write_locked(p2m));
 
+    /*
+     * Pairs with the barrier in p2m_update_vmid(): either a CPU giving the
+     * P2M a new VMID sees the updates of the entries, or we flush that VMID.
+     * A VMID of a past generation is still flushed: the CPUs which haven't
+     * flushed all their TLBs since the rollover may hold entries for it.
+     */
+    smp_mb();
+    vmid = p2m_vmid(p2m);
+
+    /* No vCPU ever ran: no TLB entries can be tagged for the P2M. */
+    if ( vmid == INVALID_VMID )
+        return;
+
     /*
      * ARM only provides an instruction to flush TLBs for the current
      * VMID. So switch to the VTTBR of a given P2M if different.
      */
+    vttbr = generate_vttbr(vmid, page_to_mfn(p2m->root));
     ovttbr = READ_SYSREG64(VTTBR_EL2);
-    if ( ovttbr != p2m->vttbr )
+    if ( ovttbr != vttbr )
     {
-        uint64_t vttbr;
-
         local_irq_save(flags);
 
         /*
@@ -281,10 +368,8 @@ void p2m_force_tlb_flush_sync(struct p2m_domain *p2m)
          * only need the VMID for flushing the TLBs, so we can generate
          * a new VTTBR with the VMID to flush and the empty root table.
          */
-        if ( !cpus_have_const_cap(ARM64_WORKAROUND_AT_SPECULATE) )
-            vttbr = p2m->vttbr;
-        else
-            vttbr = generate_vttbr(p2m->vmid, empty_root_mfn);
+        if ( cpus_have_const_cap(ARM64_WORKAROUND_AT_SPECULATE) )
+            vttbr = generate_vttbr(vmid, empty_root_mfn);
 
         WRITE_SYSREG64(vttbr, VTTBR_EL2);
 
@@ -292,7 +377,16 @@ void p2m_force_tlb_flush_sync(struct p2m_domain *p2m)
         isb();
     }
 
-    flush_guest_tlb();
+    if ( nr && p2m_flush_guest_tlb_range(gfn, nr) )
+    {
+        p2m->stats.tlb_range_flushes++;
+        p2m->stats.tlb_range_pages += nr;
+    }
+    else
+    {
+        flush_guest_tlb();
+        p2m->stats.tlb_flushes++;
+    }
 
     if ( ovttbr != READ_SYSREG64(VTTBR_EL2) )
     {
@@ -301,14 +395,52 @@ void p2m_force_tlb_flush_sync(struct p2m_domain *p2m)
         isb();
         local_irq_restore(flags);
     }
+}
+
+/*
+ * Force a synchronous P2M TLB flush.
+ *
+ * Must be called with the p2m lock held.
+ */
+void p2m_force_tlb_flush_sync(struct p2m_domain *p2m)
+{
+    p2m_flush_tlb(p2m, INVALID_GFN, 0);
 
     p2m->need_flush = false;
+    p2m->flush_nr = 0;
 }
 
 void p2m_tlb_flush_sync(struct p2m_domain *p2m)
 {
     if ( p2m->need_flush )
         p2m_force_tlb_flush_sync(p2m);
+    else if ( p2m->flush_nr )
+    {
+        p2m_flush_tlb(p2m, p2m->flush_gfn, p2m->flush_nr);
+        p2m->flush_nr = 0;
+    }
+}
+
+/*
+ * Defer the flush of the TLB entries for [gfn, gfn + nr) to the next
+ * p2m_tlb_flush_sync(), merging it with any range already pending.
+ */
+static void p2m_tlb_flush_defer(struct p2m_domain *p2m, gfn_t gfn,
+                                unsigned long nr)
+{
+    unsigned long start = gfn_x(gfn), end = start + nr;
+
+    if ( p2m->need_flush )
+        return;
+
+    if ( p2m->flush_nr )
+    {
+        start = min(start, gfn_x(p2m->flush_gfn));
+        end = max(end, gfn_x(p2m->flush_gfn) + p2m->flush_nr);
+    }
+
+    p2m->flush_gfn = _gfn(start);
+    p2m->flush_nr = end - start;
 }
 
 /*
@@ -546,6 +678,7 @@ static void p2m_set_permission(lpae_t *e, p2m_type_t t, p2m_access_t a)
         break;
 
     case p2m_ram_ro:
+    case p2m_ram_logdirty:
         e->p2m.xn = 0;
         e->p2m.write = 0;
         break;
@@ -957,26 +1090,35 @@ static bool p2m_split_superpage(struct p2m_domain *p2m, lpae_t *entry,
     return rv;
 }
 
+/* Most entries p2m_set_entries() writes after a single table walk. */
+#define P2M_SET_BATCH 64
+
 /*
- * Insert an entry in the p2m. This should be called with a mapping
- * equal to a page/superpage (4K, 2M, 1G).
+ * Insert @nr consecutive entries in the p2m, within the same table. This
+ * should be called with mappings equal to a page/superpage (4K, 2M, 1G).
+ * The table is walked once, and the TLBs flushed once for all the entries.
  */
-static int __p2m_set_entry(struct p2m_domain *p2m,
+static int p2m_set_entries(struct p2m_domain *p2m,
                            gfn_t sgfn,
                            unsigned int page_order,
+                           unsigned int nr,
                            mfn_t smfn,
                            p2m_type_t t,
                            p2m_access_t a)
 {
-    unsigned int level = 0;
+    unsigned int level = 0, i;
     unsigned int target = 3 - (page_order / XEN_PT_LPAE_SHIFT);
-    lpae_t *entry, *table, orig_pte;
+    lpae_t *entry, *table, orig[P2M_SET_BATCH];
     int rc;
     /* A mapping is removed if the MFN is invalid. */
     bool removing_mapping = mfn_eq(smfn, INVALID_MFN);
+    bool was_valid = false;
     DECLARE_OFFSETS(offsets, gfn_to_gaddr(sgfn));
 
     ASSERT(p2m_is_write_locked(p2m));
+    ASSERT(nr && nr <= P2M_SET_BATCH);
+    /* The mem access settings are only updated one entry at a time. */
+    ASSERT(nr == 1 || !p2m->mem_access_enabled);
 
     /*
      * Check if the level target is valid: we only support
@@ -988,6 +1130,8 @@ static int __p2m_set_entry(struct p2m_domain *p2m,
     if ( !table )
         return -EINVAL;
 
+    p2m->stats.walks++;
+
     for ( level = P2M_ROOT_LEVEL; level < target; level++ )
     {
         /*
@@ -1045,7 +1189,10 @@ static int __p2m_set_entry(struct p2m_domain *p2m,
          * For more details see (D4.7.1 in ARM DDI 0487A.j).
          */
         p2m_remove_pte(entry, p2m->clean_pte);
-        p2m_force_tlb_flush_sync(p2m);
+        p2m_flush_tlb(p2m,
+                      _gfn(gfn_x(sgfn) &
+                           ~((1UL << XEN_PT_LEVEL_ORDER(level)) - 1)),
+                      1UL << XEN_PT_LEVEL_ORDER(level));
 
         p2m_write_pte(entry, split_pte, p2m->clean_pte);
 
@@ -1070,8 +1217,10 @@ static int __p2m_set_entry(struct p2m_domain *p2m,
      * all the intermediate tables have been installed if necessary.
      */
     ASSERT(level == target);
+    ASSERT(offsets[level] + nr <= XEN_PT_LPAE_ENTRIES);
 
-    orig_pte = *entry;
+    for ( i = 0; i < nr; i++ )
+        orig[i] = entry[i];
 
     /*
      * The radix-tree can only work on 4KB. This is only used when
@@ -1093,16 +1242,24 @@ static int __p2m_set_entry(struct p2m_domain *p2m,
         goto out;
 
     /*
-     * Always remove the entry in order to follow the break-before-make
+     * Always remove the entries in order to follow the break-before-make
      * sequence when updating the translation table (D4.7.1 in ARM DDI
      * 0487A.j).
      */
-    if ( lpae_is_valid(orig_pte) || removing_mapping )
-        p2m_remove_pte(entry, p2m->clean_pte);
+    for ( i = 0; i < nr; i++ )
+    {
+        if ( lpae_is_valid(orig[i]) )
+            was_valid = true;
+        if ( lpae_is_valid(orig[i]) || removing_mapping )
+            p2m_remove_pte(entry + i, p2m->clean_pte);
+    }
 
     if ( removing_mapping )
-        /* Flush can be deferred if the entry is removed */
-        p2m->need_flush |= !!lpae_is_valid(orig_pte);
+    {
+        /* Flush can be deferred if the entries are removed */
+        if ( was_valid )
+            p2m_tlb_flush_defer(p2m, sgfn, (unsigned long)nr << page_order);
+    }
     else
     {
         lpae_t pte = mfn_to_p2m_entry(smfn, t, a);
@@ -1111,53 +1268,65 @@ static int __p2m_set_entry(struct p2m_domain *p2m,
             pte.p2m.table = 0; /* Superpage entry */
 
         /*
-         * It is necessary to flush the TLB before writing the new entry
-         * to keep coherency when the previous entry was valid.
+         * It is necessary to flush the TLB before writing the new entries
+         * to keep coherency when the previous entries were valid.
          *
          * Although, it could be defered when only the permissions are
          * changed (e.g in case of memaccess).
          */
-        if ( lpae_is_valid(orig_pte) )
+        if ( was_valid )
         {
             if ( likely(!p2m->mem_access_enabled) ||
-                 P2M_CLEAR_PERM(pte) != P2M_CLEAR_PERM(orig_pte) )
-                p2m_force_tlb_flush_sync(p2m);
+                 P2M_CLEAR_PERM(pte) != P2M_CLEAR_PERM(orig[0]) )
+                p2m_flush_tlb(p2m, sgfn, (unsigned long)nr << page_order);
             else
                 p2m->need_flush = true;
         }
-        else if ( !p2m_is_valid(orig_pte) ) /* new mapping */
-            p2m->stats.mappings[level]++;
 
-        p2m_write_pte(entry, pte, p2m->clean_pte);
+        for ( i = 0; i < nr; i++ )
+        {
+            if ( i )
+                lpae_set_mfn(pte,
+                             mfn_add(smfn, (unsigned long)i << page_order));
+
+            /* New mapping */
+            if ( !lpae_is_valid(orig[i]) && !p2m_is_valid(orig[i]) )
+                p2m->stats.mappings[level]++;
+
+            p2m_write_pte(entry + i, pte, p2m->clean_pte);
+        }
 
-        p2m->max_mapped_gfn = gfn_max(p2m->max_mapped_gfn,
-                                      gfn_add(sgfn, (1UL << page_order) - 1));
+        p2m->max_mapped_gfn =
+            gfn_max(p2m->max_mapped_gfn,
+                    gfn_add(sgfn, ((unsigned long)nr << page_order) - 1));
         p2m->lowest_mapped_gfn = gfn_min(p2m->lowest_mapped_gfn, sgfn);
     }
 
-    if ( is_iommu_enabled(p2m->domain) &&
-         (lpae_is_valid(orig_pte) || lpae_is_valid(*entry)) )
+    p2m->stats.entries += nr;
+
+    if ( is_iommu_enabled(p2m->domain) && (was_valid || !removing_mapping) )
     {
         unsigned int flush_flags = 0;
 
-        if ( lpae_is_valid(orig_pte) )
+        if ( was_valid )
             flush_flags |= IOMMU_FLUSHF_modified;
-        if ( lpae_is_valid(*entry) )
+        if ( !removing_mapping )
             flush_flags |= IOMMU_FLUSHF_added;
 
         rc = iommu_iotlb_flush(p2m->domain, _dfn(gfn_x(sgfn)),
-                               1UL << page_order, flush_flags);
+                               (unsigned long)nr << page_order, flush_flags);
     }
     else
         rc = 0;
 
     /*
-     * Free the entry only if the original pte was valid and the base
+     * Free an entry only if the original pte was valid and the base
      * is different (to avoid freeing when permission is changed).
      */
-    if ( p2m_is_valid(orig_pte) &&
-         !mfn_eq(lpae_get_mfn(*entry), lpae_get_mfn(orig_pte)) )
-        p2m_free_entry(p2m, orig_pte, level);
+    for ( i = 0; i < nr; i++ )
+        if ( p2m_is_valid(orig[i]) &&
+             !mfn_eq(lpae_get_mfn(entry[i]), lpae_get_mfn(orig[i])) )
+            p2m_free_entry(p2m, orig[i], level);
 
 out:
     unmap_domain_page(table);
@@ -1165,6 +1334,161 @@ out:
     return rc;
 }
 
+/*
+ * Insert an entry in the p2m. This should be called with a mapping
+ * equal to a page/superpage (4K, 2M, 1G).
+ */
+static int __p2m_set_entry(struct p2m_domain *p2m,
+                           gfn_t sgfn,
+                           unsigned int page_order,
+                           mfn_t smfn,
+                           p2m_type_t t,
+                           p2m_access_t a)
+{
+    return p2m_set_entries(p2m, sgfn, page_order, 1, smfn, t, a);
+}
+
+/*
+ * Replace the table behind @entry at @level by a block mapping, if all its
+ * entries map contiguous, suitably aligned frames with the same type and
+ * permissions.  Only RAM is merged: other types may hold references on each
+ * page (foreign mappings) or need per-page tracking.
+ */
+static bool p2m_merge_table(struct p2m_domain *p2m, lpae_t *entry,
+                            unsigned int level, gfn_t gfn)
+{
+    unsigned int next_level = level + 1;
+    unsigned int next_order = XEN_PT_LEVEL_ORDER(next_level);
+    unsigned int order = XEN_PT_LEVEL_ORDER(level);
+    mfn_t mfn, table_mfn = lpae_get_mfn(*entry);
+    lpae_t *table, first, pte, table_pte;
+    struct page_info *pg;
+    unsigned int i;
+    bool merge = false;
+
+    if ( !lpae_is_valid(*entry) )
+        return false;
+
+    table = map_domain_page(table_mfn);
+    first = table[0];
+    mfn = lpae_get_mfn(first);
+
+    if ( !lpae_is_valid(first) || !p2m_is_mapping(first, next_level) ||
+         (first.p2m.type != p2m_ram_rw && first.p2m.type != p2m_ram_ro) ||
+         (mfn_x(mfn) & ((1UL << order) - 1)) )
+        goto out;
+
+    /* Tables tend to be filled in order: look at the last entry first. */
+    for ( i = XEN_PT_LPAE_ENTRIES; i-- > 1; )
+    {
+        pte = first;
+        lpae_set_mfn(pte, mfn_add(mfn, i << next_order));
+        if ( table[i].bits != pte.bits )
+            goto out;
+
+        /* p2m_put_l3_page() has to see xenheap pages go. */
+        if ( next_level == 3 && is_xen_heap_mfn(mfn_add(mfn, i)) )
+            goto out;
+    }
+
+    merge = next_level != 3 || !is_xen_heap_mfn(mfn);
+
+ out:
+    unmap_domain_page(table);
+
+    if ( !merge )
+        return false;
+
+    table_pte = *entry;
+    pte = first;
+    pte.p2m.table = 0; /* Superpage entry */
+
+    /*
+     * Follow the break-before-make sequence, as when splitting
+     * (D4.7.1 in ARM DDI 0487A.j).
+     */
+    p2m_remove_pte(entry, p2m->clean_pte);
+    p2m_flush_tlb(p2m, _gfn(gfn_x(gfn) & ~((1UL << order) - 1)),
+                  1UL << order);
+
+    if ( is_iommu_enabled(p2m->domain) &&
+         iommu_iotlb_flush(p2m->domain,
+                           _dfn(gfn_x(gfn) & ~((1UL << order) - 1)),
+                           1UL << order, IOMMU_FLUSHF_modified) )
+    {
+        /* The IOMMU may still walk the table: put it back. */
+        p2m_write_pte(entry, table_pte, p2m->clean_pte);
+        return false;
+    }
+
+    p2m_write_pte(entry, pte, p2m->clean_pte);
+
+    /* The TLBs were flushed above: nothing walks the table any more. */
+    pg = mfn_to_page(table_mfn);
+    page_list_del(pg, &p2m->pages);
+    p2m_free_page(p2m->domain, pg);
+
+    p2m->stats.mappings[next_level] -= XEN_PT_LPAE_ENTRIES;
+    p2m->stats.mappings[level]++;
+    p2m->stats.coalesced[level]++;
+
+    return true;
+}
+
+/* Try to turn the table mapping @gfn at @target level back into a block. */
+static bool p2m_coalesce_entry(struct p2m_domain *p2m, gfn_t gfn,
+                               unsigned int target)
+{
+    DECLARE_OFFSETS(offsets, gfn_to_gaddr(gfn));
+    unsigned int level;
+    lpae_t *table, *entry;
+    bool merged = false;
+
+    ASSERT(p2m_is_write_locked(p2m));
+
+    table = p2m_get_root_pointer(p2m, gfn);
+    if ( !table )
+        return false;
+
+    for ( level = P2M_ROOT_LEVEL; level < target; level++ )
+        if ( p2m_next_level(p2m, true, level, &table,
+                            offsets[level]) != GUEST_TABLE_NORMAL_PAGE )
+            goto out;
+
+    entry = table + offsets[level];
+    if ( p2m_is_valid(*entry) && !p2m_is_mapping(*entry, level) )
+        merged = p2m_merge_table(p2m, entry, level, gfn);
+
+ out:
+    unmap_domain_page(table);
+
+    return merged;
+}
+
+/*
+ * Merge back into 2M and 1G blocks the tables covering [sgfn, sgfn + nr)
+ * which allow it.
+ */
+static void p2m_coalesce_range(struct p2m_domain *p2m, gfn_t sgfn,
+                               unsigned long nr)
+{
+    unsigned long gfn = gfn_x(sgfn) & ~((1UL << SECOND_ORDER) - 1);
+    unsigned long end = gfn_x(sgfn) + nr;
+
+    if ( p2m->mem_access_enabled || p2m->log_dirty.enabled )
+        return;
+
+    for ( ; gfn < end; gfn += 1UL << SECOND_ORDER )
+    {
+        p2m_coalesce_entry(p2m, _gfn(gfn), 2);
+
+        /* Last 2M of a 1G region, or of the range. */
+        if ( !((gfn + (1UL << SECOND_ORDER)) & ((1UL << FIRST_ORDER) - 1)) ||
+             gfn + (1UL << SECOND_ORDER) >= end )
+            p2m_coalesce_entry(p2m, _gfn(gfn), 1);
+    }
+}
+
 int p2m_set_entry(struct p2m_domain *p2m,
                   gfn_t sgfn,
                   unsigned long nr,
@@ -1173,6 +1497,8 @@ int p2m_set_entry(struct p2m_domain *p2m,
                   p2m_access_t a)
 {
     int rc = 0;
+    gfn_t start_gfn = sgfn;
+    unsigned long nr_pages = nr;
 
     /*
      * Any reference taken by the P2M mappings (e.g. foreign mapping) will
@@ -1187,6 +1513,7 @@ int p2m_set_entry(struct p2m_domain *p2m,
     {
         unsigned long mask;
         unsigned long order;
+        unsigned int n = 1;
 
         /*
          * Don't take into account the MFN when removing mapping (i.e
@@ -1208,20 +1535,122 @@ int p2m_set_entry(struct p2m_domain *p2m,
         else
             order = THIRD_ORDER;
 
-        rc = __p2m_set_entry(p2m, sgfn, order, smfn, t, a);
+        /*
+         * The following entries of the same table get the same order, as
+         * the GFN can only become aligned to a larger one at the end of
+         * the table: write them along.
+         */
+        if ( likely(!p2m->mem_access_enabled) )
+            n = min_t(unsigned long, nr >> order,
+                      min(XEN_PT_LPAE_ENTRIES -
+                          ((gfn_x(sgfn) >> order) & (XEN_PT_LPAE_ENTRIES - 1)),
+                          (unsigned long)P2M_SET_BATCH));
+
+        rc = p2m_set_entries(p2m, sgfn, order, n, smfn, t, a);
         if ( rc )
             break;
 
-        sgfn = gfn_add(sgfn, (1 << order));
+        sgfn = gfn_add(sgfn, (unsigned long)n << order);
         if ( !mfn_eq(smfn, INVALID_MFN) )
-           smfn = mfn_add(smfn, (1 << order));
+           smfn = mfn_add(smfn, (unsigned long)n << order);
 
-        nr -= (1 << order);
+        nr -= (unsigned long)n << order;
     }
 
+    /*
+     * RAM mapped whilst log-dirty is enabled is left writable: report it
+     * dirty so it gets sent and write-protected on the next clean.
+     */
+    if ( unlikely(p2m->log_dirty.enabled) && t == p2m_ram_rw )
+        p2m_log_dirty_mark(p2m->domain, start_gfn, nr_pages);
+
+    /*
+     * Mapping RAM may complete a table split earlier, e.g. on ballooning
+     * or for a foreign mapping since removed.
+     */
+    if ( !rc && (t == p2m_ram_rw || t == p2m_ram_ro) )
+        p2m_coalesce_range(p2m, start_gfn, nr_pages);
+
     return rc;
 }
 
+/*
+ * Tables left complete by changes not going through p2m_set_entry() for
+ * RAM, e.g. log-dirty mode being turned off, are found by a background scan
+ * merging back a bounded number of 2M regions of each domain at a time.
+ */
+#define P2M_COALESCE_BATCH 512
+
+static unsigned int __read_mostly opt_p2m_coalesce_interval = 1000;
+integer_param("p2m-coalesce-interval", opt_p2m_coalesce_interval);
+
+static struct timer p2m_coalesce_timer;
+
+static void p2m_coalesce_scan(struct domain *d)
+{
+    struct p2m_domain *p2m = p2m_get_hostp2m(d);
+    unsigned long gfn, end;
+
+    p2m_write_lock(p2m);
+
+    if ( d->is_dying )
+        goto out;
+
+    end = gfn_x(p2m->max_mapped_gfn) + 1;
+    gfn = gfn_x(p2m->coalesce_gfn);
+    if ( gfn < gfn_x(p2m->lowest_mapped_gfn) || gfn >= end )
+        gfn = gfn_x(p2m->lowest_mapped_gfn);
+
+    if ( gfn < end )
+    {
+        unsigned long nr = min(end - gfn,
+                               (unsigned long)P2M_COALESCE_BATCH <<
+                               SECOND_ORDER);
+
+        p2m_coalesce_range(p2m, _gfn(gfn), nr);
+        p2m->coalesce_gfn = _gfn(gfn + nr);
+    }
+
+ out:
+    p2m_write_unlock(p2m);
+}
+
+static void cf_check p2m_coalesce_work(void *unused)
+{
+    struct domain *d;
+
+    rcu_read_lock(&domlist_read_lock);
+    for_each_domain ( d )
+    {
+        p2m_coalesce_scan(d);
+        process_pending_softirqs();
+    }
+    rcu_read_unlock(&domlist_read_lock);
+
+    set_timer(&p2m_coalesce_timer,
+              NOW() + MILLISECS(opt_p2m_coalesce_interval));
+}
+
+static DECLARE_TASKLET(p2m_coalesce_tasklet, p2m_coalesce_work, NULL);
+
+static void cf_check p2m_coalesce_timer_fn(void *unused)
+{
+    tasklet_schedule(&p2m_coalesce_tasklet);
+}
+
+static int __init cf_check p2m_coalesce_init(void)
+{
+    if ( !opt_p2m_coalesce_interval )
+        return 0;
+
+    init_timer(&p2m_coalesce_timer, p2m_coalesce_timer_fn, NULL, 0);
+    set_timer(&p2m_coalesce_timer,
+              NOW() + MILLISECS(opt_p2m_coalesce_interval));
+
+    return 0;
+}
+__initcall(p2m_coalesce_init);
+
 /* Invalidate all entries in the table. The p2m should be write locked. */
 static void p2m_invalidate_table(struct p2m_domain *p2m, mfn_t mfn)
 {
@@ -1417,6 +1846,524 @@ out:
     return resolved;
 }
 
+/*
+ * Log-dirty support.
+ *
+ * When log-dirty is enabled, all the p2m_ram_rw entries are turned into
+ * p2m_ram_logdirty, which are mapped read-only. The first write to a page
+ * results in a permission fault: the page is recorded in the dirty bitmap
+ * and made writable again. Superpages are only shattered when one of their
+ * pages gets written, so read-mostly regions keep their block mappings.
+ *
+ * Changing the permissions of an entry doesn't require break-before-make,
+ * so the entries are updated in place and a single TLB flush is issued per
+ * operation.
+ */
+
+/* Number of gfns covered by a page of dirty bitmap. */
+#define LOGDIRTY_NODE_BITS (PAGE_SIZE * 8)
+
+/*
+ * Change the type of the entry mapping gfn from ot to nt, if it has type
+ * ot. The caller is responsible for flushing the TLBs.
+ *
+ * Return the order of the mapping (or of the hole) covering gfn.
+ */
+static unsigned int p2m_retype_entry(struct p2m_domain *p2m, gfn_t gfn,
+                                     p2m_type_t ot, p2m_type_t nt)
+{
+    unsigned int level;
+    lpae_t *table, *entry, pte;
+    DECLARE_OFFSETS(offsets, gfn_to_gaddr(gfn));
+
+    ASSERT(p2m_is_write_locked(p2m));
+
+    table = p2m_get_root_pointer(p2m, gfn);
+    if ( !table )
+    {
+        ASSERT_UNREACHABLE();
+        return XEN_PT_LEVEL_ORDER(P2M_ROOT_LEVEL);
+    }
+
+    for ( level = P2M_ROOT_LEVEL; level < 3; level++ )
+    {
+        int rc = p2m_next_level(p2m, true, level, &table, offsets[level]);
+
+        if ( rc == GUEST_TABLE_MAP_FAILED )
+            goto out;
+        else if ( rc != GUEST_TABLE_NORMAL_PAGE )
+            break;
+    }
+
+    entry = table + offsets[level];
+    pte = *entry;
+
+    if ( p2m_is_valid(pte) && pte.p2m.type == ot )
+    {
+        pte.p2m.type = nt;
+        p2m_set_permission(&pte, nt, p2m_mem_access_radix_get(p2m, gfn));
+        p2m_write_pte(entry, pte, p2m->clean_pte);
+    }
+
+out:
+    unmap_domain_page(table);
+
+    return XEN_PT_LEVEL_ORDER(level);
+}
+
+/*
+ * Retype all the entries of type ot in [*pstart, end) to nt.
+ *
+ * *pstart will get updated if the function is preempted.
+ */
+static int p2m_retype_range(struct p2m_domain *p2m, gfn_t *pstart, gfn_t end,
+                            p2m_type_t ot, p2m_type_t nt)
+{
+    gfn_t start = *pstart;
+    unsigned long count = 0;
+    int rc = 0;
+
+    while ( gfn_x(start) < gfn_x(end) )
+    {
+        start = gfn_next_boundary(start,
+                                  p2m_retype_entry(p2m, start, ot, nt));
+
+        /* Arbitrarily preempt every 512 iterations */
+        if ( !(++count % 512) && gfn_x(start) < gfn_x(end) &&
+             hypercall_preempt_check() )
+        {
+            rc = -ERESTART;
+            break;
+        }
+    }
+
+    p2m->need_flush = true;
+    *pstart = start;
+
+    return rc;
+}
+
+/* Record gfn in the dirty bitmap. The log-dirty lock should be held. */
+static void p2m_log_dirty_set(struct p2m_domain *p2m, unsigned long gfn)
+{
+    unsigned long idx = gfn / LOGDIRTY_NODE_BITS;
+    unsigned long *node;
+
+    ASSERT(spin_is_locked(&p2m->log_dirty.lock));
+
+    node = radix_tree_lookup(&p2m->log_dirty.bitmap, idx);
+    if ( !node )
+    {
+        node = xzalloc_array(unsigned long,
+                             BITS_TO_LONGS(LOGDIRTY_NODE_BITS));
+        if ( !node ||
+             radix_tree_insert(&p2m->log_dirty.bitmap, idx, node) )
+        {
+            xfree(node);
+            p2m->log_dirty.failed_allocs++;
+            return;
+        }
+    }
+
+    if ( !__test_and_set_bit(gfn % LOGDIRTY_NODE_BITS, node) )
+        p2m->log_dirty.dirty_count++;
+}
+
+void p2m_log_dirty_mark(struct domain *d, gfn_t gfn, unsigned long nr)
+{
+    struct p2m_domain *p2m = p2m_get_hostp2m(d);
+
+    if ( likely(!p2m->log_dirty.enabled) )
+        return;
+
+    spin_lock(&p2m->log_dirty.lock);
+    for ( ; nr; nr--, gfn = gfn_add(gfn, 1) )
+        p2m_log_dirty_set(p2m, gfn_x(gfn));
+    spin_unlock(&p2m->log_dirty.lock);
+}
+
+void p2m_log_dirty_mark_mfn(struct domain *d, mfn_t mfn)
+{
+    struct p2m_domain *p2m = p2m_get_hostp2m(d);
+    int rc;
+
+    if ( likely(!p2m->log_dirty.enabled) )
+        return;
+
+    spin_lock(&p2m->log_dirty.lock);
+
+    rc = radix_tree_insert(&p2m->log_dirty.dirty_mfns, mfn_x(mfn),
+                           radix_tree_ulong_to_ptr(mfn_x(mfn)));
+    if ( !rc )
+        p2m->log_dirty.nr_dirty_mfns++;
+    else if ( rc != -EEXIST )
+        p2m->log_dirty.failed_allocs++;
+
+    spin_unlock(&p2m->log_dirty.lock);
+}
+
+/*
+ * Move the MFNs recorded by p2m_log_dirty_mark_mfn() to the dirty bitmap.
+ * Without an M2P, this requires to walk all the RAM mappings.
+ */
+static void p2m_log_dirty_resolve_mfns(struct p2m_domain *p2m)
+{
+    gfn_t gfn = p2m->lowest_mapped_gfn;
+    gfn_t end = gfn_add(p2m->max_mapped_gfn, 1);
+
+    ASSERT(p2m_is_write_locked(p2m));
+    ASSERT(spin_is_locked(&p2m->log_dirty.lock));
+
+    if ( !p2m->log_dirty.nr_dirty_mfns )
+        return;
+
+    while ( gfn_x(gfn) < gfn_x(end) )
+    {
+        unsigned int order, i, n;
+        p2m_type_t t;
+        mfn_t mfn = p2m_get_entry(p2m, gfn, &t, NULL, &order, NULL);
+        gfn_t next = gfn_next_boundary(gfn, order);
+        unsigned long first = mfn_x(mfn);
+        unsigned long last = first + gfn_x(next) - gfn_x(gfn);
+        void *items[16];
+
+        if ( !p2m_is_ram(t) )
+        {
+            gfn = next;
+            continue;
+        }
+
+        while ( (n = radix_tree_gang_lookup(&p2m->log_dirty.dirty_mfns, items,
+                                            first, ARRAY_SIZE(items))) )
+        {
+            for ( i = 0; i < n; i++ )
+            {
+                first = radix_tree_ptr_to_ulong(items[i]);
+                if ( first >= last )
+                    break;
+
+                p2m_log_dirty_set(p2m,
+                                  gfn_x(gfn) + first - mfn_x(mfn));
+            }
+
+            if ( i < n )
+                break;
+
+            first++;
+        }
+
+        gfn = next;
+    }
+
+    radix_tree_destroy(&p2m->log_dirty.dirty_mfns, NULL);
+    p2m->log_dirty.nr_dirty_mfns = 0;
+}
+
+static void cf_check p2m_log_dirty_free_node(void *node)
+{
+    xfree(node);
+}
+
+static void p2m_log_dirty_free(struct p2m_domain *p2m)
+{
+    spin_lock(&p2m->log_dirty.lock);
+
+    radix_tree_destroy(&p2m->log_dirty.bitmap, p2m_log_dirty_free_node);
+    radix_tree_destroy(&p2m->log_dirty.dirty_mfns, NULL);
+    p2m->log_dirty.nr_dirty_mfns = 0;
+    p2m->log_dirty.fault_count = 0;
+    p2m->log_dirty.dirty_count = 0;
+    p2m->log_dirty.failed_allocs = 0;
+    p2m->log_dirty.preempt_dom = NULL;
+
+    spin_unlock(&p2m->log_dirty.lock);
+}
+
+int p2m_log_dirty_enable(struct domain *d)
+{
+    struct p2m_domain *p2m = p2m_get_hostp2m(d);
+    int rc;
+
+    /*
+     * Write-protecting the p2m would result in unrecoverable faults for
+     * DMA going through an IOMMU sharing the page-tables.
+     */
+    if ( iommu_use_hap_pt(d) )
+        return -EOPNOTSUPP;
+
+    p2m_write_lock(p2m);
+
+    /* Both mem_access and log-dirty rely on the permissions of the p2m. */
+    if ( p2m->mem_access_enabled )
+    {
+        rc = -EBUSY;
+        goto out;
+    }
+
+    if ( !p2m->log_dirty.enabled )
+    {
+        /* A previous disable has not completed */
+        if ( !gfn_eq(p2m->log_dirty.resume_gfn, INVALID_GFN) )
+        {
+            rc = -EBUSY;
+            goto out;
+        }
+
+        p2m->log_dirty.enabled = true;
+        p2m->log_dirty.resume_gfn = p2m->lowest_mapped_gfn;
+    }
+    else if ( gfn_eq(p2m->log_dirty.resume_gfn, INVALID_GFN) )
+    {
+        rc = -EINVAL;
+        goto out;
+    }
+
+    rc = p2m_retype_range(p2m, &p2m->log_dirty.resume_gfn,
+                          gfn_add(p2m->max_mapped_gfn, 1),
+                          p2m_ram_rw, p2m_ram_logdirty);
+    if ( !rc )
+        p2m->log_dirty.resume_gfn = INVALID_GFN;
+
+out:
+    p2m_write_unlock(p2m);
+
+    return rc;
+}
+
+int p2m_log_dirty_disable(struct domain *d)
+{
+    struct p2m_domain *p2m = p2m_get_hostp2m(d);
+    int rc;
+
+    p2m_write_lock(p2m);
+
+    if ( p2m->log_dirty.enabled )
+    {
+        /* This may abort an enable in progress. */
+        p2m->log_dirty.enabled = false;
+        p2m->log_dirty.resume_gfn = p2m->lowest_mapped_gfn;
+    }
+    else if ( gfn_eq(p2m->log_dirty.resume_gfn, INVALID_GFN) )
+    {
+        rc = 0;
+        goto out;
+    }
+
+    rc = p2m_retype_range(p2m, &p2m->log_dirty.resume_gfn,
+                          gfn_add(p2m->max_mapped_gfn, 1),
+                          p2m_ram_logdirty, p2m_ram_rw);
+    if ( !rc )
+    {
+        p2m->log_dirty.resume_gfn = INVALID_GFN;
+        p2m_log_dirty_free(p2m);
+    }
+
+out:
+    p2m_write_unlock(p2m);
+
+    return rc;
+}
+
+/*
+ * Handle XEN_DOMCTL_SHADOW_OP_{PEEK,CLEAN}.
+ *
+ * The bitmap is copied one page at a time, cleaning and write-protecting
+ * the pages it reports dirty, with preemption checks in between. The domain
+ * is paused while each call runs, so no write is missed between copying a
+ * bit and write-protecting its page. The operation resumes where it was
+ * preempted when the same domain issues it again, as on x86.
+ */
+int p2m_log_dirty_op(struct domain *d, struct xen_domctl_shadow_op *sc)
+{
+    struct p2m_domain *p2m = p2m_get_hostp2m(d);
+    bool clean = (sc->op == XEN_DOMCTL_SHADOW_OP_CLEAN);
+    uint64_t pages;
+    unsigned long i;
+    int rc = 0;
+
+    if ( sc->mode & ~XEN_DOMCTL_SHADOW_LOGDIRTY_FINAL )
+        return -EINVAL;
+
+    domain_pause(d);
+
+    p2m_write_lock(p2m);
+    spin_lock(&p2m->log_dirty.lock);
+
+    if ( !p2m->log_dirty.preempt_dom )
+        p2m->log_dirty.preempt_next = 0;
+    else if ( p2m->log_dirty.preempt_dom != current->domain ||
+              p2m->log_dirty.preempt_op != sc->op )
+    {
+        spin_unlock(&p2m->log_dirty.lock);
+        p2m_write_unlock(p2m);
+        domain_unpause(d);
+        return -EBUSY;
+    }
+
+    if ( !p2m->log_dirty.enabled )
+    {
+        rc = -EINVAL;
+        goto out;
+    }
+
+    p2m_log_dirty_resolve_mfns(p2m);
+
+    sc->stats.fault_count = min(p2m->log_dirty.fault_count, UINT32_MAX + 0UL);
+    sc->stats.dirty_count = min(p2m->log_dirty.dirty_count, UINT32_MAX + 0UL);
+
+    if ( unlikely(p2m->log_dirty.failed_allocs) )
+    {
+        printk(XENLOG_WARNING
+               "%u failed allocs while logging dirty pages of %pd\n",
+               p2m->log_dirty.failed_allocs, d);
+        rc = -ENOMEM;
+        goto out;
+    }
+
+    pages = min_t(uint64_t, sc->pages, gfn_x(p2m->max_mapped_gfn) + 1);
+
+    for ( i = p2m->log_dirty.preempt_next;
+          (uint64_t)i * LOGDIRTY_NODE_BITS < pages; i++ )
+    {
+        unsigned long *node = radix_tree_lookup(&p2m->log_dirty.bitmap, i);
+        unsigned long base = i * LOGDIRTY_NODE_BITS;
+        unsigned int nbits = min_t(uint64_t, pages - base, LOGDIRTY_NODE_BITS);
+        unsigned int bit;
+
+        if ( !guest_handle_is_null(sc->dirty_bitmap) &&
+             (node ? copy_to_guest_offset(sc->dirty_bitmap, base >> 3,
+                                          (uint8_t *)node, (nbits + 7) >> 3)
+                   : clear_guest_offset(sc->dirty_bitmap, base >> 3,
+                                        (nbits + 7) >> 3)) )
+        {
+            rc = -EFAULT;
+            break;
+        }
+
+        if ( node && clean )
+        {
+            /* Bits past the pages requested are left for the next round. */
+            for ( bit = find_first_bit(node, nbits); bit < nbits;
+                  bit = find_next_bit(node, nbits, bit + 1) )
+            {
+                p2m_retype_entry(p2m, _gfn(base + bit),
+                                 p2m_ram_rw, p2m_ram_logdirty);
+                __clear_bit(bit, node);
+            }
+
+            p2m->need_flush = true;
+
+            if ( find_first_bit(node, LOGDIRTY_NODE_BITS) >=
+                 LOGDIRTY_NODE_BITS )
+            {
+                radix_tree_delete(&p2m->log_dirty.bitmap, i);
+                xfree(node);
+            }
+        }
+
+        if ( (uint64_t)(i + 1) * LOGDIRTY_NODE_BITS < pages &&
+             hypercall_preempt_check() )
+        {
+            p2m->log_dirty.preempt_dom = current->domain;
+            p2m->log_dirty.preempt_op = sc->op;
+            p2m->log_dirty.preempt_next = i + 1;
+            rc = -ERESTART;
+            break;
+        }
+    }
+
+    if ( !rc )
+    {
+        if ( pages < sc->pages )
+            sc->pages = pages;
+
+        if ( clean )
+        {
+            p2m->log_dirty.fault_count = 0;
+            p2m->log_dirty.dirty_count = 0;
+        }
+    }
+
+out:
+    if ( rc != -ERESTART )
+        p2m->log_dirty.preempt_dom = NULL;
+
+    spin_unlock(&p2m->log_dirty.lock);
+    /* The pages cleaned are write-protected before the domain resumes. */
+    p2m_write_unlock(p2m);
+
+    domain_unpause(d);
+
+    return rc;
+}
+
+bool p2m_log_dirty_fault(struct domain *d, gfn_t gfn)
+{
+    struct p2m_domain *p2m = p2m_get_hostp2m(d);
+    bool resolved = false;
+    unsigned int order;
+    p2m_access_t a;
+    p2m_type_t t;
+    mfn_t mfn;
+
+    /* Permission faults are then owned by mem_access. */
+    if ( p2m->mem_access_enabled )
+        return false;
+
+    /*
+     * Look at the entry under the read lock first, so that the faults which
+     * don't need to change it don't contend for the write lock.
+     */
+    p2m_read_lock(p2m);
+    p2m_get_entry(p2m, gfn, &t, NULL, NULL, NULL);
+    p2m_read_unlock(p2m);
+
+    /*
+     * Another vCPU may have resolved the fault in the meantime, or the
+     * TLBs still hold the read-only mapping.
+     */
+    if ( t == p2m_ram_rw )
+        return true;
+    if ( t != p2m_ram_logdirty )
+        return false;
+
+    p2m_write_lock(p2m);
+
+    /* The entry may have changed while the lock was dropped. */
+    mfn = p2m_get_entry(p2m, gfn, &t, &a, &order, NULL);
+
+    if ( t == p2m_ram_rw )
+        resolved = true;
+    else if ( t == p2m_ram_logdirty )
+    {
+        /*
+         * Only make writable the page being written to, so the rest of the
+         * superpage is still tracked. Relaxing the permissions of a page
+         * entry doesn't require a TLB flush: a stale entry will only lead
+         * to a spurious fault.
+         */
+        if ( order )
+            resolved = !__p2m_set_entry(p2m, gfn, 0, mfn, p2m_ram_rw, a);
+        else
+        {
+            p2m_retype_entry(p2m, gfn, p2m_ram_logdirty, p2m_ram_rw);
+            resolved = true;
+        }
+
+        if ( resolved && p2m->log_dirty.enabled )
+        {
+            spin_lock(&p2m->log_dirty.lock);
+            p2m->log_dirty.fault_count++;
+            p2m_log_dirty_set(p2m, gfn_x(gfn));
+            spin_unlock(&p2m->log_dirty.lock);
+        }
+    }
+
+    p2m_write_unlock(p2m);
+
+    return resolved;
+}
+
 static struct page_info *p2m_allocate_root(void)
 {
     struct page_info *page;
@@ -1441,15 +2388,11 @@ static int p2m_alloc_table(struct domain *d)
     if ( !p2m->root )
         return -ENOMEM;
 
-    p2m->vttbr = generate_vttbr(p2m->vmid, page_to_mfn(p2m->root));
-
     /*
-     * Make sure that all TLBs corresponding to the new VMID are flushed
-     * before using it
+     * The VMID is given, and the TLBs flushed for it if needed, when a vCPU
+     * is first scheduled in.
      */
-    p2m_write_lock(p2m);
-    p2m_force_tlb_flush_sync(p2m);
-    p2m_write_unlock(p2m);
+    p2m->vttbr = generate_vttbr(INVALID_VMID, page_to_mfn(p2m->root));
 
     return 0;
 }
@@ -1505,10 +2448,11 @@ void p2m_final_teardown(struct domain *d)
 
     p2m->root = NULL;
 
-    p2m_free_vmid(d);
-
     radix_tree_destroy(&p2m->mem_access_settings, NULL);
 
+    p2m->log_dirty.enabled = false;
+    p2m_log_dirty_free(p2m);
+
     p2m->domain = NULL;
 }
 
@@ -1526,11 +2470,17 @@ int p2m_init(struct domain *d)
     p2m->vmid = INVALID_VMID;
     p2m->max_mapped_gfn = _gfn(0);
     p2m->lowest_mapped_gfn = _gfn(ULONG_MAX);
+    p2m->coalesce_gfn = _gfn(0);
 
     p2m->default_access = p2m_access_rwx;
     p2m->mem_access_enabled = false;
     radix_tree_init(&p2m->mem_access_settings);
 
+    spin_lock_init(&p2m->log_dirty.lock);
+    p2m->log_dirty.resume_gfn = INVALID_GFN;
+    radix_tree_init(&p2m->log_dirty.bitmap);
+    radix_tree_init(&p2m->log_dirty.dirty_mfns);
+
     /*
      * Some IOMMUs don't support coherent PT walk. When the p2m is
      * shared with the CPU, Xen has to make sure that the PT changes have
@@ -1556,10 +2506,6 @@ int p2m_init(struct domain *d)
      */
     p2m->domain = d;
 
-    rc = p2m_alloc_vmid(d);
-    if ( rc )
-        return rc;
-
     rc = p2m_alloc_table(d);
     if ( rc )
         return rc;
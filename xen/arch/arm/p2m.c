@@ -11,10 +11,6 @@
 #include <asm/page.h>
 #include <asm/traps.h>
 
-#ifdef CONFIG_ARM_64
-unsigned int __read_mostly max_vmid = MAX_VMID_8_BIT;
-#endif
-
 /*
  * Set to the maximum configured support for IPA bits, so the number of IPA bits can be
  * restricted by external entity (e.g. IOMMU).
@@ -245,69 +241,6 @@ int set_foreign_p2m_entry(struct domain *d, const struct domain *fd,
     return rc;
 }
 
-static spinlock_t vmid_alloc_lock = SPIN_LOCK_UNLOCKED;
-
-/*
- * VTTBR_EL2 VMID field is 8 or 16 bits. AArch64 may support 16-bit VMID.
- * Using a bitmap here limits us to 256 or 65536 (for AArch64) concurrent
- * domains. The bitmap space will be allocated dynamically based on
- * whether 8 or 16 bit VMIDs are supported.
- */
-static unsigned long *vmid_mask;
-
-void p2m_vmid_allocator_init(void)
-{
-    /*
-     * allocate space for vmid_mask based on MAX_VMID
-     */
-    vmid_mask = xzalloc_array(unsigned long, BITS_TO_LONGS(MAX_VMID));
-
-    if ( !vmid_mask )
-        panic("Could not allocate VMID bitmap space\n");
-
-    set_bit(INVALID_VMID, vmid_mask);
-}
-
-int p2m_alloc_vmid(struct domain *d)
-{
-    struct p2m_domain *p2m = p2m_get_hostp2m(d);
-
-    int rc, nr;
-
-    spin_lock(&vmid_alloc_lock);
-
-    nr = find_first_zero_bit(vmid_mask, MAX_VMID);
-
-    ASSERT(nr != INVALID_VMID);
-
-    if ( nr == MAX_VMID )
-    {
-        rc = -EBUSY;
-        printk(XENLOG_ERR "p2m.c: dom%d: VMID pool exhausted\n", d->domain_id);
-        goto out;
-    }
-
-    set_bit(nr, vmid_mask);
-
-    p2m->vmid = nr;
-
-    rc = 0;
-
-out:
-    spin_unlock(&vmid_alloc_lock);
-    return rc;
-}
-
-void p2m_free_vmid(struct domain *d)
-{
-    struct p2m_domain *p2m = p2m_get_hostp2m(d);
-    spin_lock(&vmid_alloc_lock);
-    if ( p2m->vmid != INVALID_VMID )
-        clear_bit(p2m->vmid, vmid_mask);
-
-    spin_unlock(&vmid_alloc_lock);
-}
-
 int p2m_cache_flush_range(struct domain *d, gfn_t *pstart, gfn_t end)
 {
     struct p2m_domain *p2m = p2m_get_hostp2m(d);
@@ -559,7 +492,13 @@ struct page_info *get_page_from_gva(struct vcpu *v, vaddr_t va,
             return NULL;
 
         if ( (flags & GV2M_WRITE) && t != p2m_ram_rw )
-            return NULL;
+        {
+            if ( t != p2m_ram_logdirty )
+                return NULL;
+
+            /* Xen writes through its own mapping, record it. */
+            p2m_log_dirty_mark(d, gaddr_to_gfn(ipa), 1);
+        }
     }
     else
         mfn = maddr_to_mfn(maddr);
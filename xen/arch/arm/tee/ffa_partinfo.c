@@ -130,6 +130,7 @@ int32_t ffa_handle_partition_info_get(uint32_t w1, uint32_t w2, uint32_t w3,
 
         memcpy(ctx->rx, ffa_rx, sz);
     }
+    p2m_log_dirty_mark_mfn(d, page_to_mfn(ctx->rx_pg));
     ctx->rx_is_free = false;
 out_rx_release:
     ffa_rx_release();
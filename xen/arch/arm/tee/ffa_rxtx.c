@@ -68,7 +68,7 @@ uint32_t ffa_handle_rxtx_map(uint32_t fid, register_t tx_addr,
         return FFA_RET_INVALID_PARAMETERS;
 
     /* Only normal RW RAM for now */
-    if ( t != p2m_ram_rw )
+    if ( !p2m_is_ram_rw(t) )
         goto err_put_tx_pg;
 
     rx_pg = get_page_from_gfn(d, gfn_x(gaddr_to_gfn(rx_addr)), &t, P2M_ALLOC);
@@ -76,7 +76,7 @@ uint32_t ffa_handle_rxtx_map(uint32_t fid, register_t tx_addr,
         goto err_put_tx_pg;
 
     /* Only normal RW RAM for now */
-    if ( t != p2m_ram_rw )
+    if ( !p2m_is_ram_rw(t) )
         goto err_put_rx_pg;
 
     tx = __map_domain_page_global(tx_pg);
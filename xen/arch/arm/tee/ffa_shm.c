@@ -184,7 +184,7 @@ static int get_shm_pages(struct domain *d, struct ffa_shm_mem *shm,
             if ( !shm->pages[pg_idx] )
                 return FFA_RET_DENIED;
             /* Only normal RW RAM for now */
-            if ( t != p2m_ram_rw )
+            if ( !p2m_is_ram_rw(t) )
                 return FFA_RET_DENIED;
             pg_idx++;
         }
@@ -203,6 +203,9 @@ static void put_shm_pages(struct ffa_shm_mem *shm)
 
     for ( n = 0; n < shm->page_count && shm->pages[n]; n++ )
     {
+        /* The page may have been written by the other endpoints. */
+        p2m_log_dirty_mark_mfn(page_get_owner(shm->pages[n]),
+                               page_to_mfn(shm->pages[n]));
         put_page(shm->pages[n]);
         shm->pages[n] = NULL;
     }
@@ -279,7 +279,7 @@ static struct page_info *get_domain_ram_page(gfn_t gfn)
     p2m_type_t t;
 
     page = get_page_from_gfn(current->domain, gfn_x(gfn), &t, P2M_ALLOC);
-    if ( !page || t != p2m_ram_rw )
+    if ( !page || !p2m_is_ram_rw(t) )
     {
         if ( page )
             put_page(page);
@@ -595,9 +595,14 @@ static void free_optee_shm_buf(struct optee_domain *ctx, uint64_t cookie)
     if ( !found )
         return;
 
+    /* The pages may have been written by OP-TEE while shared. */
     for ( i = 0; i < optee_shm_buf->page_cnt; i++ )
         if ( optee_shm_buf->pages[i] )
+        {
+            p2m_log_dirty_mark_mfn(page_get_owner(optee_shm_buf->pages[i]),
+                                   page_to_mfn(optee_shm_buf->pages[i]));
             put_page(optee_shm_buf->pages[i]);
+        }
 
     free_pg_list(optee_shm_buf);
 
@@ -1031,6 +1036,7 @@ static void copy_std_request_back(struct optee_domain *ctx,
     }
 
     unmap_domain_page(guest_arg);
+    p2m_log_dirty_mark_mfn(current->domain, page_to_mfn(page));
     put_page(page);
 }
 
@@ -1879,9 +1879,13 @@ static void do_trap_stage2_abort_guest(struct cpu_user_regs *regs,
             .kind = xabt.s1ptw ? npfec_kind_in_gpt : npfec_kind_with_gla
         };
 
+        /* Write to a page write-protected for log-dirty tracking? */
+        if ( p2m_log_dirty_fault(current->domain, gaddr_to_gfn(gpa)) )
+            return;
+
         p2m_mem_access_check(gpa, gva, npfec);
         /*
-         * The only way to get here right now is because of mem_access,
+         * The only other way to get here right now is because of mem_access,
          * thus reinjecting the exception to the guest is never required.
          */
         return;
@@ -0,0 +1,271 @@
+/* SPDX-License-Identifier: GPL-2.0-only */
+/*
+ * VMID allocation for the stage-2 translation of guests.
+ */
+#include <xen/bitmap.h>
+#include <xen/cpu.h>
+#include <xen/cpumask.h>
+#include <xen/init.h>
+#include <xen/lib.h>
+#include <xen/percpu.h>
+#include <xen/sched.h>
+#include <xen/spinlock.h>
+#include <xen/xmalloc.h>
+
+#include <asm/flushtlb.h>
+#include <asm/p2m.h>
+
+#ifdef CONFIG_ARM_64
+unsigned int __read_mostly max_vmid = MAX_VMID_8_BIT;
+#endif
+
+static spinlock_t vmid_alloc_lock = SPIN_LOCK_UNLOCKED;
+
+/*
+ * VTTBR_EL2 VMID field is 8 or 16 bits. AArch64 may support 16-bit VMID.
+ * That is fewer than the domains Xen can run, so VMIDs are handed out by
+ * generation, as Linux does for ASIDs: p2m->vmid holds the VMID in its low
+ * bits, and the generation it was allocated in above them.
+ *
+ * A domain gets a VMID of the current generation when one of its vCPUs is
+ * scheduled in.  VMIDs are not freed with domains: once all of them have been
+ * handed out, a new generation starts, and each CPU flushes its guest TLBs
+ * before running a domain with a VMID of the new generation.  The VMIDs
+ * active on CPUs at that point are reserved in the new generation, so the
+ * domains running keep using them.
+ *
+ * The bitmap space will be allocated dynamically based on whether 8 or 16 bit
+ * VMIDs are supported.
+ */
+static unsigned long *vmid_mask;
+static uint64_t vmid_generation;
+static unsigned long vmid_next = INVALID_VMID + 1;
+static cpumask_t vmid_flush_pending;
+
+/* VMID of the domain running on each CPU, and kept over a rollover. */
+static DEFINE_PER_CPU(uint64_t, active_vmid);
+static DEFINE_PER_CPU(uint64_t, reserved_vmid);
+
+#define VMID_GEN_MASK (~((uint64_t)MAX_VMID - 1))
+
+static bool vmid_gen_match(uint64_t vmid)
+{
+    return !((vmid ^ read_atomic(&vmid_generation)) & VMID_GEN_MASK);
+}
+
+static uint64_t vmid_xchg(uint64_t *ptr, uint64_t new)
+{
+    uint64_t old;
+
+    do {
+        old = read_atomic(ptr);
+    } while ( cmpxchg64(ptr, old, new) != old );
+
+    return old;
+}
+
+/* Start a new generation.  Must be called with vmid_alloc_lock held. */
+static void vmid_rollover(void)
+{
+    unsigned int cpu;
+    uint64_t vmid;
+
+    write_atomic(&vmid_generation, vmid_generation + MAX_VMID);
+
+    bitmap_zero(vmid_mask, MAX_VMID);
+    __set_bit(INVALID_VMID, vmid_mask);
+
+    for_each_online_cpu(cpu)
+    {
+        /*
+         * Clearing the active VMID sends the CPU to the slow path of
+         * p2m_update_vmid(), to flush its TLBs.  A CPU which hasn't run a
+         * domain since the last rollover keeps the VMID it reserved then.
+         */
+        vmid = vmid_xchg(&per_cpu(active_vmid, cpu), 0);
+        if ( !vmid )
+            vmid = per_cpu(reserved_vmid, cpu);
+        __set_bit(vmid & ~VMID_GEN_MASK, vmid_mask);
+        per_cpu(reserved_vmid, cpu) = vmid;
+    }
+
+    cpumask_setall(&vmid_flush_pending);
+}
+
+/*
+ * Move a reserved VMID to the current generation.  Must be called with
+ * vmid_alloc_lock held.
+ */
+static bool vmid_update_reserved(uint64_t vmid, uint64_t new)
+{
+    unsigned int cpu;
+    bool hit = false;
+
+    /* Several CPUs may have reserved the same VMID: update all of them. */
+    for_each_online_cpu(cpu)
+        if ( per_cpu(reserved_vmid, cpu) == vmid )
+        {
+            per_cpu(reserved_vmid, cpu) = new;
+            hit = true;
+        }
+
+    return hit;
+}
+
+/* Must be called with vmid_alloc_lock held. */
+static uint64_t vmid_new(uint64_t vmid)
+{
+    unsigned long nr;
+
+    if ( vmid )
+    {
+        uint64_t new = vmid_generation | (vmid & ~VMID_GEN_MASK);
+
+        /* The VMID was active when the generation rolled over: keep it. */
+        if ( vmid_update_reserved(vmid, new) )
+            return new;
+
+        /* Else try to get the same VMID back in this generation. */
+        if ( !__test_and_set_bit(vmid & ~VMID_GEN_MASK, vmid_mask) )
+            return new;
+    }
+
+    nr = find_next_zero_bit(vmid_mask, MAX_VMID, vmid_next);
+    if ( nr == MAX_VMID )
+    {
+        vmid_rollover();
+        nr = find_next_zero_bit(vmid_mask, MAX_VMID, INVALID_VMID + 1);
+        /* There are more VMIDs than CPUs to reserve them. */
+        BUG_ON(nr == MAX_VMID);
+    }
+
+    __set_bit(nr, vmid_mask);
+    vmid_next = nr + 1;
+
+    return vmid_generation | nr;
+}
+
+void p2m_vmid_allocator_init(void)
+{
+    /*
+     * allocate space for vmid_mask based on MAX_VMID
+     */
+    vmid_mask = xzalloc_array(unsigned long, BITS_TO_LONGS(MAX_VMID));
+
+    if ( !vmid_mask )
+        panic("Could not allocate VMID bitmap space\n");
+
+    if ( num_possible_cpus() >= MAX_VMID - 1 )
+        panic("%lu VMIDs are not enough for %u CPUs\n",
+              (unsigned long)MAX_VMID - 1, num_possible_cpus());
+
+    set_bit(INVALID_VMID, vmid_mask);
+
+    vmid_generation = MAX_VMID;
+
+    /* The TLBs may hold entries from before Xen started. */
+    cpumask_setall(&vmid_flush_pending);
+}
+
+/*
+ * Make sure the P2M has a VMID of the current generation, for the local CPU
+ * to run one of its vCPUs, and return it.  Must be called with interrupts
+ * disabled.
+ */
+uint16_t p2m_update_vmid(struct p2m_domain *p2m)
+{
+    unsigned int cpu = smp_processor_id();
+    uint64_t vmid = read_atomic(&p2m->vmid);
+    uint64_t active = read_atomic(&per_cpu(active_vmid, cpu));
+
+    ASSERT(!local_irq_is_enabled());
+
+    /*
+     * Fast path: the VMID is of the current generation, and the generation
+     * didn't roll over since this CPU last ran a domain, which would have
+     * cleared its active VMID.
+     */
+    if ( active && vmid_gen_match(vmid) &&
+         cmpxchg64(&per_cpu(active_vmid, cpu), active, vmid) == active )
+        return vmid & ~VMID_GEN_MASK;
+
+    spin_lock(&vmid_alloc_lock);
+
+    vmid = p2m->vmid;
+    if ( !vmid_gen_match(vmid) )
+    {
+        vmid = vmid_new(vmid);
+        write_atomic(&p2m->vmid, vmid);
+        /*
+         * Pairs with the barrier in p2m_flush_tlb(): either the P2M updates
+         * are visible to the table walks with the new VMID, or the flush
+         * uses it.
+         */
+        smp_mb();
+    }
+
+    if ( cpumask_test_and_clear_cpu(cpu, &vmid_flush_pending) )
+        flush_all_guests_tlb_local();
+
+    write_atomic(&per_cpu(active_vmid, cpu), vmid);
+
+    spin_unlock(&vmid_alloc_lock);
+
+    return vmid & ~VMID_GEN_MASK;
+}
+
+static int cf_check cpu_vmid_callback(struct notifier_block *nfb,
+                                      unsigned long action, void *hcpu)
+{
+    unsigned int cpu = (unsigned long)hcpu;
+
+    switch ( action )
+    {
+    case CPU_UP_PREPARE:
+        /*
+         * The TLBs of a CPU coming up may hold entries of any VMID: have it
+         * flush them before running a domain.
+         */
+        spin_lock_irq(&vmid_alloc_lock);
+        write_atomic(&per_cpu(active_vmid, cpu), 0);
+        per_cpu(reserved_vmid, cpu) = 0;
+        cpumask_set_cpu(cpu, &vmid_flush_pending);
+        spin_unlock_irq(&vmid_alloc_lock);
+        break;
+
+    case CPU_UP_CANCELED:
+    case CPU_DEAD:
+        /*
+         * Offline CPUs are left out of rollovers, their per-CPU area being
+         * about to be freed: don't have them pin a VMID either.
+         */
+        spin_lock_irq(&vmid_alloc_lock);
+        write_atomic(&per_cpu(active_vmid, cpu), 0);
+        per_cpu(reserved_vmid, cpu) = 0;
+        spin_unlock_irq(&vmid_alloc_lock);
+        break;
+    }
+
+    return NOTIFY_DONE;
+}
+
+static struct notifier_block cpu_vmid_nfb = {
+    .notifier_call = cpu_vmid_callback,
+};
+
+static int __init cf_check vmid_cpu_init(void)
+{
+    register_cpu_notifier(&cpu_vmid_nfb);
+
+    return 0;
+}
+presmp_initcall(vmid_cpu_init);
+
+/*
+ * Local variables:
+ * mode: C
+ * c-file-style: "BSD"
+ * c-basic-offset: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
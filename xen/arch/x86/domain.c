@@ -32,7 +32,9 @@
 #include <xen/acpi.h>
 #include <xen/pci.h>
 #include <xen/paging.h>
+#include <xen/param.h>
 #include <xen/cpu.h>
+#include <xen/tasklet.h>
 #include <xen/wait.h>
 #include <xen/guest_access.h>
 #include <xen/livepatch.h>
@@ -2345,6 +2347,163 @@ static int relinquish_memory(
     return ret;
 }
 
+/*
+ * The pages of non-PV domains carry no pagetable types to undo, so they can
+ * be released from several CPUs at once: besides the CPU continuing
+ * XEN_DOMCTL_destroydomain, up to this many CPUs of the domain's NUMA nodes
+ * help, each from a tasklet kicked again on every continuation.
+ */
+static unsigned int __read_mostly opt_teardown_workers = 4;
+integer_param("teardown-workers", opt_teardown_workers);
+
+#define RELMEM_BATCH 64 /* Pages taken off d->page_list at a time. */
+#define RELMEM_SLICE 16 /* Batches per run of a helper tasklet. */
+
+struct relmem_worker {
+    struct tasklet tasklet;
+    struct domain *domain;
+    unsigned int cpu;
+};
+
+/*
+ * Release up to RELMEM_BATCH untyped pages from the head of d->page_list,
+ * returning how many were taken off it.
+ */
+static unsigned int relinquish_batch(struct domain *d)
+{
+    struct page_info *pages[RELMEM_BATCH], *page;
+    unsigned int i, nr = 0, taken = 0;
+
+    rspin_lock(&d->page_alloc_lock);
+
+    while ( taken < RELMEM_BATCH &&
+            (page = page_list_remove_head(&d->page_list)) )
+    {
+        taken++;
+
+        /* Put the page on the list and /then/ potentially free it. */
+        page_list_add_tail(page, &d->arch.relmem_list);
+
+        /* Couldn't get a reference -- someone is freeing this page. */
+        if ( likely(get_page(page, d)) )
+            pages[nr++] = page;
+    }
+
+    /* Taken with the pages, for relinquish_memory_parallel() to wait on. */
+    if ( nr )
+        atomic_inc(&d->arch.relmem_busy);
+
+    rspin_unlock(&d->page_alloc_lock);
+
+    for ( i = 0; i < nr; i++ )
+    {
+        put_page_alloc_ref(pages[i]);
+        put_page(pages[i]);
+    }
+
+    if ( nr )
+        atomic_dec(&d->arch.relmem_busy);
+
+    return taken;
+}
+
+static void cf_check relmem_worker_fn(void *data)
+{
+    struct relmem_worker *w = data;
+    unsigned int i;
+
+    for ( i = 0; i < RELMEM_SLICE; i++ )
+        if ( !relinquish_batch(w->domain) ||
+             softirq_pending(smp_processor_id()) )
+            break;
+}
+
+static void start_relmem_workers(struct domain *d)
+{
+    struct relmem_worker *w;
+    unsigned int node, cpu, nr = 0;
+
+    /* Only try once: on failure, the teardown carries on without help. */
+    d->arch.relmem_workers_tried = true;
+
+    if ( !opt_teardown_workers || num_online_cpus() < 2 )
+        return;
+
+    w = xzalloc_array(struct relmem_worker, opt_teardown_workers);
+    if ( !w )
+        return;
+
+    for_each_node_mask ( node, d->node_affinity )
+        for_each_cpu ( cpu, &node_to_cpumask(node) )
+        {
+            if ( nr == opt_teardown_workers )
+                break;
+            if ( !cpu_online(cpu) || cpu == smp_processor_id() )
+                continue;
+
+            w[nr].domain = d;
+            w[nr].cpu = cpu;
+            tasklet_init(&w[nr].tasklet, relmem_worker_fn, &w[nr]);
+            nr++;
+        }
+
+    if ( !nr )
+    {
+        xfree(w);
+        return;
+    }
+
+    d->arch.relmem_workers = w;
+    d->arch.nr_relmem_workers = nr;
+}
+
+static void stop_relmem_workers(struct domain *d)
+{
+    unsigned int i;
+
+    for ( i = 0; i < d->arch.nr_relmem_workers; i++ )
+        tasklet_kill(&d->arch.relmem_workers[i].tasklet);
+
+    XFREE(d->arch.relmem_workers);
+    d->arch.nr_relmem_workers = 0;
+}
+
+/*
+ * relinquish_memory() for the page list of non-PV domains, spread over
+ * helper tasklets.  Returns -ERESTART until every page has been dealt with.
+ */
+static int relinquish_memory_parallel(struct domain *d)
+{
+    unsigned int i;
+
+    if ( !d->arch.relmem_workers_tried )
+        start_relmem_workers(d);
+
+    for ( i = 0; i < d->arch.nr_relmem_workers; i++ )
+    {
+        struct relmem_worker *w = &d->arch.relmem_workers[i];
+
+        if ( cpu_online(w->cpu) )
+            tasklet_schedule_on_cpu(&w->tasklet, w->cpu);
+    }
+
+    while ( relinquish_batch(d) )
+        if ( hypercall_preempt_check() )
+            return -ERESTART;
+
+    /* Helpers may still be putting the pages of their last batches. */
+    if ( atomic_read(&d->arch.relmem_busy) )
+        return -ERESTART;
+
+    stop_relmem_workers(d);
+
+    rspin_lock(&d->page_alloc_lock);
+    page_list_move(&d->page_list, &d->arch.relmem_list);
+    rspin_unlock(&d->page_alloc_lock);
+
+    return 0;
+}
+
 int domain_relinquish_resources(struct domain *d)
 {
     int ret;
@@ -2379,6 +2538,7 @@ int domain_relinquish_resources(struct domain *d)
             PROG_paging,
             PROG_vcpu_pagetables,
             PROG_xen,
+            PROG_parallel,
             PROG_l4,
             PROG_l3,
             PROG_l2,
@@ -2482,6 +2642,15 @@ int domain_relinquish_resources(struct domain *d)
         if ( ret )
             return ret;
 
+    PROGRESS(parallel):
+
+        if ( !is_pv_domain(d) )
+        {
+            ret = relinquish_memory_parallel(d);
+            if ( ret )
+                return ret;
+        }
+
     PROGRESS(l4):
 
         ret = relinquish_memory(d, &d->page_list, PGT_l4_page_table);
@@ -339,6 +339,11 @@ struct arch_domain
     /* Continuable domain_relinquish_resources(). */
     unsigned int rel_priv;
     struct page_list_head relmem_list;
+    /* Tasklets helping to relinquish the pages of non-PV domains. */
+    struct relmem_worker *relmem_workers;
+    unsigned int nr_relmem_workers;
+    bool relmem_workers_tried;
+    atomic_t relmem_busy;
 
     const struct arch_csw {
         void (*from)(struct vcpu *v);
@@ -175,6 +175,11 @@ void flush_area_mask(const cpumask_t *mask, const void *va,
 #define flush_tlb_one_all(v)                    \
     flush_tlb_one_mask(&cpu_online_map, v)
 
+/* Flush all CPUs' TLB entries of Xen's own mappings of a VA range */
+#define flush_xen_tlb_range_va(va, size)                                \
+    flush_area_all((const void *)(va), FLUSH_TLB_GLOBAL |               \
+                   FLUSH_ORDER(get_order_from_bytes(size)))
+
 #define flush_root_pgtbl_domain(d)                                       \
 {                                                                        \
     if ( is_pv_domain(d) && (d)->arch.pv.xpti )                          \
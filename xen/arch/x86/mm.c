@@ -5747,7 +5747,8 @@ int map_pages_to_xen(
             ol1e  = *pl1e;
             l1e_write(pl1e, l1e_from_mfn(mfn, flags));
             UNMAP_DOMAIN_PAGE(pl1e);
-            if ( (l1e_get_flags(ol1e) & _PAGE_PRESENT) )
+            if ( (l1e_get_flags(ol1e) & _PAGE_PRESENT) &&
+                 !(flags & MAP_NO_FLUSH) )
             {
                 unsigned int flush_flags = FLUSH_TLB | FLUSH_ORDER(0);
 
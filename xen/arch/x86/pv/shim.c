@@ -612,6 +612,59 @@ long pv_shim_event_channel_op(int cmd, XEN_GUEST_HANDLE_PARAM(void) arg)
         break;
     }
 
+    case EVTCHNOP_send_multi: {
+        XEN_GUEST_HANDLE_PARAM(evtchn_send_multi_t) uop =
+            guest_handle_cast(arg, evtchn_send_multi_t);
+        XEN_GUEST_HANDLE_PARAM(evtchn_port_t) ports =
+            guest_handle_cast(arg, evtchn_port_t);
+        struct evtchn_send_multi send_multi;
+        struct evtchn_send send;
+
+        if ( copy_from_guest(&send_multi, uop, 1) != 0 )
+            return -EFAULT;
+
+        if ( send_multi.done > send_multi.nr_ports )
+            return -EINVAL;
+
+        guest_handle_add_offset(ports,
+                                offsetof(struct evtchn_send_multi, ports) /
+                                sizeof(evtchn_port_t));
+
+        /* Send the ports one by one, as EVTCHNOP_send does. */
+        rc = 0;
+        while ( send_multi.done < send_multi.nr_ports )
+        {
+            if ( copy_from_guest_offset(&send.port, ports, send_multi.done,
+                                        1) != 0 )
+            {
+                rc = -EFAULT;
+                break;
+            }
+
+            if ( pv_console && send.port == pv_console_evtchn() )
+                consoled_guest_rx();
+            else
+                rc = xen_hypercall_event_channel_op(EVTCHNOP_send, &send);
+            if ( rc )
+                break;
+
+            if ( ++send_multi.done < send_multi.nr_ports &&
+                 hypercall_preempt_check() )
+            {
+                rc = -ERESTART;
+                break;
+            }
+        }
+
+        if ( __copy_field_to_guest(uop, &send_multi, done) )
+            rc = -EFAULT;
+        else if ( rc == -ERESTART )
+            rc = hypercall_create_continuation(__HYPERVISOR_event_channel_op,
+                                               "ih", cmd, arg);
+
+        break;
+    }
+
     case EVTCHNOP_reset: {
         struct evtchn_reset reset;
 
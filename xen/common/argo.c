@@ -1433,7 +1433,7 @@ find_ring_mfn(struct domain *d, gfn_t gfn, mfn_t *mfn)
             ret = -EINVAL;
         break;
 
-#ifdef CONFIG_X86
+#if defined(CONFIG_X86) || defined(CONFIG_ARM)
     case p2m_ram_logdirty:
         ret = -EAGAIN;
         break;
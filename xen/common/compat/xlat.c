@@ -66,6 +66,10 @@ CHECK_evtchn_init_control;
 CHECK_evtchn_reset;
 #undef xen_evtchn_reset
 
+#define xen_evtchn_send_multi evtchn_send_multi
+CHECK_evtchn_send_multi;
+#undef xen_evtchn_send_multi
+
 #define xen_evtchn_set_priority evtchn_set_priority
 CHECK_evtchn_set_priority;
 #undef xen_evtchn_set_priority
@@ -1050,6 +1050,7 @@ int domain_kill(struct domain *d)
     {
     case DOMDYING_alive:
         domain_pause(d);
+        d->teardown_pages = domain_tot_pages(d);
         d->is_dying = DOMDYING_dying;
         rspin_barrier(&d->domain_lock);
         argo_destroy(d);
@@ -866,6 +866,22 @@ long do_domctl(XEN_GUEST_HANDLE_PARAM(xen_domctl_t) u_domctl)
                 __HYPERVISOR_domctl, "h", u_domctl);
         break;
 
+    case XEN_DOMCTL_get_teardown_progress:
+    {
+        struct xen_domctl_teardown_progress *tp = &op->u.teardown_progress;
+
+        BUILD_BUG_ON(XEN_DOMCTL_TEARDOWN_alive != DOMDYING_alive);
+        BUILD_BUG_ON(XEN_DOMCTL_TEARDOWN_dying != DOMDYING_dying);
+        BUILD_BUG_ON(XEN_DOMCTL_TEARDOWN_dead != DOMDYING_dead);
+
+        tp->state = d->is_dying;
+        tp->pad = 0;
+        tp->pages = domain_tot_pages(d);
+        tp->initial_pages = d->is_dying ? d->teardown_pages : tp->pages;
+        copyback = 1;
+        break;
+    }
+
     default:
         ret = arch_do_domctl(op, d, u_domctl);
         break;
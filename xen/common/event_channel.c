@@ -869,6 +869,46 @@ out:
     return ret;
 }
 
+/* Number of ports EVTCHNOP_send_multi copies in at once. */
+#define EVTCHN_SEND_BATCH 32
+
+static long evtchn_send_multi(struct domain *ld, struct evtchn_send_multi *op,
+                              XEN_GUEST_HANDLE_PARAM(void) arg)
+{
+    XEN_GUEST_HANDLE_PARAM(evtchn_port_t) ports =
+        guest_handle_cast(arg, evtchn_port_t);
+    evtchn_port_t batch[EVTCHN_SEND_BATCH];
+    unsigned int i, n;
+    long rc;
+
+    guest_handle_add_offset(ports, offsetof(struct evtchn_send_multi, ports) /
+                                   sizeof(evtchn_port_t));
+
+    if ( op->done > op->nr_ports )
+        return -EINVAL;
+
+    while ( op->done < op->nr_ports )
+    {
+        n = min_t(unsigned int, op->nr_ports - op->done, EVTCHN_SEND_BATCH);
+
+        if ( copy_from_guest_offset(batch, ports, op->done, n) )
+            return -EFAULT;
+
+        for ( i = 0; i < n; i++ )
+        {
+            rc = evtchn_send(ld, batch[i]);
+            if ( rc )
+                return rc;
+            op->done++;
+        }
+
+        if ( op->done < op->nr_ports && hypercall_preempt_check() )
+            return -ERESTART;
+    }
+
+    return 0;
+}
+
 bool evtchn_virq_enabled(const struct vcpu *v, unsigned int virq)
 {
     if ( !v )
@@ -1335,6 +1375,22 @@ long do_event_channel_op(int cmd, XEN_GUEST_HANDLE_PARAM(void) arg)
         break;
     }
 
+    case EVTCHNOP_send_multi: {
+        struct evtchn_send_multi send_multi;
+        XEN_GUEST_HANDLE_PARAM(evtchn_send_multi_t) uop =
+            guest_handle_cast(arg, evtchn_send_multi_t);
+
+        if ( copy_from_guest(&send_multi, uop, 1) != 0 )
+            return -EFAULT;
+        rc = evtchn_send_multi(current->domain, &send_multi, arg);
+        if ( __copy_field_to_guest(uop, &send_multi, done) )
+            rc = -EFAULT;
+        else if ( rc == -ERESTART )
+            rc = hypercall_create_continuation(__HYPERVISOR_event_channel_op,
+                                               "ih", cmd, arg);
+        break;
+    }
+
     case EVTCHNOP_status: {
         struct evtchn_status status;
         if ( copy_from_guest(&status, arg, 1) != 0 )
@@ -1694,6 +1750,8 @@ static void domain_dump_evtchn_info(struct domain *d)
         }
     }
 
+    evtchn_fifo_dump(d);
+
     read_unlock(&d->event_lock);
 }
 
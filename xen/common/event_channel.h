@@ -50,6 +50,7 @@ struct evtchn_expand_array;
 
 int evtchn_fifo_init_control(struct evtchn_init_control *init_control);
 int evtchn_fifo_expand_array(const struct evtchn_expand_array *expand_array);
+void evtchn_fifo_dump(const struct domain *d);
 void evtchn_fifo_destroy(struct domain *d);
 
 /*
@@ -26,6 +26,15 @@ struct evtchn_fifo_queue {
     uint32_t tail;
     uint8_t priority;
     spinlock_t lock;
+
+    /*
+     * Statistics, dumped by the 'e' debug key.  Those updated without the
+     * lock held may miss concurrent updates.
+     */
+    unsigned long enqueued;     /* Events linked onto the queue. */
+    unsigned long coalesced;    /* Events already queued, or masked. */
+    unsigned long link_retries; /* Failed cmpxchg() linking to the tail. */
+    unsigned long lost;         /* Events lost to guest or queue changes. */
 };
 
 struct evtchn_fifo_vcpu {
@@ -94,6 +103,12 @@ static void cf_check evtchn_fifo_init(struct domain *d, struct evtchn *evtchn)
                  d->domain_id, evtchn->port);
 }
 
+static bool evtchn_fifo_word_is_queued(event_word_t w)
+{
+    return (w & (1U << EVTCHN_FIFO_PENDING)) &&
+           (w & ((1U << EVTCHN_FIFO_LINKED) | (1U << EVTCHN_FIFO_MASKED)));
+}
+
 static int try_set_link(event_word_t *word, event_word_t *w, uint32_t link)
 {
     event_word_t new, old;
@@ -124,8 +139,9 @@ static int try_set_link(event_word_t *word, event_word_t *w, uint32_t link)
  * We block unmasking by the guest by marking the tail word as BUSY,
  * therefore, the cmpxchg() may fail at most 4 times.
  */
-static bool evtchn_fifo_set_link(struct domain *d, event_word_t *word,
-                                 uint32_t link)
+static bool evtchn_fifo_set_link(struct domain *d,
+                                 struct evtchn_fifo_queue *q,
+                                 event_word_t *word, uint32_t link)
 {
     event_word_t w;
     unsigned int try;
@@ -137,6 +153,8 @@ static bool evtchn_fifo_set_link(struct domain *d, event_word_t *word,
     if ( ret >= 0 )
         return ret;
 
+    q->link_retries++;
+
     /* Lock the word to prevent guest unmasking. */
     guest_set_bit(d, EVTCHN_FIFO_BUSY, word);
 
@@ -151,7 +169,9 @@ static bool evtchn_fifo_set_link(struct domain *d, event_word_t *word,
                 guest_clear_bit(d, EVTCHN_FIFO_BUSY, word);
             return ret;
         }
+        q->link_retries++;
     }
+    q->lost++;
     gdprintk(XENLOG_WARNING, "domain %d, port %d not linked\n",
              d->domain_id, link);
     guest_clear_bit(d, EVTCHN_FIFO_BUSY, word);
@@ -183,6 +203,22 @@ static void cf_check evtchn_fifo_set_pending(
         return;
     }
 
+    /*
+     * Nothing to do for an event which is already pending and either
+     * linked, or masked: it stays where it is, and whoever set it pending
+     * took care of pollers and of waking up the vCPU.  This is the case of
+     * every event but the first of a burst, and needs no queue lock.
+     *
+     * The barrier orders the sender's writes before the test, as the
+     * guest may be about to clear PENDING and look for them.
+     */
+    smp_mb();
+    if ( evtchn_fifo_word_is_queued(read_atomic(word)) )
+    {
+        v->evtchn_fifo->queue[evtchn->priority].coalesced++;
+        return;
+    }
+
     /*
      * Lock all queues related to the event channel (in case of a queue change
      * this might be two).
@@ -229,6 +265,7 @@ static void cf_check evtchn_fifo_set_pending(
     /* If we didn't get the lock bail out. */
     if ( try == 3 )
     {
+        v->evtchn_fifo->queue[evtchn->priority].lost++;
         gprintk(XENLOG_WARNING,
                 "%pd port %u lost event (too many queue changes)\n",
                 d, evtchn->port);
@@ -296,11 +333,12 @@ static void cf_check evtchn_fifo_set_pending(
             event_word_t *tail_word;
 
             tail_word = evtchn_fifo_word_from_port(d, q->tail);
-            linked = evtchn_fifo_set_link(d, tail_word, port);
+            linked = evtchn_fifo_set_link(d, q, tail_word, port);
         }
         if ( !linked )
             write_atomic(q->head, port);
         q->tail = port;
+        q->enqueued++;
     }
 
  unlock:
@@ -704,6 +742,35 @@ int evtchn_fifo_expand_array(const struct evtchn_expand_array *expand_array)
     return rc;
 }
 
+void evtchn_fifo_dump(const struct domain *d)
+{
+    const struct vcpu *v;
+    unsigned int i;
+
+    if ( !d->evtchn_fifo )
+        return;
+
+    printk("FIFO queues [enqueued/coalesced/link retries/lost]:\n");
+
+    for_each_vcpu ( d, v )
+    {
+        if ( !v->evtchn_fifo )
+            continue;
+
+        for ( i = 0; i <= EVTCHN_FIFO_PRIORITY_MIN; i++ )
+        {
+            const struct evtchn_fifo_queue *q = &v->evtchn_fifo->queue[i];
+
+            if ( !q->enqueued && !q->coalesced && !q->lost )
+                continue;
+
+            printk("    %pv q%-2u [%lu/%lu/%lu/%lu] tail=%u\n", v, i,
+                   q->enqueued, q->coalesced, q->link_retries, q->lost,
+                   q->tail);
+        }
+    }
+}
+
 void evtchn_fifo_destroy(struct domain *d)
 {
     struct vcpu *v;
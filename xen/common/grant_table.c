@@ -269,6 +269,22 @@ struct gnttab_unmap_common {
 /* Number of unmap operations that are done between each tlb flush */
 #define GNTTAB_UNMAP_BATCH_SIZE 32
 
+/*
+ * Number of map operations that are done as a batch, sharing the lookup of
+ * the granting domain and the reservation of maptrack handles.
+ */
+#define GNTTAB_MAP_BATCH_SIZE 16
+
+/* State shared by the operations of a batch of maps. */
+struct gnttab_map_batch {
+    /* Granting domain of the last operation, with its RCU lock held. */
+    struct domain *rd;
+
+    /* Maptrack handles reserved for the batch, used in order. */
+    grant_handle_t handles[GNTTAB_MAP_BATCH_SIZE];
+    unsigned int nr_handles, next_handle;
+};
+
 
 /*
  * Tracks a mapping of another domain's grant reference. Each domain has a
@@ -530,10 +546,15 @@ static int get_paged_frame(unsigned long gfn, mfn_t *mfn,
 
 #define INVALID_MAPTRACK_HANDLE UINT_MAX
 
-static inline grant_handle_t
-_get_maptrack_handle(struct grant_table *t, struct vcpu *v)
+/*
+ * Take up to nr entries off the free list of v, returning how many were
+ * available.
+ */
+static unsigned int
+_get_maptrack_handles(struct grant_table *t, struct vcpu *v,
+                      grant_handle_t *handles, unsigned int nr)
 {
-    unsigned int head, next;
+    unsigned int head, next, i;
 
     spin_lock(&v->maptrack_freelist_lock);
 
@@ -542,22 +563,39 @@ _get_maptrack_handle(struct grant_table *t, struct vcpu *v)
     if ( unlikely(head == MAPTRACK_TAIL) )
     {
         spin_unlock(&v->maptrack_freelist_lock);
-        return INVALID_MAPTRACK_HANDLE;
+        return 0;
     }
 
-    /*
-     * Always keep one entry in the free list to make it easier to
-     * add free entries to the tail.
-     */
-    next = maptrack_entry(t, head).ref;
-    if ( unlikely(next == MAPTRACK_TAIL) )
-        head = INVALID_MAPTRACK_HANDLE;
-    else
-        v->maptrack_head = next;
+    for ( i = 0; i < nr; i++ )
+    {
+        /*
+         * Always keep one entry in the free list to make it easier to
+         * add free entries to the tail.
+         */
+        next = maptrack_entry(t, head).ref;
+        if ( unlikely(next == MAPTRACK_TAIL) )
+            break;
+
+        handles[i] = head;
+        head = next;
+    }
+
+    v->maptrack_head = head;
 
     spin_unlock(&v->maptrack_freelist_lock);
 
-    return head;
+    return i;
+}
+
+static inline grant_handle_t
+_get_maptrack_handle(struct grant_table *t, struct vcpu *v)
+{
+    grant_handle_t handle;
+
+    if ( !_get_maptrack_handles(t, v, &handle, 1) )
+        return INVALID_MAPTRACK_HANDLE;
+
+    return handle;
 }
 
 /*
@@ -706,6 +744,35 @@ get_maptrack_handle(
     return handle;
 }
 
+/*
+ * Reserve up to nr maptrack handles, taking the free list lock once for as
+ * many as the free list of the current vCPU has, and returning how many
+ * could be obtained.
+ */
+static unsigned int
+get_maptrack_handles(
+    struct grant_table *lgt, grant_handle_t *handles, unsigned int nr)
+{
+    unsigned int n = 0;
+
+    while ( n < nr )
+    {
+        grant_handle_t handle;
+
+        n += _get_maptrack_handles(lgt, current, handles + n, nr - n);
+        if ( n == nr )
+            break;
+
+        /* Grow the free list, or steal from other vCPUs. */
+        handle = get_maptrack_handle(lgt);
+        if ( handle == INVALID_MAPTRACK_HANDLE )
+            break;
+        handles[n++] = handle;
+    }
+
+    return n;
+}
+
 /* Number of grant table entries. Caller must hold d's grant table lock. */
 static unsigned int nr_grant_entries(struct grant_table *gt)
 {
@@ -993,7 +1060,7 @@ union maptrack_node {
 
 static void
 map_grant_ref(
-    struct gnttab_map_grant_ref *op)
+    struct gnttab_map_grant_ref *op, struct gnttab_map_batch *batch)
 {
     struct domain *ld, *rd, *owner = NULL;
     struct grant_table *lgt, *rgt;
@@ -1034,7 +1101,15 @@ map_grant_ref(
         return;
     }
 
-    if ( unlikely((rd = rcu_lock_domain_by_id(op->dom)) == NULL) )
+    /* Operations of a batch mostly map grants of the same domain. */
+    rd = batch->rd;
+    if ( !rd || rd->domain_id != op->dom )
+    {
+        if ( rd )
+            rcu_unlock_domain(rd);
+        batch->rd = rd = rcu_lock_domain_by_id(op->dom);
+    }
+    if ( unlikely(!rd) )
     {
         gdprintk(XENLOG_INFO, "Could not find domain %d\n", op->dom);
         op->status = GNTST_bad_domain;
@@ -1044,20 +1119,22 @@ map_grant_ref(
     rc = xsm_grant_mapref(XSM_HOOK, ld, rd, op->flags);
     if ( rc )
     {
-        rcu_unlock_domain(rd);
         op->status = GNTST_permission_denied;
         return;
     }
 
+    /*
+     * The handle is only consumed on success: otherwise, it remains for the
+     * next operation of the batch.
+     */
     lgt = ld->grant_table;
-    handle = get_maptrack_handle(lgt);
-    if ( unlikely(handle == INVALID_MAPTRACK_HANDLE) )
+    if ( unlikely(batch->next_handle == batch->nr_handles) )
     {
-        rcu_unlock_domain(rd);
         gdprintk(XENLOG_INFO, "Failed to obtain maptrack handle\n");
         op->status = GNTST_no_space;
         return;
     }
+    handle = batch->handles[batch->next_handle];
 
     rgt = rd->grant_table;
     grant_read_lock(rgt);
@@ -1323,7 +1400,7 @@ map_grant_ref(
     op->handle       = handle;
     op->status       = GNTST_okay;
 
-    rcu_unlock_domain(rd);
+    batch->next_handle++;
     return;
 
  undo_out:
@@ -1353,29 +1430,54 @@ map_grant_ref(
  unlock_out:
     grant_read_unlock(rgt);
     op->status = rc;
-    put_maptrack_handle(lgt, handle);
-    rcu_unlock_domain(rd);
+}
+
+/* Give back what the operations of a batch of maps did not use. */
+static void
+map_batch_release(struct gnttab_map_batch *batch)
+{
+    struct grant_table *lgt = current->domain->grant_table;
+
+    while ( batch->next_handle < batch->nr_handles )
+        put_maptrack_handle(lgt, batch->handles[batch->next_handle++]);
+
+    if ( batch->rd )
+        rcu_unlock_domain(batch->rd);
+    batch->rd = NULL;
 }
 
 static long
 gnttab_map_grant_ref(
     XEN_GUEST_HANDLE_PARAM(gnttab_map_grant_ref_t) uop, unsigned int count)
 {
-    int i;
-    struct gnttab_map_grant_ref op;
+    struct gnttab_map_grant_ref op[GNTTAB_MAP_BATCH_SIZE];
+    struct gnttab_map_batch batch = { .rd = NULL };
+    unsigned int i, c, done = 0;
 
-    for ( i = 0; i < count; i++ )
+    while ( count != 0 )
     {
-        if ( i && hypercall_preempt_check() )
-            return i;
+        c = min(count, (unsigned int)GNTTAB_MAP_BATCH_SIZE);
 
-        if ( unlikely(__copy_from_guest_offset(&op, uop, i, 1)) )
+        if ( unlikely(__copy_from_guest_offset(op, uop, done, c)) )
             return -EFAULT;
 
-        map_grant_ref(&op);
+        batch.nr_handles = get_maptrack_handles(current->domain->grant_table,
+                                                batch.handles, c);
+        batch.next_handle = 0;
 
-        if ( unlikely(__copy_to_guest_offset(uop, i, &op, 1)) )
+        for ( i = 0; i < c; i++ )
+            map_grant_ref(&op[i], &batch);
+
+        map_batch_release(&batch);
+
+        if ( unlikely(__copy_to_guest_offset(uop, done, op, c)) )
             return -EFAULT;
+
+        count -= c;
+        done += c;
+
+        if ( count && hypercall_preempt_check() )
+            return done;
     }
 
     return 0;
@@ -1673,6 +1775,23 @@ unmap_grant_ref(
 }
 
 
+/*
+ * Flush the TLBs once for a batch of unmaps, if any of them removed a host
+ * mapping.
+ */
+static void
+gnttab_flush_unmaps(const struct gnttab_unmap_common *common, unsigned int nr)
+{
+    unsigned int i;
+
+    for ( i = 0; i < nr; i++ )
+        if ( common[i].done & GNTMAP_host_map )
+        {
+            gnttab_flush_tlb(current->domain);
+            break;
+        }
+}
+
 static long
 gnttab_unmap_grant_ref(
     XEN_GUEST_HANDLE_PARAM(gnttab_unmap_grant_ref_t) uop, unsigned int count)
@@ -1697,7 +1816,7 @@ gnttab_unmap_grant_ref(
             guest_handle_add_offset(uop, 1);
         }
 
-        gnttab_flush_tlb(current->domain);
+        gnttab_flush_unmaps(common, partial_done);
 
         for ( i = 0; i < partial_done; i++ )
             unmap_common_complete(&common[i]);
@@ -1712,7 +1831,7 @@ gnttab_unmap_grant_ref(
     return 0;
 
 fault:
-    gnttab_flush_tlb(current->domain);
+    gnttab_flush_unmaps(common, partial_done);
 
     for ( i = 0; i < partial_done; i++ )
         unmap_common_complete(&common[i]);
@@ -1762,7 +1881,7 @@ gnttab_unmap_and_replace(
             guest_handle_add_offset(uop, 1);
         }
 
-        gnttab_flush_tlb(current->domain);
+        gnttab_flush_unmaps(common, partial_done);
 
         for ( i = 0; i < partial_done; i++ )
             unmap_common_complete(&common[i]);
@@ -1777,7 +1896,7 @@ gnttab_unmap_and_replace(
     return 0;
 
 fault:
-    gnttab_flush_tlb(current->domain);
+    gnttab_flush_unmaps(common, partial_done);
 
     for ( i = 0; i < partial_done; i++ )
         unmap_common_complete(&common[i]);
@@ -2864,14 +2983,49 @@ struct gnttab_copy_buf {
     bool have_type;
 };
 
+/*
+ * Number of mapped buffers gnttab_copy() keeps for the sources, and as many
+ * for the destinations, so that copies going back and forth between a few
+ * frames (as those of packets split differently on the two sides) don't map
+ * and unmap them each time.  All may be mapped at once, which has to fit in
+ * the per-vCPU mapcache entries.
+ */
+#define GNTTAB_COPY_CACHE_SIZE 4
+
+struct gnttab_copy_cache {
+    struct gnttab_copy_buf buf[GNTTAB_COPY_CACHE_SIZE];
+    unsigned int next;         /* Slot to claim next (round robin). */
+};
+
+struct gnttab_copy_state {
+    struct gnttab_copy_cache src, dest;
+
+    /* The pair of buffers of the last copy that XSM allowed. */
+    const struct gnttab_copy_buf *checked_src, *checked_dest;
+};
+
+/*
+ * Lock the domain of a buffer, reusing the lookup of any other buffer of
+ * the cache already referring to the same domain.
+ */
 static int gnttab_copy_lock_domain(domid_t domid, bool is_gref,
+                                   const struct gnttab_copy_cache *cache,
                                    struct gnttab_copy_buf *buf)
 {
+    unsigned int i;
+
     /* Only DOMID_SELF may reference via frame. */
     if ( domid != DOMID_SELF && !is_gref )
         return GNTST_permission_denied;
 
-    buf->domain = rcu_lock_domain_by_any_id(domid);
+    for ( i = 0; i < GNTTAB_COPY_CACHE_SIZE; i++ )
+        if ( cache->buf[i].domain && cache->buf[i].ptr.domid == domid )
+            break;
+
+    if ( i < GNTTAB_COPY_CACHE_SIZE )
+        buf->domain = rcu_lock_domain(cache->buf[i].domain);
+    else
+        buf->domain = rcu_lock_domain_by_any_id(domid);
 
     if ( !buf->domain )
         return GNTST_bad_domain;
@@ -2881,47 +3035,13 @@ static int gnttab_copy_lock_domain(domid_t domid, bool is_gref,
     return GNTST_okay;
 }
 
-static void gnttab_copy_unlock_domains(struct gnttab_copy_buf *src,
-                                       struct gnttab_copy_buf *dest)
+static void gnttab_copy_unlock_domain(struct gnttab_copy_buf *buf)
 {
-    if ( src->domain )
+    if ( buf->domain )
     {
-        rcu_unlock_domain(src->domain);
-        src->domain = NULL;
+        rcu_unlock_domain(buf->domain);
+        buf->domain = NULL;
     }
-    if ( dest->domain )
-    {
-        rcu_unlock_domain(dest->domain);
-        dest->domain = NULL;
-    }
-}
-
-static int gnttab_copy_lock_domains(const struct gnttab_copy *op,
-                                    struct gnttab_copy_buf *src,
-                                    struct gnttab_copy_buf *dest)
-{
-    int rc;
-
-    rc = gnttab_copy_lock_domain(op->source.domid,
-                                 op->flags & GNTCOPY_source_gref, src);
-    if ( rc < 0 )
-        goto error;
-    rc = gnttab_copy_lock_domain(op->dest.domid,
-                                 op->flags & GNTCOPY_dest_gref, dest);
-    if ( rc < 0 )
-        goto error;
-
-    rc = xsm_grant_copy(XSM_HOOK, src->domain, dest->domain);
-    if ( rc < 0 )
-    {
-        rc = GNTST_permission_denied;
-        goto error;
-    }
-    return 0;
-
- error:
-    gnttab_copy_unlock_domains(src, dest);
-    return rc;
 }
 
 static void gnttab_copy_release_buf(struct gnttab_copy_buf *buf)
@@ -3011,11 +3131,74 @@ static bool gnttab_copy_buf_valid(
     const struct gnttab_copy_ptr *p, const struct gnttab_copy_buf *b,
     bool has_gref)
 {
-    if ( !b->virt )
+    if ( !b->virt || p->domid != b->ptr.domid )
         return 0;
     if ( has_gref )
         return b->have_grant && p->u.ref == b->ptr.u.ref;
-    return p->u.gmfn == b->ptr.u.gmfn;
+    return !b->have_grant && p->u.gmfn == b->ptr.u.gmfn;
+}
+
+/* Release all the buffers of a cache, and the domains they refer to. */
+static void gnttab_copy_flush_cache(struct gnttab_copy_cache *cache)
+{
+    unsigned int i;
+
+    for ( i = 0; i < GNTTAB_COPY_CACHE_SIZE; i++ )
+    {
+        gnttab_copy_release_buf(&cache->buf[i]);
+        gnttab_copy_unlock_domain(&cache->buf[i]);
+    }
+}
+
+/*
+ * Find the buffer of the cache mapping what ptr refers to or, if there is
+ * none, claim one for it in place of the oldest, forgetting about the last
+ * XSM check.
+ */
+static int gnttab_copy_get_buf(const struct gnttab_copy *op,
+                               const struct gnttab_copy_ptr *ptr,
+                               struct gnttab_copy_state *state,
+                               struct gnttab_copy_cache *cache,
+                               unsigned int gref_flag,
+                               struct gnttab_copy_buf **bufp)
+{
+    bool is_gref = op->flags & gref_flag;
+    struct gnttab_copy_buf *buf;
+    unsigned int i;
+    int rc;
+
+    for ( i = 0; i < GNTTAB_COPY_CACHE_SIZE; i++ )
+    {
+        buf = &cache->buf[i];
+        if ( gnttab_copy_buf_valid(ptr, buf, is_gref) )
+        {
+            *bufp = buf;
+            return GNTST_okay;
+        }
+    }
+
+    buf = &cache->buf[cache->next];
+    cache->next = (cache->next + 1) % GNTTAB_COPY_CACHE_SIZE;
+
+    state->checked_src = NULL;
+    state->checked_dest = NULL;
+
+    gnttab_copy_release_buf(buf);
+    gnttab_copy_unlock_domain(buf);
+
+    rc = gnttab_copy_lock_domain(ptr->domid, is_gref, cache, buf);
+    if ( rc == GNTST_okay )
+        rc = gnttab_copy_claim_buf(op, ptr, buf, gref_flag);
+    if ( rc != GNTST_okay )
+    {
+        gnttab_copy_release_buf(buf);
+        gnttab_copy_unlock_domain(buf);
+        return rc;
+    }
+
+    *bufp = buf;
+
+    return GNTST_okay;
 }
 
 static int gnttab_copy_buf(const struct gnttab_copy *op,
@@ -3057,44 +3240,39 @@ static int gnttab_copy_buf(const struct gnttab_copy *op,
 }
 
 static int gnttab_copy_one(const struct gnttab_copy *op,
-                           struct gnttab_copy_buf *dest,
-                           struct gnttab_copy_buf *src)
+                           struct gnttab_copy_state *state)
 {
+    struct gnttab_copy_buf *src, *dest;
     int rc;
 
     if ( unlikely(!op->len) )
         return GNTST_okay;
 
-    if ( !src->domain || op->source.domid != src->ptr.domid ||
-         !dest->domain || op->dest.domid != dest->ptr.domid )
-    {
-        gnttab_copy_release_buf(src);
-        gnttab_copy_release_buf(dest);
-        gnttab_copy_unlock_domains(src, dest);
+    rc = gnttab_copy_get_buf(op, &op->source, state, &state->src,
+                             GNTCOPY_source_gref, &src);
+    if ( rc )
+        goto out;
 
-        rc = gnttab_copy_lock_domains(op, src, dest);
-        if ( rc < 0 )
-            goto out;
-    }
+    rc = gnttab_copy_get_buf(op, &op->dest, state, &state->dest,
+                             GNTCOPY_dest_gref, &dest);
+    if ( rc )
+        goto out;
 
-    /* Different source? */
-    if ( !gnttab_copy_buf_valid(&op->source, src,
-                                op->flags & GNTCOPY_source_gref) )
+    /*
+     * Buffers stay with their domain until evicted, and any claim resets
+     * the pair checked last: only copies between the same two buffers as
+     * the last one may skip the check.
+     */
+    if ( src != state->checked_src || dest != state->checked_dest )
     {
-        gnttab_copy_release_buf(src);
-        rc = gnttab_copy_claim_buf(op, &op->source, src, GNTCOPY_source_gref);
-        if ( rc )
+        if ( xsm_grant_copy(XSM_HOOK, src->domain, dest->domain) < 0 )
+        {
+            rc = GNTST_permission_denied;
             goto out;
-    }
+        }
 
-    /* Different dest? */
-    if ( !gnttab_copy_buf_valid(&op->dest, dest,
-                                op->flags & GNTCOPY_dest_gref) )
-    {
-        gnttab_copy_release_buf(dest);
-        rc = gnttab_copy_claim_buf(op, &op->dest, dest, GNTCOPY_dest_gref);
-        if ( rc )
-            goto out;
+        state->checked_src = src;
+        state->checked_dest = dest;
     }
 
     rc = gnttab_copy_buf(op, dest, src);
@@ -3115,8 +3293,7 @@ static long gnttab_copy(
 {
     unsigned int i;
     struct gnttab_copy op;
-    struct gnttab_copy_buf src = {};
-    struct gnttab_copy_buf dest = {};
+    struct gnttab_copy_state state = {};
     long rc = 0;
 
     for ( i = 0; i < count; i++ )
@@ -3133,7 +3310,7 @@ static long gnttab_copy(
             break;
         }
 
-        rc = gnttab_copy_one(&op, &dest, &src);
+        rc = gnttab_copy_one(&op, &state);
         if ( rc > 0 )
         {
             rc = count - i;
@@ -3141,8 +3318,10 @@ static long gnttab_copy(
         }
         if ( rc != GNTST_okay )
         {
-            gnttab_copy_release_buf(&src);
-            gnttab_copy_release_buf(&dest);
+            gnttab_copy_flush_cache(&state.src);
+            gnttab_copy_flush_cache(&state.dest);
+            state.checked_src = NULL;
+            state.checked_dest = NULL;
         }
 
         op.status = rc;
@@ -3155,9 +3334,8 @@ static long gnttab_copy(
         guest_handle_add_offset(uop, 1);
     }
 
-    gnttab_copy_release_buf(&src);
-    gnttab_copy_release_buf(&dest);
-    gnttab_copy_unlock_domains(&src, &dest);
+    gnttab_copy_flush_cache(&state.src);
+    gnttab_copy_flush_cache(&state.dest);
 
     return rc;
 }
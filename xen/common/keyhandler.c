@@ -290,6 +290,11 @@ static void cf_check dump_domains(unsigned char key)
                atomic_read(&d->paged_pages),
 #endif
                CPUMASK_PR(d->dirty_cpumask), d->max_pages);
+        if ( d->populated_pages[0] || d->populated_pages[1] ||
+             d->populated_pages[2] )
+            printk("    populated pages: 4k=%lu 2M=%lu 1G=%lu\n",
+                   d->populated_pages[0], d->populated_pages[1],
+                   d->populated_pages[2]);
         printk("    handle=%02x%02x%02x%02x-%02x%02x-%02x%02x-"
                "%02x%02x-%02x%02x%02x%02x%02x%02x vm_assist=%08lx\n",
                d->handle[ 0], d->handle[ 1], d->handle[ 2], d->handle[ 3],
@@ -81,6 +81,26 @@ static int __init cf_check parse_max_order(const char *s)
 }
 custom_param("memop-max-order", parse_max_order);
 
+/* Largest order populate_physmap() backs runs of smaller extents with. */
+static unsigned int __ro_after_init opt_populate_order = 21 - PAGE_SHIFT;
+
+static int __init cf_check parse_populate_superpages(const char *s)
+{
+    int val = parse_bool(s, NULL);
+
+    if ( val >= 0 )
+        opt_populate_order = val ? 21 - PAGE_SHIFT : 0;
+    else if ( !strcmp(s, "2M") )
+        opt_populate_order = 21 - PAGE_SHIFT;
+    else if ( !strcmp(s, "1G") )
+        opt_populate_order = 30 - PAGE_SHIFT;
+    else
+        return -EINVAL;
+
+    return 0;
+}
+custom_param("populate-superpages", parse_populate_superpages);
+
 static unsigned int max_order(const struct domain *d)
 {
     unsigned int order = domu_max_order;
@@ -156,6 +176,69 @@ static void increase_reservation(struct memop_args *a)
     a->nr_done = i;
 }
 
+/* Superpage orders populate_physmap() backs guest memory with if it can. */
+static const unsigned int populate_orders[] = {
+    30 - PAGE_SHIFT, /* 1G */
+    21 - PAGE_SHIFT, /* 2M */
+};
+
+/*
+ * Whether the extents of the list of @a from @i on, @nr of them, are
+ * contiguous from @gpfn, the first one.
+ */
+static bool extents_contiguous(const struct memop_args *a, unsigned int i,
+                               unsigned int nr, xen_pfn_t gpfn)
+{
+    xen_pfn_t buf[32];
+    unsigned int j, k, n;
+
+    for ( j = 1; j < nr; j += n )
+    {
+        n = min(nr - j, (unsigned int)ARRAY_SIZE(buf));
+        if ( __copy_from_guest_offset(buf, a->extent_list, i + j, n) )
+            return false;
+
+        for ( k = 0; k < n; k++ )
+            if ( buf[k] != gpfn + ((xen_pfn_t)(j + k) << a->extent_order) )
+                return false;
+    }
+
+    return true;
+}
+
+/*
+ * The largest order up to @max the extent at @gpfn, index @i in the list of
+ * @a, can be merged into with the extents following it.
+ */
+static unsigned int populate_order(const struct memop_args *a, unsigned int i,
+                                   xen_pfn_t gpfn, unsigned int max)
+{
+    unsigned int k;
+
+    for ( k = 0; k < ARRAY_SIZE(populate_orders); k++ )
+    {
+        unsigned int order = populate_orders[k];
+        unsigned int nr = 1U << (order - a->extent_order);
+
+        if ( order > max || order <= a->extent_order ||
+             nr > a->nr_extents - i || (gpfn & ((1UL << order) - 1)) )
+            continue;
+
+        if ( extents_contiguous(a, i, nr, gpfn) )
+            return order;
+    }
+
+    return a->extent_order;
+}
+
+static void account_populated(struct domain *d, unsigned int order)
+{
+    unsigned int size = order >= populate_orders[0] ? 2 :
+                        order >= populate_orders[1] ? 1 : 0;
+
+    arch_fetch_and_add(&d->populated_pages[size], 1UL << order);
+}
+
 static void populate_physmap(struct memop_args *a)
 {
     struct page_info *page;
@@ -164,6 +247,7 @@ static void populate_physmap(struct memop_args *a)
     struct domain *d = a->domain, *curr_d = current->domain;
     bool need_tlbflush = false;
     uint32_t tlbflush_timestamp = 0;
+    unsigned int max_superpage = 0;
 
     if ( !guest_handle_subrange_okay(a->extent_list, a->nr_done,
                                      a->nr_extents-1) )
@@ -194,8 +278,21 @@ static void populate_physmap(struct memop_args *a)
         a->memflags |= MEMF_no_icache_flush;
     }
 
+    /*
+     * Runs of extents covering aligned, contiguous guest frames are backed
+     * by a single superpage if possible, sparing the guest TLB misses and
+     * p2m walks.  The guest has no say in machine frames of translated
+     * domains, so this isn't visible to it.  The order is bounded the same
+     * way as the caller's own, and by default to 2M: a 1G allocation can
+     * take the last free 1G block of a node out of reach of other domains.
+     */
+    if ( opt_populate_order && paging_mode_translate(d) &&
+         !(a->memflags & MEMF_populate_on_demand) )
+        max_superpage = min(max_order(curr_d), opt_populate_order);
+
     for ( i = a->nr_done; i < a->nr_extents; i++ )
     {
+        unsigned int order = a->extent_order;
         mfn_t mfn;
 
         if ( i != a->nr_done && hypercall_preempt_check() )
@@ -272,7 +369,23 @@ static void populate_physmap(struct memop_args *a)
             }
             else
             {
-                page = alloc_domheap_pages(d, a->extent_order, a->memflags);
+                if ( max_superpage > order )
+                    order = populate_order(a, i, gpfn, max_superpage);
+
+                page = alloc_domheap_pages(d, order, a->memflags);
+
+                /*
+                 * Memory too fragmented for a superpage: fall back to the
+                 * next smaller order, and don't try this one again for the
+                 * rest of the call.  Nothing is compacted, as pages in use
+                 * can't be moved.
+                 */
+                while ( !page && order > a->extent_order )
+                {
+                    max_superpage = order - 1;
+                    order = populate_order(a, i, gpfn, max_superpage);
+                    page = alloc_domheap_pages(d, order, a->memflags);
+                }
 
                 if ( unlikely(!page) )
                 {
@@ -285,17 +398,21 @@ static void populate_physmap(struct memop_args *a)
 
                 if ( unlikely(a->memflags & MEMF_no_tlbflush) )
                 {
-                    for ( j = 0; j < (1U << a->extent_order); j++ )
+                    for ( j = 0; j < (1U << order); j++ )
                         accumulate_tlbflush(&need_tlbflush, &page[j],
                                             &tlbflush_timestamp);
                 }
 
+                account_populated(d, order);
                 mfn = page_to_mfn(page);
             }
 
-            if ( guest_physmap_add_page(d, _gfn(gpfn), mfn, a->extent_order) )
+            if ( guest_physmap_add_page(d, _gfn(gpfn), mfn, order) )
                 goto out;
 
+            /* The extents merged into the first one are done as well. */
+            i += (1U << (order - a->extent_order)) - 1;
+
             if ( !paging_mode_translate(d) &&
                  /* Inform the domain of the new page's machine address. */
                  unlikely(__copy_mfn_to_guest_offset(a->extent_list, i, mfn)) )
@@ -120,6 +120,7 @@
  *   regions within it.
  */
 
+#include <xen/cpu.h>
 #include <xen/domain_page.h>
 #include <xen/event.h>
 #include <xen/init.h>
@@ -475,6 +476,11 @@ static long total_avail_pages;
 static DEFINE_SPINLOCK(heap_lock);
 static long outstanding_claims; /* total outstanding claims by all domains */
 
+static void _free_heap_pages(
+    struct page_info *pg, unsigned int order, bool need_scrub);
+static bool drain_page_caches(void);
+static unsigned long page_cache_pages(unsigned int node);
+
 unsigned long domain_adjust_tot_pages(struct domain *d, long pages)
 {
     long dom_before, dom_after, dom_claimed, sys_before, sys_after;
@@ -513,6 +519,10 @@ int domain_set_outstanding_pages(struct domain *d, unsigned long pages)
     int ret = -ENOMEM;
     unsigned long claim, avail_pages;
 
+    /* Cached pages aren't counted as available: return them to the heap. */
+    if ( pages )
+        drain_page_caches();
+
     /*
      * take the domain's page_alloc_lock, else all d->tot_page adjustments
      * must always take the global heap_lock rather than only in the much
@@ -720,6 +730,10 @@ static void check_low_mem_virq(void)
 {
     unsigned long avail_pages = total_avail_pages - outstanding_claims;
 
+    /* Only count the cached pages when they may make a difference. */
+    if ( unlikely(avail_pages <= low_mem_virq_th) )
+        avail_pages += page_cache_pages(-1);
+
     if ( unlikely(avail_pages <= low_mem_virq_th) )
     {
         send_global_virq(VIRQ_ENOMEM);
@@ -951,43 +965,36 @@ static void init_free_page_fields(struct page_info *pg)
     page_set_owner(pg, NULL);
 }
 
-/* Allocate 2^@order contiguous pages. */
-static struct page_info *alloc_heap_pages(
+/* Drop the owner of a page being freed, noting if TLBs need flushing. */
+static void clear_page_owner(struct page_info *pg, mfn_t mfn)
+{
+    /* If a page has no owner it will need no safety TLB flush. */
+    pg->u.free.need_tlbflush = (page_get_owner(pg) != NULL);
+    if ( pg->u.free.need_tlbflush )
+        page_set_tlbflush_timestamp(pg);
+
+    /* This page is not a guest frame any more. */
+    page_set_owner(pg, NULL); /* set_gpfn_from_mfn snoops pg owner */
+    set_gpfn_from_mfn(mfn_x(mfn), INVALID_M2P_ENTRY);
+}
+
+/*
+ * Take 2^@order contiguous pages off the heap, with heap_lock held, and mark
+ * them in use.  Pages needing a scrub keep PGC_need_scrub, and the first of
+ * them is returned in @first_dirty.
+ */
+static struct page_info *take_heap_pages(
     unsigned int zone_lo, unsigned int zone_hi,
     unsigned int order, unsigned int memflags,
-    struct domain *d)
+    struct domain *d, unsigned int *first_dirty,
+    bool *need_tlbflush, uint32_t *tlbflush_timestamp)
 {
     nodeid_t node;
-    unsigned int i, buddy_order, zone, first_dirty;
+    unsigned int i, buddy_order, zone;
     unsigned long request = 1UL << order;
     struct page_info *pg;
-    bool need_tlbflush = false;
-    uint32_t tlbflush_timestamp = 0;
-    unsigned int dirty_cnt = 0;
-    mfn_t mfn;
-
-    /* Make sure there are enough bits in memflags for nodeID. */
-    BUILD_BUG_ON((_MEMF_bits - _MEMF_node) < (8 * sizeof(nodeid_t)));
 
-    ASSERT(zone_lo <= zone_hi);
-    ASSERT(zone_hi < NR_ZONES);
-
-    if ( unlikely(order > MAX_ORDER) )
-        return NULL;
-
-    spin_lock(&heap_lock);
-
-    /*
-     * Claimed memory is considered unavailable unless the request
-     * is made by a domain with sufficient unclaimed pages.
-     */
-    if ( (outstanding_claims + request > total_avail_pages) &&
-          ((memflags & MEMF_no_refcount) ||
-           !d || d->outstanding_pages < request) )
-    {
-        spin_unlock(&heap_lock);
-        return NULL;
-    }
+    ASSERT(spin_is_locked(&heap_lock));
 
     pg = get_free_buddy(zone_lo, zone_hi, order, memflags, d);
     /* Try getting a dirty buddy if we couldn't get a clean one. */
@@ -995,34 +1002,30 @@ static struct page_info *alloc_heap_pages(
         pg = get_free_buddy(zone_lo, zone_hi, order,
                             memflags | MEMF_no_scrub, d);
     if ( !pg )
-    {
-        /* No suitable memory blocks. Fail the request. */
-        spin_unlock(&heap_lock);
         return NULL;
-    }
 
     node = page_to_nid(pg);
     zone = page_to_zone(pg);
     buddy_order = PFN_ORDER(pg);
 
-    first_dirty = pg->u.free.first_dirty;
+    *first_dirty = pg->u.free.first_dirty;
 
     /* We may have to halve the chunk a number of times. */
     while ( buddy_order != order )
     {
         buddy_order--;
         page_list_add_scrub(pg, node, zone, buddy_order,
-                            (1U << buddy_order) > first_dirty ?
-                            first_dirty : INVALID_DIRTY_IDX);
+                            (1U << buddy_order) > *first_dirty ?
+                            *first_dirty : INVALID_DIRTY_IDX);
         pg += 1U << buddy_order;
 
-        if ( first_dirty != INVALID_DIRTY_IDX )
+        if ( *first_dirty != INVALID_DIRTY_IDX )
         {
             /* Adjust first_dirty */
-            if ( first_dirty >= 1U << buddy_order )
-                first_dirty -= 1U << buddy_order;
+            if ( *first_dirty >= 1U << buddy_order )
+                *first_dirty -= 1U << buddy_order;
             else
-                first_dirty = 0; /* We've moved past original first_dirty */
+                *first_dirty = 0; /* We've moved past original first_dirty */
         }
     }
 
@@ -1050,18 +1053,430 @@ static struct page_info *alloc_heap_pages(
         }
 
         /* PGC_need_scrub can only be set if first_dirty is valid */
-        ASSERT(first_dirty != INVALID_DIRTY_IDX || !(pg[i].count_info & PGC_need_scrub));
+        ASSERT(*first_dirty != INVALID_DIRTY_IDX ||
+               !(pg[i].count_info & PGC_need_scrub));
 
         /* Preserve PGC_need_scrub so we can check it after lock is dropped. */
         pg[i].count_info = PGC_state_inuse | (pg[i].count_info & PGC_need_scrub);
 
         if ( !(memflags & MEMF_no_tlbflush) )
-            accumulate_tlbflush(&need_tlbflush, &pg[i],
-                                &tlbflush_timestamp);
+            accumulate_tlbflush(need_tlbflush, &pg[i], tlbflush_timestamp);
 
         init_free_page_fields(&pg[i]);
     }
 
+    return pg;
+}
+
+/*
+ * Per-CPU page caches.
+ *
+ * Most allocations and frees are of single pages, and doing each of them
+ * under heap_lock makes it the most contended lock on large hosts.  Each CPU
+ * therefore keeps a small cache of free pages for every node, refilled from
+ * and drained to the heap a batch at a time.
+ *
+ * Cached pages are PGC_state_inuse with no owner, and aren't accounted in
+ * avail[] or total_avail_pages, but are added back to the free memory
+ * reported by avail_heap_pages() and seen by the low memory virq.  Pages
+ * needing a scrub keep PGC_need_scrub, but aren't accounted in
+ * node_need_scrub, and pages freed to a cache keep the TLB flush they need
+ * in u.free until they are handed out again.  Only pages above any DMA zone
+ * are cached, for requests not limited in address width.
+ */
+static unsigned int __ro_after_init opt_page_cache = 64;
+integer_param("pcpu-page-cache", opt_page_cache);
+
+#define page_cache_batch() max(opt_page_cache / 4, 1U)
+
+struct page_cache {
+    spinlock_t lock;
+    unsigned int count[MAX_NUMNODES];
+    struct page_list_head pages[MAX_NUMNODES];
+};
+
+static DEFINE_PER_CPU(struct page_cache, page_cache);
+static bool __read_mostly page_cache_ready;
+static unsigned int __ro_after_init page_cache_zone;
+
+static bool page_cache_serves(unsigned int zone_lo, unsigned int zone_hi)
+{
+    return page_cache_ready && zone_lo <= page_cache_zone &&
+           zone_hi == NR_ZONES - 1;
+}
+
+/* Node to allocate from, as get_free_buddy() would pick it first. */
+static nodeid_t page_cache_node(unsigned int memflags,
+                                const struct domain *d)
+{
+    nodeid_t node = MEMF_get_node(memflags);
+    nodemask_t nodemask;
+
+    if ( node != NUMA_NO_NODE )
+        return node;
+
+    if ( d )
+    {
+        nodes_and(nodemask, node_online_map, d->node_affinity);
+        if ( !nodes_empty(nodemask) )
+            node = cycle_node(d->last_alloc_node, nodemask);
+    }
+
+    if ( node >= MAX_NUMNODES )
+        node = cpu_to_node(smp_processor_id());
+
+    return node;
+}
+
+/*
+ * Take up to a batch of pages off the heap of @node onto @list, leaving
+ * claimed memory alone.
+ */
+static unsigned int refill_page_cache(nodeid_t node,
+                                      struct page_list_head *list)
+{
+    unsigned int nr = 0, dirty_cnt = 0, first_dirty;
+    struct page_info *pg;
+    bool need_tlbflush = false;
+    uint32_t tlbflush_timestamp = 0;
+
+    spin_lock(&heap_lock);
+
+    while ( nr < page_cache_batch() &&
+            outstanding_claims < total_avail_pages &&
+            (pg = take_heap_pages(page_cache_zone, NR_ZONES - 1, 0,
+                                  MEMF_node(node) | MEMF_exact_node, NULL,
+                                  &first_dirty, &need_tlbflush,
+                                  &tlbflush_timestamp)) != NULL )
+    {
+        if ( pg->count_info & PGC_need_scrub )
+            dirty_cnt++;
+        pg->u.free.need_tlbflush = false;
+        page_list_add_tail(pg, list);
+        nr++;
+    }
+
+    node_need_scrub[node] -= dirty_cnt;
+
+    spin_unlock(&heap_lock);
+
+    /* Flush once for the batch, rather than as each page is handed out. */
+    if ( need_tlbflush )
+        filtered_flush_tlb_mask(tlbflush_timestamp);
+
+    return nr;
+}
+
+/* Give pages taken out of a cache back to the heap. */
+static void free_cached_pages(struct page_list_head *list)
+{
+    struct page_info *pg, *tmp;
+    bool need_tlbflush = false;
+    uint32_t tlbflush_timestamp = 0;
+
+    /* The heap only tracks TLB flushes for pages freed by their owner. */
+    page_list_for_each ( pg, list )
+        accumulate_tlbflush(&need_tlbflush, pg, &tlbflush_timestamp);
+    if ( need_tlbflush )
+        filtered_flush_tlb_mask(tlbflush_timestamp);
+
+    spin_lock(&heap_lock);
+    page_list_for_each_safe ( pg, tmp, list )
+        _free_heap_pages(pg, 0,
+                         test_and_clear_bit(_PGC_need_scrub, &pg->count_info));
+    spin_unlock(&heap_lock);
+}
+
+static struct page_info *alloc_cached_page(unsigned int memflags,
+                                           struct domain *d)
+{
+    struct page_cache *pc = &this_cpu(page_cache);
+    nodeid_t node = page_cache_node(memflags, d);
+    struct page_info *pg;
+    bool need_tlbflush = false;
+    uint32_t tlbflush_timestamp = 0;
+    unsigned int nr;
+
+    if ( node >= MAX_NUMNODES )
+        return NULL;
+
+    for ( ; ; )
+    {
+        spin_lock(&pc->lock);
+        if ( (pg = page_list_remove_head(&pc->pages[node])) != NULL )
+            pc->count[node]--;
+        spin_unlock(&pc->lock);
+
+        if ( !pg )
+        {
+            PAGE_LIST_HEAD(list);
+
+            if ( !(nr = refill_page_cache(node, &list)) )
+                return NULL;
+
+            pg = page_list_remove_head(&list);
+
+            spin_lock(&pc->lock);
+            page_list_splice(&list, &pc->pages[node]);
+            pc->count[node] += nr - 1;
+            spin_unlock(&pc->lock);
+        }
+
+        /* The page may have been offlined while in the cache. */
+        if ( likely(page_state_is(pg, inuse)) )
+            break;
+
+        spin_lock(&heap_lock);
+        _free_heap_pages(pg, 0,
+                         test_and_clear_bit(_PGC_need_scrub, &pg->count_info));
+        spin_unlock(&heap_lock);
+    }
+
+    if ( test_and_clear_bit(_PGC_need_scrub, &pg->count_info) )
+    {
+        if ( !(memflags & MEMF_no_scrub) )
+            scrub_one_page(pg);
+    }
+    else if ( !(memflags & MEMF_no_scrub) )
+        check_one_page(pg);
+
+    if ( !(memflags & MEMF_no_tlbflush) )
+    {
+        accumulate_tlbflush(&need_tlbflush, pg, &tlbflush_timestamp);
+        if ( need_tlbflush )
+            filtered_flush_tlb_mask(tlbflush_timestamp);
+    }
+
+    init_free_page_fields(pg);
+
+    flush_page_to_ram(mfn_x(page_to_mfn(pg)),
+                      !(memflags & MEMF_no_icache_flush));
+
+    if ( d != NULL )
+        d->last_alloc_node = node;
+
+    return pg;
+}
+
+static bool free_cached_page(struct page_info *pg, bool need_scrub)
+{
+    struct page_cache *pc;
+    nodeid_t node = page_to_nid(pg);
+    unsigned long x, y = pg->count_info;
+    unsigned int i;
+    PAGE_LIST_HEAD(list);
+
+    if ( !page_cache_ready || page_to_zone(pg) < page_cache_zone )
+        return false;
+
+    /* Pages being offlined, broken or static are left to the heap. */
+    do {
+        x = y;
+        if ( (x & PGC_state) != PGC_state_inuse ||
+             (x & (PGC_broken | PGC_static)) )
+            return false;
+    } while ( (y = cmpxchg(&pg->count_info, x,
+                           PGC_state_inuse |
+                           (need_scrub ? PGC_need_scrub : 0))) != x );
+
+    clear_page_owner(pg, page_to_mfn(pg));
+
+    pc = &this_cpu(page_cache);
+
+    spin_lock(&pc->lock);
+
+    page_list_add(pg, &pc->pages[node]);
+
+    /* Give the coldest pages back once the cache overflows. */
+    if ( ++pc->count[node] > opt_page_cache )
+    {
+        for ( i = 0; i < page_cache_batch(); i++ )
+        {
+            pg = page_list_last(&pc->pages[node]);
+            page_list_del(pg, &pc->pages[node]);
+            page_list_add(pg, &list);
+        }
+        pc->count[node] -= i;
+    }
+
+    spin_unlock(&pc->lock);
+
+    if ( !page_list_empty(&list) )
+        free_cached_pages(&list);
+
+    return true;
+}
+
+static bool drain_page_cache(unsigned int cpu)
+{
+    struct page_cache *pc = &per_cpu(page_cache, cpu);
+    nodeid_t node;
+    PAGE_LIST_HEAD(list);
+
+    spin_lock(&pc->lock);
+    for ( node = 0; node < MAX_NUMNODES; node++ )
+    {
+        if ( !pc->count[node] )
+            continue;
+        page_list_splice(&pc->pages[node], &list);
+        INIT_PAGE_LIST_HEAD(&pc->pages[node]);
+        pc->count[node] = 0;
+    }
+    spin_unlock(&pc->lock);
+
+    if ( page_list_empty(&list) )
+        return false;
+
+    free_cached_pages(&list);
+
+    return true;
+}
+
+/* Give all cached pages back to the heap.  Returns whether there were any. */
+static bool drain_page_caches(void)
+{
+    unsigned int cpu;
+    bool drained = false;
+
+    if ( !page_cache_ready )
+        return false;
+
+    for_each_online_cpu ( cpu )
+        if ( drain_page_cache(cpu) )
+            drained = true;
+
+    return drained;
+}
+
+/* Pages held in the caches of online CPUs, for @node or all nodes if -1. */
+static unsigned long page_cache_pages(unsigned int node)
+{
+    unsigned long total = 0;
+    unsigned int cpu, i;
+
+    if ( !page_cache_ready )
+        return 0;
+
+    for_each_online_cpu ( cpu )
+        for_each_online_node ( i )
+            if ( (node == -1) || (node == i) )
+                total += read_atomic(&per_cpu(page_cache, cpu).count[i]);
+
+    return total;
+}
+
+static void page_cache_init_cpu(unsigned int cpu)
+{
+    struct page_cache *pc = &per_cpu(page_cache, cpu);
+    nodeid_t node;
+
+    spin_lock_init(&pc->lock);
+    for ( node = 0; node < MAX_NUMNODES; node++ )
+    {
+        pc->count[node] = 0;
+        INIT_PAGE_LIST_HEAD(&pc->pages[node]);
+    }
+}
+
+static int cf_check cpu_page_cache_callback(
+    struct notifier_block *nfb, unsigned long action, void *hcpu)
+{
+    unsigned int cpu = (unsigned long)hcpu;
+
+    switch ( action )
+    {
+    case CPU_UP_PREPARE:
+        page_cache_init_cpu(cpu);
+        break;
+
+    case CPU_UP_CANCELED:
+    case CPU_DEAD:
+        drain_page_cache(cpu);
+        break;
+    }
+
+    return NOTIFY_DONE;
+}
+
+static struct notifier_block cpu_page_cache_nfb = {
+    .notifier_call = cpu_page_cache_callback
+};
+
+static int __init cf_check page_cache_init(void)
+{
+    page_cache_zone = dma_bitsize ? bits_to_zone(dma_bitsize) + 1
+                                  : MEMZONE_XEN + 1;
+    if ( !opt_page_cache || page_cache_zone >= NR_ZONES )
+        return 0;
+
+    page_cache_init_cpu(smp_processor_id());
+    register_cpu_notifier(&cpu_page_cache_nfb);
+    page_cache_ready = true;
+
+    return 0;
+}
+presmp_initcall(page_cache_init);
+
+/* Allocate 2^@order contiguous pages. */
+static struct page_info *alloc_heap_pages(
+    unsigned int zone_lo, unsigned int zone_hi,
+    unsigned int order, unsigned int memflags,
+    struct domain *d)
+{
+    nodeid_t node;
+    unsigned int i, first_dirty;
+    unsigned long request = 1UL << order;
+    struct page_info *pg;
+    bool need_tlbflush = false, drained = false;
+    uint32_t tlbflush_timestamp = 0;
+    unsigned int dirty_cnt = 0;
+    mfn_t mfn;
+
+    /* Make sure there are enough bits in memflags for nodeID. */
+    BUILD_BUG_ON((_MEMF_bits - _MEMF_node) < (8 * sizeof(nodeid_t)));
+
+    ASSERT(zone_lo <= zone_hi);
+    ASSERT(zone_hi < NR_ZONES);
+
+    if ( unlikely(order > MAX_ORDER) )
+        return NULL;
+
+    if ( !order && page_cache_serves(zone_lo, zone_hi) &&
+         (pg = alloc_cached_page(memflags, d)) != NULL )
+        return pg;
+
+ retry:
+    spin_lock(&heap_lock);
+
+    /*
+     * Claimed memory is considered unavailable unless the request
+     * is made by a domain with sufficient unclaimed pages.
+     */
+    if ( (outstanding_claims + request > total_avail_pages) &&
+          ((memflags & MEMF_no_refcount) ||
+           !d || d->outstanding_pages < request) )
+        pg = NULL;
+    else
+        pg = take_heap_pages(zone_lo, zone_hi, order, memflags, d,
+                             &first_dirty, &need_tlbflush,
+                             &tlbflush_timestamp);
+    if ( !pg )
+    {
+        /*
+         * No suitable memory blocks. Fail the request, unless pages held in
+         * the per-CPU caches may make up for it.
+         */
+        spin_unlock(&heap_lock);
+        if ( !drained && drain_page_caches() )
+        {
+            drained = true;
+            goto retry;
+        }
+        return NULL;
+    }
+
+    node = page_to_nid(pg);
+
     spin_unlock(&heap_lock);
 
     if ( first_dirty != INVALID_DIRTY_IDX ||
@@ -1199,16 +1614,20 @@ static int reserve_offlined_page(struct page_info *head)
     return count;
 }
 
-static nodemask_t node_scrubbing;
+/* Background scrubbing of each node, updated under heap_lock. */
+static struct {
+    unsigned int scrubbers;     /* CPUs scrubbing the node. */
+    unsigned long scrubbed;     /* Pages scrubbed since boot. */
+    uint64_t scrub_ns;          /* Time spent scrubbing them. */
+} node_scrub[MAX_NUMNODES];
 
 /*
- * If get_node is true this will return closest node that needs to be scrubbed,
- * with appropriate bit in node_scrubbing set.
- * If get_node is not set, this will return *a* node that needs to be scrubbed.
- * node_scrubbing bitmask will no be updated.
- * If no node needs scrubbing then NUMA_NO_NODE is returned.
+ * Return the node the current CPU should scrub: its own if it has memory to
+ * scrub, else the closest memory-only node with memory to scrub.  Nodes with
+ * CPUs of their own are left to them.  If no node needs scrubbing then
+ * NUMA_NO_NODE is returned.
  */
-static unsigned int node_to_scrub(bool get_node)
+static unsigned int node_to_scrub(void)
 {
     nodeid_t node = cpu_to_node(smp_processor_id()), local_node;
     nodeid_t closest = NUMA_NO_NODE;
@@ -1217,8 +1636,7 @@ static unsigned int node_to_scrub(bool get_node)
     if ( node == NUMA_NO_NODE )
         node = 0;
 
-    if ( node_need_scrub[node] &&
-         (!get_node || !node_test_and_set(node, node_scrubbing)) )
+    if ( node_need_scrub[node] )
         return node;
 
     /*
@@ -1246,24 +1664,9 @@ static unsigned int node_to_scrub(bool get_node)
 
         if ( node_need_scrub[node] )
         {
-            if ( !get_node )
-                return node;
-
             dist = __node_distance(local_node, node);
-
-            /*
-             * Grab the node right away. If we find a closer node later we will
-             * release this one. While there is a chance that another CPU will
-             * not be able to scrub that node when it is searching for scrub work
-             * at the same time it will be able to do so next time it wakes up.
-             * The alternative would be to perform this search under a lock but
-             * then we'd need to take this lock every time we come in here.
-             */
-            if ( (dist < shortest || closest == NUMA_NO_NODE) &&
-                 !node_test_and_set(node, node_scrubbing) )
+            if ( dist < shortest || closest == NUMA_NO_NODE )
             {
-                if ( closest != NUMA_NO_NODE )
-                    node_clear(closest, node_scrubbing);
                 shortest = dist;
                 closest = node;
             }
@@ -1273,6 +1676,45 @@ static unsigned int node_to_scrub(bool get_node)
     return closest;
 }
 
+/*
+ * Find the last buddy of a heap list with pages to scrub which no other CPU
+ * is scrubbing.  Unscrubbed pages are always at the end of the list.
+ */
+static struct page_info *buddy_to_scrub(struct page_list_head *list)
+{
+    struct page_info *pg, *tmp;
+
+    page_list_for_each_safe_reverse ( pg, tmp, list )
+    {
+        if ( pg->u.free.first_dirty == INVALID_DIRTY_IDX )
+            break;
+        if ( pg->u.free.scrub_state == BUDDY_NOT_SCRUBBING )
+            return pg;
+    }
+
+    return NULL;
+}
+
+static void account_scrub(nodeid_t node, unsigned int dirty_cnt,
+                          s_time_t start)
+{
+    ASSERT(spin_is_locked(&heap_lock));
+
+    node_need_scrub[node] -= dirty_cnt;
+    node_scrub[node].scrubbed += dirty_cnt;
+    node_scrub[node].scrub_ns += NOW() - start;
+}
+
+void get_scrub_stats(unsigned int node, struct scrub_stats *stats)
+{
+    spin_lock(&heap_lock);
+    stats->pending = node_need_scrub[node];
+    stats->scrubbed = node_scrub[node].scrubbed;
+    stats->scrub_ns = node_scrub[node].scrub_ns;
+    stats->scrubbers = node_scrub[node].scrubbers;
+    spin_unlock(&heap_lock);
+}
+
 struct scrub_wait_state {
     struct page_info *pg;
     unsigned int first_dirty;
@@ -1296,42 +1738,47 @@ static void cf_check scrub_continue(void *data)
     }
 }
 
+/*
+ * Scrub free memory of a node from an idle CPU.  All idle CPUs of a node scrub
+ * it in parallel, each taking whole buddies off the end of the heap lists.
+ * Returns whether the CPU should come back for more, rather than go idle.
+ */
 bool scrub_free_pages(void)
 {
     struct page_info *pg;
     unsigned int zone;
     unsigned int cpu = smp_processor_id();
-    bool preempt = false;
+    bool preempt = false, scrubbed = false;
     nodeid_t node;
     unsigned int cnt = 0;
+    s_time_t start;
 
-    node = node_to_scrub(true);
+    node = node_to_scrub();
     if ( node == NUMA_NO_NODE )
         return false;
 
     spin_lock(&heap_lock);
 
+    node_scrub[node].scrubbers++;
+
     for ( zone = 0; zone < NR_ZONES; zone++ )
     {
         unsigned int order = MAX_ORDER;
 
         do {
-            while ( !page_list_empty(&heap(node, zone, order)) )
+            while ( (pg = buddy_to_scrub(&heap(node, zone, order))) != NULL )
             {
                 unsigned int i, dirty_cnt;
                 struct scrub_wait_state st;
 
-                /* Unscrubbed pages are always at the end of the list. */
-                pg = page_list_last(&heap(node, zone, order));
-                if ( pg->u.free.first_dirty == INVALID_DIRTY_IDX )
-                    break;
-
                 ASSERT(pg->u.free.scrub_state == BUDDY_NOT_SCRUBBING);
                 pg->u.free.scrub_state = BUDDY_SCRUBBING;
 
                 spin_unlock(&heap_lock);
 
                 dirty_cnt = 0;
+                scrubbed = true;
+                start = NOW();
 
                 for ( i = pg->u.free.first_dirty; i < (1U << order); i++)
                 {
@@ -1360,9 +1807,8 @@ bool scrub_free_pages(void)
                         pg->u.free.scrub_state = BUDDY_NOT_SCRUBBING;
 
                         spin_lock(&heap_lock);
-                        node_need_scrub[node] -= dirty_cnt;
-                        spin_unlock(&heap_lock);
-                        goto out_nolock;
+                        account_scrub(node, dirty_cnt, start);
+                        goto out;
                     }
 
                     /*
@@ -1392,7 +1838,7 @@ bool scrub_free_pages(void)
                 st.drop = false;
                 spin_lock_cb(&heap_lock, scrub_continue, &st);
 
-                node_need_scrub[node] -= dirty_cnt;
+                account_scrub(node, dirty_cnt, start);
 
                 if ( st.drop )
                     goto out;
@@ -1414,11 +1860,15 @@ bool scrub_free_pages(void)
     }
 
  out:
+    node_scrub[node].scrubbers--;
+
     spin_unlock(&heap_lock);
 
- out_nolock:
-    node_clear(node, node_scrubbing);
-    return node_to_scrub(false) != NUMA_NO_NODE;
+    /*
+     * Once all memory left to scrub is being scrubbed by other CPUs, there's
+     * nothing left to do for this one.
+     */
+    return scrubbed && node_to_scrub() != NUMA_NO_NODE;
 }
 
 static bool mark_page_free(struct page_info *pg, mfn_t mfn)
@@ -1460,20 +1910,13 @@ static bool mark_page_free(struct page_info *pg, mfn_t mfn)
         BUG();
     }
 
-    /* If a page has no owner it will need no safety TLB flush. */
-    pg->u.free.need_tlbflush = (page_get_owner(pg) != NULL);
-    if ( pg->u.free.need_tlbflush )
-        page_set_tlbflush_timestamp(pg);
-
-    /* This page is not a guest frame any more. */
-    page_set_owner(pg, NULL); /* set_gpfn_from_mfn snoops pg owner */
-    set_gpfn_from_mfn(mfn_x(mfn), INVALID_M2P_ENTRY);
+    clear_page_owner(pg, mfn);
 
     return pg_offlined;
 }
 
-/* Free 2^@order set of pages. */
-static void free_heap_pages(
+/* Free 2^@order set of pages, with heap_lock held. */
+static void _free_heap_pages(
     struct page_info *pg, unsigned int order, bool need_scrub)
 {
     unsigned long mask;
@@ -1483,8 +1926,7 @@ static void free_heap_pages(
     bool pg_offlined = false;
 
     ASSERT(order <= MAX_ORDER);
-
-    spin_lock(&heap_lock);
+    ASSERT(spin_is_locked(&heap_lock));
 
     for ( i = 0; i < (1 << order); i++ )
     {
@@ -1567,7 +2009,17 @@ static void free_heap_pages(
 
     if ( pg_offlined )
         reserve_offlined_page(pg);
+}
+
+/* Free 2^@order set of pages. */
+static void free_heap_pages(
+    struct page_info *pg, unsigned int order, bool need_scrub)
+{
+    if ( !order && free_cached_page(pg, need_scrub) )
+        return;
 
+    spin_lock(&heap_lock);
+    _free_heap_pages(pg, order, need_scrub);
     spin_unlock(&heap_lock);
 }
 
@@ -1677,6 +2129,9 @@ int offline_page(mfn_t mfn, int broken, uint32_t *status)
         return 0;
     }
 
+    /* Let a free page held in a per-CPU cache be offlined right away. */
+    drain_page_caches();
+
     spin_lock(&heap_lock);
 
     old_info = mark_page_offline(pg, broken);
@@ -1957,6 +2412,10 @@ static unsigned long avail_heap_pages(
                 free_pages += avail[i][zone];
     }
 
+    /* Cached pages are free too, but not accounted per zone. */
+    if ( page_cache_serves(zone_lo, zone_hi) )
+        free_pages += page_cache_pages(node);
+
     return free_pages;
 }
 
@@ -2621,7 +3080,7 @@ unsigned long avail_node_heap_pages(unsigned int nodeid)
 
 static void cf_check pagealloc_info(unsigned char key)
 {
-    unsigned int zone = MEMZONE_XEN;
+    unsigned int zone = MEMZONE_XEN, node;
     unsigned long n, total = 0;
 
     printk("Physical memory information:\n");
@@ -2644,6 +3103,28 @@ static void cf_check pagealloc_info(unsigned char key)
     }
 
     printk("    Dom heap: %lukB free\n", total << (PAGE_SHIFT-10));
+
+    if ( page_cache_ready )
+        printk("    Per-CPU caches: %lukB\n",
+               page_cache_pages(-1) << (PAGE_SHIFT-10));
+
+    for_each_online_node ( node )
+    {
+        struct scrub_stats stats;
+        uint64_t us;
+
+        get_scrub_stats(node, &stats);
+        if ( !stats.pending && !stats.scrubbed )
+            continue;
+
+        us = stats.scrub_ns / 1000;
+        printk("    Node %u: %lukB to scrub, %lukB scrubbed at %"PRIu64
+               "MB/s per CPU, %u CPUs scrubbing\n", node,
+               stats.pending << (PAGE_SHIFT-10),
+               stats.scrubbed << (PAGE_SHIFT-10),
+               us ? ((uint64_t)stats.scrubbed << PAGE_SHIFT) / us : 0,
+               stats.scrubbers);
+    }
 }
 
 static __init int cf_check pagealloc_keyhandler_init(void)
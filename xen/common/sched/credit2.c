@@ -20,6 +20,7 @@
 #include <xen/event.h>
 #include <xen/time.h>
 #include <xen/perfc.h>
+#include <xen/rbtree.h>
 #include <xen/softirq.h>
 #include <asm/div64.h>
 #include <xen/errno.h>
@@ -260,6 +261,8 @@
 #define CSCHED2_MIGRATE_RESIST       ((opt_migrate_resist)*MICROSECS(1))
 /* How much to "compensate" an unit for L2 migration. */
 #define CSCHED2_MIGRATE_COMPENSATION MICROSECS(50)
+/* For how long an unit that stopped running still has its cache warm. */
+#define CSCHED2_CACHE_HOT            MILLISECS(1)
 /* How tolerant we should be when peeking at runtime of units on other cpus */
 #define CSCHED2_RATELIMIT_TICKLE_TOLERANCE MICROSECS(50)
 /* Reset: Value below which credit will be reset. */
@@ -490,6 +493,33 @@ custom_param("credit2_runqueue", parse_credit2_runqueue);
 static unsigned int __read_mostly opt_max_cpus_runqueue = MAX_CPUS_RUNQ;
 integer_param("sched_credit2_max_cpus_runqueue", opt_max_cpus_runqueue);
 
+/*
+ * Placement cost.
+ *
+ * Moving an unit to another runqueue costs more than the load averages
+ * show:
+ *
+ * - memory locality: on a NUMA node that is not in the node affinity of its
+ *   domain, where the memory of the domain is, each cache miss of the unit
+ *   is a remote access, the more expensive the further away the node is;
+ *
+ * - cache warmth: an unit that ran recently still has its working set in
+ *   the caches it ran on, and loses it when moving to a runqueue with which
+ *   it does not share the last level cache (taken as the socket).
+ *
+ * Both are accounted as extra load on the target runqueue, when picking a
+ * runqueue for an unit and when balancing load. The parameters express them
+ * as a percentage of the load of a fully busy CPU: credit2_numa_cost for
+ * each hop of NUMA distance (as in, each 10 of SLIT distance beyond the
+ * local one), credit2_cache_cost for an unit that is running or has just
+ * stopped, decaying to nothing after CSCHED2_CACHE_HOT.
+ */
+#define CSCHED2_NUMA_LOCAL_DISTANCE 10
+static unsigned int __read_mostly opt_numa_cost = 50;
+integer_param("credit2_numa_cost", opt_numa_cost);
+static unsigned int __read_mostly opt_cache_cost = 25;
+integer_param("credit2_cache_cost", opt_cache_cost);
+
 /*
  * Per-runqueue data
  */
@@ -497,12 +527,14 @@ struct csched2_runqueue_data {
     spinlock_t lock;           /* Lock for this runqueue                     */
 
     struct list_head rql;      /* List of runqueues                          */
-    struct list_head runq;     /* Ordered list of runnable vms               */
+    struct rb_root runq;       /* Runnable units, by decreasing credit       */
+    struct rb_node *runq_first;/* Leftmost node of runq (highest credit)     */
     unsigned int refcnt;       /* How many CPUs reference this runqueue      */
                                /* (including not yet active ones)            */
     unsigned int nr_cpus;      /* How many CPUs are sharing this runqueue    */
                                /* (only active ones)                         */
     int id;                    /* ID of this runqueue (-1 if invalid)        */
+    nodeid_t node;             /* NUMA node of all its CPUs (or NUMA_NO_NODE)*/
 
     int load;                  /* Instantaneous load (num of non-idle units) */
     s_time_t load_last_update; /* Last time average was updated              */
@@ -561,12 +593,13 @@ struct csched2_unit {
     s_time_t budget_quota;             /* Budget to which unit is entitled    */
 
     s_time_t start_time;               /* Time we were scheduled (for credit) */
+    s_time_t last_run;                 /* Time we were descheduled            */
 
     /* Individual contribution to load                                        */
     s_time_t load_last_update;         /* Last time average was updated       */
     s_time_t avgload;                  /* Decaying queue load                 */
 
-    struct list_head runq_elem;        /* On the runqueue (rqd->runq)         */
+    struct rb_node runq_elem;          /* On the runqueue (rqd->runq)         */
     struct list_head parked_elem;      /* On the parked_units list            */
     struct list_head rqd_elem;         /* On csched2_runqueue_data's svc list */
     struct csched2_runqueue_data *migrate_rqd; /* Pre-determined migr. target */
@@ -833,12 +866,19 @@ static s_time_t c2t(const struct csched2_runqueue_data *rqd, s_time_t credit,
 
 static inline int unit_on_runq(const struct csched2_unit *svc)
 {
-    return !list_empty(&svc->runq_elem);
+    return !RB_EMPTY_NODE(&svc->runq_elem);
 }
 
-static inline struct csched2_unit * runq_elem(struct list_head *elem)
+static inline struct csched2_unit * runq_elem(struct rb_node *elem)
 {
-    return list_entry(elem, struct csched2_unit, runq_elem);
+    return rb_entry(elem, struct csched2_unit, runq_elem);
+}
+
+/* The unit with the highest credit in the runqueue, if any. */
+static inline struct csched2_unit *
+runq_first(const struct csched2_runqueue_data *rqd)
+{
+    return rqd->runq_first ? runq_elem(rqd->runq_first) : NULL;
 }
 
 static inline bool same_node(unsigned int cpua, unsigned int cpub)
@@ -857,6 +897,79 @@ static inline bool same_core(unsigned int cpua, unsigned int cpub)
            cpu_to_core(cpua) == cpu_to_core(cpub);
 }
 
+/* Account for an unit moving from old_cpu to new_cpu. */
+static inline void count_migration(unsigned int old_cpu, unsigned int new_cpu)
+{
+    if ( !same_socket(old_cpu, new_cpu) )
+        SCHED_STAT_CRANK(migrate_cross_llc);
+    if ( !same_node(old_cpu, new_cpu) )
+        SCHED_STAT_CRANK(migrate_cross_node);
+}
+
+/*
+ * Extra load that svc would put on rqd if moved there, as its memory is
+ * remote or its cache is lost (see "Placement cost" above).
+ */
+static s_time_t placement_cost(const struct csched2_private *prv,
+                               const struct csched2_unit *svc,
+                               const struct csched2_runqueue_data *rqd,
+                               s_time_t now)
+{
+    const struct domain *d = svc->unit->domain;
+    s_time_t cpu_load = 1LL << prv->load_precision_shift;
+    s_time_t cost = 0;
+
+    if ( rqd == svc->rqd )
+        return 0;
+
+    if ( rqd->node != NUMA_NO_NODE &&
+         !nodemask_test(rqd->node, &d->node_affinity) )
+    {
+        unsigned int dist = NUMA_NO_DISTANCE;
+        nodeid_t node;
+
+        for_each_node_mask ( node, d->node_affinity )
+            dist = min_t(unsigned int, dist, __node_distance(rqd->node, node));
+        if ( dist == NUMA_NO_DISTANCE )
+            dist = 2 * CSCHED2_NUMA_LOCAL_DISTANCE;
+
+        if ( dist > CSCHED2_NUMA_LOCAL_DISTANCE )
+            cost += cpu_load * opt_numa_cost / 100 *
+                    (dist - CSCHED2_NUMA_LOCAL_DISTANCE) /
+                    CSCHED2_NUMA_LOCAL_DISTANCE;
+    }
+
+    if ( svc->rqd && !same_socket(rqd->pick_bias, svc->rqd->pick_bias) )
+    {
+        s_time_t age = svc->flags & CSFLAG_scheduled ? 0
+                                                     : now - svc->last_run;
+
+        if ( age < CSCHED2_CACHE_HOT )
+            cost += cpu_load * opt_cache_cost / 100 *
+                    (CSCHED2_CACHE_HOT - age) / CSCHED2_CACHE_HOT;
+    }
+
+    return cost;
+}
+
+/* Find out whether all the CPUs of rqd are on the same NUMA node. */
+static void update_runq_node(struct csched2_runqueue_data *rqd)
+{
+    unsigned int cpu;
+
+    rqd->node = NUMA_NO_NODE;
+    for_each_cpu ( cpu, &rqd->active )
+    {
+        if ( rqd->node == NUMA_NO_NODE )
+            rqd->node = cpu_to_node(cpu);
+        else if ( rqd->node != cpu_to_node(cpu) )
+        {
+            rqd->node = NUMA_NO_NODE;
+            break;
+        }
+    }
+}
+
 static inline bool
 cpu_runqueue_match(const struct csched2_runqueue_data *rqd, unsigned int cpu)
 {
@@ -1428,53 +1541,80 @@ update_load(const struct scheduler *ops,
         update_svc_load(ops, svc, change, now);
 }
 
+/*
+ * The runqueue is a red-black tree ordered by decreasing credit. Units with
+ * the same credit are kept in insertion order, by going right on ties.
+ *
+ * Credits of queued units only change in reset_credit(), which adds the
+ * same amount to everyone (clipping at the top), so the order of the tree
+ * stays valid without any re-sorting.
+ */
 static void runq_insert(struct csched2_unit *svc)
 {
-    struct list_head *iter;
     unsigned int cpu = sched_unit_master(svc->unit);
-    struct list_head *runq = &c2rqd(cpu)->runq;
-    int pos = 0;
+    struct csched2_runqueue_data *rqd = c2rqd(cpu);
+    struct rb_node **link = &rqd->runq.rb_node, *parent = NULL;
+    bool leftmost = true;
 
     ASSERT(spin_is_locked(get_sched_res(cpu)->schedule_lock));
 
     ASSERT(!unit_on_runq(svc));
     ASSERT(c2r(cpu) == c2r(sched_unit_master(svc->unit)));
 
-    ASSERT(&svc->rqd->runq == runq);
+    ASSERT(svc->rqd == rqd);
     ASSERT(!is_idle_unit(svc->unit));
     ASSERT(!svc->unit->is_running);
     ASSERT(!(svc->flags & CSFLAG_scheduled));
 
-    list_for_each( iter, runq )
+    while ( *link )
     {
-        struct csched2_unit * iter_svc = runq_elem(iter);
-
-        if ( svc->credit > iter_svc->credit )
-            break;
+        parent = *link;
 
-        pos++;
+        if ( svc->credit > runq_elem(parent)->credit )
+            link = &parent->rb_left;
+        else
+        {
+            link = &parent->rb_right;
+            leftmost = false;
+        }
     }
-    list_add_tail(&svc->runq_elem, iter);
+
+    rb_link_node(&svc->runq_elem, parent, link);
+    rb_insert_color(&svc->runq_elem, &rqd->runq);
+    if ( leftmost )
+        rqd->runq_first = &svc->runq_elem;
 
     if ( unlikely(tb_init_done) )
     {
+        const struct rb_node *iter;
+        unsigned int pos = 0;
         struct {
             uint16_t unit, dom;
             uint32_t pos;
         } d = {
             .unit = svc->unit->unit_id,
             .dom  = svc->unit->domain->domain_id,
-            .pos  = pos,
         };
 
+        /* Only worth walking the tree to find the position when tracing. */
+        for ( iter = rb_prev(&svc->runq_elem); iter; iter = rb_prev(iter) )
+            pos++;
+        d.pos = pos;
+
         trace_time(TRC_CSCHED2_RUNQ_POS, sizeof(d), &d);
     }
 }
 
 static inline void runq_remove(struct csched2_unit *svc)
 {
+    struct csched2_runqueue_data *rqd = svc->rqd;
+
     ASSERT(unit_on_runq(svc));
-    list_del_init(&svc->runq_elem);
+
+    if ( rqd->runq_first == &svc->runq_elem )
+        rqd->runq_first = rb_next(&svc->runq_elem);
+    rb_erase(&svc->runq_elem, &rqd->runq);
+    RB_CLEAR_NODE(&svc->runq_elem);
 }
 
 static void burn_credits(struct csched2_runqueue_data *rqd,
@@ -2184,7 +2324,7 @@ csched2_alloc_udata(const struct scheduler *ops, struct sched_unit *unit,
         return NULL;
 
     INIT_LIST_HEAD(&svc->rqd_elem);
-    INIT_LIST_HEAD(&svc->runq_elem);
+    RB_CLEAR_NODE(&svc->runq_elem);
 
     svc->sdom = dd;
     svc->unit = unit;
@@ -2314,6 +2454,7 @@ csched2_context_saved(const struct scheduler *ops, struct sched_unit *unit)
 
     /* This unit is now eligible to be put on the runqueue again */
     __clear_bit(__CSFLAG_scheduled, &svc->flags);
+    svc->last_run = now;
 
     if ( unlikely(has_cap(svc) && svc->budget > 0) )
         unit_return_budget(svc, &were_parked);
@@ -2350,6 +2491,7 @@ csched2_res_pick(const struct scheduler *ops, const struct sched_unit *unit)
     unsigned int new_cpu, cpu = sched_unit_master(unit);
     struct csched2_unit *svc = csched2_unit(unit);
     s_time_t min_avgload = MAX_LOAD, min_s_avgload = MAX_LOAD;
+    s_time_t now = NOW();
     bool has_soft;
     struct csched2_runqueue_data *rqd, *min_rqd = NULL, *min_s_rqd = NULL;
 
@@ -2428,6 +2570,9 @@ csched2_res_pick(const struct scheduler *ops, const struct sched_unit *unit)
      *    contains cpus in our hard affinity; this represent the best runq
      *    on which we can run.
      *
+     * The load of runqueues other than ours includes what moving there
+     * would cost us, in memory locality and cache warmth.
+     *
      * Find both runqueues in one pass.
      */
     has_soft = has_soft_affinity(unit);
@@ -2462,6 +2607,7 @@ csched2_res_pick(const struct scheduler *ops, const struct sched_unit *unit)
         {
             rqd_avgload = rqd->b_avgload;
             spin_unlock(&rqd->lock);
+            rqd_avgload += placement_cost(prv, svc, rqd, now);
         }
 
         /*
@@ -2571,6 +2717,8 @@ typedef struct {
     /* NB: Read by consider() */
     struct csched2_runqueue_data *lrqd;
     struct csched2_runqueue_data *orqd;
+    const struct csched2_private *prv;
+    s_time_t now;
 } balance_state_t;
 
 static void consider(balance_state_t *st,
@@ -2598,6 +2746,12 @@ static void consider(balance_state_t *st,
     if ( delta < 0 )
         delta = -delta;
 
+    /* Moving units is only worth it if the gain exceeds the cost. */
+    if ( push_svc )
+        delta += placement_cost(st->prv, push_svc, st->orqd, st->now);
+    if ( pull_svc )
+        delta += placement_cost(st->prv, pull_svc, st->lrqd, st->now);
+
     if ( delta < st->load_delta )
     {
         st->load_delta = delta;
@@ -2659,6 +2813,7 @@ static void migrate(const struct scheduler *ops,
                       get_sched_res(cpumask_cycle(trqd->pick_bias,
                                                   cpumask_scratch_cpu(cpu))));
         trqd->pick_bias = sched_unit_master(unit);
+        count_migration(cpu, sched_unit_master(unit));
         ASSERT(sched_unit_master(unit) < nr_cpu_ids);
 
         _runq_assign(svc, trqd);
@@ -2699,7 +2854,9 @@ static void balance_load(const struct scheduler *ops, int cpu, s_time_t now)
     bool inner_load_updated = 0;
     struct csched2_runqueue_data *rqd, *max_delta_rqd;
 
-    balance_state_t st = { .best_push_svc = NULL, .best_pull_svc = NULL };
+    balance_state_t st = {
+        .best_push_svc = NULL, .best_pull_svc = NULL, .prv = prv, .now = now,
+    };
 
     /*
      * Basic algorithm: Push, pull, or swap.
@@ -2899,7 +3056,10 @@ static void cf_check csched2_unit_migrate(
     if ( trqd != svc->rqd )
         migrate(ops, svc, trqd, now);
     else
+    {
+        count_migration(sched_unit_master(unit), new_cpu);
         sched_set_res(unit, get_sched_res(new_cpu));
+    }
 }
 
 static int cf_check
@@ -3216,7 +3376,7 @@ csched2_unit_insert(const struct scheduler *ops, struct sched_unit *unit)
     spinlock_t *lock;
 
     ASSERT(!is_idle_unit(unit));
-    ASSERT(list_empty(&svc->runq_elem));
+    ASSERT(!unit_on_runq(svc));
 
     /* csched2_res_pick() expects the pcpu lock to be held */
     lock = unit_schedule_lock_irq(unit);
@@ -3254,7 +3414,7 @@ csched2_unit_remove(const struct scheduler *ops, struct sched_unit *unit)
     spinlock_t *lock;
 
     ASSERT(!is_idle_unit(unit));
-    ASSERT(list_empty(&svc->runq_elem));
+    ASSERT(!unit_on_runq(svc));
 
     SCHED_STAT_CRANK(unit_remove);
 
@@ -3276,7 +3436,7 @@ csched2_runtime(const struct scheduler *ops, int cpu,
     s_time_t time, min_time;
     int rt_credit; /* Proposed runtime measured in credits */
     struct csched2_runqueue_data *rqd = c2rqd(cpu);
-    struct list_head *runq = &rqd->runq;
+    const struct csched2_unit *swait = runq_first(rqd);
     const struct csched2_private *prv = csched2_priv(ops);
 
     /*
@@ -3314,16 +3474,8 @@ csched2_runtime(const struct scheduler *ops, int cpu,
      * 2) If there's someone waiting whose credit is positive,
      *    run until your credit ~= his.
      */
-    if ( ! list_empty(runq) )
-    {
-        struct csched2_unit *swait = runq_elem(runq->next);
-
-        if ( ! is_idle_unit(swait->unit)
-             && swait->credit > 0 )
-        {
-            rt_credit = snext->credit - swait->credit;
-        }
-    }
+    if ( swait && ! is_idle_unit(swait->unit) && swait->credit > 0 )
+        rt_credit = snext->credit - swait->credit;
 
     /*
      * The next guy on the runqueue may actually have a higher credit,
@@ -3372,7 +3524,7 @@ runq_candidate(struct csched2_runqueue_data *rqd,
                struct csched2_unit *scurr,
                int cpu, s_time_t now)
 {
-    struct list_head *iter, *temp;
+    struct rb_node *iter, *next;
     const struct sched_resource *sr = get_sched_res(cpu);
     struct csched2_unit *snext = NULL;
     struct csched2_private *prv = csched2_priv(sr->scheduler);
@@ -3455,9 +3607,12 @@ runq_candidate(struct csched2_runqueue_data *rqd,
         snext = csched2_unit(sched_idle_unit(cpu));
 
  check_runq:
-    list_for_each_safe( iter, temp, &rqd->runq )
+    for ( iter = rqd->runq_first; iter; iter = next )
     {
-        struct csched2_unit * svc = list_entry(iter, struct csched2_unit, runq_elem);
+        struct csched2_unit * svc = runq_elem(iter);
+
+        /* svc may leave the runqueue, if it gets parked below. */
+        next = rb_next(iter);
 
         if ( unlikely(tb_init_done) )
         {
@@ -3699,10 +3854,10 @@ static void cf_check csched2_schedule(
          * returned the first unit in the runqueue, for various reasons
          * (e.g., affinity). Only trigger a reset when it does.
          */
-        if ( list_empty(&rqd->runq) )
+        if ( !rqd->runq_first )
             top_credit = snext->credit;
         else
-            top_credit = max(snext->credit, runq_elem(rqd->runq.next)->credit);
+            top_credit = max(snext->credit, runq_first(rqd)->credit);
         if ( top_credit <= CSCHED2_CREDIT_RESET )
         {
             reset_credit(sched_cpu, now, snext);
@@ -3716,6 +3871,7 @@ static void cf_check csched2_schedule(
         if ( sched_unit_master(snext->unit) != sched_cpu )
         {
             snext->credit += CSCHED2_MIGRATE_COMPENSATION;
+            count_migration(sched_unit_master(snext->unit), sched_cpu);
             sched_set_res(snext->unit, get_sched_res(sched_cpu));
             SCHED_STAT_CRANK(migrated);
             migrated = true;
@@ -3878,7 +4034,7 @@ csched2_dump(const struct scheduler *ops)
 
     list_for_each_entry ( rqd, &prv->rql, rql )
     {
-        struct list_head *iter, *runq = &rqd->runq;
+        struct rb_node *iter;
 
         loop = 0;
         /* We need the lock to scan the runqueue. */
@@ -3890,7 +4046,7 @@ csched2_dump(const struct scheduler *ops)
             dump_pcpu(ops, j);
 
         printk("RUNQ:\n");
-        list_for_each( iter, runq )
+        for ( iter = rb_first(&rqd->runq); iter; iter = rb_next(iter) )
         {
             const struct csched2_unit *svc = runq_elem(iter);
 
@@ -3950,7 +4106,7 @@ init_cpu_runqueue(struct csched2_private *prv, struct csched2_pcpu *spc,
         BUG_ON(!cpumask_empty(&rqd->active));
         rqd->max_weight = 1;
         INIT_LIST_HEAD(&rqd->svc);
-        INIT_LIST_HEAD(&rqd->runq);
+        rqd->runq = RB_ROOT;
         spin_lock_init(&rqd->lock);
         prv->active_queues++;
     }
@@ -3972,6 +4128,7 @@ init_cpu_runqueue(struct csched2_private *prv, struct csched2_pcpu *spc,
 
     rqd->nr_cpus++;
     ASSERT(cpumask_weight(&rqd->active) == rqd->nr_cpus);
+    update_runq_node(rqd);
 
     if ( rqd->nr_cpus == 1 )
         rqd->pick_bias = cpu;
@@ -4074,6 +4231,7 @@ csched2_deinit_pdata(const struct scheduler *ops, void *pcpu, int cpu)
 
     rqd->nr_cpus--;
     ASSERT(cpumask_weight(&rqd->active) == rqd->nr_cpus);
+    update_runq_node(rqd);
 
     if ( rqd->nr_cpus == 0 )
     {
@@ -13,6 +13,7 @@
 
 #include <xen/init.h>
 #include <xen/lib.h>
+#include <xen/param.h>
 #include <xen/sched.h>
 #include <xen/domain.h>
 #include <xen/delay.h>
@@ -20,6 +21,7 @@
 #include <xen/time.h>
 #include <xen/timer.h>
 #include <xen/perfc.h>
+#include <xen/rbtree.h>
 #include <xen/softirq.h>
 #include <asm/atomic.h>
 #include <xen/errno.h>
@@ -65,26 +67,89 @@
  * When an UNIT has no task but with budget left, its budget is preserved.
  *
  * Queue scheme:
- * A global runqueue and a global depletedqueue for each CPU pool.
+ * A runqueue and a depletedqueue for each cluster of PCPUs (see below).
  * The runqueue holds all runnable UNITs with budget,
  * sorted by priority_level and deadline;
  * The depletedqueue holds all UNITs without budget, unsorted;
+ * Both the runqueue and the replenishment queue are red-black trees, so
+ * that queueing an UNIT is logarithmic in the number of queued UNITs.
  *
  * Note: cpumask and cpupool is supported.
  */
 
 /*
  * Locking:
- * A global system lock is used to protect the RunQ and DepletedQ.
- * The global lock is referenced by sched_res->schedule_lock
- * from all physical cpus.
+ * A per-cluster lock is used to protect the RunQ, DepletedQ and
+ * replenishment queue of the cluster. It is referenced by
+ * sched_res->schedule_lock from all physical cpus of the cluster.
  *
  * The lock is already grabbed when calling wake/sleep/schedule/ functions
  * in schedule.c
  *
  * The functions involes RunQ and needs to grab locks are:
  *    unit_insert, unit_remove, context_saved, runq_insert
+ *
+ * The private lock (an rwlock) protects the list of domains and the list
+ * of clusters. It is taken before a cluster lock, or only tried when
+ * already holding one. The lock of another cluster is only ever tried,
+ * when already holding that of a cluster.
+ */
+
+/*
+ * Clusters.
+ *
+ * The PCPUs of a cpupool are grouped in clusters, and EDF is global
+ * within each cluster: the UNITs queued in a cluster are those whose
+ * processor is one of the cluster's PCPUs, and any of these PCPUs picks
+ * the highest priority one it can run. Depending on the rtds_cluster
+ * parameter, a cluster is made of:
+ *
+ * - cpu: one logical cpu (that is, partitioned EDF);
+ * - core: the logical cpus of a physical core;
+ * - socket: the logical cpus of a socket;
+ * - node: the logical cpus of a NUMA node;
+ * - all: all the cpus of the cpupool (global EDF, the default).
+ *
+ * Smaller clusters mean less contention on their locks and shorter
+ * queues, at the price of a worse approximation of global EDF. Between
+ * clusters, UNITs are pushed and pulled:
+ * - push: an UNIT that wakes up when no PCPU of its cluster is idle kicks
+ *   an idle PCPU of another cluster, if there is one it can run on;
+ * - pull: a PCPU which has nothing to run picks the highest priority
+ *   UNIT it can run from the runqueues of the other clusters.
+ * Neither of them waits for the lock of another cluster: a busy cluster
+ * is just skipped.
  */
+#define OPT_CLUSTER_CPU     0
+#define OPT_CLUSTER_CORE    1
+#define OPT_CLUSTER_SOCKET  2
+#define OPT_CLUSTER_NODE    3
+#define OPT_CLUSTER_ALL     4
+static const char *const opt_cluster_str[] = {
+    [OPT_CLUSTER_CPU] = "cpu",
+    [OPT_CLUSTER_CORE] = "core",
+    [OPT_CLUSTER_SOCKET] = "socket",
+    [OPT_CLUSTER_NODE] = "node",
+    [OPT_CLUSTER_ALL] = "all"
+};
+static int __read_mostly opt_cluster = OPT_CLUSTER_ALL;
+
+static int __init cf_check parse_rtds_cluster(const char *s)
+{
+    unsigned int i;
+
+    for ( i = 0; i < ARRAY_SIZE(opt_cluster_str); i++ )
+    {
+        if ( !strcmp(s, opt_cluster_str[i]) )
+        {
+            opt_cluster = i;
+            return 0;
+        }
+    }
+
+    return -EINVAL;
+}
+custom_param("rtds_cluster", parse_rtds_cluster);
 
 
 /*
@@ -176,29 +241,54 @@
 static void cf_check repl_timer_handler(void *data);
 
 /*
- * System-wide private data, include global RunQueue/DepletedQ
- * Global lock is referenced by sched_res->schedule_lock from all
- * physical cpus. It can be grabbed via unit_schedule_lock_irq()
+ * System-wide private data
  */
 struct rt_private {
-    spinlock_t lock;            /* the global coarse-grained lock */
+    rwlock_t lock;              /* protects sdom and the list of clusters */
     struct list_head sdom;      /* list of availalbe domains, used for dump */
+    struct list_head clusters;  /* list of clusters, ordered by id */
+
+    cpumask_t idle;             /* cpus running their idle unit */
+};
 
-    struct list_head runq;      /* ordered list of runnable units */
+/*
+ * Cluster, include its RunQueue/DepletedQ
+ * The cluster lock is referenced by sched_res->schedule_lock from all
+ * the physical cpus in the cluster. It can be grabbed via
+ * unit_schedule_lock_irq()
+ */
+struct rt_cluster {
+    spinlock_t lock;            /* the lock of the cluster's cpus */
+    struct list_head cluster_elem; /* on the list of clusters */
+    const struct scheduler *ops;
+    unsigned int id;
+    unsigned int refcnt;        /* cpus allocated to the cluster */
+    unsigned int pick_bias;     /* cpu the cluster was created for */
+    cpumask_t active;           /* cpus the cluster is scheduling on */
+
+    struct rb_root runq;        /* runnable units, by priority */
     struct list_head depletedq; /* unordered list of depleted units */
 
     struct timer repl_timer;    /* replenishment timer */
-    struct list_head replq;     /* ordered list of units that need replenishment */
+    struct rb_root replq;       /* units that need replenishment, by deadline */
 
     cpumask_t tickled;          /* cpus been tickled */
 };
 
+/*
+ * Physical CPU
+ */
+struct rt_pcpu {
+    struct rt_cluster *cl;      /* the cluster of this cpu */
+};
+
 /*
  * Virtual CPU
  */
 struct rt_unit {
-    struct list_head q_elem;     /* on the runq/depletedq list */
-    struct list_head replq_elem; /* on the replenishment events list */
+    struct rb_node q_elem;       /* on the runq */
+    struct list_head depletedq_elem; /* on the depletedq list */
+    struct rb_node replq_elem;   /* on the replenishment events queue */
 
     /* UNIT parameters, in nanoseconds */
     s_time_t period;
@@ -239,19 +329,17 @@ static inline struct rt_unit *rt_unit(const struct sched_unit *unit)
     return unit->priv;
 }
 
-static inline struct list_head *rt_runq(const struct scheduler *ops)
+static inline struct rt_cluster *rt_cpu_cluster(unsigned int cpu)
 {
-    return &rt_priv(ops)->runq;
-}
+    const struct rt_pcpu *spc = get_sched_res(cpu)->sched_priv;
 
-static inline struct list_head *rt_depletedq(const struct scheduler *ops)
-{
-    return &rt_priv(ops)->depletedq;
+    return spc->cl;
 }
 
-static inline struct list_head *rt_replq(const struct scheduler *ops)
+/* The cluster whose queues the unit is on, or may be put on. */
+static inline struct rt_cluster *rt_unit_cluster(const struct rt_unit *svc)
 {
-    return &rt_priv(ops)->replq;
+    return rt_cpu_cluster(sched_unit_master(svc->unit));
 }
 
 static inline bool has_extratime(const struct rt_unit *svc)
@@ -263,35 +351,50 @@ static inline bool has_extratime(const struct rt_unit *svc)
  * Helper functions for manipulating the runqueue, the depleted queue,
  * and the replenishment events queue.
  */
+static int
+unit_on_runq(const struct rt_unit *svc)
+{
+   return !RB_EMPTY_NODE(&svc->q_elem);
+}
+
 static int
 unit_on_q(const struct rt_unit *svc)
 {
-   return !list_empty(&svc->q_elem);
+   return unit_on_runq(svc) || !list_empty(&svc->depletedq_elem);
 }
 
 static struct rt_unit *cf_check
-q_elem(struct list_head *elem)
+q_elem(struct rb_node *elem)
 {
-    return list_entry(elem, struct rt_unit, q_elem);
+    return rb_entry(elem, struct rt_unit, q_elem);
 }
 
 static struct rt_unit *cf_check
-replq_elem(struct list_head *elem)
+replq_elem(struct rb_node *elem)
 {
-    return list_entry(elem, struct rt_unit, replq_elem);
+    return rb_entry(elem, struct rt_unit, replq_elem);
 }
 
 static int
 unit_on_replq(const struct rt_unit *svc)
 {
-    return !list_empty(&svc->replq_elem);
+    return !RB_EMPTY_NODE(&svc->replq_elem);
+}
+
+/* The highest priority unit on the runq, if any. */
+static struct rt_unit *
+runq_first(const struct rt_cluster *cl)
+{
+    struct rb_node *node = rb_first(&cl->runq);
+
+    return node ? q_elem(node) : NULL;
 }
 
 /*
  * If v1 priority >= v2 priority, return value > 0
  * Otherwise, return value < 0
  */
-static s_time_t
+static s_time_t cf_check
 compare_unit_priority(const struct rt_unit *v1, const struct rt_unit *v2)
 {
     int prio = v2->priority_level - v1->priority_level;
@@ -302,6 +405,16 @@ compare_unit_priority(const struct rt_unit *v1, const struct rt_unit *v2)
     return prio;
 }
 
+/*
+ * The order of the replenishment events: the priority level of an unit
+ * may change while its event is queued, its deadline may not.
+ */
+static s_time_t cf_check
+compare_unit_deadline(const struct rt_unit *v1, const struct rt_unit *v2)
+{
+    return v2->cur_deadline - v1->cur_deadline;
+}
+
 /*
  * Debug related code, dump unit/cpu information
  */
@@ -351,58 +464,68 @@ rt_dump_unit(const struct scheduler *ops, const struct rt_unit *svc)
 static void cf_check
 rt_dump_pcpu(const struct scheduler *ops, int cpu)
 {
-    struct rt_private *prv = rt_priv(ops);
     const struct rt_unit *svc;
     unsigned long flags;
+    spinlock_t *lock;
 
-    spin_lock_irqsave(&prv->lock, flags);
-    printk("CPU[%02d]\n", cpu);
+    lock = pcpu_schedule_lock_irqsave(cpu, &flags);
+    printk("CPU[%02d] cluster=%u\n", cpu, rt_cpu_cluster(cpu)->id);
     /* current UNIT (nothing to say if that's the idle unit). */
     svc = rt_unit(curr_on_cpu(cpu));
     if ( svc && !is_idle_unit(svc->unit) )
     {
         rt_dump_unit(ops, svc);
     }
-    spin_unlock_irqrestore(&prv->lock, flags);
+    pcpu_schedule_unlock_irqrestore(lock, flags, cpu);
 }
 
 static void cf_check
 rt_dump(const struct scheduler *ops)
 {
-    struct list_head *runq, *depletedq, *replq, *iter;
+    struct list_head *iter;
+    struct rb_node *node;
     struct rt_private *prv = rt_priv(ops);
+    struct rt_cluster *cl;
     const struct rt_unit *svc;
     const struct rt_dom *sdom;
     unsigned long flags;
 
-    spin_lock_irqsave(&prv->lock, flags);
+    read_lock_irqsave(&prv->lock, flags);
 
     if ( list_empty(&prv->sdom) )
         goto out;
 
-    runq = rt_runq(ops);
-    depletedq = rt_depletedq(ops);
-    replq = rt_replq(ops);
-
-    printk("Global RunQueue info:\n");
-    list_for_each ( iter, runq )
+    list_for_each_entry ( cl, &prv->clusters, cluster_elem )
     {
-        svc = q_elem(iter);
-        rt_dump_unit(ops, svc);
-    }
+        if ( cpumask_empty(&cl->active) )
+            continue;
 
-    printk("Global DepletedQueue info:\n");
-    list_for_each ( iter, depletedq )
-    {
-        svc = q_elem(iter);
-        rt_dump_unit(ops, svc);
-    }
+        spin_lock(&cl->lock);
 
-    printk("Global Replenishment Events info:\n");
-    list_for_each ( iter, replq )
-    {
-        svc = replq_elem(iter);
-        rt_dump_unit(ops, svc);
+        printk("Cluster %u: cpus=%*pbl\n", cl->id, CPUMASK_PR(&cl->active));
+
+        printk("RunQueue info:\n");
+        for ( node = rb_first(&cl->runq); node; node = rb_next(node) )
+        {
+            svc = q_elem(node);
+            rt_dump_unit(ops, svc);
+        }
+
+        printk("DepletedQueue info:\n");
+        list_for_each ( iter, &cl->depletedq )
+        {
+            svc = list_entry(iter, struct rt_unit, depletedq_elem);
+            rt_dump_unit(ops, svc);
+        }
+
+        printk("Replenishment Events info:\n");
+        for ( node = rb_first(&cl->replq); node; node = rb_next(node) )
+        {
+            svc = replq_elem(node);
+            rt_dump_unit(ops, svc);
+        }
+
+        spin_unlock(&cl->lock);
     }
 
     printk("Domain info:\n");
@@ -415,13 +538,17 @@ rt_dump(const struct scheduler *ops)
 
         for_each_sched_unit ( sdom->dom, unit )
         {
+            spinlock_t *lock = unit_schedule_lock(unit);
+
             svc = rt_unit(unit);
             rt_dump_unit(ops, svc);
+
+            unit_schedule_unlock(lock, unit);
         }
     }
 
  out:
-    spin_unlock_irqrestore(&prv->lock, flags);
+    read_unlock_irqrestore(&prv->lock, flags);
 }
 
 /*
@@ -488,56 +615,66 @@ rt_update_deadline(s_time_t now, struct rt_unit *svc)
  * are dealing with).
  */
 static inline bool
-deadline_queue_remove(struct list_head *queue, struct list_head *elem)
+deadline_queue_remove(struct rb_root *queue, struct rb_node *elem)
 {
-    bool first = false;
-
-    if ( queue->next != elem )
-        first = true;
+    bool first = rb_first(queue) == elem;
 
-    list_del_init(elem);
-    return !first;
+    rb_erase(elem, queue);
+    RB_CLEAR_NODE(elem);
+    return first;
 }
 
 static inline bool
-deadline_queue_insert(struct rt_unit * (*qelem)(struct list_head *),
-                      struct rt_unit *svc, struct list_head *elem,
-                      struct list_head *queue)
+deadline_queue_insert(struct rt_unit * (*qelem)(struct rb_node *),
+                      s_time_t (*compare)(const struct rt_unit *,
+                                          const struct rt_unit *),
+                      struct rt_unit *svc, struct rb_node *elem,
+                      struct rb_root *queue)
 {
-    struct list_head *iter;
+    struct rb_node **node = &queue->rb_node, *parent = NULL;
     bool first = true;
 
-    list_for_each ( iter, queue )
+    /* Units with the same priority go after the ones already there. */
+    while ( *node )
     {
-        const struct rt_unit * iter_svc = (*qelem)(iter);
-        if ( compare_unit_priority(svc, iter_svc) > 0 )
-            break;
-        first = false;
+        parent = *node;
+        if ( (*compare)(svc, (*qelem)(parent)) > 0 )
+            node = &parent->rb_left;
+        else
+        {
+            node = &parent->rb_right;
+            first = false;
+        }
     }
-    list_add_tail(elem, iter);
+    rb_link_node(elem, parent, node);
+    rb_insert_color(elem, queue);
     return first;
 }
 #define deadline_runq_insert(...) \
-  deadline_queue_insert(&q_elem, ##__VA_ARGS__)
+  deadline_queue_insert(&q_elem, &compare_unit_priority, ##__VA_ARGS__)
 #define deadline_replq_insert(...) \
-  deadline_queue_insert(&replq_elem, ##__VA_ARGS__)
+  deadline_queue_insert(&replq_elem, &compare_unit_deadline, ##__VA_ARGS__)
 
 static inline void
 q_remove(struct rt_unit *svc)
 {
     ASSERT( unit_on_q(svc) );
-    list_del_init(&svc->q_elem);
+
+    if ( unit_on_runq(svc) )
+        deadline_queue_remove(&rt_unit_cluster(svc)->runq, &svc->q_elem);
+    else
+        list_del_init(&svc->depletedq_elem);
 }
 
 static inline void
 replq_remove(const struct scheduler *ops, struct rt_unit *svc)
 {
-    struct rt_private *prv = rt_priv(ops);
-    struct list_head *replq = rt_replq(ops);
+    struct rt_cluster *cl = rt_unit_cluster(svc);
+    struct rb_node *next;
 
     ASSERT( unit_on_replq(svc) );
 
-    if ( deadline_queue_remove(replq, &svc->replq_elem) )
+    if ( deadline_queue_remove(&cl->replq, &svc->replq_elem) )
     {
         /*
          * The replenishment timer needs to be set to fire when a
@@ -545,13 +682,11 @@ replq_remove(const struct scheduler *ops, struct rt_unit *svc)
          * queue is due. If it is such unit that we just removed, we may
          * need to reprogram the timer.
          */
-        if ( !list_empty(replq) )
-        {
-            const struct rt_unit *svc_next = replq_elem(replq->next);
-            set_timer(&prv->repl_timer, svc_next->cur_deadline);
-        }
+        next = rb_first(&cl->replq);
+        if ( next )
+            set_timer(&cl->repl_timer, replq_elem(next)->cur_deadline);
         else
-            stop_timer(&prv->repl_timer);
+            stop_timer(&cl->repl_timer);
     }
 }
 
@@ -563,26 +698,24 @@ replq_remove(const struct scheduler *ops, struct rt_unit *svc)
 static void
 runq_insert(const struct scheduler *ops, struct rt_unit *svc)
 {
-    struct rt_private *prv = rt_priv(ops);
-    struct list_head *runq = rt_runq(ops);
+    struct rt_cluster *cl = rt_unit_cluster(svc);
 
-    ASSERT( spin_is_locked(&prv->lock) );
+    ASSERT( spin_is_locked(&cl->lock) );
     ASSERT( !unit_on_q(svc) );
     ASSERT( unit_on_replq(svc) );
 
     /* add svc to runq if svc still has budget or its extratime is set */
     if ( svc->cur_budget > 0 ||
          has_extratime(svc) )
-        deadline_runq_insert(svc, &svc->q_elem, runq);
+        deadline_runq_insert(svc, &svc->q_elem, &cl->runq);
     else
-        list_add(&svc->q_elem, &prv->depletedq);
+        list_add(&svc->depletedq_elem, &cl->depletedq);
 }
 
 static void
 replq_insert(const struct scheduler *ops, struct rt_unit *svc)
 {
-    struct list_head *replq = rt_replq(ops);
-    struct rt_private *prv = rt_priv(ops);
+    struct rt_cluster *cl = rt_unit_cluster(svc);
 
     ASSERT( !unit_on_replq(svc) );
 
@@ -590,8 +723,8 @@ replq_insert(const struct scheduler *ops, struct rt_unit *svc)
      * The timer may be re-programmed if svc is inserted
      * at the front of the event list.
      */
-    if ( deadline_replq_insert(svc, &svc->replq_elem, replq) )
-        set_timer(&prv->repl_timer, svc->cur_deadline);
+    if ( deadline_replq_insert(svc, &svc->replq_elem, &cl->replq) )
+        set_timer(&cl->repl_timer, svc->cur_deadline);
 }
 
 /*
@@ -603,7 +736,7 @@ replq_insert(const struct scheduler *ops, struct rt_unit *svc)
 static void
 replq_reinsert(const struct scheduler *ops, struct rt_unit *svc)
 {
-    struct list_head *replq = rt_replq(ops);
+    struct rt_cluster *cl = rt_unit_cluster(svc);
     const struct rt_unit *rearm_svc = svc;
     bool rearm = false;
 
@@ -618,17 +751,17 @@ replq_reinsert(const struct scheduler *ops, struct rt_unit *svc)
      * We may also need to re-program, if svc has been put at the front
      * of the replenishment queue when being re-inserted.
      */
-    if ( deadline_queue_remove(replq, &svc->replq_elem) )
+    if ( deadline_queue_remove(&cl->replq, &svc->replq_elem) )
     {
-        deadline_replq_insert(svc, &svc->replq_elem, replq);
-        rearm_svc = replq_elem(replq->next);
+        deadline_replq_insert(svc, &svc->replq_elem, &cl->replq);
+        rearm_svc = replq_elem(rb_first(&cl->replq));
         rearm = true;
     }
     else
-        rearm = deadline_replq_insert(svc, &svc->replq_elem, replq);
+        rearm = deadline_replq_insert(svc, &svc->replq_elem, &cl->replq);
 
     if ( rearm )
-        set_timer(&rt_priv(ops)->repl_timer, rearm_svc->cur_deadline);
+        set_timer(&cl->repl_timer, rearm_svc->cur_deadline);
 }
 
 /*
@@ -685,11 +818,9 @@ rt_init(struct scheduler *ops)
     if ( prv == NULL )
         goto err;
 
-    spin_lock_init(&prv->lock);
+    rwlock_init(&prv->lock);
     INIT_LIST_HEAD(&prv->sdom);
-    INIT_LIST_HEAD(&prv->runq);
-    INIT_LIST_HEAD(&prv->depletedq);
-    INIT_LIST_HEAD(&prv->replq);
+    INIT_LIST_HEAD(&prv->clusters);
 
     ops->sched_data = prv;
     rc = 0;
@@ -706,22 +837,169 @@ rt_deinit(struct scheduler *ops)
 {
     struct rt_private *prv = rt_priv(ops);
 
-    ASSERT(prv->repl_timer.status == TIMER_STATUS_invalid ||
-           prv->repl_timer.status == TIMER_STATUS_killed);
+    ASSERT(list_empty(&prv->clusters));
 
     ops->sched_data = NULL;
     xfree(prv);
 }
 
+static inline bool same_node(unsigned int cpua, unsigned int cpub)
+{
+    return cpu_to_node(cpua) == cpu_to_node(cpub);
+}
+
+static inline bool same_socket(unsigned int cpua, unsigned int cpub)
+{
+    return cpu_to_socket(cpua) == cpu_to_socket(cpub);
+}
+
+static inline bool same_core(unsigned int cpua, unsigned int cpub)
+{
+    return same_socket(cpua, cpub) &&
+           cpu_to_core(cpua) == cpu_to_core(cpub);
+}
+
+static bool
+cpu_cluster_match(const struct rt_cluster *cl, unsigned int cpu)
+{
+    unsigned int peer_cpu = cl->pick_bias;
+
+    BUG_ON(cpu_to_socket(peer_cpu) == XEN_INVALID_SOCKET_ID);
+
+    /* OPT_CLUSTER_CPU will never find an existing cluster. */
+    return opt_cluster == OPT_CLUSTER_ALL ||
+           (opt_cluster == OPT_CLUSTER_CORE && same_core(peer_cpu, cpu)) ||
+           (opt_cluster == OPT_CLUSTER_SOCKET && same_socket(peer_cpu, cpu)) ||
+           (opt_cluster == OPT_CLUSTER_NODE && same_node(peer_cpu, cpu));
+}
+
+static struct rt_cluster *
+cpu_add_to_cluster(const struct scheduler *ops, unsigned int cpu)
+{
+    struct rt_private *prv = rt_priv(ops);
+    struct rt_cluster *cl, *cl_new;
+    struct list_head *cl_ins;
+    unsigned long flags;
+    unsigned int id = 0;
+
+    /* Prealloc in case we need it - not allowed with interrupts off. */
+    cl_new = xzalloc(struct rt_cluster);
+
+    write_lock_irqsave(&prv->lock, flags);
+
+    /* Look for the cluster of cpu, and for the first unused id. */
+    cl_ins = &prv->clusters;
+    list_for_each_entry ( cl, &prv->clusters, cluster_elem )
+    {
+        if ( cpu_cluster_match(cl, cpu) )
+            goto out;
+
+        if ( cl->id == id )
+        {
+            id++;
+            cl_ins = &cl->cluster_elem;
+        }
+    }
+
+    if ( !cl_new )
+    {
+        cl = ERR_PTR(-ENOMEM);
+        goto out_unlock;
+    }
+    cl = cl_new;
+    cl_new = NULL;
+
+    spin_lock_init(&cl->lock);
+    cl->ops = ops;
+    cl->id = id;
+    cl->pick_bias = cpu;
+    cl->runq = RB_ROOT;
+    INIT_LIST_HEAD(&cl->depletedq);
+    cl->replq = RB_ROOT;
+    list_add(&cl->cluster_elem, cl_ins);
+
+ out:
+    cl->refcnt++;
+
+ out_unlock:
+    write_unlock_irqrestore(&prv->lock, flags);
+
+    xfree(cl_new);
+
+    return cl;
+}
+
+static void *cf_check
+rt_alloc_pdata(const struct scheduler *ops, int cpu)
+{
+    struct rt_pcpu *spc;
+    struct rt_cluster *cl;
+
+    spc = xzalloc(struct rt_pcpu);
+    if ( spc == NULL )
+        return ERR_PTR(-ENOMEM);
+
+    cl = cpu_add_to_cluster(ops, cpu);
+    if ( IS_ERR(cl) )
+    {
+        xfree(spc);
+        return cl;
+    }
+
+    spc->cl = cl;
+
+    return spc;
+}
+
+static void cf_check
+rt_free_pdata(const struct scheduler *ops, void *pcpu, int cpu)
+{
+    struct rt_private *prv = rt_priv(ops);
+    struct rt_pcpu *spc = pcpu;
+    struct rt_cluster *cl;
+    unsigned long flags;
+
+    if ( !spc )
+        return;
+
+    write_lock_irqsave(&prv->lock, flags);
+
+    cl = spc->cl;
+    ASSERT(cl && cl->refcnt);
+    ASSERT(!cpumask_test_cpu(cpu, &cl->active));
+
+    cl->refcnt--;
+    if ( !cl->refcnt )
+        list_del(&cl->cluster_elem);
+    else
+        cl = NULL;
+
+    write_unlock_irqrestore(&prv->lock, flags);
+
+    if ( cl )
+    {
+        ASSERT(RB_EMPTY_ROOT(&cl->runq) && RB_EMPTY_ROOT(&cl->replq) &&
+               list_empty(&cl->depletedq));
+        ASSERT(cl->repl_timer.status == TIMER_STATUS_invalid ||
+               cl->repl_timer.status == TIMER_STATUS_killed);
+        xfree(cl);
+    }
+    xfree(spc);
+}
+
 /* Change the scheduler of cpu to us (RTDS). */
 static spinlock_t *cf_check
 rt_switch_sched(struct scheduler *new_ops, unsigned int cpu,
                 void *pdata, void *vdata)
 {
     struct rt_private *prv = rt_priv(new_ops);
+    struct rt_pcpu *spc = pdata;
     struct rt_unit *svc = vdata;
+    struct rt_cluster *cl;
 
-    ASSERT(!pdata && svc && is_idle_unit(svc->unit));
+    ASSERT(spc && svc && is_idle_unit(svc->unit));
+
+    cl = spc->cl;
 
     /*
      * We are holding the runqueue lock already (it's been taken in
@@ -729,45 +1007,56 @@ rt_switch_sched(struct scheduler *new_ops, unsigned int cpu,
      * another scheduler, but that is how things need to be, for
      * preventing races.
      */
-    ASSERT(get_sched_res(cpu)->schedule_lock != &prv->lock);
+    ASSERT(get_sched_res(cpu)->schedule_lock != &cl->lock);
+    ASSERT(!local_irq_is_enabled());
+
+    write_lock(&prv->lock);
+    spin_lock(&cl->lock);
 
     /*
      * If we are the absolute first cpu being switched toward this
-     * scheduler (in which case we'll see TIMER_STATUS_invalid), or the
-     * first one that is added back to the cpupool that had all its cpus
+     * cluster (in which case we'll see TIMER_STATUS_invalid), or the
+     * first one that is added back to a cluster that had all its cpus
      * removed (in which case we'll see TIMER_STATUS_killed), it's our
      * job to (re)initialize the timer.
      */
-    if ( prv->repl_timer.status == TIMER_STATUS_invalid ||
-         prv->repl_timer.status == TIMER_STATUS_killed )
+    if ( cl->repl_timer.status == TIMER_STATUS_invalid ||
+         cl->repl_timer.status == TIMER_STATUS_killed )
     {
-        init_timer(&prv->repl_timer, repl_timer_handler, (void *)new_ops, cpu);
-        dprintk(XENLOG_DEBUG, "RTDS: timer initialized on cpu %u\n", cpu);
+        init_timer(&cl->repl_timer, repl_timer_handler, cl, cpu);
+        dprintk(XENLOG_DEBUG, "RTDS: cluster %u timer initialized on cpu %u\n",
+                cl->id, cpu);
     }
 
+    __cpumask_set_cpu(cpu, &cl->active);
+    cpumask_set_cpu(cpu, &prv->idle);
+
     sched_idle_unit(cpu)->priv = vdata;
 
-    return &prv->lock;
+    spin_unlock(&cl->lock);
+    write_unlock(&prv->lock);
+
+    return &cl->lock;
 }
 
-static void move_repl_timer(struct rt_private *prv, unsigned int old_cpu)
+static void move_repl_timer(struct rt_cluster *cl, unsigned int old_cpu)
 {
-    cpumask_t *online = get_sched_res(old_cpu)->cpupool->res_valid;
-    unsigned int new_cpu = cpumask_cycle(old_cpu, online);
+    unsigned int new_cpu = cpumask_cycle(old_cpu, &cl->active);
 
     /*
      * Make sure the timer run on one of the cpus that are still available
-     * to this scheduler. If there aren't any left, it means it's the time
+     * to this cluster. If there aren't any left, it means it's the time
      * to just kill it.
      */
     if ( new_cpu >= nr_cpu_ids )
     {
-        kill_timer(&prv->repl_timer);
-        dprintk(XENLOG_DEBUG, "RTDS: timer killed on cpu %d\n", old_cpu);
+        kill_timer(&cl->repl_timer);
+        dprintk(XENLOG_DEBUG, "RTDS: cluster %u timer killed on cpu %d\n",
+                cl->id, old_cpu);
     }
     else
     {
-        migrate_timer(&prv->repl_timer, new_cpu);
+        migrate_timer(&cl->repl_timer, new_cpu);
     }
 }
 
@@ -776,13 +1065,26 @@ rt_deinit_pdata(const struct scheduler *ops, void *pcpu, int cpu)
 {
     unsigned long flags;
     struct rt_private *prv = rt_priv(ops);
+    struct rt_pcpu *spc = pcpu;
+    struct rt_cluster *cl;
+
+    ASSERT(spc && spc->cl);
+
+    write_lock_irqsave(&prv->lock, flags);
+
+    cl = spc->cl;
+    spin_lock(&cl->lock);
 
-    spin_lock_irqsave(&prv->lock, flags);
+    __cpumask_clear_cpu(cpu, &cl->active);
+    cpumask_clear_cpu(cpu, &cl->tickled);
+    cpumask_clear_cpu(cpu, &prv->idle);
 
-    if ( prv->repl_timer.cpu == cpu )
-        move_repl_timer(prv, cpu);
+    if ( cl->repl_timer.cpu == cpu || cpumask_empty(&cl->active) )
+        move_repl_timer(cl, cpu);
 
-    spin_unlock_irqrestore(&prv->lock, flags);
+    spin_unlock(&cl->lock);
+
+    write_unlock_irqrestore(&prv->lock, flags);
 }
 
 static void cf_check
@@ -790,17 +1092,24 @@ rt_move_timers(const struct scheduler *ops, struct sched_resource *sr)
 {
     unsigned long flags;
     struct rt_private *prv = rt_priv(ops);
+    struct rt_cluster *cl;
     unsigned int old_cpu;
 
-    spin_lock_irqsave(&prv->lock, flags);
+    read_lock_irqsave(&prv->lock, flags);
+
+    /* Bring back the timer of the cluster, if it is off its cpus. */
+    cl = rt_cpu_cluster(sr->master_cpu);
+    spin_lock(&cl->lock);
 
-    old_cpu = prv->repl_timer.cpu;
-    if ( prv->repl_timer.status != TIMER_STATUS_invalid &&
-         prv->repl_timer.status != TIMER_STATUS_killed &&
-         !cpumask_test_cpu(old_cpu, sr->cpupool->res_valid) )
-        move_repl_timer(prv, old_cpu);
+    old_cpu = cl->repl_timer.cpu;
+    if ( cl->repl_timer.status != TIMER_STATUS_invalid &&
+         cl->repl_timer.status != TIMER_STATUS_killed &&
+         !cpumask_test_cpu(old_cpu, &cl->active) )
+        migrate_timer(&cl->repl_timer, sr->master_cpu);
 
-    spin_unlock_irqrestore(&prv->lock, flags);
+    spin_unlock(&cl->lock);
+
+    read_unlock_irqrestore(&prv->lock, flags);
 }
 
 static void *cf_check
@@ -817,10 +1126,10 @@ rt_alloc_domdata(const struct scheduler *ops, struct domain *dom)
     INIT_LIST_HEAD(&sdom->sdom_elem);
     sdom->dom = dom;
 
-    /* spinlock here to insert the dom */
-    spin_lock_irqsave(&prv->lock, flags);
+    /* lock here to insert the dom */
+    write_lock_irqsave(&prv->lock, flags);
     list_add_tail(&sdom->sdom_elem, &(prv->sdom));
-    spin_unlock_irqrestore(&prv->lock, flags);
+    write_unlock_irqrestore(&prv->lock, flags);
 
     return sdom;
 }
@@ -835,9 +1144,9 @@ rt_free_domdata(const struct scheduler *ops, void *data)
     {
         unsigned long flags;
 
-        spin_lock_irqsave(&prv->lock, flags);
+        write_lock_irqsave(&prv->lock, flags);
         list_del_init(&sdom->sdom_elem);
-        spin_unlock_irqrestore(&prv->lock, flags);
+        write_unlock_irqrestore(&prv->lock, flags);
 
         xfree(sdom);
     }
@@ -853,8 +1162,9 @@ rt_alloc_udata(const struct scheduler *ops, struct sched_unit *unit, void *dd)
     if ( svc == NULL )
         return NULL;
 
-    INIT_LIST_HEAD(&svc->q_elem);
-    INIT_LIST_HEAD(&svc->replq_elem);
+    RB_CLEAR_NODE(&svc->q_elem);
+    INIT_LIST_HEAD(&svc->depletedq_elem);
+    RB_CLEAR_NODE(&svc->replq_elem);
     svc->flags = 0U;
     svc->sdom = dd;
     svc->unit = unit;
@@ -1012,16 +1322,15 @@ burn_budget(const struct scheduler *ops, struct rt_unit *svc, s_time_t now)
  * lock is grabbed before calling this function
  */
 static struct rt_unit *
-runq_pick(const struct scheduler *ops, const cpumask_t *mask, unsigned int cpu)
+runq_pick(struct rt_cluster *cl, const cpumask_t *mask, unsigned int cpu)
 {
-    struct list_head *runq = rt_runq(ops);
-    struct list_head *iter;
+    struct rb_node *iter;
     struct rt_unit *svc = NULL;
     struct rt_unit *iter_svc = NULL;
     cpumask_t *cpu_common = cpumask_scratch_cpu(cpu);
     const cpumask_t *online;
 
-    list_for_each ( iter, runq )
+    for ( iter = rb_first(&cl->runq); iter; iter = rb_next(iter) )
     {
         iter_svc = q_elem(iter);
 
@@ -1056,6 +1365,78 @@ runq_pick(const struct scheduler *ops, const cpumask_t *mask, unsigned int cpu)
     return svc;
 }
 
+/*
+ * Pull to cpu, which has nothing to run, the highest priority unit that can
+ * run there from the runqueues of the other clusters. Clusters whose lock
+ * is taken are skipped. Returns whether an unit was put on the runqueue of
+ * the cluster of cpu.
+ * The lock of the cluster of cpu is grabbed before calling this function
+ */
+static bool
+runq_pull(const struct scheduler *ops, struct rt_cluster *cl, unsigned int cpu)
+{
+    struct rt_private *prv = rt_priv(ops);
+    struct rt_cluster *iter_cl, *from = NULL;
+    struct rt_unit *svc = NULL;
+    struct rb_node *iter;
+
+    if ( !read_trylock(&prv->lock) )
+        return false;
+
+    list_for_each_entry ( iter_cl, &prv->clusters, cluster_elem )
+    {
+        struct rt_unit *iter_svc = NULL;
+
+        if ( iter_cl == cl || RB_EMPTY_ROOT(&iter_cl->runq) )
+            continue;
+
+        if ( !spin_trylock(&iter_cl->lock) )
+        {
+            SCHED_STAT_CRANK(rtds_pull_trylock_failed);
+            continue;
+        }
+
+        for ( iter = rb_first(&iter_cl->runq); iter; iter = rb_next(iter) )
+        {
+            iter_svc = q_elem(iter);
+
+            if ( cpumask_test_cpu(cpu, iter_svc->unit->cpu_hard_affinity) &&
+                 unit_runnable(iter_svc->unit) )
+                break;
+            iter_svc = NULL;
+        }
+
+        /* Keep the lock of the cluster with the best candidate only. */
+        if ( iter_svc &&
+             (svc == NULL || compare_unit_priority(iter_svc, svc) > 0) )
+        {
+            if ( from )
+                spin_unlock(&from->lock);
+            from = iter_cl;
+            svc = iter_svc;
+        }
+        else
+            spin_unlock(&iter_cl->lock);
+    }
+
+    if ( svc )
+    {
+        SCHED_STAT_CRANK(rtds_pull);
+
+        q_remove(svc);
+        replq_remove(ops, svc);
+        sched_set_res(svc->unit, get_sched_res(cpu));
+        replq_insert(ops, svc);
+        runq_insert(ops, svc);
+
+        spin_unlock(&from->lock);
+    }
+
+    read_unlock(&prv->lock);
+
+    return svc != NULL;
+}
+
 /*
  * schedule function for rt scheduler.
  * The lock is already grabbed in schedule.c, no need to lock here
@@ -1067,9 +1448,10 @@ rt_schedule(const struct scheduler *ops, struct sched_unit *currunit,
     const unsigned int cur_cpu = smp_processor_id();
     const unsigned int sched_cpu = sched_get_resource_cpu(cur_cpu);
     struct rt_private *prv = rt_priv(ops);
+    struct rt_cluster *cl = rt_cpu_cluster(sched_cpu);
     struct rt_unit *const scurr = rt_unit(currunit);
     struct rt_unit *snext = NULL;
-    bool migrated = false;
+    bool migrated = false, pulled = false;
 
     if ( unlikely(tb_init_done) )
     {
@@ -1079,7 +1461,7 @@ rt_schedule(const struct scheduler *ops, struct sched_unit *currunit,
         } d = {
             .cpu     = cur_cpu,
             .tasklet = tasklet_work_scheduled,
-            .tickled = cpumask_test_cpu(sched_cpu, &prv->tickled),
+            .tickled = cpumask_test_cpu(sched_cpu, &cl->tickled),
             .idle    = is_idle_unit(currunit),
         };
 
@@ -1087,7 +1469,7 @@ rt_schedule(const struct scheduler *ops, struct sched_unit *currunit,
     }
 
     /* clear ticked bit now that we've been scheduled */
-    cpumask_clear_cpu(sched_cpu, &prv->tickled);
+    cpumask_clear_cpu(sched_cpu, &cl->tickled);
 
     /* burn_budget would return for IDLE UNIT */
     burn_budget(ops, scurr, now);
@@ -1101,10 +1483,24 @@ rt_schedule(const struct scheduler *ops, struct sched_unit *currunit,
     {
         while ( true )
         {
-            snext = runq_pick(ops, cpumask_of(sched_cpu), cur_cpu);
+            snext = runq_pick(cl, cpumask_of(sched_cpu), cur_cpu);
 
             if ( snext == NULL )
             {
+                /*
+                 * Unless scurr can go on running, look for work in the
+                 * other clusters before going idle.
+                 */
+                if ( !pulled &&
+                     (is_idle_unit(currunit) ||
+                      !unit_runnable_state(currunit) ||
+                      scurr->cur_budget <= 0) )
+                {
+                    pulled = true;
+                    if ( runq_pull(ops, cl, sched_cpu) )
+                        continue;
+                }
+
                 snext = rt_unit(sched_idle_unit(sched_cpu));
                 break;
             }
@@ -1146,6 +1542,16 @@ rt_schedule(const struct scheduler *ops, struct sched_unit *currunit,
         /* Invoke the scheduler next time. */
         currunit->next_time = snext->cur_budget;
     }
+
+    /* Tell the other clusters whether we are up for pulling work. */
+    if ( is_idle_unit(snext->unit) && !tasklet_work_scheduled )
+    {
+        if ( !cpumask_test_cpu(sched_cpu, &prv->idle) )
+            cpumask_set_cpu(sched_cpu, &prv->idle);
+    }
+    else if ( cpumask_test_cpu(sched_cpu, &prv->idle) )
+        cpumask_clear_cpu(sched_cpu, &prv->idle);
+
     currunit->next_task = snext->unit;
     snext->unit->migrated = migrated;
 }
@@ -1178,10 +1584,12 @@ rt_unit_sleep(const struct scheduler *ops, struct sched_unit *unit)
  * possibly kicking out the unit running there
  * Called by wake() and context_saved()
  * We have a running candidate here, the kick logic is:
- * Among all the cpus that are within the cpu affinity
+ * Among all the cpus of the cluster that are within the cpu affinity
  * 1) if there are any idle CPUs, kick one.
       For cache benefit, we check new->cpu as first
- * 2) now all pcpus are busy;
+ * 2) if there are idle CPUs within the affinity in other clusters,
+ *    kick one, for it to pull new;
+ * 3) now all pcpus are busy;
  *    among all the running units, pick lowest priority one
  *    if snext has higher priority, kick it.
  *
@@ -1195,6 +1603,7 @@ static void
 runq_tickle(const struct scheduler *ops, const struct rt_unit *new)
 {
     struct rt_private *prv = rt_priv(ops);
+    struct rt_cluster *cl;
     const struct rt_unit *latest_deadline_unit = NULL; /* lowest priority */
     const struct rt_unit *iter_svc;
     const struct sched_unit *iter_unit;
@@ -1205,9 +1614,11 @@ runq_tickle(const struct scheduler *ops, const struct rt_unit *new)
     if ( new == NULL || is_idle_unit(new->unit) )
         return;
 
+    cl = rt_unit_cluster(new);
     online = cpupool_domain_master_cpumask(new->unit->domain);
     cpumask_and(not_tickled, online, new->unit->cpu_hard_affinity);
-    cpumask_andnot(not_tickled, not_tickled, &prv->tickled);
+    cpumask_and(not_tickled, not_tickled, &cl->active);
+    cpumask_andnot(not_tickled, not_tickled, &cl->tickled);
 
     /*
      * 1) If there are any idle CPUs, kick one.
@@ -1233,7 +1644,24 @@ runq_tickle(const struct scheduler *ops, const struct rt_unit *new)
         cpu = cpumask_cycle(cpu, not_tickled);
     }
 
-    /* 2) candicate has higher priority, kick out lowest priority unit */
+    /*
+     * 2) If idle CPUs of other clusters can run the candidate, kick one.
+     *    Clearing its idle bit makes sure no one else picks it as well.
+     */
+    cpumask_and(not_tickled, online, new->unit->cpu_hard_affinity);
+    cpumask_and(not_tickled, not_tickled, &prv->idle);
+    cpumask_andnot(not_tickled, not_tickled, &cl->active);
+    for_each_cpu ( cpu, not_tickled )
+    {
+        if ( cpumask_test_and_clear_cpu(cpu, &prv->idle) )
+        {
+            SCHED_STAT_CRANK(rtds_push);
+            cpu_to_tickle = cpu;
+            goto out;
+        }
+    }
+
+    /* 3) candicate has higher priority, kick out lowest priority unit */
     if ( latest_deadline_unit != NULL &&
          compare_unit_priority(latest_deadline_unit, new) < 0 )
     {
@@ -1257,7 +1685,8 @@ runq_tickle(const struct scheduler *ops, const struct rt_unit *new)
         trace_time(TRC_RTDS_TICKLE, sizeof(d), &d);
     }
 
-    cpumask_set_cpu(cpu_to_tickle, &prv->tickled);
+    if ( cpumask_test_cpu(cpu_to_tickle, &cl->active) )
+        cpumask_set_cpu(cpu_to_tickle, &cl->tickled);
     cpu_raise_softirq(cpu_to_tickle, SCHEDULE_SOFTIRQ);
     return;
 }
@@ -1371,9 +1800,9 @@ rt_dom_cntl(
     struct domain *d,
     struct xen_domctl_scheduler_op *op)
 {
-    struct rt_private *prv = rt_priv(ops);
     struct rt_unit *svc;
     const struct sched_unit *unit;
+    spinlock_t *lock;
     unsigned long flags;
     int rc = 0;
     struct xen_domctl_schedparam_vcpu local_sched;
@@ -1393,14 +1822,14 @@ rt_dom_cntl(
             rc = -EINVAL;
             break;
         }
-        spin_lock_irqsave(&prv->lock, flags);
         for_each_sched_unit ( d, unit )
         {
+            lock = unit_schedule_lock_irqsave(unit, &flags);
             svc = rt_unit(unit);
             svc->period = MICROSECS(op->u.rtds.period); /* transfer to nanosec */
             svc->budget = MICROSECS(op->u.rtds.budget);
+            unit_schedule_unlock_irqrestore(lock, flags, unit);
         }
-        spin_unlock_irqrestore(&prv->lock, flags);
         break;
     case XEN_DOMCTL_SCHEDOP_getvcpuinfo:
     case XEN_DOMCTL_SCHEDOP_putvcpuinfo:
@@ -1421,15 +1850,16 @@ rt_dom_cntl(
 
             if ( op->cmd == XEN_DOMCTL_SCHEDOP_getvcpuinfo )
             {
-                spin_lock_irqsave(&prv->lock, flags);
-                svc = rt_unit(d->vcpu[local_sched.vcpuid]->sched_unit);
+                unit = d->vcpu[local_sched.vcpuid]->sched_unit;
+                lock = unit_schedule_lock_irqsave(unit, &flags);
+                svc = rt_unit(unit);
                 local_sched.u.rtds.budget = svc->budget / MICROSECS(1);
                 local_sched.u.rtds.period = svc->period / MICROSECS(1);
                 if ( has_extratime(svc) )
                     local_sched.u.rtds.flags |= XEN_DOMCTL_SCHEDRT_extra;
                 else
                     local_sched.u.rtds.flags &= ~XEN_DOMCTL_SCHEDRT_extra;
-                spin_unlock_irqrestore(&prv->lock, flags);
+                unit_schedule_unlock_irqrestore(lock, flags, unit);
 
                 if ( copy_to_guest_offset(op->u.v.vcpus, index,
                                           &local_sched, 1) )
@@ -1449,15 +1879,16 @@ rt_dom_cntl(
                     break;
                 }
 
-                spin_lock_irqsave(&prv->lock, flags);
-                svc = rt_unit(d->vcpu[local_sched.vcpuid]->sched_unit);
+                unit = d->vcpu[local_sched.vcpuid]->sched_unit;
+                lock = unit_schedule_lock_irqsave(unit, &flags);
+                svc = rt_unit(unit);
                 svc->period = period;
                 svc->budget = budget;
                 if ( local_sched.u.rtds.flags & XEN_DOMCTL_SCHEDRT_extra )
                     __set_bit(__RTDS_extratime, &svc->flags);
                 else
                     __clear_bit(__RTDS_extratime, &svc->flags);
-                spin_unlock_irqrestore(&prv->lock, flags);
+                unit_schedule_unlock_irqrestore(lock, flags, unit);
             }
             /* Process a most 64 vCPUs without checking for preemptions. */
             if ( (++index > 63) && hypercall_preempt_check() )
@@ -1472,6 +1903,42 @@ rt_dom_cntl(
     return rc;
 }
 
+/*
+ * Move an unit which is not running to new_cpu, and to its cluster.
+ * The locks of both the old and the new cluster are grabbed before
+ * calling this function
+ */
+static void cf_check
+rt_unit_migrate(const struct scheduler *ops, struct sched_unit *unit,
+                unsigned int new_cpu)
+{
+    struct rt_unit *svc = rt_unit(unit);
+    bool on_q, on_replq;
+
+    if ( rt_cpu_cluster(new_cpu) == rt_unit_cluster(svc) )
+    {
+        sched_set_res(unit, get_sched_res(new_cpu));
+        return;
+    }
+
+    on_q = unit_on_q(svc);
+    if ( on_q )
+        q_remove(svc);
+    on_replq = unit_on_replq(svc);
+    if ( on_replq )
+        replq_remove(ops, svc);
+
+    sched_set_res(unit, get_sched_res(new_cpu));
+
+    if ( on_replq )
+        replq_insert(ops, svc);
+    if ( on_q )
+    {
+        runq_insert(ops, svc);
+        runq_tickle(ops, svc);
+    }
+}
+
 /*
  * The replenishment timer handler picks units
  * from the replq and does the actual replenishment.
@@ -1479,34 +1946,32 @@ rt_dom_cntl(
 static void cf_check repl_timer_handler(void *data)
 {
     s_time_t now;
-    const struct scheduler *ops = data;
-    struct rt_private *prv = rt_priv(ops);
-    struct list_head *replq = rt_replq(ops);
-    struct list_head *runq = rt_runq(ops);
-    struct list_head *iter, *tmp;
-    struct rt_unit *svc;
-    LIST_HEAD(tmp_replq);
+    struct rt_cluster *cl = data;
+    const struct scheduler *ops = cl->ops;
+    struct rb_node *iter;
+    struct rt_unit *svc, *next_on_runq;
+    struct rb_root tmp_replq = RB_ROOT;
 
-    spin_lock_irq(&prv->lock);
+    spin_lock_irq(&cl->lock);
 
     now = NOW();
 
     /*
      * Do the replenishment and move replenished units
-     * to the temporary list to tickle.
+     * to the temporary queue to tickle.
      * If svc is on run queue, we need to put it at
      * the correct place since its deadline changes.
      */
-    list_for_each_safe ( iter, tmp, replq )
+    while ( (iter = rb_first(&cl->replq)) != NULL )
     {
         svc = replq_elem(iter);
 
         if ( now < svc->cur_deadline )
             break;
 
-        list_del(&svc->replq_elem);
+        rb_erase(iter, &cl->replq);
         rt_update_deadline(now, svc);
-        list_add(&svc->replq_elem, &tmp_replq);
+        deadline_replq_insert(svc, iter, &tmp_replq);
 
         if ( unit_on_q(svc) )
         {
@@ -1516,21 +1981,20 @@ static void cf_check repl_timer_handler(void *data)
     }
 
     /*
-     * Iterate through the list of updated units.
+     * Iterate through the updated units.
      * If an updated unit is running, tickle the head of the
      * runqueue if it has a higher priority.
      * If an updated unit was depleted and on the runqueue, tickle it.
-     * Finally, reinsert the units back to replenishement events list.
+     * Finally, reinsert the units back to replenishement events queue.
      */
-    list_for_each_safe ( iter, tmp, &tmp_replq )
+    while ( (iter = rb_first(&tmp_replq)) != NULL )
     {
         svc = replq_elem(iter);
+        next_on_runq = runq_first(cl);
 
         if ( curr_on_cpu(sched_unit_master(svc->unit)) == svc->unit &&
-             !list_empty(runq) )
+             next_on_runq != NULL )
         {
-            struct rt_unit *next_on_runq = q_elem(runq->next);
-
             if ( compare_unit_priority(svc, next_on_runq) < 0 )
                 runq_tickle(ops, next_on_runq);
         }
@@ -1538,19 +2002,20 @@ static void cf_check repl_timer_handler(void *data)
                   unit_on_q(svc) )
             runq_tickle(ops, svc);
 
-        list_del(&svc->replq_elem);
-        deadline_replq_insert(svc, &svc->replq_elem, replq);
+        rb_erase(iter, &tmp_replq);
+        deadline_replq_insert(svc, iter, &cl->replq);
     }
 
     /*
-     * If there are units left in the replenishment event list,
+     * If there are units left in the replenishment event queue,
      * set the next replenishment to happen at the deadline of
      * the one in the front.
      */
-    if ( !list_empty(replq) )
-        set_timer(&prv->repl_timer, replq_elem(replq->next)->cur_deadline);
+    iter = rb_first(&cl->replq);
+    if ( iter != NULL )
+        set_timer(&cl->repl_timer, replq_elem(iter)->cur_deadline);
 
-    spin_unlock_irq(&prv->lock);
+    spin_unlock_irq(&cl->lock);
 }
 
 static const struct scheduler sched_rtds_def = {
@@ -1564,6 +2029,8 @@ static const struct scheduler sched_rtds_def = {
     .init           = rt_init,
     .deinit         = rt_deinit,
     .switch_sched   = rt_switch_sched,
+    .alloc_pdata    = rt_alloc_pdata,
+    .free_pdata     = rt_free_pdata,
     .deinit_pdata   = rt_deinit_pdata,
     .alloc_domdata  = rt_alloc_domdata,
     .free_domdata   = rt_free_domdata,
@@ -1575,6 +2042,7 @@ static const struct scheduler sched_rtds_def = {
     .adjust         = rt_dom_cntl,
 
     .pick_resource  = rt_res_pick,
+    .migrate        = rt_unit_migrate,
     .do_schedule    = rt_schedule,
     .sleep          = rt_unit_sleep,
     .wake           = rt_unit_wake,
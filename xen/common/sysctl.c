@@ -363,6 +363,47 @@ long do_sysctl(XEN_GUEST_HANDLE_PARAM(xen_sysctl_t) u_sysctl)
     }
     break;
 
+    case XEN_SYSCTL_scrubinfo:
+    {
+        unsigned int i, num_nodes = last_node(node_online_map) + 1;
+        struct xen_sysctl_scrubinfo *si = &op->u.scrubinfo;
+
+        if ( !guest_handle_is_null(si->scrubinfo) )
+        {
+            struct xen_sysctl_scrubnode scrubnode = { };
+
+            if ( num_nodes > si->num_nodes )
+                num_nodes = si->num_nodes;
+            for ( i = 0; i < num_nodes; ++i )
+            {
+                struct scrub_stats stats = { };
+
+                if ( node_online(i) )
+                    get_scrub_stats(i, &stats);
+
+                scrubnode.pending = stats.pending;
+                scrubnode.scrubbed = stats.scrubbed;
+                scrubnode.scrub_ns = stats.scrub_ns;
+                scrubnode.scrubbers = stats.scrubbers;
+
+                if ( copy_to_guest_offset(si->scrubinfo, i, &scrubnode, 1) )
+                {
+                    ret = -EFAULT;
+                    break;
+                }
+            }
+        }
+
+        if ( !ret && (si->num_nodes != num_nodes) )
+        {
+            si->num_nodes = num_nodes;
+            if ( __copy_field_to_guest(u_sysctl, op,
+                                       u.scrubinfo.num_nodes) )
+                ret = -EFAULT;
+        }
+    }
+    break;
+
     case XEN_SYSCTL_cputopoinfo:
     {
         unsigned int i, num_cpus;
@@ -29,12 +29,19 @@
 static unsigned int timer_slop __read_mostly = 50000; /* 50 us */
 integer_param("timer_slop", timer_slop);
 
+/* Keep timers due within the wheel horizon on a timer wheel. */
+static bool __ro_after_init opt_timer_wheel;
+boolean_param("timer_wheel", opt_timer_wheel);
+
 struct timers {
     spinlock_t     lock;
     struct timer **heap;
     struct timer  *list;
+    struct timer_wheel *wheel;
     struct timer  *running;
     struct list_head inactive;
+    /* Earliest deadline as of the last softirq, lowered by wheel additions. */
+    s_time_t       deadline;
 } __cacheline_aligned;
 
 static DEFINE_PER_CPU(struct timers, timers);
@@ -176,6 +183,186 @@ static int add_to_list(struct timer **pprev, struct timer *t)
 }
 
 
+/****************************************************************************
+ * TIMER WHEEL OPERATIONS.
+ *
+ * A hierarchical timer wheel, in ticks of the largest power of two
+ * nanoseconds not above timer_slop.  Level 0 has a slot per tick for the
+ * WHEEL_SLOTS ticks from the wheel clock on; each slot of the next level
+ * spans a whole round of the level below it.  Timers are added and removed
+ * in constant time, and are cascaded down a level as the wheel clock reaches
+ * the start of their slot, so they still expire at their precise time.
+ * Timers beyond the last level go to the heap.
+ */
+
+#define WHEEL_SLOT_BITS 6
+#define WHEEL_SLOTS     (1U << WHEEL_SLOT_BITS)
+#define WHEEL_LEVELS    4
+
+struct timer_wheel {
+    /* Tick of the current level 0 slot; all earlier ticks have run. */
+    uint64_t         clk;
+    /* Bitmaps of the non-empty slots of each level. */
+    uint64_t         pending[WHEEL_LEVELS];
+    struct list_head slots[WHEEL_LEVELS][WHEEL_SLOTS];
+};
+
+static unsigned int __ro_after_init wheel_shift;
+
+static uint64_t wheel_tick(s_time_t t)
+{
+    return t > 0 ? (uint64_t)t >> wheel_shift : 0;
+}
+
+/* Add @t to @w. Return FALSE if it is due beyond the wheel horizon. */
+static bool add_to_wheel(struct timer_wheel *w, struct timer *t)
+{
+    uint64_t tick = max(wheel_tick(t->expires), w->clk);
+    uint64_t delta = tick - w->clk;
+    unsigned int level = 0, slot;
+
+    BUILD_BUG_ON(WHEEL_LEVELS * WHEEL_SLOTS >
+                 1U << (8 * sizeof(t->wheel_slot)));
+    BUILD_BUG_ON(WHEEL_SLOTS > 8 * sizeof(w->pending[0]));
+
+    while ( delta >> (WHEEL_SLOT_BITS * (level + 1)) )
+        if ( ++level == WHEEL_LEVELS )
+            return false;
+
+    slot = (tick >> (WHEEL_SLOT_BITS * level)) & (WHEEL_SLOTS - 1);
+    t->wheel_slot = level * WHEEL_SLOTS + slot;
+    list_add_tail(&t->wheel_list, &w->slots[level][slot]);
+    w->pending[level] |= 1ULL << slot;
+
+    return true;
+}
+
+static void remove_from_wheel(struct timer_wheel *w, struct timer *t)
+{
+    unsigned int level = t->wheel_slot / WHEEL_SLOTS;
+    unsigned int slot = t->wheel_slot % WHEEL_SLOTS;
+
+    list_del(&t->wheel_list);
+    if ( list_empty(&w->slots[level][slot]) )
+        w->pending[level] &= ~(1ULL << slot);
+}
+
+/* Move the timers of the current slot of @level down the wheel. */
+static void cascade_wheel(struct timer_wheel *w, unsigned int level)
+{
+    unsigned int slot = (w->clk >> (WHEEL_SLOT_BITS * level)) &
+                        (WHEEL_SLOTS - 1);
+    struct timer *t, *tmp;
+    LIST_HEAD(list);
+
+    if ( !(w->pending[level] & (1ULL << slot)) )
+        return;
+
+    list_splice_init(&w->slots[level][slot], &list);
+    w->pending[level] &= ~(1ULL << slot);
+
+    list_for_each_entry_safe ( t, tmp, &list, wheel_list )
+        if ( !add_to_wheel(w, t) )
+            BUG();
+}
+
+/*
+ * Tick after the wheel clock which needs looking at, or @limit if earlier:
+ * the next non-empty level 0 slot of this round, else the start of the next
+ * round of the lowest level which may have timers to cascade.
+ */
+static uint64_t wheel_next_clk(const struct timer_wheel *w, uint64_t limit)
+{
+    unsigned int idx = w->clk & (WHEEL_SLOTS - 1), level, shift;
+    uint64_t later = w->pending[0] & ~((2ULL << idx) - 1), next;
+
+    if ( later )
+        next = w->clk - idx + ffs64(later) - 1;
+    else
+    {
+        for ( level = 0; level < WHEEL_LEVELS && !w->pending[level]; level++ )
+            continue;
+        if ( level == WHEEL_LEVELS )
+            return limit;
+
+        shift = WHEEL_SLOT_BITS * max(level, 1U);
+        next = ((w->clk >> shift) + 1) << shift;
+    }
+
+    return min(next, limit);
+}
+
+static void set_wheel_clk(struct timer_wheel *w, uint64_t clk)
+{
+    unsigned int level;
+
+    w->clk = clk;
+
+    for ( level = WHEEL_LEVELS - 1; level > 0; level-- )
+        if ( !(clk & ((1ULL << (WHEEL_SLOT_BITS * level)) - 1)) )
+            cascade_wheel(w, level);
+}
+
+/* Earliest time at which a timer of @w may expire. */
+static s_time_t wheel_deadline(const struct timer_wheel *w)
+{
+    s_time_t deadline = STIME_MAX;
+    const struct timer *t;
+    unsigned int level, shift, pos, n;
+    uint64_t pending, round;
+
+    for ( level = 0; level < WHEEL_LEVELS; level++ )
+    {
+        if ( !(pending = w->pending[level]) )
+            continue;
+
+        /*
+         * Level 0 slots are looked at from the current one on.  The current
+         * slots of other levels were cascaded already, so the next round of
+         * each starts after them.
+         */
+        shift = WHEEL_SLOT_BITS * level;
+        round = (w->clk >> shift) + !!level;
+        pos = round & (WHEEL_SLOTS - 1);
+        if ( pos )
+            pending = (pending >> pos) | (pending << (WHEEL_SLOTS - pos));
+        n = ffs64(pending) - 1;
+
+        if ( !level )
+        {
+            /* Timers in a level 0 slot expire within its tick, if not before. */
+            list_for_each_entry ( t, &w->slots[0][(pos + n) % WHEEL_SLOTS],
+                                  wheel_list )
+                deadline = min(deadline, t->expires);
+        }
+        else
+            deadline = min(deadline,
+                           (s_time_t)((round + n) << shift << wheel_shift));
+    }
+
+    return deadline;
+}
+
+static struct timer_wheel *alloc_wheel(void)
+{
+    struct timer_wheel *w = xmalloc(struct timer_wheel);
+    unsigned int level, slot;
+
+    if ( !w )
+        return NULL;
+
+    w->clk = wheel_tick(NOW());
+    for ( level = 0; level < WHEEL_LEVELS; level++ )
+    {
+        w->pending[level] = 0;
+        for ( slot = 0; slot < WHEEL_SLOTS; slot++ )
+            INIT_LIST_HEAD(&w->slots[level][slot]);
+    }
+
+    return w;
+}
+
+
 /****************************************************************************
  * TIMER OPERATIONS.
  */
@@ -193,6 +380,11 @@ static int remove_entry(struct timer *t)
     case TIMER_STATUS_in_list:
         rc = remove_from_list(&timers->list, t);
         break;
+    case TIMER_STATUS_in_wheel:
+        /* A stale deadline only costs a spurious softirq. */
+        remove_from_wheel(timers->wheel, t);
+        rc = 0;
+        break;
     default:
         rc = 0;
         BUG();
@@ -209,6 +401,16 @@ static int add_entry(struct timer *t)
 
     ASSERT(t->status == TIMER_STATUS_invalid);
 
+    /* Try to add to the wheel, if this CPU has one. */
+    if ( timers->wheel && add_to_wheel(timers->wheel, t) )
+    {
+        t->status = TIMER_STATUS_in_wheel;
+        if ( t->expires >= timers->deadline )
+            return 0;
+        timers->deadline = t->expires;
+        return 1;
+    }
+
     /* Try to add to heap. t->heap_offset indicates whether we succeed. */
     t->heap_offset = 0;
     t->status = TIMER_STATUS_in_heap;
@@ -457,6 +659,42 @@ static void execute_timer(struct timers *ts, struct timer *t)
     ts->running = NULL;
 }
 
+static void run_wheel(struct timers *ts, s_time_t now)
+{
+    struct timer_wheel *w = ts->wheel;
+    uint64_t now_tick = wheel_tick(now);
+    struct list_head *slot;
+    struct timer *t;
+
+    /* Execute all timers of the ticks which are over. */
+    while ( w->clk < now_tick )
+    {
+        slot = &w->slots[0][w->clk & (WHEEL_SLOTS - 1)];
+        while ( !list_empty(slot) )
+        {
+            t = list_first_entry(slot, struct timer, wheel_list);
+            remove_from_wheel(w, t);
+            execute_timer(ts, t);
+        }
+
+        set_wheel_clk(w, wheel_next_clk(w, now_tick));
+    }
+
+    /*
+     * Execute the ready timers of the current tick.  The slot may change
+     * while a timer runs, so look it up again after each.
+     */
+    slot = &w->slots[0][w->clk & (WHEEL_SLOTS - 1)];
+ again:
+    list_for_each_entry ( t, slot, wheel_list )
+        if ( t->expires < now )
+        {
+            remove_from_wheel(w, t);
+            execute_timer(ts, t);
+            goto again;
+        }
+}
+
 
 static void cf_check timer_softirq_action(void)
 {
@@ -507,6 +745,10 @@ static void cf_check timer_softirq_action(void)
         execute_timer(ts, t);
     }
 
+    /* Execute ready wheel timers. */
+    if ( ts->wheel )
+        run_wheel(ts, now);
+
     /* Execute ready list timers. */
     while ( ((t = ts->list) != NULL) && (t->expires < now) )
     {
@@ -514,7 +756,7 @@ static void cf_check timer_softirq_action(void)
         execute_timer(ts, t);
     }
 
-    /* Try to move timers from linked list to more efficient heap. */
+    /* Try to move timers from linked list to more efficient wheel or heap. */
     next = ts->list;
     ts->list = NULL;
     while ( unlikely((t = next) != NULL) )
@@ -524,12 +766,15 @@ static void cf_check timer_softirq_action(void)
         add_entry(t);
     }
 
-    /* Find earliest deadline from head of linked list and top of heap. */
+    /* Find earliest deadline from head of linked list, heap and wheel. */
     deadline = STIME_MAX;
     if ( heap_metadata(heap)->size != 0 )
         deadline = heap[1]->expires;
     if ( (ts->list != NULL) && (ts->list->expires < deadline) )
         deadline = ts->list->expires;
+    if ( ts->wheel )
+        deadline = min(deadline, wheel_deadline(ts->wheel));
+    ts->deadline = deadline;
     now = NOW();
     this_cpu(timer_deadline) =
         (deadline == STIME_MAX) ? 0 : MAX(deadline, now + timer_slop);
@@ -574,10 +819,34 @@ static void cf_check dump_timerq(unsigned char key)
             dump_timer(ts->heap[j], now);
         for ( t = ts->list; t != NULL; t = t->list_next )
             dump_timer(t, now);
+        for ( j = 0; ts->wheel && j < WHEEL_LEVELS * WHEEL_SLOTS; j++ )
+            list_for_each_entry ( t, &ts->wheel->slots[j / WHEEL_SLOTS]
+                                                      [j % WHEEL_SLOTS],
+                                  wheel_list )
+                dump_timer(t, now);
         spin_unlock_irqrestore(&ts->lock, flags);
     }
 }
 
+/* Any active timer of @ts, or NULL if none. */
+static struct timer *first_timer(const struct timers *ts)
+{
+    unsigned int level;
+
+    if ( heap_metadata(ts->heap)->size )
+        return ts->heap[1];
+    if ( ts->list )
+        return ts->list;
+
+    for ( level = 0; ts->wheel && level < WHEEL_LEVELS; level++ )
+        if ( ts->wheel->pending[level] )
+            return list_first_entry(
+                &ts->wheel->slots[level][ffs64(ts->wheel->pending[level]) - 1],
+                struct timer, wheel_list);
+
+    return NULL;
+}
+
 static void migrate_timers_from_cpu(unsigned int old_cpu)
 {
     unsigned int new_cpu = cpumask_any(&cpu_online_map);
@@ -601,8 +870,7 @@ static void migrate_timers_from_cpu(unsigned int old_cpu)
         spin_lock(&old_ts->lock);
     }
 
-    while ( (t = heap_metadata(old_ts->heap)->size
-             ? old_ts->heap[1] : old_ts->list) != NULL )
+    while ( (t = first_timer(old_ts)) != NULL )
     {
         remove_entry(t);
         write_atomic(&t->cpu, new_cpu);
@@ -643,6 +911,13 @@ static void free_percpu_timers(unsigned int cpu)
     }
     else
         ASSERT(ts->heap == dummy_heap);
+
+    if ( ts->wheel )
+    {
+        ASSERT(!first_timer(ts));
+        xfree(ts->wheel);
+        ts->wheel = NULL;
+    }
 }
 
 static int cf_check cpu_callback(
@@ -660,6 +935,17 @@ static int cf_check cpu_callback(
             INIT_LIST_HEAD(&ts->inactive);
             spin_lock_init(&ts->lock);
             ts->heap = dummy_heap;
+            ts->deadline = STIME_MAX;
+        }
+        /* Failing to allocate the wheel leaves all timers to the heap. */
+        if ( opt_timer_wheel && !ts->wheel )
+        {
+            struct timer_wheel *wheel = alloc_wheel();
+            unsigned long flags;
+
+            spin_lock_irqsave(&ts->lock, flags);
+            ts->wheel = wheel;
+            spin_unlock_irqrestore(&ts->lock, flags);
         }
         break;
 
@@ -695,6 +981,9 @@ void __init timer_init(void)
 
     open_softirq(TIMER_SOFTIRQ, timer_softirq_action);
 
+    /* Group timers due within timer_slop of each other in wheel ticks. */
+    wheel_shift = max(fls(timer_slop), 11U) - 1;
+
     cpu_callback(&cpu_nfb, CPU_UP_PREPARE, cpu);
     register_cpu_notifier(&cpu_nfb);
 
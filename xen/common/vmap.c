@@ -1,14 +1,23 @@
 #include <xen/bitmap.h>
+#include <xen/cpu.h>
 #include <xen/sections.h>
 #include <xen/init.h>
+#include <xen/keyhandler.h>
 #include <xen/mm.h>
+#include <xen/percpu.h>
 #include <xen/pfn.h>
 #include <xen/spinlock.h>
+#include <xen/timer.h>
 #include <xen/types.h>
 #include <xen/vmap.h>
 #include <xen/xvmalloc.h>
+#include <asm/flushtlb.h>
 #include <asm/page.h>
 
+#ifndef MAP_NO_FLUSH
+#define MAP_NO_FLUSH 0
+#endif
+
 static DEFINE_SPINLOCK(vm_lock);
 static void *__read_mostly vm_base[VMAP_REGION_NR];
 #define vm_bitmap(x) ((unsigned long *)vm_base[x])
@@ -19,6 +28,46 @@ static unsigned int __read_mostly vm_end[VMAP_REGION_NR];
 /* lowest known clear bit in the bitmap */
 static unsigned int vm_low[VMAP_REGION_NR];
 
+/*
+ * Single pages of VMAP_DEFAULT unmapped on a CPU, their TLB entries flushed,
+ * are kept allocated in a small cache of the CPU, for its next single page
+ * mappings (map_domain_page_global() and the like) not to take vm_lock.
+ *
+ * Where unmapping can leave the TLB flush to the caller (MAP_NO_FLUSH),
+ * vfree() goes further: it only clears the mappings and queues the range
+ * with its pages on the CPU.  Both stay allocated until the queue fills up,
+ * or VM_LAZY_TIMEOUT after the first range was queued, and is then purged
+ * with a single flush of all TLBs.
+ *
+ * The lock of each CPU's state is only contended when an allocation fails
+ * and the caches and queues of all CPUs are given back.
+ */
+#define VM_CACHE_PAGES  16
+#define VM_LAZY_RANGES  32
+#define VM_LAZY_PAGES   512
+#define VM_LAZY_TIMEOUT MILLISECS(10)
+
+struct vm_cpu {
+    spinlock_t lock;
+    struct timer purge_timer;
+
+    unsigned int nr_cached;
+    void *cached[VM_CACHE_PAGES];
+
+    unsigned int nr_lazy, lazy_pages;
+    struct {
+        void *va;
+        unsigned int pages;
+    } lazy[VM_LAZY_RANGES];
+    struct page_list_head lazy_list;
+
+    /* Statistics. */
+    unsigned long allocs, cache_hits, flushes, purges, purged;
+};
+
+static DEFINE_PER_CPU(struct vm_cpu, vm_cpu);
+static bool __read_mostly vm_cpu_ready;
+
 void __init vm_init_type(enum vmap_region type, void *start, void *end)
 {
     unsigned int i, nr;
@@ -57,8 +106,8 @@ void __init vm_init_type(enum vmap_region type, void *start, void *end)
     populate_pt_range(va, vm_low[type] - nr);
 }
 
-static void *vm_alloc(unsigned int nr, unsigned int align,
-                      enum vmap_region t)
+static void *vm_alloc_bitmap(unsigned int nr, unsigned int align,
+                             enum vmap_region t)
 {
     unsigned int start, bit;
 
@@ -191,11 +240,14 @@ static unsigned int vm_size(const void *va, enum vmap_region type)
     return min(end, vm_top[type]) - start;
 }
 
-static void vm_free(const void *va)
+/* Release the range at @va in the bitmap, with vm_lock held. */
+static void vm_release(const void *va)
 {
     enum vmap_region type = VMAP_DEFAULT;
     unsigned int bit = vm_index(va, type);
 
+    ASSERT(spin_is_locked(&vm_lock));
+
     if ( !bit )
     {
         type = VMAP_XEN;
@@ -208,7 +260,6 @@ static void vm_free(const void *va)
         return;
     }
 
-    spin_lock(&vm_lock);
     if ( bit < vm_low[type] )
     {
         vm_low[type] = bit - 1;
@@ -218,9 +269,253 @@ static void vm_free(const void *va)
     while ( __test_and_clear_bit(bit, vm_bitmap(type)) )
         if ( ++bit == vm_top[type] )
             break;
+}
+
+static void vm_free(const void *va)
+{
+    spin_lock(&vm_lock);
+    vm_release(va);
     spin_unlock(&vm_lock);
 }
 
+/*
+ * Keep the range of @pages at @va, unmapped and flushed, in the cache of
+ * @vc if it is a single page there is room for.  Called with vc->lock held.
+ */
+static bool vm_cache(struct vm_cpu *vc, const void *va, unsigned int pages)
+{
+    if ( pages != 1 || vc->nr_cached >= VM_CACHE_PAGES ||
+         !vm_index(va, VMAP_DEFAULT) )
+        return false;
+
+    vc->cached[vc->nr_cached++] = (void *)va;
+
+    return true;
+}
+
+/*
+ * Flush the TLBs for the ranges queued on @vc, and free them.  Called with
+ * vc->lock held.
+ */
+static void vm_purge(struct vm_cpu *vc)
+{
+    unsigned long start = ~0UL, end = 0;
+    struct page_info *pg;
+    unsigned int i;
+
+    if ( !vc->nr_lazy )
+        return;
+
+    stop_timer(&vc->purge_timer);
+
+    for ( i = 0; i < vc->nr_lazy; i++ )
+    {
+        unsigned long va = (unsigned long)vc->lazy[i].va;
+
+        start = min(start, va);
+        end = max(end, va + PAGE_SIZE * vc->lazy[i].pages);
+    }
+
+    flush_xen_tlb_range_va(start, end - start);
+
+    while ( (pg = page_list_remove_head(&vc->lazy_list)) != NULL )
+        free_domheap_page(pg);
+
+    spin_lock(&vm_lock);
+    for ( i = 0; i < vc->nr_lazy; i++ )
+        if ( !vm_cache(vc, vc->lazy[i].va, vc->lazy[i].pages) )
+            vm_release(vc->lazy[i].va);
+    spin_unlock(&vm_lock);
+
+    vc->flushes++;
+    vc->purges++;
+    vc->purged += vc->lazy_pages;
+    vc->nr_lazy = 0;
+    vc->lazy_pages = 0;
+}
+
+/* Give the pages cached on @vc back to the bitmap, with vc->lock held. */
+static void vm_drain(struct vm_cpu *vc)
+{
+    if ( !vc->nr_cached )
+        return;
+
+    spin_lock(&vm_lock);
+    while ( vc->nr_cached )
+        vm_release(vc->cached[--vc->nr_cached]);
+    spin_unlock(&vm_lock);
+}
+
+static void vm_purge_cpu(unsigned int cpu)
+{
+    struct vm_cpu *vc = &per_cpu(vm_cpu, cpu);
+
+    spin_lock(&vc->lock);
+    vm_purge(vc);
+    vm_drain(vc);
+    spin_unlock(&vc->lock);
+}
+
+/*
+ * Give back what all CPUs hold on to.  Returns false if there was nothing
+ * to give back.
+ */
+static bool vm_purge_all(void)
+{
+    unsigned int cpu;
+    bool held = false;
+
+    if ( !get_cpu_maps() )
+    {
+        /* CPUs are coming or going: only look at this one. */
+        cpu = smp_processor_id();
+        held = per_cpu(vm_cpu, cpu).nr_lazy || per_cpu(vm_cpu, cpu).nr_cached;
+        vm_purge_cpu(cpu);
+
+        return held;
+    }
+
+    for_each_online_cpu ( cpu )
+    {
+        const struct vm_cpu *vc = &per_cpu(vm_cpu, cpu);
+
+        /* Racy, but anything queued meanwhile may be purged on the retry. */
+        if ( !vc->nr_lazy && !vc->nr_cached )
+            continue;
+
+        vm_purge_cpu(cpu);
+        held = true;
+    }
+
+    put_cpu_maps();
+
+    return held;
+}
+
+static void *vm_alloc(unsigned int nr, unsigned int align,
+                      enum vmap_region t)
+{
+    struct vm_cpu *vc;
+    void *va = NULL;
+
+    if ( !vm_cpu_ready )
+        return vm_alloc_bitmap(nr, align, t);
+
+    vc = &this_cpu(vm_cpu);
+
+    spin_lock(&vc->lock);
+    vc->allocs++;
+    if ( nr == 1 && align <= 1 && t == VMAP_DEFAULT && vc->nr_cached )
+    {
+        va = vc->cached[--vc->nr_cached];
+        vc->cache_hits++;
+    }
+    spin_unlock(&vc->lock);
+
+    if ( !va && !(va = vm_alloc_bitmap(nr, align, t)) && vm_purge_all() )
+        va = vm_alloc_bitmap(nr, align, t);
+
+    return va;
+}
+
+static void vm_put(const void *va, unsigned int pages, bool flushed)
+{
+    struct vm_cpu *vc = &this_cpu(vm_cpu);
+    bool cached;
+
+    if ( !vm_cpu_ready )
+    {
+        vm_free(va);
+        return;
+    }
+
+    spin_lock(&vc->lock);
+    if ( flushed )
+        vc->flushes++;
+    cached = vm_cache(vc, va, pages);
+    spin_unlock(&vc->lock);
+
+    if ( !cached )
+        vm_free(va);
+}
+
+static void cf_check vm_purge_timer_fn(void *data)
+{
+    struct vm_cpu *vc = data;
+
+    spin_lock(&vc->lock);
+    vm_purge(vc);
+    spin_unlock(&vc->lock);
+}
+
+static void cf_check dump_vmap(unsigned char key)
+{
+    unsigned long allocs = 0, hits = 0, flushes = 0, purges = 0, purged = 0;
+    unsigned int cpu, cached = 0, lazy = 0;
+
+    for_each_online_cpu ( cpu )
+    {
+        const struct vm_cpu *vc = &per_cpu(vm_cpu, cpu);
+
+        allocs += vc->allocs;
+        hits += vc->cache_hits;
+        flushes += vc->flushes;
+        purges += vc->purges;
+        purged += vc->purged;
+        cached += vc->nr_cached;
+        lazy += vc->lazy_pages;
+    }
+
+    printk("vmap: %lu allocations, %lu from per-CPU caches\n", allocs, hits);
+    printk("vmap: %lu TLB flushes, %lu purges of %lu pages, "
+           "%u pages cached, %u pages awaiting a flush\n",
+           flushes, purges, purged, cached, lazy);
+}
+
+static int cf_check cpu_callback(
+    struct notifier_block *nfb, unsigned long action, void *hcpu)
+{
+    unsigned int cpu = (unsigned long)hcpu;
+    struct vm_cpu *vc = &per_cpu(vm_cpu, cpu);
+
+    switch ( action )
+    {
+    case CPU_UP_PREPARE:
+        memset(vc, 0, sizeof(*vc));
+        spin_lock_init(&vc->lock);
+        init_timer(&vc->purge_timer, vm_purge_timer_fn, vc, cpu);
+        INIT_PAGE_LIST_HEAD(&vc->lazy_list);
+        break;
+
+    case CPU_UP_CANCELED:
+    case CPU_DEAD:
+        vm_purge_cpu(cpu);
+        kill_timer(&vc->purge_timer);
+        break;
+    }
+
+    return NOTIFY_DONE;
+}
+
+static struct notifier_block cpu_nfb = {
+    .notifier_call = cpu_callback,
+};
+
+static int __init cf_check vm_cpu_init(void)
+{
+    struct vm_cpu *vc = &this_cpu(vm_cpu);
+
+    spin_lock_init(&vc->lock);
+    init_timer(&vc->purge_timer, vm_purge_timer_fn, vc, smp_processor_id());
+    INIT_PAGE_LIST_HEAD(&vc->lazy_list);
+    register_cpu_notifier(&cpu_nfb);
+    register_keyhandler('U', dump_vmap, "dump vmap statistics", 1);
+    vm_cpu_ready = true;
+
+    return 0;
+}
+presmp_initcall(vm_cpu_init);
+
 void *__vmap(const mfn_t *mfn, unsigned int granularity,
              unsigned int nr, unsigned int align, unsigned int flags,
              enum vmap_region type)
@@ -268,11 +563,47 @@ void vunmap(const void *va)
 #ifndef _PAGE_NONE
     destroy_xen_mappings(addr, addr + PAGE_SIZE * pages);
 #else /* Avoid tearing down intermediate page tables. */
-    map_pages_to_xen(addr, INVALID_MFN, pages, _PAGE_NONE);
+    map_pages_to_xen(addr, INVALID_MFN, pages, _PAGE_NONE | MAP_NO_FLUSH);
+    /* A single flush for the range, not one per page. */
+    if ( MAP_NO_FLUSH && pages )
+        flush_xen_tlb_range_va(addr, PAGE_SIZE * pages);
 #endif
-    vm_free(va);
+    vm_put(va, pages, true);
 }
 
+#if MAP_NO_FLUSH
+/*
+ * Unmap the range of @pages at @va without flushing TLBs, and queue it with
+ * its pages on @list for the next purge of this CPU.
+ */
+static void vunmap_lazy(const void *va, unsigned int pages,
+                        struct page_list_head *list)
+{
+    struct vm_cpu *vc = &this_cpu(vm_cpu);
+
+    map_pages_to_xen((unsigned long)va, INVALID_MFN, pages,
+                     _PAGE_NONE | MAP_NO_FLUSH);
+
+    spin_lock(&vc->lock);
+
+    if ( vc->nr_lazy == VM_LAZY_RANGES )
+        vm_purge(vc);
+
+    if ( !vc->nr_lazy )
+        set_timer(&vc->purge_timer, NOW() + VM_LAZY_TIMEOUT);
+
+    vc->lazy[vc->nr_lazy].va = (void *)va;
+    vc->lazy[vc->nr_lazy++].pages = pages;
+    vc->lazy_pages += pages;
+    page_list_splice(list, &vc->lazy_list);
+
+    if ( vc->lazy_pages >= VM_LAZY_PAGES )
+        vm_purge(vc);
+
+    spin_unlock(&vc->lock);
+}
+#endif
+
 static void *vmalloc_type(size_t size, enum vmap_region type)
 {
     mfn_t *mfn;
@@ -349,6 +680,15 @@ static void _vfree(const void *va, unsigned int pages)
         ASSERT(pg);
         page_list_add(pg, &pg_list);
     }
+
+#if MAP_NO_FLUSH
+    if ( vm_cpu_ready )
+    {
+        vunmap_lazy(va, pages, &pg_list);
+        return;
+    }
+#endif
+
     vunmap(va);
 
     while ( (pg = page_list_remove_head(&pg_list)) != NULL )
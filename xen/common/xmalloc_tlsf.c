@@ -23,8 +23,11 @@
  * Adapted for Xen by Dan Magenheimer (dan.magenheimer@oracle.com)
  */
 
+#include <xen/cpu.h>
 #include <xen/irq.h>
+#include <xen/keyhandler.h>
 #include <xen/mm.h>
+#include <xen/param.h>
 #include <xen/pfn.h>
 #include <asm/time.h>
 #include <asm/page.h>
@@ -47,7 +50,7 @@
 #define BHDR_OVERHEAD   (sizeof(struct bhdr) - MIN_BLOCK_SIZE)
 
 #define PTR_MASK        (sizeof(void *) - 1)
-#define BLOCK_SIZE_MASK (0xFFFFFFFFU - PTR_MASK)
+#define BLOCK_SIZE_MASK (0xFFFFFFFFU & ~(PTR_MASK | CACHED_BLOCK))
 
 #define GET_NEXT_BLOCK(addr, r) ((struct bhdr *) \
                                 ((char *)(addr) + (r)))
@@ -66,6 +69,9 @@
 #define PREV_FREE       (0x2)
 #define PREV_USED       (0x0)
 
+/* bit 2 of the block size, only ever set on used blocks */
+#define CACHED_BLOCK    (0x4)
+
 static DEFINE_SPINLOCK(pool_list_lock);
 static LIST_HEAD(pool_list_head);
 
@@ -81,6 +87,7 @@ struct bhdr {
      * The size is stored in bytes
      *  bit 0: block is free, if set
      *  bit 1: previous block is free, if set
+     *  bit 2: block was handed out by the xmalloc() per-CPU caches, if set
      */
     u32 size;
     /* Free blocks in individual freelists are linked */
@@ -382,11 +389,54 @@ void xmem_pool_destroy(struct xmem_pool *pool)
     free_xenheap_pages(pool,pool_order);
 }
 
+/*
+ * Take the free block @b, found on list (@fl, @sl), for an allocation of
+ * @size bytes, with the pool lock held.
+ */
+static void *take_block(struct xmem_pool *pool, struct bhdr *b, int fl, int sl,
+                        unsigned long size)
+{
+    struct bhdr *b2, *next_b;
+    unsigned long tmp_size;
+
+    EXTRACT_BLOCK_HDR(b, pool, fl, sl);
+
+    /*-- found: */
+    next_b = GET_NEXT_BLOCK(b->ptr.buffer, b->size & BLOCK_SIZE_MASK);
+    /* Should the block be split? */
+    tmp_size = (b->size & BLOCK_SIZE_MASK) - size;
+    if ( tmp_size >= sizeof(struct bhdr) )
+    {
+        tmp_size -= BHDR_OVERHEAD;
+        b2 = GET_NEXT_BLOCK(b->ptr.buffer, size);
+
+        b2->size = tmp_size | FREE_BLOCK | PREV_USED;
+        b2->prev_hdr = b;
+
+        next_b->prev_hdr = b2;
+
+        MAPPING_INSERT(tmp_size, &fl, &sl);
+        INSERT_BLOCK(b2, pool, fl, sl);
+
+        b->size = size | (b->size & PREV_STATE);
+    }
+    else
+    {
+        next_b->size &= (~PREV_FREE);
+        b->size &= (~FREE_BLOCK); /* Now it's used */
+    }
+
+    pool->used_size += (b->size & BLOCK_SIZE_MASK) + BHDR_OVERHEAD;
+
+    return (void *)b->ptr.buffer;
+}
+
 void *xmem_pool_alloc(unsigned long size, struct xmem_pool *pool)
 {
-    struct bhdr *b, *b2, *next_b, *region;
+    struct bhdr *b, *region;
     int fl, sl;
     unsigned long tmp_size;
+    void *p;
 
     ASSERT_ALLOC_CONTEXT();
 
@@ -423,37 +473,11 @@ void *xmem_pool_alloc(unsigned long size, struct xmem_pool *pool)
         ADD_REGION(region, pool->grow_size, pool);
         goto retry_find;
     }
-    EXTRACT_BLOCK_HDR(b, pool, fl, sl);
-
-    /*-- found: */
-    next_b = GET_NEXT_BLOCK(b->ptr.buffer, b->size & BLOCK_SIZE_MASK);
-    /* Should the block be split? */
-    tmp_size = (b->size & BLOCK_SIZE_MASK) - size;
-    if ( tmp_size >= sizeof(struct bhdr) )
-    {
-        tmp_size -= BHDR_OVERHEAD;
-        b2 = GET_NEXT_BLOCK(b->ptr.buffer, size);
-
-        b2->size = tmp_size | FREE_BLOCK | PREV_USED;
-        b2->prev_hdr = b;
-
-        next_b->prev_hdr = b2;
-
-        MAPPING_INSERT(tmp_size, &fl, &sl);
-        INSERT_BLOCK(b2, pool, fl, sl);
-
-        b->size = size | (b->size & PREV_STATE);
-    }
-    else
-    {
-        next_b->size &= (~PREV_FREE);
-        b->size &= (~FREE_BLOCK); /* Now it's used */
-    }
 
-    pool->used_size += (b->size & BLOCK_SIZE_MASK) + BHDR_OVERHEAD;
+    p = take_block(pool, b, fl, sl, size);
 
     spin_unlock(&pool->lock);
-    return (void *)b->ptr.buffer;
+    return p;
 
     /* Failed alloc */
  out_locked:
@@ -463,19 +487,50 @@ void *xmem_pool_alloc(unsigned long size, struct xmem_pool *pool)
     return NULL;
 }
 
-void xmem_pool_free(void *ptr, struct xmem_pool *pool)
+/*
+ * Allocate up to @nr blocks of @size bytes, a multiple of MEM_ALIGN, with a
+ * single acquisition of the pool lock and without growing the pool.  The
+ * blocks are chained through their first word onto *@head, and their number
+ * is returned.
+ */
+static unsigned int xmem_pool_alloc_batch(unsigned long size,
+                                          struct xmem_pool *pool,
+                                          unsigned int nr, void **head)
 {
-    struct bhdr *b, *tmp_b;
-    int fl = 0, sl = 0;
+    unsigned int i;
 
-    ASSERT_ALLOC_CONTEXT();
+    spin_lock(&pool->lock);
 
-    if ( unlikely(ptr == NULL) )
-        return;
+    for ( i = 0; i < nr; i++ )
+    {
+        unsigned long block_size = size;
+        struct bhdr *b;
+        int fl, sl;
+        void *p;
+
+        MAPPING_SEARCH(&block_size, &fl, &sl);
+        if ( !(b = FIND_SUITABLE_BLOCK(pool, &fl, &sl)) )
+            break;
+
+        p = take_block(pool, b, fl, sl, block_size);
+        *(void **)p = *head;
+        *head = p;
+    }
+
+    spin_unlock(&pool->lock);
+
+    return i;
+}
+
+/* Free the block at @ptr, with the pool lock held. */
+static void free_block(void *ptr, struct xmem_pool *pool)
+{
+    struct bhdr *b, *tmp_b;
+    int fl = 0, sl = 0;
 
     b = (struct bhdr *)((char *) ptr - BHDR_OVERHEAD);
 
-    spin_lock(&pool->lock);
+    b->size &= ~CACHED_BLOCK;
     b->size |= FREE_BLOCK;
     pool->used_size -= (b->size & BLOCK_SIZE_MASK) + BHDR_OVERHEAD;
     b->ptr.free_ptr = (struct free_ptr) { NULL, NULL};
@@ -504,17 +559,49 @@ void xmem_pool_free(void *ptr, struct xmem_pool *pool)
         pool->put_mem(b);
         pool->num_regions--;
         pool->used_size -= BHDR_OVERHEAD; /* sentinel block header */
-        goto out;
+        return;
     }
 
     INSERT_BLOCK(b, pool, fl, sl);
 
     tmp_b->size |= PREV_FREE;
     tmp_b->prev_hdr = b;
- out:
+}
+
+void xmem_pool_free(void *ptr, struct xmem_pool *pool)
+{
+    ASSERT_ALLOC_CONTEXT();
+
+    if ( unlikely(ptr == NULL) )
+        return;
+
+    spin_lock(&pool->lock);
+    free_block(ptr, pool);
     spin_unlock(&pool->lock);
 }
 
+/*
+ * Free the first @nr blocks chained through their first word from @head, with
+ * a single acquisition of the pool lock, and return the rest of the chain.
+ */
+static void *xmem_pool_free_batch(void *head, unsigned int nr,
+                                  struct xmem_pool *pool)
+{
+    spin_lock(&pool->lock);
+
+    for ( ; nr; nr-- )
+    {
+        void *next = *(void **)head;
+
+        free_block(head, pool);
+        head = next;
+    }
+
+    spin_unlock(&pool->lock);
+
+    return head;
+}
+
 int xmem_pool_maxalloc(struct xmem_pool *pool)
 {
     return pool->grow_size - (2 * BHDR_OVERHEAD);
@@ -569,6 +656,262 @@ static void tlsf_init(void)
     BUG_ON(!xenpool);
 }
 
+/*
+ * Per-CPU caches of small blocks.
+ *
+ * Allocations of up to XMALLOC_CACHE_MAX bytes without particular alignment
+ * are rounded up to one of the size classes below.  Freed blocks of these
+ * sizes are kept on per-CPU lists, still accounted as used by the pool, for
+ * the next allocations of their class on that CPU, so that most don't take
+ * the pool lock.  Blocks aren't tied to a CPU: one freed on another CPU than
+ * it was allocated on is cached there.  Lists are refilled from and trimmed
+ * back to the pool in batches, and other sizes are served by the pool alone.
+ * Blocks handed out through the caches are marked CACHED_BLOCK, and only
+ * these are taken back by them.  With CONFIG_XMEM_POOL_POISON, cached blocks
+ * are poisoned past their chain pointer like free blocks of the pool, and
+ * checked when handed out again.
+ */
+#define XMALLOC_CACHE_MAX   2048
+#define XMALLOC_CACHE_BYTES 4096 /* Cached per class and CPU. */
+#define NR_XMALLOC_CLASSES  14
+
+static const unsigned short xmalloc_class_size[NR_XMALLOC_CLASSES] = {
+    16, 32, 48, 64, 96, 128, 192, 256, 384, 512, 768, 1024, 1536, 2048,
+};
+
+/* Smallest class of each size, in steps of MEM_ALIGN. */
+static uint8_t __ro_after_init xmalloc_class[XMALLOC_CACHE_MAX / MEM_ALIGN];
+
+static bool __ro_after_init opt_xmalloc_cache = true;
+boolean_param("xmalloc-cache", opt_xmalloc_cache);
+
+static bool __ro_after_init xmalloc_cache_ready;
+
+struct xmalloc_cache {
+    /* Free blocks, chained through their first word. */
+    void *head;
+    unsigned int count;
+
+    /*
+     * Statistics.  Blocks larger than their class, the rest not being worth
+     * splitting off, are counted as freed to the class of their actual size.
+     */
+    unsigned long allocs, hits, frees;
+};
+
+struct xmalloc_cpu_cache {
+    struct xmalloc_cache class[NR_XMALLOC_CLASSES];
+};
+
+static DEFINE_PER_CPU(struct xmalloc_cpu_cache, xmalloc_cache);
+
+/* Statistics of the CPUs taken offline. */
+static struct xmalloc_cpu_cache xmalloc_cache_offline;
+
+static unsigned int xmalloc_cache_limit(unsigned int class)
+{
+    return max(XMALLOC_CACHE_BYTES / xmalloc_class_size[class], 4);
+}
+
+static unsigned long cached_block_size(const void *p)
+{
+    const struct bhdr *b = p - BHDR_OVERHEAD;
+
+    return b->size & BLOCK_SIZE_MASK;
+}
+
+static void *xmalloc_cache_alloc(unsigned long size)
+{
+    unsigned int class = xmalloc_class[(size - 1) / MEM_ALIGN];
+    struct xmalloc_cache *xc = &this_cpu(xmalloc_cache).class[class];
+    struct bhdr *b;
+    void *p;
+
+    xc->allocs++;
+
+    if ( xc->head )
+        xc->hits++;
+    else if ( !(xc->count = xmem_pool_alloc_batch(
+                    xmalloc_class_size[class], xenpool,
+                    xmalloc_cache_limit(class) / 2, &xc->head)) )
+    {
+        /* Let the pool grow. */
+        p = xmem_pool_alloc(xmalloc_class_size[class], xenpool);
+        if ( !p )
+            return NULL;
+        goto out;
+    }
+
+    p = xc->head;
+    xc->head = *(void **)p;
+    xc->count--;
+
+    /* Blocks from the pool are poisoned the same way as cached ones. */
+    if ( IS_ENABLED(CONFIG_XMEM_POOL_POISON) &&
+         cached_block_size(p) > MIN_BLOCK_SIZE &&
+         memchr_inv(p + MIN_BLOCK_SIZE, POISON_BYTE,
+                    cached_block_size(p) - MIN_BLOCK_SIZE) )
+    {
+        printk(XENLOG_ERR "XMEM Pool corruption found");
+        BUG();
+    }
+
+ out:
+    b = p - BHDR_OVERHEAD;
+    b->size |= CACHED_BLOCK;
+
+    return p;
+}
+
+/* Return all but @keep cached blocks to the pool, the latest freed first. */
+static void trim_xmalloc_cache(struct xmalloc_cache *xc, unsigned int keep)
+{
+    xc->head = xmem_pool_free_batch(xc->head, xc->count - keep, xenpool);
+    xc->count = keep;
+}
+
+/* Cache the block at @p if it was handed out by xmalloc_cache_alloc(). */
+static bool xmalloc_cache_free(void *p)
+{
+    const struct bhdr *b = p - BHDR_OVERHEAD;
+    unsigned long size = b->size & BLOCK_SIZE_MASK;
+    struct xmalloc_cache *xc;
+    unsigned int class;
+
+    if ( !(b->size & CACHED_BLOCK) )
+        return false;
+
+    /* Blocks may be larger than their class, when not worth splitting. */
+    if ( size > XMALLOC_CACHE_MAX )
+        class = NR_XMALLOC_CLASSES - 1;
+    else if ( xmalloc_class_size[class = xmalloc_class[(size - 1) /
+                                                       MEM_ALIGN]] > size )
+        class--;
+
+    ASSERT(size - xmalloc_class_size[class] < sizeof(struct bhdr));
+
+    xc = &this_cpu(xmalloc_cache).class[class];
+    xc->frees++;
+
+    if ( IS_ENABLED(CONFIG_XMEM_POOL_POISON) && size > MIN_BLOCK_SIZE )
+        memset(p + MIN_BLOCK_SIZE, POISON_BYTE, size - MIN_BLOCK_SIZE);
+
+    *(void **)p = xc->head;
+    xc->head = p;
+
+    if ( ++xc->count > xmalloc_cache_limit(class) )
+        trim_xmalloc_cache(xc, xmalloc_cache_limit(class) / 2);
+
+    return true;
+}
+
+static void drain_xmalloc_cache(unsigned int cpu)
+{
+    struct xmalloc_cpu_cache *cache = &per_cpu(xmalloc_cache, cpu);
+    unsigned int class;
+
+    for ( class = 0; class < NR_XMALLOC_CLASSES; class++ )
+    {
+        struct xmalloc_cache *xc = &cache->class[class];
+        struct xmalloc_cache *off = &xmalloc_cache_offline.class[class];
+
+        trim_xmalloc_cache(xc, 0);
+
+        off->allocs += xc->allocs;
+        off->hits += xc->hits;
+        off->frees += xc->frees;
+    }
+}
+
+static void cf_check dump_xmalloc(unsigned char key)
+{
+    unsigned int class, cpu;
+
+    if ( xenpool )
+        printk("xmalloc pool: %lukB used, %lukB total\n",
+               xmem_pool_get_used_size(xenpool) >> 10,
+               xmem_pool_get_total_size(xenpool) >> 10);
+
+    if ( !xmalloc_cache_ready )
+        return;
+
+    printk("  %5s %8s %14s %14s %14s\n",
+           "size", "cached", "allocs", "hits", "frees");
+
+    for ( class = 0; class < NR_XMALLOC_CLASSES; class++ )
+    {
+        const struct xmalloc_cache *off = &xmalloc_cache_offline.class[class];
+        unsigned long count = 0, allocs = off->allocs, hits = off->hits;
+        unsigned long frees = off->frees;
+
+        for_each_online_cpu ( cpu )
+        {
+            const struct xmalloc_cache *xc =
+                &per_cpu(xmalloc_cache, cpu).class[class];
+
+            count += xc->count;
+            allocs += xc->allocs;
+            hits += xc->hits;
+            frees += xc->frees;
+        }
+
+        printk("  %5u %8lu %14lu %14lu %14lu\n", xmalloc_class_size[class],
+               count, allocs, hits, frees);
+    }
+}
+
+static int cf_check cpu_xmalloc_cache_callback(
+    struct notifier_block *nfb, unsigned long action, void *hcpu)
+{
+    unsigned int cpu = (unsigned long)hcpu;
+
+    switch ( action )
+    {
+    case CPU_UP_PREPARE:
+        memset(&per_cpu(xmalloc_cache, cpu), 0,
+               sizeof(per_cpu(xmalloc_cache, cpu)));
+        break;
+
+    case CPU_UP_CANCELED:
+    case CPU_DEAD:
+        drain_xmalloc_cache(cpu);
+        break;
+    }
+
+    return NOTIFY_DONE;
+}
+
+static struct notifier_block cpu_xmalloc_cache_nfb = {
+    .notifier_call = cpu_xmalloc_cache_callback
+};
+
+static int __init cf_check xmalloc_cache_init(void)
+{
+    unsigned int class = 0, i;
+
+    register_keyhandler('X', dump_xmalloc, "dump xmalloc statistics", 1);
+
+    if ( !opt_xmalloc_cache )
+        return 0;
+
+    for ( i = 0; i < ARRAY_SIZE(xmalloc_class); i++ )
+    {
+        if ( (i + 1) * MEM_ALIGN > xmalloc_class_size[class] )
+            class++;
+        xmalloc_class[i] = class;
+    }
+
+    if ( !xenpool )
+        tlsf_init();
+
+    memset(&this_cpu(xmalloc_cache), 0, sizeof(this_cpu(xmalloc_cache)));
+    register_cpu_notifier(&cpu_xmalloc_cache_nfb);
+    xmalloc_cache_ready = true;
+
+    return 0;
+}
+presmp_initcall(xmalloc_cache_init);
+
 /*
  * xmalloc()
  */
@@ -625,7 +968,10 @@ void *_xmalloc(unsigned long size, unsigned long align)
     if ( !xenpool )
         tlsf_init();
 
-    if ( size < PAGE_SIZE )
+    if ( size <= XMALLOC_CACHE_MAX && align == MEM_ALIGN &&
+         xmalloc_cache_ready )
+        p = xmalloc_cache_alloc(size);
+    else if ( size < PAGE_SIZE )
         p = xmem_pool_alloc(size, xenpool);
     if ( p == NULL )
         return xmalloc_whole_pages(size - align + MEM_ALIGN, align);
@@ -737,5 +1083,8 @@ void xfree(void *p)
     /* Strip alignment padding. */
     p = strip_padding(p);
 
+    if ( xmalloc_cache_ready && xmalloc_cache_free(p) )
+        return;
+
     xmem_pool_free(p, xenpool);
 }
@@ -962,7 +962,10 @@ struct xen_domctl_set_broken_page_p2m {
  * guest memory.
  */
 struct xen_domctl_cacheflush {
-    /* IN: page range to flush. */
+    /*
+     * IN: page range to flush.  If the flush is preempted, Xen updates both
+     * fields to the part of the range left to flush before continuing.
+     */
     xen_pfn_t start_pfn, nr_pfns;
 };
 
@@ -1236,6 +1239,23 @@ struct xen_domctl_dt_overlay {
 };
 #endif
 
+/*
+ * XEN_DOMCTL_get_teardown_progress
+ *
+ * Report how far the destruction of a domain has got, so that a toolstack
+ * can show progress while XEN_DOMCTL_destroydomain is still being continued,
+ * and tell when the memory of the domain will be available again.
+ */
+struct xen_domctl_teardown_progress {
+#define XEN_DOMCTL_TEARDOWN_alive  0 /* Destruction has not been requested. */
+#define XEN_DOMCTL_TEARDOWN_dying  1 /* Resources are being released. */
+#define XEN_DOMCTL_TEARDOWN_dead   2 /* All resources have been released. */
+    uint32_t state;                   /* OUT: XEN_DOMCTL_TEARDOWN_*. */
+    uint32_t pad;                     /* OUT: Always zero. */
+    uint64_aligned_t pages;           /* OUT: Pages still owned by the domain. */
+    uint64_aligned_t initial_pages;   /* OUT: Pages owned when dying started. */
+};
+
 struct xen_domctl {
     uint32_t cmd;
 #define XEN_DOMCTL_createdomain                   1
@@ -1325,6 +1345,7 @@ struct xen_domctl {
 #define XEN_DOMCTL_set_paging_mempool_size       86
 #define XEN_DOMCTL_dt_overlay                    87
 #define XEN_DOMCTL_gsi_permission                88
+#define XEN_DOMCTL_get_teardown_progress         89
 #define XEN_DOMCTL_gdbsx_guestmemio            1000
 #define XEN_DOMCTL_gdbsx_pausevcpu             1001
 #define XEN_DOMCTL_gdbsx_unpausevcpu           1002
@@ -1388,6 +1409,7 @@ struct xen_domctl {
         struct xen_domctl_vuart_op          vuart_op;
         struct xen_domctl_vmtrace_op        vmtrace_op;
         struct xen_domctl_paging_mempool    paging_mempool;
+        struct xen_domctl_teardown_progress teardown_progress;
 #if defined(__arm__) || defined(__aarch64__)
         struct xen_domctl_dt_overlay        dt_overlay;
 #endif
@@ -60,6 +60,7 @@
 #ifdef __XEN__
 #define EVTCHNOP_reset_cont      14
 #endif
+#define EVTCHNOP_send_multi      15
 /* ` } */
 
 typedef uint32_t evtchn_port_t;
@@ -181,6 +182,27 @@ struct evtchn_send {
 };
 typedef struct evtchn_send evtchn_send_t;
 
+/*
+ * EVTCHNOP_send_multi: Send an event to each of the <nr_ports> channels whose
+ * local endpoints are listed in <ports>, as EVTCHNOP_send would, in a single
+ * hypercall.
+ * NOTES:
+ *  1. <done> must be zero on entry. It is updated to the number of ports
+ *     handled, which on error is the index of the port that failed.
+ *  2. Ports notifying the same vCPU only kick it once while its upcall stays
+ *     pending, as they would with as many EVTCHNOP_send.
+ */
+struct evtchn_send_multi {
+    /* IN parameters. */
+    uint32_t nr_ports;
+    /* IN/OUT parameters. */
+    uint32_t done;
+    /* IN parameters. */
+    evtchn_port_t ports[XEN_FLEX_ARRAY_DIM];
+};
+typedef struct evtchn_send_multi evtchn_send_multi_t;
+DEFINE_XEN_GUEST_HANDLE(evtchn_send_multi_t);
+
 /*
  * EVTCHNOP_status: Get the current status of the communication channel which
  * has an endpoint at <dom, port>.
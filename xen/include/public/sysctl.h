@@ -1210,6 +1210,36 @@ struct xen_sysctl_dt_overlay {
 };
 #endif
 
+/*
+ * XEN_SYSCTL_scrubinfo
+ * Background scrubbing of free memory by idle CPUs, per node.
+ *
+ * IN:
+ *  - A null 'scrubinfo' handle is a request for the maximum value of
+ *    'num_nodes'.
+ *  - Otherwise it's the number of entries in 'scrubinfo'.
+ *
+ * OUT:
+ *  - 'num_nodes' is the number of entries written, or the maximum value if
+ *    'scrubinfo' is null.
+ */
+struct xen_sysctl_scrubnode {
+    uint64_aligned_t pending;   /* Free pages waiting to be scrubbed. */
+    uint64_aligned_t scrubbed;  /* Pages scrubbed since boot. */
+    uint64_aligned_t scrub_ns;  /* Time spent scrubbing them, summed over
+                                   all scrubbing CPUs. */
+    uint32_t scrubbers;         /* CPUs scrubbing the node right now. */
+    uint32_t pad;
+};
+typedef struct xen_sysctl_scrubnode xen_sysctl_scrubnode_t;
+DEFINE_XEN_GUEST_HANDLE(xen_sysctl_scrubnode_t);
+
+struct xen_sysctl_scrubinfo {
+    uint32_t num_nodes;                                   /* IN/OUT */
+    uint32_t pad;
+    XEN_GUEST_HANDLE_64(xen_sysctl_scrubnode_t) scrubinfo; /* OUT */
+};
+
 struct xen_sysctl {
     uint32_t cmd;
 #define XEN_SYSCTL_readconsole                    1
@@ -1241,6 +1271,7 @@ struct xen_sysctl {
 /* #define XEN_SYSCTL_set_parameter              28 */
 #define XEN_SYSCTL_get_cpu_policy                29
 #define XEN_SYSCTL_dt_overlay                    30
+#define XEN_SYSCTL_scrubinfo                     31
     uint32_t interface_version; /* XEN_SYSCTL_INTERFACE_VERSION */
     union {
         struct xen_sysctl_readconsole       readconsole;
@@ -1275,6 +1306,7 @@ struct xen_sysctl {
 #if defined(__arm__) || defined(__aarch64__)
         struct xen_sysctl_dt_overlay        dt_overlay;
 #endif
+        struct xen_sysctl_scrubinfo         scrubinfo;
         uint8_t                             pad[128];
     } u;
 };
@@ -140,6 +140,16 @@ unsigned long avail_domheap_pages_region(
     unsigned int node, unsigned int min_width, unsigned int max_width);
 unsigned long avail_domheap_pages(void);
 unsigned long avail_node_heap_pages(unsigned int nodeid);
+
+/* Background scrubbing of a node. */
+struct scrub_stats {
+    unsigned long pending;      /* Free pages waiting to be scrubbed. */
+    unsigned long scrubbed;     /* Pages scrubbed by idle CPUs since boot. */
+    uint64_t scrub_ns;          /* Time spent scrubbing them. */
+    unsigned int scrubbers;     /* CPUs scrubbing the node right now. */
+};
+void get_scrub_stats(unsigned int node, struct scrub_stats *stats);
+
 #define alloc_domheap_page(d,f) (alloc_domheap_pages(d,0,f))
 #define free_domheap_page(p)  (free_domheap_pages(p,0))
 unsigned int online_page(mfn_t mfn, uint32_t *status);
@@ -79,6 +79,15 @@ PERFCOUNTER(credit_reset,           "csched2: credit_reset")
 PERFCOUNTER(deferred_to_tickled_cpu,"csched2: deferred_to_tickled_cpu")
 PERFCOUNTER(tickled_cpu_overwritten,"csched2: tickled_cpu_overwritten")
 PERFCOUNTER(tickled_cpu_overridden, "csched2: tickled_cpu_overridden")
+PERFCOUNTER(migrate_cross_llc,      "csched2: migrate_cross_llc")
+PERFCOUNTER(migrate_cross_node,     "csched2: migrate_cross_node")
+#endif
+
+/* RTDS specific counters */
+#ifdef CONFIG_SCHED_RTDS
+PERFCOUNTER(rtds_push,              "rtds: push")
+PERFCOUNTER(rtds_pull,              "rtds: pull")
+PERFCOUNTER(rtds_pull_trylock_failed, "rtds: pull_trylock_failed")
 #endif
 
 PERFCOUNTER(need_flush_tlb_flush,   "PG_need_flush tlb flushes")
@@ -396,6 +396,9 @@ struct domain
     unsigned int     outstanding_pages; /* pages claimed but not possessed */
     unsigned int     max_pages;         /* maximum value for domain_tot_pages() */
     unsigned int     extra_pages;       /* pages not included in domain_tot_pages() */
+    unsigned int     teardown_pages;    /* domain_tot_pages() on domain_kill() */
+    /* Pages populated by populate_physmap(): below 2M, 2M and 1G extents. */
+    unsigned long    populated_pages[3];
 
 #ifdef CONFIG_MEM_SHARING
     atomic_t         shr_pages;         /* shared pages */
@@ -166,10 +166,10 @@ struct xsm_ops {
 #endif
 
     int (*platform_op)(uint32_t cmd);
+    int (*shadow_control)(struct domain *d, uint32_t op);
 
 #ifdef CONFIG_X86
     int (*do_mca)(void);
-    int (*shadow_control)(struct domain *d, uint32_t op);
     int (*mem_sharing_op)(struct domain *d, struct domain *cd, int op);
     int (*apic)(struct domain *d, int cmd);
     int (*machine_memory_map)(void);
@@ -657,18 +657,18 @@ static inline int xsm_platform_op(xsm_default_t def, uint32_t op)
     return alternative_call(xsm_ops.platform_op, op);
 }
 
-#ifdef CONFIG_X86
-static inline int xsm_do_mca(xsm_default_t def)
-{
-    return alternative_call(xsm_ops.do_mca);
-}
-
 static inline int xsm_shadow_control(
     xsm_default_t def, struct domain *d, uint32_t op)
 {
     return alternative_call(xsm_ops.shadow_control, d, op);
 }
 
+#ifdef CONFIG_X86
+static inline int xsm_do_mca(xsm_default_t def)
+{
+    return alternative_call(xsm_ops.do_mca);
+}
+
 static inline int xsm_mem_sharing_op(
     xsm_default_t def, struct domain *d, struct domain *cd, int op)
 {
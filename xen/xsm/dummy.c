@@ -124,9 +124,9 @@ static const struct xsm_ops __initconst_cf_clobber dummy_ops = {
 #endif
 
     .platform_op                   = xsm_platform_op,
+    .shadow_control                = xsm_shadow_control,
 #ifdef CONFIG_X86
     .do_mca                        = xsm_do_mca,
-    .shadow_control                = xsm_shadow_control,
     .mem_sharing_op                = xsm_mem_sharing_op,
     .apic                          = xsm_apic,
     .machine_memory_map            = xsm_machine_memory_map,
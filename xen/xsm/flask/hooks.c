@@ -692,9 +692,9 @@ static int cf_check flask_domctl(struct domain *d, unsigned int cmd,
     /* These have individual XSM hooks (arch/../domctl.c) */
     case XEN_DOMCTL_bind_pt_irq:
     case XEN_DOMCTL_unbind_pt_irq:
+    case XEN_DOMCTL_shadow_op:
 #ifdef CONFIG_X86
     /* These have individual XSM hooks (arch/x86/domctl.c) */
-    case XEN_DOMCTL_shadow_op:
     case XEN_DOMCTL_ioport_permission:
     case XEN_DOMCTL_ioport_mapping:
     case XEN_DOMCTL_gsi_permission:
@@ -838,6 +838,9 @@ static int cf_check flask_domctl(struct domain *d, unsigned int cmd,
     case XEN_DOMCTL_get_paging_mempool_size:
         return current_has_perm(d, SECCLASS_DOMAIN, DOMAIN__GETPAGINGMEMPOOL);
 
+    case XEN_DOMCTL_get_teardown_progress:
+        return current_has_perm(d, SECCLASS_DOMAIN, DOMAIN__GETDOMAININFO);
+
     case XEN_DOMCTL_set_paging_mempool_size:
         return current_has_perm(d, SECCLASS_DOMAIN, DOMAIN__SETPAGINGMEMPOOL);
 
@@ -895,6 +898,7 @@ static int cf_check flask_sysctl(int cmd)
     case XEN_SYSCTL_numainfo:
     case XEN_SYSCTL_pcitopoinfo:
     case XEN_SYSCTL_get_cpu_policy:
+    case XEN_SYSCTL_scrubinfo:
         return domain_has_xen(current->domain, XEN__PHYSINFO);
 
     case XEN_SYSCTL_psr_cmt_op:
@@ -1581,12 +1585,6 @@ static int cf_check flask_platform_op(uint32_t op)
     }
 }
 
-#ifdef CONFIG_X86
-static int cf_check flask_do_mca(void)
-{
-    return domain_has_xen(current->domain, XEN__MCA_OP);
-}
-
 static int cf_check flask_shadow_control(struct domain *d, uint32_t op)
 {
     uint32_t perm;
@@ -1614,6 +1612,12 @@ static int cf_check flask_shadow_control(struct domain *d, uint32_t op)
     return current_has_perm(d, SECCLASS_SHADOW, perm);
 }
 
+#ifdef CONFIG_X86
+static int cf_check flask_do_mca(void)
+{
+    return domain_has_xen(current->domain, XEN__MCA_OP);
+}
+
 struct ioport_has_perm_data {
     uint32_t ssid;
     uint32_t dsid;
@@ -1968,9 +1972,9 @@ static const struct xsm_ops __initconst_cf_clobber flask_ops = {
 #endif
 
     .platform_op = flask_platform_op,
+    .shadow_control = flask_shadow_control,
 #ifdef CONFIG_X86
     .do_mca = flask_do_mca,
-    .shadow_control = flask_shadow_control,
     .mem_sharing_op = flask_mem_sharing_op,
     .apic = flask_apic,
     .machine_memory_map = flask_machine_memory_map,